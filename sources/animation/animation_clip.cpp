@@ -0,0 +1,237 @@
+#include "animation_clip.h"
+#include "skeleton.h"
+#include "keyframes.h"
+#include <random>
+#include <render/model.h>
+#include <benchmark.h>
+#include <log.h>
+
+void ClipCursor::reset(int num_bones)
+{
+  translationKeys.assign(num_bones, 0);
+  rotationKeys.assign(num_bones, 0);
+  scaleKeys.assign(num_bones, 0);
+}
+
+template<typename T>
+static size_t channel_bytes(const KeyChannel<T> &channel)
+{
+  return channel.tracks.size() * sizeof(channel.tracks[0]) + channel.times.size() * sizeof(float) +
+         channel.values.size() * sizeof(T);
+}
+
+size_t AnimationClip::size_bytes() const
+{
+  return sizeof(*this) + name.size() + channel_bytes(translations) + channel_bytes(rotations) + channel_bytes(scales);
+}
+
+template<typename T>
+static void add_track(KeyChannel<T> &channel, const std::vector<AnimationKey<T>> *keys, const T &bind_value)
+{
+  const uint32_t first = channel.times.size();
+  if (keys && !keys->empty())
+  {
+    for (const AnimationKey<T> &key : *keys)
+    {
+      // assimp can repeat a time when the fbx has a key per curve, the later one wins
+      if (channel.times.size() > first && key.time <= channel.times.back())
+      {
+        channel.values.back() = key.value;
+        continue;
+      }
+      channel.times.push_back(key.time);
+      channel.values.push_back(key.value);
+    }
+  }
+  else
+  {
+    channel.times.push_back(0.f);
+    channel.values.push_back(bind_value);
+  }
+  channel.tracks.push_back({first, uint32_t(channel.times.size() - first)});
+}
+
+AnimationClipPtr import_clip(const ModelAnimation &animation, const Skeleton &skeleton)
+{
+  const int numBones = skeleton.num_bones();
+  std::vector<const ModelAnimationChannel *> boneChannels(numBones, nullptr);
+  for (const ModelAnimationChannel &channel : animation.channels)
+  {
+    int bone = skeleton.find_bone(channel.nodeName);
+    if (bone < 0)
+    {
+      debug_error("animation %s: channel %s has no bone in the skeleton", animation.name.c_str(), channel.nodeName.c_str());
+      continue;
+    }
+    boneChannels[bone] = &channel;
+  }
+
+  auto clip = std::make_shared<AnimationClip>();
+  clip->name = animation.name;
+  clip->duration = animation.duration;
+  for (int i = 0; i < numBones; i++)
+  {
+    const ModelAnimationChannel *channel = boneChannels[i];
+    add_track(clip->translations, channel ? &channel->positionKeys : nullptr, skeleton.bindPose.translations[i]);
+    add_track(clip->rotations, channel ? &channel->rotationKeys : nullptr, skeleton.bindPose.rotations[i]);
+    add_track(clip->scales, channel ? &channel->scaleKeys : nullptr, skeleton.bindPose.scales[i]);
+  }
+  return clip;
+}
+
+AnimationClipPtr make_procedural_clip(const Skeleton &skeleton, float duration, float fps)
+{
+  const int numBones = skeleton.num_bones();
+  const int numFrames = int(duration * fps) + 1;
+  std::vector<AnimationKey<vec3>> translationKeys(numFrames);
+  std::vector<AnimationKey<quat>> rotationKeys(numFrames);
+
+  auto clip = std::make_shared<AnimationClip>();
+  clip->name = "procedural";
+  clip->duration = duration;
+  for (int i = 0; i < numBones; i++)
+  {
+    const vec3 axis = normalize(vec3(sinf(i * 1.3f), cosf(i * 0.7f), 0.5f));
+    for (int frame = 0; frame < numFrames; frame++)
+    {
+      const float time = min(frame / fps, duration);
+      const float phase = PITWO * time / duration + i * 0.4f;
+      rotationKeys[frame] = {time, skeleton.bindPose.rotations[i] * angleAxis(0.3f * sinf(phase), axis)};
+      translationKeys[frame] = {time, skeleton.bindPose.translations[i] + vec3(0.f, 0.02f * sinf(2.f * phase), 0.f)};
+    }
+    // only the roots move, the rest keep their bone lengths like a real clip does
+    add_track(clip->translations, skeleton.parents[i] < 0 ? &translationKeys : nullptr, skeleton.bindPose.translations[i]);
+    add_track(clip->rotations, &rotationKeys, skeleton.bindPose.rotations[i]);
+    add_track(clip->scales, (const std::vector<AnimationKey<vec3>> *)nullptr, skeleton.bindPose.scales[i]);
+  }
+  return clip;
+}
+
+AnimationClipPtr make_additive_clip(const AnimationClip &clip, const AnimationClip &reference, float reference_time)
+{
+  Transforms pose;
+  pose.resize(reference.num_bones());
+  sample_clip(reference, reference_time, pose);
+
+  auto additive = std::make_shared<AnimationClip>(clip);
+  additive->name = clip.name + " additive";
+  additive->rootMotion = nullptr;
+  for (int i = 0; i < additive->num_bones(); i++)
+  {
+    const auto subtract = [](auto &channel, int bone, auto &&delta) {
+      const auto [first, count] = channel.tracks[bone];
+      for (uint32_t k = first; k < first + count; k++)
+        channel.values[k] = delta(channel.values[k]);
+    };
+    subtract(additive->translations, i, [&](vec3 t) { return t - pose.translations[i]; });
+    subtract(additive->rotations, i, [&](quat q) { return normalize(conjugate(pose.rotations[i]) * q); });
+    subtract(additive->scales, i, [&](vec3 s) { return s / pose.scales[i]; });
+  }
+  return additive;
+}
+
+template<bool UseCursor, typename T>
+static void sample_channel(const KeyChannel<T> &channel, float time, uint32_t *cursor, T *out)
+{
+  const float *times = channel.times.data();
+  const T *values = channel.values.data();
+  const int numTracks = channel.tracks.size();
+  for (int i = 0; i < numTracks; i++)
+  {
+    const auto [first, count] = channel.tracks[i];
+    if (count == 1)
+    {
+      out[i] = values[first];
+      continue;
+    }
+    const uint32_t k = UseCursor ? advance_key(times + first, count, time, cursor[i]) : search_key(times + first, count, time);
+    if (UseCursor)
+      cursor[i] = k;
+    const float t0 = times[first + k], t1 = times[first + k + 1];
+    const float t = clamp((time - t0) / (t1 - t0), 0.f, 1.f);
+    out[i] = interpolate(values[first + k], values[first + k + 1], t);
+  }
+}
+
+void sample_clip(const AnimationClip &clip, float time, Transforms &pose)
+{
+  sample_channel<false>(clip.translations, time, nullptr, pose.translations.data());
+  sample_channel<false>(clip.rotations, time, nullptr, pose.rotations.data());
+  sample_channel<false>(clip.scales, time, nullptr, pose.scales.data());
+}
+
+void sample_clip(const AnimationClip &clip, float time, ClipCursor &cursor, Transforms &pose)
+{
+  if (cursor.rotationKeys.size() != size_t(clip.num_bones()))
+    cursor.reset(clip.num_bones());
+  sample_channel<true>(clip.translations, time, cursor.translationKeys.data(), pose.translations.data());
+  sample_channel<true>(clip.rotations, time, cursor.rotationKeys.data(), pose.rotations.data());
+  sample_channel<true>(clip.scales, time, cursor.scaleKeys.data(), pose.scales.data());
+}
+
+void benchmark_clip(const AnimationClip &clip)
+{
+  const int numBones = clip.num_bones();
+  Transforms searched, cursored;
+  searched.resize(numBones);
+  cursored.resize(numBones);
+  ClipCursor cursor;
+  cursor.reset(numBones);
+
+  const int numTimes = 4096;
+  std::vector<float> randomTimes(numTimes);
+  std::mt19937 rng(12345);
+  std::uniform_real_distribution<float> distribution(0.f, clip.duration);
+  for (float &time : randomTimes)
+    time = distribution(rng);
+
+  // 60 fps playback looping over the clip
+  const float dt = 1.f / 60.f;
+  float sequentialTime = 0.f;
+  auto next_sequential = [&]() {
+    sequentialTime += dt;
+    if (sequentialTime > clip.duration)
+      sequentialTime -= clip.duration;
+    return sequentialTime;
+  };
+  int randomIndex = 0;
+  auto next_random = [&]() { return randomTimes[randomIndex++ & (numTimes - 1)]; };
+
+  // both paths have to agree before timing them
+  float maxError = 0.f;
+  for (int i = 0; i < numTimes; i++)
+  {
+    const float time = i < numTimes / 2 ? next_sequential() : next_random();
+    sample_clip(clip, time, searched);
+    sample_clip(clip, time, cursor, cursored);
+    for (int b = 0; b < numBones; b++)
+    {
+      maxError = max(maxError, compMax(abs(searched.translations[b] - cursored.translations[b])));
+      maxError = max(maxError, compMax(abs(to_vec4(searched.rotations[b]) - to_vec4(cursored.rotations[b]))));
+    }
+  }
+
+  const int iterations = 20000;
+  double sequentialSearchNs = measure_ns(iterations, [&]() {
+    sample_clip(clip, next_sequential(), searched);
+    do_not_optimize(searched.rotations[numBones - 1]);
+  });
+  double sequentialCursorNs = measure_ns(iterations, [&]() {
+    sample_clip(clip, next_sequential(), cursor, cursored);
+    do_not_optimize(cursored.rotations[numBones - 1]);
+  });
+  double randomSearchNs = measure_ns(iterations, [&]() {
+    sample_clip(clip, next_random(), searched);
+    do_not_optimize(searched.rotations[numBones - 1]);
+  });
+  double randomCursorNs = measure_ns(iterations, [&]() {
+    sample_clip(clip, next_random(), cursor, cursored);
+    do_not_optimize(cursored.rotations[numBones - 1]);
+  });
+
+  debug_log("clip %s: %d bones, %zu keys, %.2f s", clip.name.c_str(), numBones, clip.num_keys(), clip.duration);
+  debug_log("  sequential: cursor %.0f ns/pose (%.1f M bones/s), binary search %.0f ns/pose", sequentialCursorNs,
+    numBones * 1e3 / sequentialCursorNs, sequentialSearchNs);
+  debug_log("  random:     cursor %.0f ns/pose (%.1f M bones/s), binary search %.0f ns/pose, max difference %g",
+    randomCursorNs, numBones * 1e3 / randomCursorNs, randomSearchNs, maxError);
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <3dmath.h>
+
+struct Skeleton;
+struct Transforms;
+struct ModelAnimation;
+struct RootMotionTrack;
+
+// Keys of one channel type for every bone, flat so a whole pose is sampled from three arrays.
+// Track i holds the keys of bone i in [first, first + count), count is never 0.
+template<typename T>
+struct KeyChannel
+{
+  struct Track
+  {
+    uint32_t first, count;
+  };
+  std::vector<Track> tracks;
+  std::vector<float> times; // in seconds, increasing within a track
+  std::vector<T> values;
+};
+
+struct AnimationClip
+{
+  std::string name;
+  float duration = 0.f; // in seconds
+  KeyChannel<vec3> translations;
+  KeyChannel<quat> rotations;
+  KeyChannel<vec3> scales;
+  std::shared_ptr<const RootMotionTrack> rootMotion; // set by extract_root_motion, null for in place clips
+
+  int num_bones() const { return translations.tracks.size(); }
+  size_t num_keys() const { return translations.times.size() + rotations.times.size() + scales.times.size(); }
+  size_t size_bytes() const;
+};
+
+using AnimationClipPtr = std::shared_ptr<AnimationClip>;
+
+// Per instance playback state: the current key of every track.
+// Moving forward from the last sampled time only walks the few keys in between.
+struct ClipCursor
+{
+  std::vector<uint32_t> translationKeys, rotationKeys, scaleKeys;
+
+  void reset(int num_bones);
+};
+
+// Channels are matched to bones by node name, bones without keys hold their bind pose.
+AnimationClipPtr import_clip(const ModelAnimation &animation, const Skeleton &skeleton);
+
+// A looping sway of every bone around its bind pose, keyed at fps. Stands in when a file carries no animation.
+AnimationClipPtr make_procedural_clip(const Skeleton &skeleton, float duration, float fps);
+
+// clip as a delta against the pose of reference at reference_time, key by key so no resampling happens:
+// translations minus the reference, rotations inverse(reference) * rotation, scales over the reference.
+// What apply_additive_pose adds back on top of another pose. The delta carries no root motion.
+AnimationClipPtr make_additive_clip(const AnimationClip &clip, const AnimationClip &reference, float reference_time);
+
+// Writes the local pose at time (clamped to the clip) into pose, which has clip.num_bones() entries.
+// The first overload binary searches every track, the second keeps the keys in the cursor.
+void sample_clip(const AnimationClip &clip, float time, Transforms &pose);
+void sample_clip(const AnimationClip &clip, float time, ClipCursor &cursor, Transforms &pose);
+
+// Logs ns per pose for sequential playback and random seeks, with and without a cursor.
+void benchmark_clip(const AnimationClip &clip);
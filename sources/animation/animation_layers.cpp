@@ -0,0 +1,122 @@
+#include "animation_layers.h"
+#include "skeleton.h"
+#include <algorithm>
+#include <benchmark.h>
+#include <log.h>
+
+void set_subtree_weight(const Skeleton &skeleton, const char *root, float weight, std::vector<float> &bone_weights)
+{
+  const int bone = skeleton.find_bone(root);
+  if (bone < 0)
+  {
+    debug_error("no bone %s for the mask", root);
+    return;
+  }
+  bone_weights.resize(skeleton.num_bones(), 0.f);
+  std::fill(bone_weights.begin() + bone, bone_weights.begin() + skeleton.subtreeEnd[bone], weight);
+}
+
+BoneMaskPtr make_bone_mask(const std::vector<float> &bone_weights)
+{
+  auto mask = std::make_shared<BoneMask>();
+  const int numBones = bone_weights.size();
+  for (int first = 0; first < numBones; first += PoseBlockWidth)
+  {
+    MaskBlock block = {};
+    bool any = false;
+    for (int lane = 0; lane < PoseBlockWidth && first + lane < numBones; lane++)
+    {
+      block.weights[lane] = bone_weights[first + lane];
+      any = any || block.weights[lane] > 0.f;
+    }
+    if (!any)
+      continue;
+    mask->blocks.push_back(first / PoseBlockWidth);
+    mask->weights.push_back(block);
+  }
+  return mask;
+}
+
+BoneMaskPtr make_subtree_mask(const Skeleton &skeleton, const char *root)
+{
+  std::vector<float> weights(skeleton.num_bones(), 0.f);
+  set_subtree_weight(skeleton, root, 1.f, weights);
+  return make_bone_mask(weights);
+}
+
+void init_animation_layer(AnimationLayer &layer, AnimationClipPtr clip, BoneMaskPtr mask, LayerBlend blend, float weight)
+{
+  const int numBones = clip->num_bones();
+  layer.clip = std::move(clip);
+  layer.mask = std::move(mask);
+  layer.blend = blend;
+  layer.weight = weight;
+  layer.time = 0.f;
+  layer.cursor.reset(numBones);
+  layer.pose.resize(numBones);
+}
+
+void update_animation_layer(AnimationLayer &layer, float dt, SoaPose &pose, SimdWidth width)
+{
+  const AnimationClip &clip = *layer.clip;
+  layer.time += dt;
+  if (clip.duration > 0.f)
+    layer.time = fmodf(layer.time, clip.duration);
+  if (layer.weight <= 0.f)
+    return;
+  sample_clip_masked(clip, layer.time, layer.cursor, layer.keyframes, *layer.mask, layer.pose, width);
+  if (layer.blend == LayerBlend::Override)
+    blend_poses_masked(layer.pose, *layer.mask, layer.weight, pose, width);
+  else
+    apply_additive_pose_masked(layer.pose, *layer.mask, layer.weight, pose, width);
+}
+
+void benchmark_animation_layers(const Skeleton &skeleton, const AnimationClip &clip)
+{
+  const int numBones = skeleton.num_bones();
+  const char *upperRoot = skeleton.find_bone("Spine1") >= 0 ? "Spine1" : skeleton.names[numBones / 2].c_str();
+  BoneMaskPtr upperBody = make_subtree_mask(skeleton, upperRoot);
+  std::vector<float> lowerWeights(numBones, 0.f);
+  set_subtree_weight(skeleton, skeleton.names[0].c_str(), 1.f, lowerWeights);
+  set_subtree_weight(skeleton, upperRoot, 0.f, lowerWeights);
+  BoneMaskPtr lowerBody = make_bone_mask(lowerWeights);
+  // every bone, what an unmasked layer costs
+  BoneMaskPtr fullBody = make_bone_mask(std::vector<float>(numBones, 1.f));
+
+  AnimationClipPtr aim = make_procedural_clip(skeleton, 1.3f, 30.f);
+  AnimationClipPtr additive = make_additive_clip(*aim, *aim, 0.f);
+
+  SoaPose base;
+  ClipCursor cursor;
+  SoaKeyframes keys;
+  sample_clip(clip, 0.f, cursor, keys, base);
+
+  auto count_bones = [&](const BoneMask &mask) {
+    int bones = 0;
+    for (const MaskBlock &block : mask.weights)
+      for (float weight : block.weights)
+        bones += weight > 0.f;
+    return bones;
+  };
+  debug_log("animation layers, %d bones, upper body from %s: %d bones in %d of %d blocks, lower body %d bones in %d blocks",
+    numBones, upperRoot, count_bones(*upperBody), (int)upperBody->blocks.size(), base.num_blocks(),
+    count_bones(*lowerBody), (int)lowerBody->blocks.size());
+
+  for (LayerBlend blend : {LayerBlend::Override, LayerBlend::Additive})
+  {
+    double ns[3];
+    int i = 0;
+    for (const BoneMaskPtr &mask : {upperBody, lowerBody, fullBody})
+    {
+      AnimationLayer layer;
+      init_animation_layer(layer, blend == LayerBlend::Override ? aim : additive, mask, blend, 0.7f);
+      SoaPose pose = base;
+      ns[i++] = measure_ns(20000, [&]() {
+        update_animation_layer(layer, 1.f / 60.f, pose);
+        do_not_optimize(pose.blocks[0]);
+      });
+    }
+    debug_log("  %-8s layer: upper body %.0f ns, lower body %.0f ns, whole skeleton %.0f ns",
+      blend == LayerBlend::Override ? "override" : "additive", ns[0], ns[1], ns[2]);
+  }
+}
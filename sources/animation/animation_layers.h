@@ -0,0 +1,48 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include "soa_pose.h"
+#include "animation_clip.h"
+
+struct Skeleton;
+
+using BoneMaskPtr = std::shared_ptr<const BoneMask>;
+
+// Sets root and every bone below it to weight, later calls override earlier ones, so a lower body mask is
+// Hips at 1 followed by Spine1 at 0. Unknown bones log an error and change nothing.
+void set_subtree_weight(const Skeleton &skeleton, const char *root, float weight, std::vector<float> &bone_weights);
+
+// The blocks of bone_weights with any weight above 0.
+BoneMaskPtr make_bone_mask(const std::vector<float> &bone_weights);
+
+// Bones of the subtree of root, Spine1 gives the upper body of a humanoid rig.
+BoneMaskPtr make_subtree_mask(const Skeleton &skeleton, const char *root);
+
+enum class LayerBlend
+{
+  Override, // the layer's pose replaces the one below by weight * mask
+  Additive  // the layer plays an additive clip on top of the one below
+};
+
+// A clip played over the bones of a mask after the base pose, in the order the layers are kept.
+struct AnimationLayer
+{
+  AnimationClipPtr clip; // for Additive one from make_additive_clip
+  BoneMaskPtr mask;
+  LayerBlend blend = LayerBlend::Override;
+  float weight = 1.f;
+
+  float time = 0.f;
+  ClipCursor cursor;
+  SoaKeyframes keyframes;
+  SoaPose pose; // only the blocks of the mask are ever written
+};
+
+void init_animation_layer(AnimationLayer &layer, AnimationClipPtr clip, BoneMaskPtr mask, LayerBlend blend,
+  float weight = 1.f);
+
+// Advances the layer by dt, samples its clip over the mask and blends it into pose. Layers with weight 0 sample nothing.
+void update_animation_layer(AnimationLayer &layer, float dt, SoaPose &pose, SimdWidth width = BestSimdWidth);
+
+// Logs ns of upper and lower body layers of each blend mode, masked against sampling and blending the whole skeleton.
+void benchmark_animation_layers(const Skeleton &skeleton, const AnimationClip &clip);
@@ -0,0 +1,190 @@
+#include "animation_lod.h"
+#include "character_rig.h"
+#include <algorithm>
+#include <random>
+#include <benchmark.h>
+#include <job_system.h>
+#include <log.h>
+
+constexpr float AnimationLodHysteresis = 0.2f;
+
+int select_animation_interval(float screen_size, bool visible, int current_interval)
+{
+  if (!visible)
+    return 0;
+  // level l updates every 1 << l frames and holds while the size stays above its threshold
+  const float thresholds[] = {FullRateScreenSize, HalfRateScreenSize, 0.f};
+  int level = current_interval == 1 ? 0 : current_interval == 2 ? 1 : 2;
+  while (level < 2 && screen_size < thresholds[level] * (1.f - AnimationLodHysteresis))
+    level++;
+  while (level > 0 && screen_size > thresholds[level - 1] * (1.f + AnimationLodHysteresis))
+    level--;
+  return 1 << level;
+}
+
+void blend_palettes(const Affine3x4 *from, const Affine3x4 *to, float t, Affine3x4 *out, int count, SimdWidth width)
+{
+  // entries are only 16 byte aligned, so at most four lanes
+  simd_dispatch(width > SimdWidth::Sse ? SimdWidth::Sse : width, [&](auto lanes) {
+    using L = decltype(lanes);
+    const typename L::V vt = L::set1(t);
+    const float *a = from[0].rows[0], *b = to[0].rows[0];
+    float *o = out[0].rows[0];
+    for (int i = 0; i < count * 12; i += L::Width)
+    {
+      const typename L::V va = L::load(a + i);
+      L::store(o + i, L::add(va, L::mul(L::sub(L::load(b + i), va), vt)));
+    }
+  });
+}
+
+// The steps of the latest evaluation's motion that frames after this one would still have shown.
+static RootMotionDelta unshown_root_motion(const AnimationLod &lod)
+{
+  const float steps = float(max(lod.span - lod.framesSinceUpdate - 1, 0));
+  return blend_root_motion(RootMotionDelta{}, lod.motionStep, steps);
+}
+
+bool update_rig_instance_lod(RigInstance &instance, uint32_t frame, float dt)
+{
+  AnimationLod &lod = instance.lod;
+  lod.pendingDt += dt;
+  const bool first = lod.latest.empty();
+  if (lod.interval == 0 && !first)
+  {
+    // out of view nothing is sampled, but the clips keep moving the character. The motion of the last
+    // evaluation not shown yet goes along at once, nobody sees it.
+    const RootMotionDelta caughtUp = unshown_root_motion(lod);
+    advance_rig_root_motion(instance, lod.pendingDt);
+    instance.rootMotion = combine_root_motion(caughtUp, instance.rootMotion);
+    lod.framesSinceUpdate = lod.span;
+    lod.pendingDt = 0.f;
+    lod.paused = true;
+    return false;
+  }
+
+  // back in view the pose is evaluated right away and shown as is, the held palette is long out of date
+  const bool resumed = lod.paused;
+  const bool due = first || resumed || (frame + lod.offset) % lod.interval == 0;
+  RootMotionDelta caughtUp;
+  if (due)
+  {
+    // a faster rate can evaluate before the last span was through, what is left of its motion goes
+    // along this frame and the blend goes on from the palette shown, not from the latest evaluation
+    caughtUp = unshown_root_motion(lod);
+    lod.previous.assign(instance.palette.begin(), instance.palette.end());
+    update_rig_instance(instance, lod.pendingDt);
+    lod.latest.assign(instance.palette.begin(), instance.palette.end());
+    if (first || resumed)
+      lod.previous = lod.latest;
+    // after a pause pendingDt is a single frame, its motion is not spread over the frames to the next update
+    lod.span = resumed ? 1 : max(lod.interval, 1);
+    lod.motionStep = blend_root_motion(RootMotionDelta{}, instance.rootMotion, 1.f / lod.span);
+    lod.framesSinceUpdate = 0;
+    lod.pendingDt = 0.f;
+    lod.paused = false;
+    lod.updates++;
+  }
+  else
+    lod.framesSinceUpdate++;
+
+  // past the span the palette already is the latest evaluation
+  const bool moving = lod.framesSinceUpdate < lod.span;
+  instance.rootMotion = combine_root_motion(caughtUp, moving ? lod.motionStep : RootMotionDelta{});
+  if (!moving || (due && lod.span == 1))
+    return due;
+  const float t = float(lod.framesSinceUpdate + 1) / lod.span;
+  blend_palettes(lod.previous.data(), lod.latest.data(), t, instance.palette.data(), instance.palette.size());
+  if (instance.dualQuaternions)
+    build_dual_quat_palette(instance.palette.data(), instance.palette.size(), instance.dualQuatPalette.data());
+  return due;
+}
+
+void benchmark_animation_lod(const Skeleton &skeleton, const AnimationClip &clip)
+{
+  auto rig = std::make_shared<CharacterRig>();
+  rig->skeleton = skeleton;
+  rig->inverseBind = skeleton_inverse_bind(skeleton, nullptr);
+  rig->clips.push_back(std::make_shared<AnimationClip>(clip));
+  rig->clips.push_back(make_procedural_clip(skeleton, 1.3f, 30.f));
+  rig->stateMachine = make_clip_state_machine(rig->clips, 0.3f);
+
+  // a crowd on a square ahead of the camera, which looks down +z with a 90 degree field of view
+  constexpr float CrowdHalfExtent = 40.f, CharacterRadius = 0.9f;
+  struct Placement
+  {
+    float screenSize;
+    bool visible;
+  };
+  std::mt19937 random(11);
+  std::uniform_real_distribution<float> coordinate(-CrowdHalfExtent, CrowdHalfExtent);
+
+  constexpr int WarmupFrames = 16, Frames = 64;
+  constexpr float Dt = 1.f / 60.f;
+  using clock = std::chrono::high_resolution_clock;
+  debug_log("animation update-rate lod, %d bones, %d workers:", skeleton.num_bones(), get_num_workers() + 1);
+  for (int count : {250, 500, 1000, 2000})
+  {
+    std::vector<Placement> placements(count);
+    int intervals[MaxAnimationInterval + 1] = {};
+    for (Placement &placement : placements)
+    {
+      const vec2 position(coordinate(random), coordinate(random) + CrowdHalfExtent);
+      const float distance = max(length(position), 1.f);
+      placement.visible = position.y + CharacterRadius > fabsf(position.x);
+      placement.screenSize = CharacterRadius / distance;
+      intervals[select_animation_interval(placement.screenSize, placement.visible, 1)]++;
+    }
+
+    std::vector<RigInstance> characters(count);
+    for (int i = 0; i < count; i++)
+    {
+      init_rig_instance(characters[i], rig, 0, 0.f);
+      attach_state_machine(characters[i], rig->stateMachine);
+      set_state_parameter(characters[i].states, "state", i % 2);
+    }
+
+    // average and worst frame of update run over every character
+    uint32_t frame = 0;
+    auto run = [&](auto update) {
+      double total = 0.0, worst = 0.0;
+      for (int i = 0; i < WarmupFrames + Frames; i++, frame++)
+      {
+        const auto start = clock::now();
+        parallel_for(count, 8, [&](size_t begin, size_t end) {
+          for (size_t c = begin; c < end; c++)
+            update(characters[c], c);
+        });
+        const double ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+        if (i >= WarmupFrames)
+          total += ms, worst = max(worst, ms);
+      }
+      return std::make_pair(total / Frames, worst);
+    };
+    const auto everyFrame = run([&](RigInstance &character, size_t) { update_rig_instance(character, Dt); });
+    auto scheduled_with_offsets = [&](bool staggered) {
+      for (int i = 0; i < count; i++)
+      {
+        characters[i].lod.offset = staggered ? i : 0;
+        characters[i].lod.updates = 0;
+      }
+      return run([&](RigInstance &character, size_t c) {
+        character.lod.interval = select_animation_interval(placements[c].screenSize, placements[c].visible,
+          character.lod.interval);
+        update_rig_instance_lod(character, frame, Dt);
+      });
+    };
+    const auto unstaggered = scheduled_with_offsets(false);
+    const auto staggered = scheduled_with_offsets(true);
+    uint32_t updates = 0;
+    for (const RigInstance &character : characters)
+      updates += character.lod.updates;
+
+    debug_log("  %4d characters (%d every frame, %d every 2nd, %d every 4th, %d paused):", count, intervals[1],
+      intervals[2], intervals[4], intervals[0]);
+    debug_log("    every frame %.2f ms (worst %.2f), scheduled %.2f ms (worst %.2f, %.2f without staggering), "
+              "%.0f%% evaluated per frame",
+      everyFrame.first, everyFrame.second, staggered.first, staggered.second, unstaggered.second,
+      100.f * updates / float((WarmupFrames + Frames) * count));
+  }
+}
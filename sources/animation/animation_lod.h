@@ -0,0 +1,51 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <simd.h>
+#include "skinning_matrices.h"
+#include "root_motion.h"
+
+struct Skeleton;
+struct AnimationClip;
+struct RigInstance;
+
+// Projected size, as a fraction of the screen height, a character needs for an update every frame,
+// and every 2nd frame. Smaller ones update every 4th frame, characters out of view not at all.
+constexpr float FullRateScreenSize = 0.25f;
+constexpr float HalfRateScreenSize = 0.1f;
+constexpr int MaxAnimationInterval = 4;
+
+// Frames between updates for a character of screen_size, 0 pauses it. Like mesh lods, a rate changes
+// only once the size is past the threshold by some margin, so characters near one don't flicker.
+int select_animation_interval(float screen_size, bool visible, int current_interval);
+
+// Update-rate LOD of one character. It is evaluated every interval frames, with everything that elapsed
+// since the last evaluation, and in between the palette moves from the previous evaluation to the latest.
+// What is shown lags up to an interval behind, in return every shown frame is a different pose.
+// A paused character holds its palette but keeps its root motion going.
+struct AnimationLod
+{
+  int interval = 1; // set every frame from select_animation_interval
+  int offset = 0;   // characters of one interval with different offsets update on different frames
+  int span = 1;     // interval the latest evaluation is spread over
+  int framesSinceUpdate = 0;
+  float pendingDt = 0.f;
+  bool paused = false; // out of view since the last evaluation
+  RootMotionDelta motionStep; // share of the latest root motion applied on each frame of the span
+  std::vector<Affine3x4> previous, latest;
+  uint32_t updates = 0;
+};
+
+// Palette entries blended component-wise. Between poses a few frames apart the scale this leaves in
+// the rotations stays well below what shows.
+void blend_palettes(const Affine3x4 *from, const Affine3x4 *to, float t, Affine3x4 *out, int count,
+  SimdWidth width = BestSimdWidth);
+
+// Runs update_rig_instance when instance.lod is due on frame, otherwise only blends the palette, or while
+// paused only advances the root motion. rootMotion is the part of the motion shown this frame.
+// Returns whether the character was evaluated.
+bool update_rig_instance_lod(RigInstance &instance, uint32_t frame, float dt);
+
+// Logs animation ms per frame of crowds of growing size, every character updated every frame against
+// the scheduler, with and without staggering.
+void benchmark_animation_lod(const Skeleton &skeleton, const AnimationClip &clip);
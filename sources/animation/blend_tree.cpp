@@ -0,0 +1,462 @@
+#include "blend_tree.h"
+#include "skeleton.h"
+#include <algorithm>
+#include <benchmark.h>
+#include <log.h>
+
+int BlendTree::find_parameter(const char *name) const
+{
+  for (size_t i = 0; i < parameters.size(); i++)
+    if (parameters[i] == name)
+      return i;
+  return -1;
+}
+
+int BlendTree::num_bones() const
+{
+  for (const BlendNode &node : nodes)
+    if (node.clip)
+      return node.clip->num_bones();
+  return 0;
+}
+
+int BlendTree::num_clips() const
+{
+  return std::count_if(nodes.begin(), nodes.end(), [](const BlendNode &node) { return node.type == BlendNodeType::Clip; });
+}
+
+static int parameter_index(BlendTree &tree, const char *name)
+{
+  if (!name)
+    return -1;
+  int index = tree.find_parameter(name);
+  if (index < 0)
+  {
+    index = tree.parameters.size();
+    tree.parameters.emplace_back(name);
+  }
+  return index;
+}
+
+static int add_node(BlendTree &tree, BlendNode &&node)
+{
+  tree.nodes.push_back(std::move(node));
+  return tree.nodes.size() - 1;
+}
+
+int add_clip_node(BlendTree &tree, AnimationClipPtr clip)
+{
+  BlendNode node;
+  node.type = BlendNodeType::Clip;
+  node.clip = std::move(clip);
+  return add_node(tree, std::move(node));
+}
+
+int add_blend_1d(BlendTree &tree, const char *parameter, std::vector<int> children, std::vector<float> thresholds)
+{
+  assert(!children.empty() && children.size() == thresholds.size() && std::is_sorted(thresholds.begin(), thresholds.end()));
+  BlendNode node;
+  node.type = BlendNodeType::Blend1D;
+  node.parameter = parameter_index(tree, parameter);
+  node.children = std::move(children);
+  node.thresholds = std::move(thresholds);
+  return add_node(tree, std::move(node));
+}
+
+int add_blend_2d(BlendTree &tree, const char *parameter_x, const char *parameter_y, std::vector<int> children,
+  std::vector<vec2> positions)
+{
+  assert(!children.empty() && children.size() == positions.size());
+  BlendNode node;
+  node.type = BlendNodeType::Blend2D;
+  node.parameter = parameter_index(tree, parameter_x);
+  node.parameterY = parameter_index(tree, parameter_y);
+  node.children = std::move(children);
+  node.positions = std::move(positions);
+  return add_node(tree, std::move(node));
+}
+
+int add_additive(BlendTree &tree, int base, int additive, const char *amount_parameter)
+{
+  BlendNode node;
+  node.type = BlendNodeType::Additive;
+  node.parameter = parameter_index(tree, amount_parameter);
+  node.children = {base, additive};
+  return add_node(tree, std::move(node));
+}
+
+BlendTreePtr make_clip_tree(AnimationClipPtr clip)
+{
+  auto tree = std::make_shared<BlendTree>();
+  tree->root = add_clip_node(*tree, std::move(clip));
+  return tree;
+}
+
+SoaPose *PosePool::acquire(int num_bones)
+{
+  if (free.empty())
+  {
+    poses.push_back(std::make_unique<SoaPose>());
+    free.push_back(poses.back().get());
+  }
+  SoaPose *pose = free.back();
+  free.pop_back();
+  if (pose->numBones != num_bones)
+    pose->resize(num_bones);
+  return pose;
+}
+
+void PosePool::release(SoaPose *pose)
+{
+  free.push_back(pose);
+}
+
+PosePool &thread_pose_pool()
+{
+  thread_local PosePool pool;
+  return pool;
+}
+
+static float unsigned_angle(vec2 a, vec2 b)
+{
+  return acosf(clamp(dot(a, b) / (length(a) * length(b)), -1.f, 1.f));
+}
+
+// Johansen's gradient band interpolation in polar space: every sample's influence falls off along the
+// direction to each other sample, with magnitude differences relative to the pair's average magnitude
+// and angular differences scaled by AngleScale. The weight is the smallest of those falloffs.
+void gradient_band_weights(const vec2 *positions, int count, vec2 point, float *weights)
+{
+  constexpr float AngleScale = 2.f;
+  const float pointMagnitude = length(point);
+  float total = 0.f;
+  for (int i = 0; i < count; i++)
+  {
+    const vec2 pi = positions[i];
+    const float mi = length(pi);
+    float weight = 1.f;
+    for (int j = 0; j < count && weight > 0.f; j++)
+    {
+      const vec2 pj = positions[j];
+      const float mj = length(pj);
+      const float averageMagnitude = (mi + mj) * 0.5f;
+      if (j == i || averageMagnitude <= 0.f)
+        continue;
+      float angleIJ, angleIP;
+      if (mi == 0.f)
+      {
+        // a sample at the center has no direction of its own, it takes the point's
+        angleIJ = pointMagnitude > 0.f ? unsigned_angle(point, pj) : 0.f;
+        angleIP = 0.f;
+      }
+      else if (mj == 0.f)
+      {
+        angleIJ = pointMagnitude > 0.f ? unsigned_angle(point, pi) : 0.f;
+        angleIP = angleIJ;
+      }
+      else
+      {
+        angleIJ = unsigned_angle(pi, pj);
+        angleIP = pointMagnitude > 0.f ? unsigned_angle(pi, point) : 0.f;
+      }
+      const vec2 ij((mj - mi) / averageMagnitude, AngleScale * angleIJ);
+      const vec2 ip((pointMagnitude - mi) / averageMagnitude, AngleScale * angleIP);
+      const float lengthSq = dot(ij, ij);
+      if (lengthSq > 0.f)
+        weight = min(weight, 1.f - dot(ip, ij) / lengthSq);
+    }
+    weights[i] = max(weight, 0.f);
+    total += weights[i];
+  }
+  if (total > 0.f)
+    for (int i = 0; i < count; i++)
+      weights[i] /= total;
+}
+
+void init_blend_tree_instance(BlendTreeInstance &instance, BlendTreePtr tree)
+{
+  const int numNodes = tree->nodes.size();
+  instance.tree = std::move(tree);
+  instance.parameters.assign(instance.tree->parameters.size(), 0.f);
+  instance.phase = 0.f;
+  instance.cursors.assign(numNodes, ClipCursor{});
+  instance.firstActive.assign(numNodes, 0);
+  instance.numActive.assign(numNodes, 0);
+  instance.active.clear();
+  instance.syncClips.clear();
+  instance.sampledClips = 0;
+  instance.rootMotion = {};
+
+  // everything an evaluation can grow is sized here, the first visit of a branch allocates nothing either
+  const int numBones = instance.tree->num_bones();
+  size_t maxChildren = 0;
+  for (int i = 0; i < numNodes; i++)
+  {
+    const BlendNode &node = instance.tree->nodes[i];
+    if (node.clip)
+      instance.cursors[i].reset(numBones);
+    if (node.type == BlendNodeType::Blend2D)
+      maxChildren = max(maxChildren, node.children.size());
+  }
+  instance.active.reserve(numNodes);
+  instance.syncClips.reserve(numNodes);
+  instance.directionWeights.reserve(maxChildren);
+  instance.keyframes.from.resize(numBones);
+  instance.keyframes.to.resize(numBones);
+  instance.keyframes.alpha.assign(instance.keyframes.from.num_blocks(), AlphaBlock{});
+}
+
+void set_blend_parameter(BlendTreeInstance &instance, const char *name, float value)
+{
+  const int index = instance.tree->find_parameter(name);
+  if (index >= 0)
+    instance.parameters[index] = value;
+  else
+    debug_error("blend tree has no parameter %s", name);
+}
+
+struct WeightPass
+{
+  BlendTreeInstance &instance;
+  float weightedDuration = 0.f;
+  float syncWeight = 0.f;
+
+  float parameter(int index, float fallback) const { return index >= 0 ? instance.parameters[index] : fallback; }
+
+  void push(int child, float weight) { instance.active.push_back(ActiveChild{child, weight}); }
+
+  // weight is the node's effective weight, sync says whether its clips drive the shared phase
+  void visit(int node_index, float weight, bool sync)
+  {
+    const BlendNode &node = instance.tree->nodes[node_index];
+    const int first = instance.active.size();
+    instance.firstActive[node_index] = first;
+    switch (node.type)
+    {
+    case BlendNodeType::Clip:
+      if (sync)
+      {
+        weightedDuration += weight * node.clip->duration;
+        syncWeight += weight;
+        instance.syncClips.push_back(ActiveChild{node_index, weight});
+      }
+      instance.numActive[node_index] = 0;
+      return;
+
+    case BlendNodeType::Blend1D:
+    {
+      const std::vector<float> &thresholds = node.thresholds;
+      const float x = parameter(node.parameter, thresholds[0]);
+      const int upper = std::upper_bound(thresholds.begin(), thresholds.end(), x) - thresholds.begin();
+      if (upper == 0 || upper == (int)thresholds.size())
+        push(node.children[upper == 0 ? 0 : upper - 1], 1.f);
+      else
+      {
+        const float t = (x - thresholds[upper - 1]) / (thresholds[upper] - thresholds[upper - 1]);
+        if (weight * (1.f - t) >= BlendWeightEpsilon)
+          push(node.children[upper - 1], 1.f - t);
+        if (weight * t >= BlendWeightEpsilon)
+          push(node.children[upper], t);
+        // a node nested deep enough can drop both, the closer one still has to give the pose
+        if ((int)instance.active.size() == first)
+          push(node.children[t < 0.5f ? upper - 1 : upper], 1.f);
+      }
+      break;
+    }
+
+    case BlendNodeType::Blend2D:
+    {
+      const int count = node.children.size();
+      const vec2 point(parameter(node.parameter, 0.f), parameter(node.parameterY, 0.f));
+      std::vector<float> &scratch = instance.directionWeights;
+      scratch.resize(count);
+      gradient_band_weights(node.positions.data(), count, point, scratch.data());
+      int best = 0;
+      for (int i = 0; i < count; i++)
+      {
+        if (weight * scratch[i] >= BlendWeightEpsilon)
+          push(node.children[i], scratch[i]);
+        if (scratch[i] > scratch[best])
+          best = i;
+      }
+      if ((int)instance.active.size() == first)
+        push(node.children[best], 1.f);
+      break;
+    }
+
+    case BlendNodeType::Additive:
+    {
+      push(node.children[0], 1.f);
+      const float amount = clamp(parameter(node.parameter, 1.f), 0.f, 1.f);
+      if (weight * amount >= BlendWeightEpsilon)
+        push(node.children[1], amount);
+      break;
+    }
+    }
+
+    const int count = instance.active.size() - first;
+    instance.numActive[node_index] = count;
+    if (node.type != BlendNodeType::Additive)
+    {
+      // what the skipped children had goes to the ones that are sampled
+      float total = 0.f;
+      for (int i = first; i < first + count; i++)
+        total += instance.active[i].weight;
+      for (int i = first; i < first + count; i++)
+        instance.active[i].weight /= total;
+    }
+    // children append their own ranges, so read the entries by index
+    for (int i = first; i < first + count; i++)
+    {
+      const ActiveChild child = instance.active[i];
+      const bool additiveBranch = node.type == BlendNodeType::Additive && i > first;
+      visit(child.node, weight * child.weight, sync && !additiveBranch);
+    }
+  }
+};
+
+static void evaluate_node(BlendTreeInstance &instance, int node_index, PosePool &pool, SoaPose &out, SimdWidth width)
+{
+  const BlendNode &node = instance.tree->nodes[node_index];
+  if (node.type == BlendNodeType::Clip)
+  {
+    sample_clip(*node.clip, instance.phase * node.clip->duration, instance.cursors[node_index], instance.keyframes, out, width);
+    instance.sampledClips++;
+    return;
+  }
+
+  const int first = instance.firstActive[node_index];
+  const int count = instance.numActive[node_index];
+  if (node.type == BlendNodeType::Additive)
+  {
+    evaluate_node(instance, instance.active[first].node, pool, out, width);
+    if (count > 1)
+    {
+      SoaPose *additive = pool.acquire(out.numBones);
+      evaluate_node(instance, instance.active[first + 1].node, pool, *additive, width);
+      apply_additive_pose(*additive, instance.active[first + 1].weight, out, width);
+      pool.release(additive);
+    }
+    return;
+  }
+
+  if (count == 1)
+  {
+    evaluate_node(instance, instance.active[first].node, pool, out, width);
+    return;
+  }
+  SoaPose *child = pool.acquire(out.numBones);
+  clear_pose(out);
+  for (int i = first; i < first + count; i++)
+  {
+    evaluate_node(instance, instance.active[i].node, pool, *child, width);
+    accumulate_pose(*child, instance.active[i].weight, out, width);
+  }
+  pool.release(child);
+  normalize_pose(out, width);
+}
+
+void advance_blend_tree(BlendTreeInstance &instance, float dt)
+{
+  const BlendTree &tree = *instance.tree;
+  instance.active.clear();
+  instance.syncClips.clear();
+  WeightPass pass{instance};
+  pass.visit(tree.root, 1.f, true);
+
+  const float start = instance.phase;
+  const float step = pass.syncWeight > 0.f && pass.weightedDuration > 0.f ? dt * pass.syncWeight / pass.weightedDuration : 0.f;
+  instance.phase += step;
+  instance.phase -= floorf(instance.phase);
+
+  // clips without a track stand still, so an in place clip in the blend slows the motion down
+  instance.rootMotion = {};
+  for (const ActiveChild &sync : instance.syncClips)
+  {
+    const AnimationClip &clip = *tree.nodes[sync.node].clip;
+    if (!clip.rootMotion)
+      continue;
+    const RootMotionDelta delta = integrate_root_motion(*clip.rootMotion, start * clip.duration, (start + step) * clip.duration);
+    const float weight = sync.weight / pass.syncWeight;
+    instance.rootMotion.translation += delta.translation * weight;
+    instance.rootMotion.yaw += delta.yaw * weight;
+  }
+}
+
+void evaluate_blend_tree(BlendTreeInstance &instance, float dt, PosePool &pool, SoaPose &out, SimdWidth width)
+{
+  const BlendTree &tree = *instance.tree;
+  const int numBones = tree.num_bones();
+  if (out.numBones != numBones)
+    out.resize(numBones);
+
+  advance_blend_tree(instance, dt);
+  instance.sampledClips = 0;
+  evaluate_node(instance, tree.root, pool, out, width);
+}
+
+// 1D over num_clips leaves, which keeps two of them active for any parameter value
+static BlendTreePtr make_speed_tree(const std::vector<AnimationClipPtr> &clips, int num_clips)
+{
+  auto tree = std::make_shared<BlendTree>();
+  std::vector<int> children;
+  std::vector<float> thresholds;
+  for (int i = 0; i < num_clips; i++)
+  {
+    children.push_back(add_clip_node(*tree, clips[i % clips.size()]));
+    thresholds.push_back(i);
+  }
+  tree->root = add_blend_1d(*tree, "speed", children, thresholds);
+  return tree;
+}
+
+// 2D with num_clips directions around the center, evaluated at the center every one of them is active
+static BlendTreePtr make_direction_tree(const std::vector<AnimationClipPtr> &clips, int num_clips)
+{
+  auto tree = std::make_shared<BlendTree>();
+  std::vector<int> children;
+  std::vector<vec2> positions;
+  for (int i = 0; i < num_clips; i++)
+  {
+    children.push_back(add_clip_node(*tree, clips[i % clips.size()]));
+    const float angle = PITWO * i / num_clips;
+    positions.push_back(vec2(cosf(angle), sinf(angle)));
+  }
+  tree->root = add_blend_2d(*tree, "x", "y", children, positions);
+  return tree;
+}
+
+void benchmark_blend_tree(const Skeleton &skeleton, const AnimationClip &clip)
+{
+  // a handful of distinct clips, leaves share them like real trees share locomotion cycles
+  std::vector<AnimationClipPtr> clips;
+  clips.push_back(std::make_shared<AnimationClip>(clip));
+  for (int i = 1; i < 4; i++)
+    clips.push_back(make_procedural_clip(skeleton, 0.8f + 0.3f * i, 30.f));
+
+  PosePool pool;
+  SoaPose out;
+  debug_log("blend tree evaluation, %d bones:", skeleton.num_bones());
+  for (int numClips : {2, 8, 32, 64})
+  {
+    BlendTreeInstance speed, direction;
+    init_blend_tree_instance(speed, make_speed_tree(clips, numClips));
+    init_blend_tree_instance(direction, make_direction_tree(clips, numClips));
+    float parameter = 0.f;
+    const double speedNs = measure_ns(2000, [&]() {
+      parameter += 0.37f;
+      if (parameter > numClips - 1)
+        parameter -= numClips - 1;
+      speed.parameters[0] = parameter;
+      evaluate_blend_tree(speed, 1.f / 60.f, pool, out);
+      do_not_optimize(out.blocks[0]);
+    });
+    const double directionNs = measure_ns(200, [&]() {
+      evaluate_blend_tree(direction, 1.f / 60.f, pool, out);
+      do_not_optimize(out.blocks[0]);
+    });
+    debug_log("  %3d clips: 1d with %d active %6.0f ns, 2d at the center with %d active %7.0f ns (%.0f ns per active clip)",
+      numClips, speed.sampledClips, speedNs, direction.sampledClips, directionNs, directionNs / direction.sampledClips);
+  }
+  debug_log("  pose pool: %d poses allocated over all evaluations", (int)pool.poses.size());
+}
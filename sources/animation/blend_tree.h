@@ -0,0 +1,110 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+#include <3dmath.h>
+#include "soa_pose.h"
+#include "animation_clip.h"
+#include "root_motion.h"
+
+// A branch whose effective weight is below this is neither sampled nor blended.
+constexpr float BlendWeightEpsilon = 1e-3f;
+
+enum class BlendNodeType
+{
+  Clip,
+  Blend1D,     // children at ascending thresholds of one parameter, the two around it are blended
+  Blend2D,     // freeform directional: children at 2d positions, polar gradient band weights
+  Additive     // children[0] plus children[1] as an additive delta, scaled by the parameter
+};
+
+struct BlendNode
+{
+  BlendNodeType type;
+  std::vector<int> children;
+  AnimationClipPtr clip;
+  int parameter = -1;  // x for Blend2D, the amount for Additive (-1 applies it fully)
+  int parameterY = -1;
+  std::vector<float> thresholds;
+  std::vector<vec2> positions;
+};
+
+// Nodes reference children by index, root is where evaluation starts.
+struct BlendTree
+{
+  std::vector<BlendNode> nodes;
+  std::vector<std::string> parameters;
+  int root = 0;
+
+  int find_parameter(const char *name) const;
+  int num_bones() const;
+  int num_clips() const;
+};
+
+using BlendTreePtr = std::shared_ptr<const BlendTree>;
+
+// Builders return the new node's index. Parameters are created by name on first use.
+int add_clip_node(BlendTree &tree, AnimationClipPtr clip);
+int add_blend_1d(BlendTree &tree, const char *parameter, std::vector<int> children, std::vector<float> thresholds);
+int add_blend_2d(BlendTree &tree, const char *parameter_x, const char *parameter_y, std::vector<int> children,
+  std::vector<vec2> positions);
+int add_additive(BlendTree &tree, int base, int additive, const char *amount_parameter);
+
+// A tree of a single clip, what a state that just plays a clip holds.
+BlendTreePtr make_clip_tree(AnimationClipPtr clip);
+
+// Scratch poses lent out during an evaluation. A warm pool evaluates without allocating.
+struct PosePool
+{
+  std::vector<std::unique_ptr<SoaPose>> poses;
+  std::vector<SoaPose *> free;
+
+  SoaPose *acquire(int num_bones);
+  void release(SoaPose *pose);
+};
+
+// The pool of the calling thread, for evaluations running inside jobs.
+PosePool &thread_pose_pool();
+
+// The active children of a blend node after the weight pass, weights relative to the node.
+struct ActiveChild
+{
+  int node;
+  float weight;
+};
+
+struct BlendTreeInstance
+{
+  BlendTreePtr tree;
+  std::vector<float> parameters;
+  float phase = 0.f; // normalized time every clip plays at, so blended cycles stay in step
+  std::vector<ClipCursor> cursors; // per node, used by clip nodes
+  SoaKeyframes keyframes;
+
+  // filled by the weight pass, only for the nodes it reached
+  std::vector<ActiveChild> active;
+  std::vector<int> firstActive, numActive;
+  std::vector<float> directionWeights; // scratch of the Blend2D nodes
+  std::vector<ActiveChild> syncClips; // clip nodes driving the phase, with their effective weights
+  int sampledClips = 0;
+  RootMotionDelta rootMotion; // of the last evaluation, weighted over the synced clips that have a track
+};
+
+void init_blend_tree_instance(BlendTreeInstance &instance, BlendTreePtr tree);
+void set_blend_parameter(BlendTreeInstance &instance, const char *name, float value);
+
+// Walks down from the root only through branches above BlendWeightEpsilon, advances the phase by dt
+// over the weighted duration of the clips reached, then samples and blends just those clips into out.
+// The root motion of the step is blended with the same weights, from the tracks alone.
+void evaluate_blend_tree(BlendTreeInstance &instance, float dt, PosePool &pool, SoaPose &out,
+  SimdWidth width = BestSimdWidth);
+
+// The weight pass, phase and root motion of evaluate_blend_tree without sampling a clip.
+void advance_blend_tree(BlendTreeInstance &instance, float dt);
+
+// Polar gradient band weights of point among positions, they sum to 1. Exposed for tools and checks.
+void gradient_band_weights(const vec2 *positions, int count, vec2 point, float *weights);
+
+// Logs ns per evaluation for trees of growing size with a fixed number of active clips, and for the
+// same trees with every clip active.
+void benchmark_blend_tree(const Skeleton &skeleton, const AnimationClip &clip);
@@ -0,0 +1,108 @@
+#include "character_rig.h"
+#include <render/model.h>
+#include <log.h>
+
+CharacterRigPtr import_character_rig(const char *path, int mesh_idx,
+  const std::unordered_map<std::string, RootMotionOptions> &root_motion)
+{
+  ModelPtr model = import_model_rig(path);
+  if (!model)
+    return nullptr;
+
+  auto rig = std::make_shared<CharacterRig>();
+  rig->skeleton = build_skeleton(model->nodes);
+  const bool hasMesh = mesh_idx >= 0 && mesh_idx < (int)model->skins.size();
+  rig->inverseBind = skeleton_inverse_bind(rig->skeleton, hasMesh ? &model->skins[mesh_idx] : nullptr);
+
+  const int meshNode = hasMesh ? model->meshNodes[mesh_idx] : -1;
+  if (meshNode >= 0)
+  {
+    std::vector<mat4> bindModel(rig->skeleton.num_bones());
+    local_to_model(rig->skeleton, rig->skeleton.bindPose, bindModel.data());
+    rig->modelToMesh = inverse(bindModel[meshNode]);
+  }
+
+  for (const ModelAnimation &animation : model->animations)
+    rig->clips.push_back(import_clip(animation, rig->skeleton));
+  if (rig->clips.empty())
+    rig->clips.push_back(make_procedural_clip(rig->skeleton, 2.f, 30.f));
+  // before anything is baked from the clips, so additive clips and states see them in place
+  for (const AnimationClipPtr &clip : rig->clips)
+  {
+    auto options = root_motion.find(clip->name);
+    extract_root_motion(*clip, rig->skeleton, options != root_motion.end() ? options->second : RootMotionOptions{});
+  }
+  for (const AnimationClipPtr &clip : rig->clips)
+    rig->additiveClips.push_back(make_additive_clip(*clip, *clip, 0.f));
+  rig->stateMachine = make_clip_state_machine(rig->clips, 0.3f, TransitionBlend::Inertialize);
+
+  const Skeleton &skeleton = rig->skeleton;
+  if (skeleton.find_bone("Spine1") >= 0)
+  {
+    std::vector<float> weights(skeleton.num_bones(), 0.f);
+    set_subtree_weight(skeleton, "Spine1", 1.f, weights);
+    rig->upperBody = make_bone_mask(weights);
+    for (float &weight : weights)
+      weight = 1.f - weight;
+    rig->lowerBody = make_bone_mask(weights);
+  }
+
+  debug_log("rig %s: %d bones, %d clips", path, rig->skeleton.num_bones(), (int)rig->clips.size());
+  return rig;
+}
+
+void init_rig_instance(RigInstance &instance, CharacterRigPtr rig, int clip, float start_time, bool dual_quaternions)
+{
+  const int numBones = rig->skeleton.num_bones();
+  instance.rig = std::move(rig);
+  instance.clip = clip;
+  instance.time = start_time;
+  instance.dualQuaternions = dual_quaternions;
+  instance.cursor.reset(numBones);
+  instance.pose.resize(numBones);
+  instance.modelSpace.resize(numBones);
+  instance.palette.resize(numBones);
+  instance.dualQuatPalette.resize(dual_quaternions ? numBones : 0);
+}
+
+void attach_state_machine(RigInstance &instance, StateMachinePtr machine)
+{
+  init_state_machine_instance(instance.states, std::move(machine));
+}
+
+void advance_rig_root_motion(RigInstance &instance, float dt)
+{
+  if (instance.states.machine)
+  {
+    advance_state_machine(instance.states, dt);
+    instance.rootMotion = instance.states.rootMotion;
+    return;
+  }
+  const AnimationClip &clip = *instance.rig->clips[instance.clip];
+  instance.rootMotion = clip.rootMotion ? integrate_root_motion(*clip.rootMotion, instance.time, instance.time + dt)
+                                        : RootMotionDelta{};
+  instance.time += dt;
+  if (clip.duration > 0.f)
+    instance.time = fmodf(instance.time, clip.duration);
+}
+
+void update_rig_instance(RigInstance &instance, float dt)
+{
+  const CharacterRig &rig = *instance.rig;
+  if (instance.states.machine)
+  {
+    update_state_machine(instance.states, dt, thread_pose_pool(), instance.pose);
+    instance.rootMotion = instance.states.rootMotion;
+  }
+  else
+  {
+    advance_rig_root_motion(instance, dt);
+    sample_clip(*rig.clips[instance.clip], instance.time, instance.cursor, instance.keyframes, instance.pose);
+  }
+  for (AnimationLayer &layer : instance.layers)
+    update_animation_layer(layer, dt, instance.pose);
+  local_to_model_affine(rig.skeleton, instance.pose, rig.inverseBind.data(), instance.modelSpace.data(),
+    instance.palette.data());
+  if (instance.dualQuaternions)
+    build_dual_quat_palette(instance.palette.data(), instance.palette.size(), instance.dualQuatPalette.data());
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <3dmath.h>
+#include "skeleton.h"
+#include "animation_clip.h"
+#include "soa_pose.h"
+#include "skinning_matrices.h"
+#include "dual_quat_skinning.h"
+#include "state_machine.h"
+#include "animation_layers.h"
+#include "root_motion.h"
+#include "animation_lod.h"
+
+// What every instance of a character shares: its skeleton, the inverse bind matrices of the skinned mesh,
+// the clips of the file and the state machine playing them.
+struct CharacterRig
+{
+  Skeleton skeleton;
+  std::vector<Affine3x4> inverseBind;
+  std::vector<AnimationClipPtr> clips;
+  std::vector<AnimationClipPtr> additiveClips; // every clip against its own first frame, baked at import
+  StateMachinePtr stateMachine;
+  // split at Spine1 when the rig has one, for layers like aiming over locomotion
+  BoneMaskPtr upperBody, lowerBody;
+  // skinned vertices come out in skeleton model space, this brings them back to the space of the mesh
+  mat4 modelToMesh = mat4(1.f);
+};
+
+using CharacterRigPtr = std::shared_ptr<CharacterRig>;
+
+// Reads path without its meshes, mesh_idx is the skinned mesh. Runs on any thread.
+// Files without animation get a procedural clip, so there is always at least one.
+// Root motion is extracted from every clip, with the options of its name in root_motion or the defaults;
+// axes 0 leaves a clip as it is.
+CharacterRigPtr import_character_rig(const char *path, int mesh_idx,
+  const std::unordered_map<std::string, RootMotionOptions> &root_motion = {});
+
+// Playback of one looping clip, or of a state machine once one is attached, and the palette it produces.
+// One per character.
+struct RigInstance
+{
+  CharacterRigPtr rig;
+  int clip = 0;
+  float time = 0.f;
+  bool dualQuaternions = false; // dualQuatPalette is built from palette too
+  ClipCursor cursor;
+  SoaKeyframes keyframes;
+  StateMachineInstance states;
+  std::vector<AnimationLayer> layers; // applied over the base pose in order
+  SoaPose pose;
+  std::vector<Affine3x4> modelSpace, palette;
+  std::vector<DualQuat> dualQuatPalette;
+  RootMotionDelta rootMotion; // of the last update, in skeleton model space
+  AnimationLod lod;           // used by update_rig_instance_lod
+};
+
+void init_rig_instance(RigInstance &instance, CharacterRigPtr rig, int clip, float start_time, bool dual_quaternions = false);
+// From now on the pose comes from machine, driven by the parameters of instance.states.
+void attach_state_machine(RigInstance &instance, StateMachinePtr machine);
+// Advances time by dt, rebuilds the palettes and sets rootMotion. Safe to run on job system workers.
+void update_rig_instance(RigInstance &instance, float dt);
+// Advances time by dt and sets rootMotion, the pose and palettes stay as they are.
+void advance_rig_root_motion(RigInstance &instance, float dt);
@@ -0,0 +1,558 @@
+#include "clip_compression.h"
+#include "skeleton.h"
+#include "keyframes.h"
+#include <cstring>
+#include <benchmark.h>
+#include <log.h>
+
+// the skin sits about this far from a bone, rotation errors are measured there and not only at the joint
+constexpr float ShellDistance = 0.05f;
+// bounds both the reduction search and how far a cursor walks
+constexpr int MaxKeyGap = 32;
+constexpr float ConstantEpsilon = 1e-5f;
+constexpr float KeyTimeScale = 65535.f;
+constexpr float Sqrt2 = 1.41421356f;
+
+size_t CompressedClip::size_bytes() const
+{
+  const size_t numTracks = translationTracks.size() + rotationTracks.size() + scaleTracks.size();
+  return sizeof(*this) + name.size() + numTracks * sizeof(CompressedTrack) + keyTimes.size() * sizeof(uint16_t) +
+         floats.size() * sizeof(float) + bitstream.size();
+}
+
+static uint64_t quantize(float unit, int bits)
+{
+  const float maxValue = float((1u << bits) - 1);
+  return uint64_t(clamp(unit, 0.f, 1.f) * maxValue + 0.5f);
+}
+
+// Smallest three: the largest component is dropped and rebuilt from the unit length,
+// the other three lie in [-1/sqrt(2), 1/sqrt(2)]. Layout is 2 bits of index, then 3 * bits.
+static uint64_t encode_rotation(const quat &q, int bits)
+{
+  const float c[4] = {q.x, q.y, q.z, q.w};
+  int largest = 0;
+  for (int i = 1; i < 4; i++)
+    if (fabsf(c[i]) > fabsf(c[largest]))
+      largest = i;
+  // q and -q are the same rotation, the dropped component is always positive
+  const float sign = c[largest] < 0.f ? -1.f : 1.f;
+  uint64_t code = largest;
+  int shift = 2;
+  for (int i = 0; i < 4; i++)
+  {
+    if (i == largest)
+      continue;
+    code |= quantize((c[i] * sign * Sqrt2 + 1.f) * 0.5f, bits) << shift;
+    shift += bits;
+  }
+  return code;
+}
+
+static quat decode_rotation(uint64_t code, int bits)
+{
+  const uint32_t mask = (1u << bits) - 1;
+  const float scale = 2.f / (mask * Sqrt2);
+  const int largest = code & 3;
+  code >>= 2;
+  float c[4];
+  float sum = 0.f;
+  for (int i = 0; i < 4; i++)
+  {
+    if (i == largest)
+      continue;
+    c[i] = float(code & mask) * scale - 1.f / Sqrt2;
+    sum += c[i] * c[i];
+    code >>= bits;
+  }
+  // unit length up to the quantization step, interpolate normalizes anyway
+  c[largest] = sqrtf(max(1.f - sum, 0.f));
+  return quat(c[3], c[0], c[1], c[2]);
+}
+
+// Each component is reduced to the track's own [min, min + extent] range first.
+static uint64_t encode_vector(const vec3 &v, const float *range, int bits)
+{
+  uint64_t code = 0;
+  for (int i = 0; i < 3; i++)
+  {
+    const float unit = range[3 + i] > 0.f ? (v[i] - range[i]) / range[3 + i] : 0.f;
+    code |= quantize(unit, bits) << (i * bits);
+  }
+  return code;
+}
+
+static vec3 decode_vector(uint64_t code, const float *range, int bits)
+{
+  const uint32_t mask = (1u << bits) - 1;
+  const float scale = 1.f / mask;
+  vec3 v;
+  for (int i = 0; i < 3; i++)
+    v[i] = range[i] + range[3 + i] * (float((code >> (i * bits)) & mask) * scale);
+  return v;
+}
+
+static void write_bits(std::vector<uint8_t> &stream, uint64_t &bit_position, uint64_t value, int bits)
+{
+  for (int i = 0; i < bits; i++, bit_position++)
+  {
+    if ((bit_position >> 3) >= stream.size())
+      stream.push_back(0);
+    stream[bit_position >> 3] |= ((value >> i) & 1) << (bit_position & 7);
+  }
+}
+
+// One unaligned little endian load, a key is at most 50 bits so it fits with the 7 bit shift.
+static uint64_t read_bits(const uint8_t *stream, uint64_t bit_position, int bits)
+{
+  uint64_t word;
+  memcpy(&word, stream + (bit_position >> 3), sizeof(word));
+  return (word >> (bit_position & 7)) & ((uint64_t(1) << bits) - 1);
+}
+
+static int rotation_key_bits(int bits)
+{
+  return 2 + 3 * bits;
+}
+
+// compression side
+
+enum Channel
+{
+  ChannelTranslation,
+  ChannelRotation,
+  ChannelScale,
+  ChannelCount
+};
+
+// Raw and lossy poses at every frame, the error metric runs over these.
+struct ClipFrames
+{
+  int numFrames;
+  std::vector<Transforms> raw, lossy;
+  std::vector<mat4> rawModel, lossyModel; // numFrames * numBones
+};
+
+struct TrackBuild
+{
+  TrackType type = TrackType::Default;
+  float range[6] = {}; // min, extent
+  std::vector<uint64_t> codes; // per frame
+  std::vector<char> keep;      // per frame
+};
+
+static float point_error(const mat4 &a, const mat4 &b)
+{
+  const vec3 pa = vec3(a[3]), pb = vec3(b[3]);
+  float error = distance(pa, pb);
+  for (int axis = 0; axis < 2; axis++)
+    error = max(error, distance(pa + ShellDistance * normalize(vec3(a[axis])), pb + ShellDistance * normalize(vec3(b[axis]))));
+  return error;
+}
+
+static float component_deviation(const vec3 &a, const vec3 &b)
+{
+  return compMax(abs(a - b));
+}
+
+static float component_deviation(const quat &a, const quat &b)
+{
+  const float sign = dot(a, b) < 0.f ? -1.f : 1.f;
+  return compMax(abs(to_vec4(a) - to_vec4(b) * sign));
+}
+
+template<typename T>
+static TrackType classify_track(const std::vector<T> &values, const T &identity)
+{
+  for (const T &value : values)
+    if (component_deviation(value, values[0]) > ConstantEpsilon)
+      return TrackType::Animated;
+  return component_deviation(values[0], identity) <= ConstantEpsilon ? TrackType::Default : TrackType::Constant;
+}
+
+static std::vector<vec3> &channel_values(Transforms &pose, Channel channel)
+{
+  return channel == ChannelTranslation ? pose.translations : pose.scales;
+}
+
+// Quantizes one track at every frame and writes the decoded values into the lossy poses.
+static TrackBuild build_track(ClipFrames &frames, int bone, Channel channel, const ClipCompressionSettings &settings)
+{
+  const int numFrames = frames.numFrames;
+  TrackBuild track;
+  track.keep.assign(numFrames, 1);
+  if (channel == ChannelRotation)
+  {
+    std::vector<quat> values(numFrames);
+    for (int f = 0; f < numFrames; f++)
+      values[f] = frames.raw[f].rotations[bone];
+    track.type = classify_track(values, quat(1.f, 0.f, 0.f, 0.f));
+    for (int f = 0; f < numFrames; f++)
+    {
+      if (track.type == TrackType::Animated)
+      {
+        track.codes.push_back(encode_rotation(values[f], settings.rotationBits));
+        values[f] = decode_rotation(track.codes.back(), settings.rotationBits);
+      }
+      const quat &value = values[track.type == TrackType::Constant ? 0 : f];
+      frames.lossy[f].rotations[bone] = track.type == TrackType::Default ? quat(1.f, 0.f, 0.f, 0.f) : value;
+    }
+    return track;
+  }
+
+  const int bits = channel == ChannelTranslation ? settings.translationBits : settings.scaleBits;
+  const vec3 identity = channel == ChannelTranslation ? vec3(0.f) : vec3(1.f);
+  std::vector<vec3> values(numFrames);
+  for (int f = 0; f < numFrames; f++)
+    values[f] = channel_values(frames.raw[f], channel)[bone];
+  track.type = classify_track(values, identity);
+  if (track.type == TrackType::Animated)
+  {
+    vec3 lo = values[0], hi = values[0];
+    for (const vec3 &v : values)
+    {
+      lo = min(lo, v);
+      hi = max(hi, v);
+    }
+    for (int i = 0; i < 3; i++)
+    {
+      track.range[i] = lo[i];
+      track.range[3 + i] = hi[i] - lo[i];
+    }
+  }
+  for (int f = 0; f < numFrames; f++)
+  {
+    vec3 value = track.type == TrackType::Default ? identity : values[track.type == TrackType::Constant ? 0 : f];
+    if (track.type == TrackType::Animated)
+    {
+      track.codes.push_back(encode_vector(values[f], track.range, bits));
+      value = decode_vector(track.codes.back(), track.range, bits);
+    }
+    channel_values(frames.lossy[f], channel)[bone] = value;
+  }
+  return track;
+}
+
+static mat4 local_transform(const Transforms &pose, int bone)
+{
+  return compose_transform(pose.translations[bone], pose.rotations[bone], pose.scales[bone]);
+}
+
+// Largest error over the subtree of bone in frames [first, last), ancestors use their final lossy transforms.
+static float subtree_error(const Skeleton &skeleton, const ClipFrames &frames, int bone, int first, int last,
+  float tolerance, std::vector<mat4> &scratch)
+{
+  static const mat4 identity(1.f);
+  const int numBones = skeleton.num_bones();
+  const int parent = skeleton.parents[bone];
+  float error = 0.f;
+  for (int f = first; f < last; f++)
+  {
+    const mat4 *lossyModel = frames.lossyModel.data() + size_t(f) * numBones;
+    const mat4 *rawModel = frames.rawModel.data() + size_t(f) * numBones;
+    for (int i = bone; i < skeleton.subtreeEnd[bone]; i++)
+    {
+      const mat4 &parentModel = i == bone ? (parent >= 0 ? lossyModel[parent] : identity) : scratch[skeleton.parents[i]];
+      scratch[i] = parentModel * local_transform(frames.lossy[f], i);
+      error = max(error, point_error(scratch[i], rawModel[i]));
+    }
+    if (error > tolerance)
+      break;
+  }
+  return error;
+}
+
+template<typename T>
+static T &lossy_value(ClipFrames &frames, int frame, int bone, Channel channel);
+
+template<>
+quat &lossy_value<quat>(ClipFrames &frames, int frame, int bone, Channel)
+{
+  return frames.lossy[frame].rotations[bone];
+}
+
+template<>
+vec3 &lossy_value<vec3>(ClipFrames &frames, int frame, int bone, Channel channel)
+{
+  return channel_values(frames.lossy[frame], channel)[bone];
+}
+
+// Greedy pass over the frames: a key goes when interpolating its neighbours keeps the whole subtree within tolerance.
+template<typename T, typename Decode>
+static void reduce_track(const Skeleton &skeleton, ClipFrames &frames, int bone, Channel channel, TrackBuild &track,
+  float tolerance, Decode decode, std::vector<mat4> &scratch)
+{
+  const int numFrames = frames.numFrames;
+  std::vector<T> saved(MaxKeyGap);
+  int previous = 0;
+  for (int k = 1; k + 1 < numFrames; k++)
+  {
+    const int next = k + 1;
+    if (next - previous > MaxKeyGap)
+    {
+      previous = k;
+      continue;
+    }
+    const T a = decode(track.codes[previous]), b = decode(track.codes[next]);
+    for (int f = previous + 1; f < next; f++)
+    {
+      T &value = lossy_value<T>(frames, f, bone, channel);
+      saved[f - previous - 1] = value;
+      value = interpolate(a, b, float(f - previous) / (next - previous));
+    }
+    if (subtree_error(skeleton, frames, bone, previous + 1, next, tolerance, scratch) <= tolerance)
+    {
+      track.keep[k] = 0;
+      continue;
+    }
+    for (int f = previous + 1; f < next; f++)
+      lossy_value<T>(frames, f, bone, channel) = saved[f - previous - 1];
+    previous = k;
+  }
+}
+
+CompressedClipPtr compress_clip(const AnimationClip &clip, const Skeleton &skeleton, const ClipCompressionSettings &settings)
+{
+  const int numBones = skeleton.num_bones();
+  if (clip.num_bones() != numBones)
+  {
+    debug_error("clip %s has %d bones, the skeleton %d", clip.name.c_str(), clip.num_bones(), numBones);
+    return nullptr;
+  }
+  ClipCompressionSettings s = settings;
+  s.rotationBits = clamp(s.rotationBits, 4, 16);
+  s.translationBits = clamp(s.translationBits, 4, 16);
+  s.scaleBits = clamp(s.scaleBits, 4, 16);
+
+  // resample at the densest track's rate so every track shares the frame grid
+  uint32_t maxKeys = 2;
+  for (int i = 0; i < numBones; i++)
+    maxKeys = std::max({maxKeys, clip.translations.tracks[i].count, clip.rotations.tracks[i].count, clip.scales.tracks[i].count});
+  if (maxKeys > 65536)
+  {
+    debug_error("clip %s has %u keys in a track, too many for 16 bit key times", clip.name.c_str(), maxKeys);
+    return nullptr;
+  }
+
+  ClipFrames frames;
+  frames.numFrames = maxKeys;
+  frames.raw.resize(frames.numFrames);
+  frames.rawModel.resize(size_t(frames.numFrames) * numBones);
+  frames.lossyModel.resize(size_t(frames.numFrames) * numBones);
+  for (int f = 0; f < frames.numFrames; f++)
+  {
+    frames.raw[f].resize(numBones);
+    sample_clip(clip, clip.duration * f / (frames.numFrames - 1), frames.raw[f]);
+    local_to_model(skeleton, frames.raw[f], frames.rawModel.data() + size_t(f) * numBones);
+  }
+  frames.lossy = frames.raw;
+
+  std::vector<TrackBuild> tracks(size_t(numBones) * ChannelCount);
+  for (int bone = 0; bone < numBones; bone++)
+    for (int channel = 0; channel < ChannelCount; channel++)
+      tracks[bone * ChannelCount + channel] = build_track(frames, bone, Channel(channel), s);
+
+  // parents first, so a bone is reduced against its ancestors' final lossy transforms
+  // and the error it leaves is checked down to the leaves of its subtree
+  std::vector<mat4> scratch(numBones);
+  static const mat4 identity(1.f);
+  for (int bone = 0; bone < numBones; bone++)
+  {
+    for (int channel : {ChannelRotation, ChannelTranslation, ChannelScale})
+    {
+      TrackBuild &track = tracks[bone * ChannelCount + channel];
+      if (track.type != TrackType::Animated || s.tolerance <= 0.f)
+        continue;
+      if (channel == ChannelRotation)
+        reduce_track<quat>(skeleton, frames, bone, Channel(channel), track, s.tolerance,
+          [&](uint64_t code) { return decode_rotation(code, s.rotationBits); }, scratch);
+      else
+        reduce_track<vec3>(skeleton, frames, bone, Channel(channel), track, s.tolerance,
+          [&](uint64_t code) { return decode_vector(code, track.range, channel == ChannelTranslation ? s.translationBits : s.scaleBits); },
+          scratch);
+    }
+    const int parent = skeleton.parents[bone];
+    for (int f = 0; f < frames.numFrames; f++)
+    {
+      mat4 *lossyModel = frames.lossyModel.data() + size_t(f) * numBones;
+      lossyModel[bone] = (parent >= 0 ? lossyModel[parent] : identity) * local_transform(frames.lossy[f], bone);
+    }
+  }
+
+  auto result = std::make_shared<CompressedClip>();
+  result->name = clip.name;
+  result->duration = clip.duration;
+  result->rotationBits = s.rotationBits;
+  result->translationBits = s.translationBits;
+  result->scaleBits = s.scaleBits;
+  uint64_t bitPosition = 0;
+  for (int bone = 0; bone < numBones; bone++)
+  {
+    for (int channel = 0; channel < ChannelCount; channel++)
+    {
+      const TrackBuild &build = tracks[bone * ChannelCount + channel];
+      CompressedTrack track = {build.type, 0, 0, 0, 0};
+      if (build.type == TrackType::Constant)
+      {
+        track.floats = result->floats.size();
+        const Transforms &first = frames.raw[0];
+        if (channel == ChannelRotation)
+          result->floats.insert(result->floats.end(), {first.rotations[bone].x, first.rotations[bone].y,
+            first.rotations[bone].z, first.rotations[bone].w});
+        else
+        {
+          const vec3 &v = channel_values(frames.raw[0], Channel(channel))[bone];
+          result->floats.insert(result->floats.end(), {v.x, v.y, v.z});
+        }
+      }
+      else if (build.type == TrackType::Animated)
+      {
+        track.firstKey = result->keyTimes.size();
+        track.bitOffset = bitPosition;
+        const int keyBits = channel == ChannelRotation ? rotation_key_bits(s.rotationBits)
+                                                       : 3 * (channel == ChannelTranslation ? s.translationBits : s.scaleBits);
+        if (channel != ChannelRotation)
+        {
+          track.floats = result->floats.size();
+          result->floats.insert(result->floats.end(), build.range, build.range + 6);
+        }
+        for (int f = 0; f < frames.numFrames; f++)
+        {
+          if (!build.keep[f])
+            continue;
+          result->keyTimes.push_back(uint16_t(float(f) / (frames.numFrames - 1) * KeyTimeScale + 0.5f));
+          write_bits(result->bitstream, bitPosition, build.codes[f], keyBits);
+        }
+        track.numKeys = result->keyTimes.size() - track.firstKey;
+      }
+      std::vector<CompressedTrack> &dst = channel == ChannelTranslation ? result->translationTracks
+                                          : channel == ChannelRotation  ? result->rotationTracks
+                                                                        : result->scaleTracks;
+      dst.push_back(track);
+    }
+  }
+  result->bitstream.resize(result->bitstream.size() + sizeof(uint64_t), 0);
+  return result;
+}
+
+// runtime side
+
+static void load_value(const float *f, vec3 &value)
+{
+  value = vec3(f[0], f[1], f[2]);
+}
+
+static void load_value(const float *f, quat &value)
+{
+  value = quat(f[3], f[0], f[1], f[2]);
+}
+
+template<typename T, typename Decode>
+static void sample_compressed_channel(const CompressedClip &clip, const std::vector<CompressedTrack> &tracks, float key_time,
+  uint32_t *cursor, const T &identity, Decode decode, T *out)
+{
+  const int numTracks = tracks.size();
+  for (int i = 0; i < numTracks; i++)
+  {
+    const CompressedTrack &track = tracks[i];
+    if (track.type == TrackType::Default)
+    {
+      out[i] = identity;
+      continue;
+    }
+    if (track.type == TrackType::Constant)
+    {
+      load_value(clip.floats.data() + track.floats, out[i]);
+      continue;
+    }
+    const uint16_t *times = clip.keyTimes.data() + track.firstKey;
+    const uint32_t k = advance_key(times, track.numKeys, key_time, cursor[i]);
+    cursor[i] = k;
+    const float t = clamp((key_time - times[k]) / float(times[k + 1] - times[k]), 0.f, 1.f);
+    out[i] = interpolate(decode(track, k), decode(track, k + 1), t);
+  }
+}
+
+void sample_clip(const CompressedClip &clip, float time, ClipCursor &cursor, Transforms &pose)
+{
+  if (cursor.rotationKeys.size() != size_t(clip.num_bones()))
+    cursor.reset(clip.num_bones());
+  const float keyTime = clip.duration > 0.f ? time / clip.duration * KeyTimeScale : 0.f;
+  const uint8_t *stream = clip.bitstream.data();
+
+  const int rotationBits = clip.rotationBits, rotationKeyBits = rotation_key_bits(rotationBits);
+  sample_compressed_channel(clip, clip.rotationTracks, keyTime, cursor.rotationKeys.data(), quat(1.f, 0.f, 0.f, 0.f),
+    [&](const CompressedTrack &track, uint32_t key) {
+      return decode_rotation(read_bits(stream, track.bitOffset + uint64_t(key) * rotationKeyBits, rotationKeyBits), rotationBits);
+    },
+    pose.rotations.data());
+
+  auto sample_vectors = [&](const std::vector<CompressedTrack> &tracks, uint32_t *keys, int bits, const vec3 &identity, vec3 *out) {
+    sample_compressed_channel(clip, tracks, keyTime, keys, identity,
+      [&](const CompressedTrack &track, uint32_t key) {
+        return decode_vector(read_bits(stream, track.bitOffset + uint64_t(key) * 3 * bits, 3 * bits),
+          clip.floats.data() + track.floats, bits);
+      },
+      out);
+  };
+  sample_vectors(clip.translationTracks, cursor.translationKeys.data(), clip.translationBits, vec3(0.f), pose.translations.data());
+  sample_vectors(clip.scaleTracks, cursor.scaleKeys.data(), clip.scaleBits, vec3(1.f), pose.scales.data());
+}
+
+void report_clip_compression(const AnimationClip &clip, const Skeleton &skeleton)
+{
+  static const ClipCompressionSettings settings[] = {
+    {"quantized only", 16, 16, 16, 0.f},
+    {"high", 16, 16, 16, 0.0001f},
+    {"medium", 14, 14, 12, 0.0005f},
+    {"low", 12, 12, 10, 0.001f},
+  };
+
+  const int numBones = skeleton.num_bones();
+  const size_t rawBytes = clip.size_bytes();
+  debug_log("clip %s: %d bones, %zu keys, %zu bytes raw", clip.name.c_str(), numBones, clip.num_keys(), rawBytes);
+
+  // errors are checked at twice the key rate so interpolation between kept keys is covered too
+  const int numSamples = 2 * max<int>(clip.rotations.times.size() / max(numBones, 1), 30);
+  Transforms raw, lossy;
+  raw.resize(numBones);
+  lossy.resize(numBones);
+  std::vector<mat4> rawModel(numBones), lossyModel(numBones);
+  for (const ClipCompressionSettings &setting : settings)
+  {
+    CompressedClipPtr compressed = compress_clip(clip, skeleton, setting);
+    if (!compressed)
+      return;
+
+    ClipCursor cursor;
+    double maxError = 0.0, sumError = 0.0;
+    for (int i = 0; i <= numSamples; i++)
+    {
+      const float time = clip.duration * i / numSamples;
+      sample_clip(clip, time, raw);
+      sample_clip(*compressed, time, cursor, lossy);
+      local_to_model(skeleton, raw, rawModel.data());
+      local_to_model(skeleton, lossy, lossyModel.data());
+      for (int b = 0; b < numBones; b++)
+      {
+        const float error = point_error(lossyModel[b], rawModel[b]);
+        maxError = max<double>(maxError, error);
+        sumError += error;
+      }
+    }
+
+    float time = 0.f;
+    double sampleNs = measure_ns(10000, [&]() {
+      time += 1.f / 60.f;
+      if (time > clip.duration)
+        time -= clip.duration;
+      sample_clip(*compressed, time, cursor, lossy);
+      do_not_optimize(lossy.rotations[numBones - 1]);
+    });
+
+    const size_t bytes = compressed->size_bytes();
+    debug_log("  %-14s %7zu bytes, ratio %5.1f:1, %6zu keys, error max %.3f mm avg %.3f mm, %.0f ns/pose", setting.name,
+      bytes, double(rawBytes) / bytes, compressed->keyTimes.size(), maxError * 1000.0,
+      sumError / (double(numSamples + 1) * numBones) * 1000.0, sampleNs);
+  }
+}
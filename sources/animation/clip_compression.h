@@ -0,0 +1,53 @@
+#pragma once
+#include "animation_clip.h"
+
+struct ClipCompressionSettings
+{
+  const char *name;
+  int rotationBits;    // per smallest three component, 4..16
+  int translationBits; // per component inside the track's range, 4..16
+  int scaleBits;       // same as translations
+  float tolerance;     // model space error in metres key reduction may spend, 0 keeps every frame
+};
+
+enum class TrackType : uint8_t
+{
+  Default,  // identity rotation, zero translation or unit scale, nothing stored
+  Constant, // one full precision value in floats
+  Animated  // quantized keys in the bitstream
+};
+
+struct CompressedTrack
+{
+  TrackType type;
+  uint16_t numKeys;
+  uint32_t firstKey;  // into keyTimes
+  uint32_t floats;    // the constant value or the min/extent range of an animated vec3 track
+  uint32_t bitOffset; // of the first key in the bitstream
+};
+
+// A clip resampled to its frame rate, then quantized and reduced against the skeleton it plays on.
+// Every animated track keeps its own subset of the frames.
+struct CompressedClip
+{
+  std::string name;
+  float duration = 0.f;
+  uint8_t rotationBits = 0, translationBits = 0, scaleBits = 0;
+  std::vector<CompressedTrack> translationTracks, rotationTracks, scaleTracks; // one per bone
+  std::vector<uint16_t> keyTimes; // 0..65535 over the duration
+  std::vector<float> floats;
+  std::vector<uint8_t> bitstream; // padded for 8 byte reads
+
+  int num_bones() const { return rotationTracks.size(); }
+  size_t size_bytes() const;
+};
+
+using CompressedClipPtr = std::shared_ptr<CompressedClip>;
+
+CompressedClipPtr compress_clip(const AnimationClip &clip, const Skeleton &skeleton, const ClipCompressionSettings &settings);
+
+// Same contract as sample_clip on the raw clip, the cursor keeps the key of every animated track.
+void sample_clip(const CompressedClip &clip, float time, ClipCursor &cursor, Transforms &pose);
+
+// Logs bytes, ratio against the raw clip, max/avg model space error in mm and sampling cost for a few settings.
+void report_clip_compression(const AnimationClip &clip, const Skeleton &skeleton);
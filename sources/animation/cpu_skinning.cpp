@@ -0,0 +1,167 @@
+#include "cpu_skinning.h"
+#include "skeleton.h"
+#include "soa_pose.h"
+#include "animation_clip.h"
+#include "skinning_matrices.h"
+#include <render/mesh.h>
+#include <render/model.h>
+#include <job_system.h>
+#include <benchmark.h>
+#include <log.h>
+
+SkinnedMeshSource build_skinned_mesh_source(const MeshData &data)
+{
+  SkinnedMeshSource source;
+  source.numVertices = data.vertices.size();
+  source.blocks.assign((source.numVertices + SkinBlockWidth - 1) / SkinBlockWidth, SkinBlock{});
+  const bool hasWeights = !data.weights.empty();
+  for (uint32_t i = 0; i < source.numVertices; i++)
+  {
+    SkinBlock &block = source.blocks[i / SkinBlockWidth];
+    const int lane = i % SkinBlockWidth;
+    const vec3 normal = data.normals.empty() ? vec3(0.f, 0.f, 1.f) : data.normals[i];
+    for (int c = 0; c < 3; c++)
+    {
+      block.position[c][lane] = data.vertices[i][c];
+      block.normal[c][lane] = normal[c];
+    }
+    for (int k = 0; k < 4; k++)
+    {
+      // an unskinned vertex follows the first bone
+      block.weights[k][lane] = hasWeights ? data.weights[i][k] : float(k == 0);
+      const uint32_t bone = hasWeights ? data.weightsIndex[i][k] : 0;
+      block.offsets[k][lane] = bone * 12;
+    }
+  }
+  return source;
+}
+
+template<typename L>
+static void skin_blocks(const SkinnedMeshSource &source, const float *palette, size_t first_block, size_t num_blocks,
+  SkinnedVertex *out)
+{
+  using V = typename L::V;
+  alignas(32) float result[6][SkinBlockWidth];
+  for (size_t b = first_block; b < first_block + num_blocks; b++)
+  {
+    const SkinBlock &block = source.blocks[b];
+    for (int lane = 0; lane < SkinBlockWidth; lane += L::Width)
+    {
+      // blend the palette entries of the four influences, one gather per matrix element
+      V m[12];
+      for (int e = 0; e < 12; e++)
+        m[e] = L::set1(0.f);
+      for (int k = 0; k < 4; k++)
+      {
+        const V w = L::load(block.weights[k] + lane);
+        const int32_t *offsets = block.offsets[k] + lane;
+        for (int e = 0; e < 12; e++)
+          m[e] = L::add(m[e], L::mul(w, L::gather(palette + e, offsets)));
+      }
+
+      const V px = L::load(block.position[0] + lane), py = L::load(block.position[1] + lane),
+              pz = L::load(block.position[2] + lane);
+      const V nx = L::load(block.normal[0] + lane), ny = L::load(block.normal[1] + lane),
+              nz = L::load(block.normal[2] + lane);
+      V normal[3];
+      for (int r = 0; r < 3; r++)
+      {
+        const V *row = m + r * 4;
+        const V p = L::add(L::add(L::mul(row[0], px), L::mul(row[1], py)), L::add(L::mul(row[2], pz), row[3]));
+        L::store(result[r] + lane, p);
+        normal[r] = L::add(L::add(L::mul(row[0], nx), L::mul(row[1], ny)), L::mul(row[2], nz));
+      }
+      const V lengthSq = L::add(L::add(L::mul(normal[0], normal[0]), L::mul(normal[1], normal[1])), L::mul(normal[2], normal[2]));
+      const V invLength = L::div(L::set1(1.f), L::sqrt(L::max(lengthSq, L::set1(1e-20f))));
+      for (int r = 0; r < 3; r++)
+        L::store(result[3 + r] + lane, L::mul(normal[r], invLength));
+    }
+
+    const uint32_t firstVertex = b * SkinBlockWidth;
+    const uint32_t count = min<uint32_t>(SkinBlockWidth, source.numVertices - firstVertex);
+    for (uint32_t lane = 0; lane < count; lane++)
+    {
+      SkinnedVertex &v = out[firstVertex + lane];
+      v.position = vec3(result[0][lane], result[1][lane], result[2][lane]);
+      v.normal = vec3(result[3][lane], result[4][lane], result[5][lane]);
+    }
+  }
+}
+
+void skin_vertices(const SkinnedMeshSource &source, const Affine3x4 *palette, size_t first_block, size_t num_blocks,
+  SkinnedVertex *out, SimdWidth width)
+{
+  simd_dispatch(width, [&](auto lanes) {
+    skin_blocks<decltype(lanes)>(source, &palette[0].rows[0][0], first_block, num_blocks, out);
+  });
+}
+
+void skin_mesh(const SkinnedMeshSource &source, const Affine3x4 *palette, SkinnedVertex *out, SimdWidth width)
+{
+  parallel_for(source.blocks.size(), SkinChunkBlocks, [&](size_t begin, size_t end) {
+    skin_vertices(source, palette, begin, end - begin, out, width);
+  });
+}
+
+SkinnedVertex skin_vertex_reference(const MeshData &data, uint32_t vertex, const Affine3x4 *palette)
+{
+  mat4 m(0.f);
+  if (data.weights.empty())
+    m = to_mat4(palette[0]);
+  else
+    for (int k = 0; k < 4; k++)
+      m += data.weights[vertex][k] * to_mat4(palette[data.weightsIndex[vertex][k]]);
+  const vec3 normal = data.normals.empty() ? vec3(0.f, 0.f, 1.f) : data.normals[vertex];
+  return {vec3(m * vec4(data.vertices[vertex], 1.f)), normalize(vec3(m * vec4(normal, 0.f)))};
+}
+
+void benchmark_cpu_skinning(const Skeleton &skeleton, const MeshData &data, const MeshSkin &skin, const AnimationClip &clip)
+{
+  const int numBones = skeleton.num_bones();
+  const SkinnedMeshSource source = build_skinned_mesh_source(data);
+
+  Transforms pose;
+  pose.resize(numBones);
+  sample_clip(clip, clip.duration * 0.5f, pose);
+  SoaPose soaPose;
+  to_soa(pose, soaPose);
+  const std::vector<Affine3x4> inverseBind = skeleton_inverse_bind(skeleton, &skin);
+  std::vector<Affine3x4> model(numBones), palette(numBones);
+  local_to_model_affine(skeleton, soaPose, inverseBind.data(), model.data(), palette.data());
+
+  std::vector<SkinnedVertex> reference(source.numVertices), out(source.numVertices);
+  for (uint32_t i = 0; i < source.numVertices; i++)
+    reference[i] = skin_vertex_reference(data, i, palette.data());
+
+  const int numThreads = get_num_workers() + 1;
+  debug_log("cpu skinning, %u vertices, %d threads:", source.numVertices, numThreads);
+  const int iterations = 20;
+  for (SimdWidth width : {SimdWidth::Scalar, SimdWidth::Sse, SimdWidth::Avx2})
+  {
+    if (width > BestSimdWidth)
+      break;
+    const double singleNs = measure_ns(iterations, [&]() {
+      skin_vertices(source, palette.data(), 0, source.blocks.size(), out.data(), width);
+      do_not_optimize(out.back());
+    });
+    float positionError = 0.f, normalError = 0.f;
+    for (uint32_t i = 0; i < source.numVertices; i++)
+    {
+      positionError = max(positionError, length(out[i].position - reference[i].position));
+      normalError = max(normalError, length(out[i].normal - reference[i].normal));
+    }
+    const double threadedNs = measure_ns(iterations, [&]() {
+      skin_mesh(source, palette.data(), out.data(), width);
+      do_not_optimize(out.back());
+    });
+
+    simd_dispatch(width, [&](auto lanes) {
+      using L = decltype(lanes);
+      const double singleRate = source.numVertices * 1e3 / singleNs;
+      const double threadedRate = source.numVertices * 1e3 / threadedNs;
+      debug_log("  %-6s 1 thread %.1f M vertices/s, %d threads %.1f M vertices/s (%.1f M per core), "
+                "max error to reference: position %g, normal %g",
+        L::name, singleRate, numThreads, threadedRate, threadedRate / numThreads, positionError, normalError);
+    });
+  }
+}
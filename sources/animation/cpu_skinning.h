@@ -0,0 +1,54 @@
+#pragma once
+#include <vector>
+#include <simd.h>
+#include <3dmath.h>
+
+struct Skeleton;
+struct MeshData;
+struct MeshSkin;
+struct AnimationClip;
+struct Affine3x4;
+
+constexpr int SkinBlockWidth = 8;
+// blocks per job system task, 1024 vertices
+constexpr size_t SkinChunkBlocks = 128;
+
+// Eight vertices transposed so every lane of a register is a vertex. Unused lanes have zero weights.
+struct alignas(32) SkinBlock
+{
+  float position[3][SkinBlockWidth];
+  float normal[3][SkinBlockWidth];
+  float weights[4][SkinBlockWidth];
+  int32_t offsets[4][SkinBlockWidth]; // skeleton bone * 12, the first float of its palette entry
+};
+
+// Rest pose vertices in the layout the skinning kernels read.
+struct SkinnedMeshSource
+{
+  uint32_t numVertices = 0;
+  std::vector<SkinBlock> blocks;
+};
+
+// What the kernels write and the streaming vertex buffer holds.
+struct SkinnedVertex
+{
+  vec3 position;
+  vec3 normal;
+};
+
+// The bone indices of imported mesh data already are skeleton bones.
+SkinnedMeshSource build_skinned_mesh_source(const MeshData &data);
+
+// Linear blend skinning of blocks [first_block, first_block + num_blocks) with a palette indexed by skeleton bone.
+// out is indexed by vertex and receives only the real vertices of the range.
+void skin_vertices(const SkinnedMeshSource &source, const Affine3x4 *palette, size_t first_block, size_t num_blocks,
+  SkinnedVertex *out, SimdWidth width = BestSimdWidth);
+
+// The whole mesh in chunks of SkinChunkBlocks spread over the job system workers.
+void skin_mesh(const SkinnedMeshSource &source, const Affine3x4 *palette, SkinnedVertex *out, SimdWidth width = BestSimdWidth);
+
+// Plain glm mat4 blending of one rest pose vertex, what every other skinning path is checked against.
+SkinnedVertex skin_vertex_reference(const MeshData &data, uint32_t vertex, const Affine3x4 *palette);
+
+// Logs vertices/s per core of each width on one thread and on all workers, with the max error to the reference.
+void benchmark_cpu_skinning(const Skeleton &skeleton, const MeshData &data, const MeshSkin &skin, const AnimationClip &clip);
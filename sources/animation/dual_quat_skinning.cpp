@@ -0,0 +1,117 @@
+#include "dual_quat_skinning.h"
+#include "skeleton.h"
+#include "soa_pose.h"
+#include "animation_clip.h"
+#include "skinning_matrices.h"
+#include "cpu_skinning.h"
+#include <render/mesh.h>
+#include <benchmark.h>
+#include <log.h>
+
+DualQuat to_dual_quat(const Affine3x4 &m)
+{
+  mat3 rotation;
+  for (int c = 0; c < 3; c++)
+    rotation[c] = normalize(vec3(m.rows[0][c], m.rows[1][c], m.rows[2][c]));
+  const quat q = normalize(quat_cast(rotation));
+  const vec3 t(m.rows[0][3], m.rows[1][3], m.rows[2][3]);
+  const vec3 r(q.x, q.y, q.z);
+  // dual = 0.5 * (t, 0) * q
+  const vec3 d = 0.5f * (q.w * t + cross(t, r));
+  return DualQuat{{q.x, q.y, q.z, q.w}, {d.x, d.y, d.z, -0.5f * dot(t, r)}};
+}
+
+void build_dual_quat_palette(const Affine3x4 *skinning, int num_bones, DualQuat *out)
+{
+  for (int i = 0; i < num_bones; i++)
+    out[i] = to_dual_quat(skinning[i]);
+  const float *root = out[0].real;
+  for (int i = 1; i < num_bones; i++)
+  {
+    DualQuat &dq = out[i];
+    const float d = dq.real[0] * root[0] + dq.real[1] * root[1] + dq.real[2] * root[2] + dq.real[3] * root[3];
+    if (d < 0.f)
+      for (int c = 0; c < 4; c++)
+      {
+        dq.real[c] = -dq.real[c];
+        dq.dual[c] = -dq.dual[c];
+      }
+  }
+}
+
+SkinnedVertex skin_vertex_dual_quat_reference(const MeshData &data, uint32_t vertex, const DualQuat *palette)
+{
+  vec4 real(0.f), dual(0.f);
+  for (int k = 0; k < 4; k++)
+  {
+    const float w = data.weights.empty() ? float(k == 0) : data.weights[vertex][k];
+    const DualQuat &dq = palette[data.weights.empty() ? 0 : data.weightsIndex[vertex][k]];
+    real += w * vec4(dq.real[0], dq.real[1], dq.real[2], dq.real[3]);
+    dual += w * vec4(dq.dual[0], dq.dual[1], dq.dual[2], dq.dual[3]);
+  }
+  const float invLength = 1.f / length(real);
+  real *= invLength;
+  dual *= invLength;
+
+  const vec3 r(real), d(dual);
+  const vec3 p = data.vertices[vertex];
+  const vec3 n = data.normals.empty() ? vec3(0.f, 0.f, 1.f) : data.normals[vertex];
+  const vec3 translation = 2.f * (real.w * d - dual.w * r + cross(r, d));
+  const vec3 position = p + 2.f * cross(r, cross(r, p) + real.w * p) + translation;
+  const vec3 normal = n + 2.f * cross(r, cross(r, n) + real.w * n);
+  return {position, normalize(normal)};
+}
+
+// Shader instructions per vertex with four influences as character_vs.glsl spells them, a mad counts as one.
+// linear: 12 vec4 mads to blend the rows, 3 dot4 for the position and 3 dot3 for the normal
+constexpr int LinearSkinningOps = 12 * 4 + 3 * 4 + 3 * 3;
+// dual quaternion: 8 vec4 mads to blend, dot4 + rsqrt + 8 muls to renormalize, 2 crosses + 2 vec3 mads
+// per rotated vector (position and normal), a mul, a mad, a cross, a scale and an add for the translation
+constexpr int DualQuatSkinningOps = 8 * 4 + (4 + 1 + 8) + 2 * (2 * 6 + 2 * 3) + (3 + 3 + 6 + 3 + 3);
+
+void report_skinning_cost(const Skeleton &skeleton, const AnimationClip &clip, const MeshData &data, const Affine3x4 *inverse_bind)
+{
+  const int numBones = skeleton.num_bones();
+  constexpr int NumCharacters = 1000;
+
+  // a spread of poses so the characters don't all hit the same cache lines
+  constexpr int NumPoses = 16;
+  std::vector<SoaPose> poses(NumPoses);
+  ClipCursor cursor;
+  SoaKeyframes keys;
+  for (int i = 0; i < NumPoses; i++)
+    sample_clip(clip, clip.duration * i / NumPoses, cursor, keys, poses[i]);
+
+  std::vector<Affine3x4> model(numBones), palette(numBones);
+  std::vector<DualQuat> dualQuats(numBones);
+  const double linearNs = measure_ns(5, [&]() {
+    for (int c = 0; c < NumCharacters; c++)
+      local_to_model_affine(skeleton, poses[c % NumPoses], inverse_bind, model.data(), palette.data());
+    do_not_optimize(palette.back());
+  });
+  const double dualQuatNs = measure_ns(5, [&]() {
+    for (int c = 0; c < NumCharacters; c++)
+    {
+      local_to_model_affine(skeleton, poses[c % NumPoses], inverse_bind, model.data(), palette.data());
+      build_dual_quat_palette(palette.data(), numBones, dualQuats.data());
+    }
+    do_not_optimize(dualQuats.back());
+  });
+
+  // where the two methods disagree on a mid clip pose, mostly around twisting joints
+  local_to_model_affine(skeleton, poses[NumPoses / 2], inverse_bind, model.data(), palette.data());
+  build_dual_quat_palette(palette.data(), numBones, dualQuats.data());
+  float maxDifference = 0.f;
+  for (uint32_t i = 0; i < data.vertices.size(); i++)
+    maxDifference = max(maxDifference, length(skin_vertex_reference(data, i, palette.data()).position -
+                                              skin_vertex_dual_quat_reference(data, i, dualQuats.data()).position));
+
+  debug_log("skinning cost, %d bones, %d characters:", numBones, NumCharacters);
+  debug_log("  linear     palette %5zu B (%.2f MB per frame), %3d ops per vertex, palettes %.3f ms",
+    sizeof(Affine3x4) * numBones, sizeof(Affine3x4) * numBones * NumCharacters / float(1 << 20), LinearSkinningOps,
+    linearNs * 1e-6);
+  debug_log("  dual quat  palette %5zu B (%.2f MB per frame), %3d ops per vertex, palettes %.3f ms",
+    sizeof(DualQuat) * numBones, sizeof(DualQuat) * numBones * NumCharacters / float(1 << 20), DualQuatSkinningOps,
+    dualQuatNs * 1e-6);
+  debug_log("  max position difference between the methods on %zu vertices: %g", data.vertices.size(), maxDifference);
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <cstdint>
+#include <3dmath.h>
+
+struct Skeleton;
+struct MeshData;
+struct AnimationClip;
+struct Affine3x4;
+struct SkinnedVertex;
+
+// Rotation and translation of a skinning matrix as a unit dual quaternion, components in x y z w order
+// so the two halves are the two vec4 a palette entry has on the gpu. 32 bytes against 48 of Affine3x4.
+struct alignas(16) DualQuat
+{
+  float real[4];
+  float dual[4];
+};
+
+// Scale and shear are dropped, dual quaternion skinning only blends rigid transforms.
+DualQuat to_dual_quat(const Affine3x4 &m);
+
+// Converts a whole palette and flips every entry into the hemisphere of bone 0, the root, so blending
+// two bones never takes the long way around through the antipodal quaternion.
+void build_dual_quat_palette(const Affine3x4 *skinning, int num_bones, DualQuat *out);
+
+// Blends the four influences, renormalizes and applies the result, what the shader path is checked against.
+SkinnedVertex skin_vertex_dual_quat_reference(const MeshData &data, uint32_t vertex, const DualQuat *palette);
+
+// Logs palette bytes, shader ALU per vertex and the cpu palette cost for 1000 characters of both methods,
+// with the largest distance between the linear and the dual quaternion result on data.
+void report_skinning_cost(const Skeleton &skeleton, const AnimationClip &clip, const MeshData &data, const Affine3x4 *inverse_bind);
@@ -0,0 +1,273 @@
+#include "inertialization.h"
+#include "state_machine.h"
+#include "skeleton.h"
+#include <benchmark.h>
+#include <log.h>
+
+static vec3 load_vec3(const SoaPose &pose, int first_row, int bone)
+{
+  const PoseBlock &block = pose.blocks[bone / PoseBlockWidth];
+  const int lane = bone % PoseBlockWidth;
+  return vec3(block.rows[first_row][lane], block.rows[first_row + 1][lane], block.rows[first_row + 2][lane]);
+}
+
+static quat load_quat(const SoaPose &pose, int bone)
+{
+  const PoseBlock &block = pose.blocks[bone / PoseBlockWidth];
+  const int lane = bone % PoseBlockWidth;
+  return quat(block.rows[PoseQW][lane], block.rows[PoseQX][lane], block.rows[PoseQY][lane], block.rows[PoseQZ][lane]);
+}
+
+// Rotation vector of q taken the short way round.
+static vec3 rotation_vector(quat q)
+{
+  if (q.w < 0.f)
+    q = -q;
+  const float sinHalf = length(vec3(q.x, q.y, q.z));
+  if (sinHalf < 1e-7f)
+    return vec3(0.f);
+  return vec3(q.x, q.y, q.z) * (2.f * atan2f(sinHalf, q.w) / sinHalf);
+}
+
+// Bollo's inertialization quintic for an offset magnitude x0 moving at v0, stored relative to x0.
+// Moving away from the target counts as standing still, and a fast approach shortens the decay so it can't overshoot.
+static void fit_decay(float x0, float v0, float duration, InertialBlock &block, int channel, int lane)
+{
+  float c[InertialCoefficients] = {};
+  float end = 0.f;
+  if (x0 > 1e-6f && duration > 0.f)
+  {
+    v0 = min(v0, 0.f);
+    end = v0 < 0.f ? min(duration, -5.f * x0 / v0) : duration;
+    const float t2 = end * end, t3 = t2 * end;
+    const float a0 = max((-8.f * v0 * end - 20.f * x0) / t2, 0.f);
+    const float a = -(a0 * t2 + 6.f * v0 * end + 12.f * x0) / (2.f * t3 * t2);
+    const float b = (3.f * a0 * t2 + 16.f * v0 * end + 30.f * x0) / (2.f * t2 * t2);
+    const float cubic = -(3.f * a0 * t2 + 12.f * v0 * end + 20.f * x0) / (2.f * t3);
+    const float invX0 = 1.f / x0;
+    c[0] = v0 * invX0;
+    c[1] = 0.5f * a0 * invX0;
+    c[2] = cubic * invX0;
+    c[3] = b * invX0;
+    c[4] = a * invX0;
+  }
+  for (int i = 0; i < InertialCoefficients; i++)
+    block.coefficients[channel][i][lane] = c[i];
+  block.end[channel][lane] = end;
+}
+
+void begin_inertialization(const SoaPose &previous, const SoaPose &before_previous, float dt, const SoaPose &target,
+  float duration, Inertializer &inertializer)
+{
+  const int numBones = target.numBones;
+  SoaPose &offset = inertializer.offset;
+  if (offset.numBones != numBones)
+    offset.resize(numBones);
+  inertializer.decay.resize(offset.num_blocks());
+  const float invDt = dt > 0.f ? 1.f / dt : 0.f;
+
+  for (int bone = 0; bone < numBones; bone++)
+  {
+    PoseBlock &block = offset.blocks[bone / PoseBlockWidth];
+    InertialBlock &decay = inertializer.decay[bone / PoseBlockWidth];
+    const int lane = bone % PoseBlockWidth;
+
+    for (int channel : {InertialTranslation, InertialScale})
+    {
+      const int row = channel == InertialTranslation ? PoseTX : PoseSX;
+      const vec3 x = load_vec3(previous, row, bone) - load_vec3(target, row, bone);
+      const vec3 v = (load_vec3(previous, row, bone) - load_vec3(before_previous, row, bone)) * invDt;
+      const float x0 = length(x);
+      for (int c = 0; c < 3; c++)
+        block.rows[row + c][lane] = x[c];
+      fit_decay(x0, x0 > 0.f ? dot(v, x) / x0 : 0.f, duration, decay, channel, lane);
+    }
+
+    quat q = load_quat(previous, bone) * conjugate(load_quat(target, bone));
+    if (q.w < 0.f)
+      q = -q;
+    block.rows[PoseQX][lane] = q.x;
+    block.rows[PoseQY][lane] = q.y;
+    block.rows[PoseQZ][lane] = q.z;
+    block.rows[PoseQW][lane] = q.w;
+    // angular velocity of the source projected on the offset axis
+    const vec3 x = rotation_vector(q);
+    const vec3 w = rotation_vector(load_quat(previous, bone) * conjugate(load_quat(before_previous, bone))) * invDt;
+    const float x0 = length(x);
+    fit_decay(x0, x0 > 0.f ? dot(w, x) / x0 : 0.f, duration, decay, InertialRotation, lane);
+  }
+  // the lanes past the last bone stay identity
+  for (int bone = numBones; bone < offset.num_blocks() * PoseBlockWidth; bone++)
+  {
+    PoseBlock &block = offset.blocks[bone / PoseBlockWidth];
+    const int lane = bone % PoseBlockWidth;
+    for (int row = 0; row < PoseRowCount; row++)
+      block.rows[row][lane] = row == PoseQW ? 1.f : 0.f;
+    for (int channel = 0; channel < InertialChannelCount; channel++)
+      fit_decay(0.f, 0.f, duration, inertializer.decay[bone / PoseBlockWidth], channel, lane);
+  }
+}
+
+template<typename L>
+static inline typename L::V decayed_fraction(const InertialBlock &decay, int channel, typename L::V time, int lane)
+{
+  using V = typename L::V;
+  const V t = L::min(time, L::load(decay.end[channel] + lane));
+  V f = L::load(decay.coefficients[channel][InertialCoefficients - 1] + lane);
+  for (int i = InertialCoefficients - 2; i >= 0; i--)
+    f = L::add(L::load(decay.coefficients[channel][i] + lane), L::mul(f, t));
+  return L::add(L::set1(1.f), L::mul(f, t));
+}
+
+void apply_inertialization(const Inertializer &inertializer, float time, SoaPose &pose, SimdWidth width)
+{
+  simd_dispatch(width, [&](auto lanes) {
+    using L = decltype(lanes);
+    using V = typename L::V;
+    const V t = L::set1(time), one = L::set1(1.f);
+    for (int block = 0; block < pose.num_blocks(); block++)
+      for (int lane = 0; lane < PoseBlockWidth; lane += L::Width)
+      {
+        const PoseBlock &o = inertializer.offset.blocks[block];
+        const InertialBlock &decay = inertializer.decay[block];
+        PoseBlock &p = pose.blocks[block];
+
+        const V ft = decayed_fraction<L>(decay, InertialTranslation, t, lane);
+        for (int row = PoseTX; row <= PoseTZ; row++)
+          L::store(p.rows[row] + lane, L::add(L::load(p.rows[row] + lane), L::mul(L::load(o.rows[row] + lane), ft)));
+        const V fs = decayed_fraction<L>(decay, InertialScale, t, lane);
+        for (int row = PoseSX; row <= PoseSZ; row++)
+          L::store(p.rows[row] + lane, L::add(L::load(p.rows[row] + lane), L::mul(L::load(o.rows[row] + lane), fs)));
+
+        // d = nlerp(identity, offset, f) multiplied on the left, normalized after the product
+        const V fr = decayed_fraction<L>(decay, InertialRotation, t, lane);
+        const V dx = L::mul(L::load(o.rows[PoseQX] + lane), fr);
+        const V dy = L::mul(L::load(o.rows[PoseQY] + lane), fr);
+        const V dz = L::mul(L::load(o.rows[PoseQZ] + lane), fr);
+        const V dw = L::add(one, L::mul(L::sub(L::load(o.rows[PoseQW] + lane), one), fr));
+        const V px = L::load(p.rows[PoseQX] + lane), py = L::load(p.rows[PoseQY] + lane);
+        const V pz = L::load(p.rows[PoseQZ] + lane), pw = L::load(p.rows[PoseQW] + lane);
+        V q[4];
+        q[0] = L::add(L::add(L::mul(dw, px), L::mul(dx, pw)), L::sub(L::mul(dy, pz), L::mul(dz, py)));
+        q[1] = L::add(L::sub(L::mul(dw, py), L::mul(dx, pz)), L::add(L::mul(dy, pw), L::mul(dz, px)));
+        q[2] = L::add(L::add(L::mul(dw, pz), L::mul(dx, py)), L::sub(L::mul(dz, pw), L::mul(dy, px)));
+        q[3] = L::sub(L::sub(L::mul(dw, pw), L::mul(dx, px)), L::add(L::mul(dy, py), L::mul(dz, pz)));
+        V lengthSq = L::mul(q[0], q[0]);
+        for (int c = 1; c < 4; c++)
+          lengthSq = L::add(lengthSq, L::mul(q[c], q[c]));
+        const V invLength = L::div(one, L::sqrt(lengthSq));
+        for (int c = 0; c < 4; c++)
+          L::store(p.rows[PoseQX + c] + lane, L::mul(q[c], invLength));
+      }
+  });
+}
+
+static float max_difference(const SoaPose &a, const SoaPose &b)
+{
+  float difference = 0.f;
+  for (int block = 0; block < a.num_blocks(); block++)
+    for (int row = 0; row < PoseRowCount; row++)
+      for (int lane = 0; lane < PoseBlockWidth; lane++)
+        difference = max(difference, fabsf(a.blocks[block].rows[row][lane] - b.blocks[block].rows[row][lane]));
+  return difference;
+}
+
+// Two states that keep handing over to each other, every frame of the measurement is inside a transition.
+static double transition_frame_ns(const std::vector<AnimationClipPtr> &clips, TransitionBlend blend, float duration,
+  float dt, float *sampled_clips)
+{
+  auto machine = std::make_shared<StateMachine>();
+  for (int i = 0; i < 2; i++)
+  {
+    auto tree = std::make_shared<BlendTree>();
+    tree->root = add_blend_1d(*tree, "speed", {add_clip_node(*tree, clips[2 * i]), add_clip_node(*tree, clips[2 * i + 1])},
+      {0.f, 1.f});
+    add_state(*machine, i == 0 ? "a" : "b", tree);
+  }
+  for (int i = 0; i < 2; i++)
+    add_transition(*machine, i, 1 - i, duration, {make_condition(*machine, "switch", ConditionOp::Trigger)}, -1.f, true,
+      blend);
+
+  StateMachineInstance instance;
+  init_state_machine_instance(instance, machine);
+  set_state_parameter(instance, "speed", 0.5f);
+  PosePool pool;
+  SoaPose out;
+  // a new transition starts the frame after the last one finished, so none is interrupted
+  const int framesPerTransition = int(ceilf(duration / dt)) + 1;
+  int frame = 0, sampled = 0, frames = 0;
+  const double ns = measure_ns(framesPerTransition * 200, [&]() {
+    if (frame++ % framesPerTransition == 0)
+      set_state_parameter(instance, "switch", 1.f);
+    update_state_machine(instance, dt, pool, out);
+    do_not_optimize(out.blocks[0]);
+    sampled += instance.states[instance.current].sampledClips;
+    if (instance.transition >= 0 && instance.source >= 0)
+      sampled += instance.states[instance.source].sampledClips;
+    frames++;
+  });
+  *sampled_clips = sampled / float(frames);
+  return ns;
+}
+
+void benchmark_inertialization(const Skeleton &skeleton, const AnimationClip &clip)
+{
+  const int numBones = skeleton.num_bones();
+  std::vector<AnimationClipPtr> clips;
+  clips.push_back(std::make_shared<AnimationClip>(clip));
+  for (int i = 1; i < 4; i++)
+    clips.push_back(make_procedural_clip(skeleton, 0.7f + 0.4f * i, 30.f));
+
+  const float dt = 1.f / 60.f;
+  Transforms sampled;
+  sampled.resize(numBones);
+  SoaPose beforePrevious, previous, target, pose, reference;
+  sample_clip(*clips[0], 0.5f, sampled);
+  to_soa(sampled, beforePrevious);
+  sample_clip(*clips[0], 0.5f + dt, sampled);
+  to_soa(sampled, previous);
+  sample_clip(*clips[2], 0.2f, sampled);
+  to_soa(sampled, target);
+  Inertializer inertializer;
+  begin_inertialization(previous, beforePrevious, dt, target, 0.3f, inertializer);
+
+  debug_log("inertialization, %d bones:", numBones);
+  for (SimdWidth width : {SimdWidth::Scalar, SimdWidth::Sse, SimdWidth::Avx2})
+  {
+    if (width > BestSimdWidth)
+      break;
+    // restarts from the target every time, the copy is part of the cost
+    const double ns = measure_ns(100000, [&]() {
+      pose.blocks = target.blocks;
+      pose.numBones = target.numBones;
+      apply_inertialization(inertializer, 0.1f, pose, width);
+      do_not_optimize(pose.blocks[0]);
+    });
+    float difference = 0.f;
+    if (width == SimdWidth::Scalar)
+      reference = pose;
+    else
+      difference = max_difference(pose, reference);
+    simd_dispatch(width, [&](auto lanes) {
+      using L = decltype(lanes);
+      debug_log("  decay %-6s (%d lanes): %.0f M bones/s, max difference to scalar %g", L::name, L::Width,
+        numBones * 1e3 / ns, difference);
+    });
+  }
+  const double captureNs = measure_ns(10000, [&]() {
+    begin_inertialization(previous, beforePrevious, dt, target, 0.3f, inertializer);
+    do_not_optimize(inertializer.decay[0]);
+  });
+  debug_log("  capture %.0f ns, once per transition", captureNs);
+  // at the start the offset gives back the pose the transition left
+  pose = target;
+  apply_inertialization(inertializer, 0.f, pose);
+  debug_log("  offset at t = 0 restores the source pose within %g", max_difference(pose, previous));
+
+  float crossfadeClips, inertialClips;
+  const double crossfadeNs = transition_frame_ns(clips, TransitionBlend::Crossfade, 0.3f, dt, &crossfadeClips);
+  const double inertialNs = transition_frame_ns(clips, TransitionBlend::Inertialize, 0.3f, dt, &inertialClips);
+  debug_log("  per transitioning character and frame: crossfade %.0f ns sampling %.1f clips, inertialization %.0f ns "
+            "sampling %.1f clips",
+    crossfadeNs, crossfadeClips, inertialNs, inertialClips);
+}
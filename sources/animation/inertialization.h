@@ -0,0 +1,46 @@
+#pragma once
+#include <vector>
+#include <simd.h>
+#include "soa_pose.h"
+
+struct Skeleton;
+struct AnimationClip;
+
+enum InertialChannel
+{
+  InertialTranslation,
+  InertialRotation,
+  InertialScale,
+  InertialChannelCount
+};
+
+constexpr int InertialCoefficients = 5;
+
+// Decay of every channel of eight bones as a fraction of the offset it started from:
+// f(t) = 1 + t (c[0] + t (c[1] + t (c[2] + t (c[3] + t c[4])))) for t up to end, after which it stays 0.
+// The quintic reaches 0 at end with zero velocity and acceleration, so nothing pops when it stops.
+struct alignas(32) InertialBlock
+{
+  float coefficients[InertialChannelCount][InertialCoefficients][PoseBlockWidth];
+  float end[InertialChannelCount][PoseBlockWidth];
+};
+
+// What is left of a transition: the offset from the pose it entered to the pose it left, per bone.
+struct Inertializer
+{
+  SoaPose offset; // source - target for translations and scales, source * inverse(target) for rotations
+  std::vector<InertialBlock> decay;
+};
+
+// Captures previous against target, with the velocity previous moved at since before_previous, dt earlier.
+// Each channel gets its own quintic that brings its offset magnitude to 0 within duration.
+void begin_inertialization(const SoaPose &previous, const SoaPose &before_previous, float dt, const SoaPose &target,
+  float duration, Inertializer &inertializer);
+
+// pose = pose + offset decayed to time since the transition. Rotations nlerp their offset toward identity by the
+// decayed fraction and multiply it on.
+void apply_inertialization(const Inertializer &inertializer, float time, SoaPose &pose, SimdWidth width = BestSimdWidth);
+
+// Logs the decay kernel at every width against scalar, and the update cost of a character transitioning by
+// crossfade and by inertialization.
+void benchmark_inertialization(const Skeleton &skeleton, const AnimationClip &clip);
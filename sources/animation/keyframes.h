@@ -0,0 +1,42 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <3dmath.h>
+
+// Key search shared by the raw and the compressed clips, times are floats or quantized integers.
+
+// Index k of the key pair [k, k + 1] around time, count >= 2.
+template<typename TimeT>
+inline uint32_t search_key(const TimeT *times, uint32_t count, float time)
+{
+  uint32_t k = std::upper_bound(times + 1, times + count - 1, time) - times;
+  return k - 1;
+}
+
+// Continues from the pair k of the previous sample.
+template<typename TimeT>
+inline uint32_t advance_key(const TimeT *times, uint32_t count, float time, uint32_t k)
+{
+  if (k + 1 >= count || time < times[k])
+  {
+    // a loop wrap lands in the first pair, anything else is a seek
+    if (time < times[1])
+      return 0;
+    return search_key(times, count, time);
+  }
+  while (k + 2 < count && times[k + 1] <= time)
+    k++;
+  return k;
+}
+
+inline vec3 interpolate(const vec3 &a, const vec3 &b, float t)
+{
+  return mix(a, b, t);
+}
+
+inline quat interpolate(const quat &a, const quat &b, float t)
+{
+  // nlerp along the shorter arc, keys are dense enough that slerp's constant speed is not visible
+  const float sign = dot(a, b) < 0.f ? -1.f : 1.f;
+  return normalize(quat(mix(a.w, b.w * sign, t), mix(a.x, b.x * sign, t), mix(a.y, b.y * sign, t), mix(a.z, b.z * sign, t)));
+}
@@ -0,0 +1,271 @@
+#include "root_motion.h"
+#include "animation_clip.h"
+#include "skeleton.h"
+#include <algorithm>
+#include <random>
+#include <benchmark.h>
+#include <log.h>
+
+static const vec3 RootMotionUp = vec3(0.f, 1.f, 0.f);
+
+static RootMotionDelta to_delta(const vec4 &sample)
+{
+  return RootMotionDelta{vec3(sample), sample.w};
+}
+
+static RootMotionDelta inverse_root_motion(const RootMotionDelta &delta)
+{
+  return RootMotionDelta{-(angleAxis(-delta.yaw, RootMotionUp) * delta.translation), -delta.yaw};
+}
+
+RootMotionDelta combine_root_motion(const RootMotionDelta &a, const RootMotionDelta &b)
+{
+  return RootMotionDelta{a.translation + angleAxis(a.yaw, RootMotionUp) * b.translation, a.yaw + b.yaw};
+}
+
+RootMotionDelta blend_root_motion(const RootMotionDelta &a, const RootMotionDelta &b, float weight)
+{
+  return RootMotionDelta{mix(a.translation, b.translation, weight), mix(a.yaw, b.yaw, weight)};
+}
+
+mat4 root_motion_transform(const RootMotionDelta &delta)
+{
+  return translate(mat4(1.f), delta.translation) * mat4_cast(angleAxis(delta.yaw, RootMotionUp));
+}
+
+static vec4 sample_track(const RootMotionTrack &track, float time)
+{
+  const float x = clamp(time, 0.f, track.duration) * track.sampleRate;
+  const int i = min(int(x), (int)track.samples.size() - 2);
+  return mix(track.samples[i], track.samples[i + 1], x - i);
+}
+
+RootMotionDelta integrate_root_motion(const RootMotionTrack &track, float from, float to, bool loop)
+{
+  if (track.samples.size() < 2 || track.duration <= 0.f)
+    return {};
+  if (!loop)
+    return combine_root_motion(inverse_root_motion(to_delta(sample_track(track, from))), to_delta(sample_track(track, to)));
+
+  // both times relative to the loop from starts in, every whole loop between them adds the motion of one cycle
+  const float start = floorf(from / track.duration) * track.duration;
+  const RootMotionDelta cycle = to_delta(track.samples.back());
+  auto unrolled = [&](float time) {
+    const float loops = floorf((time - start) / track.duration);
+    RootMotionDelta motion;
+    const RootMotionDelta step = loops >= 0.f ? cycle : inverse_root_motion(cycle);
+    for (int i = 0; i < (int)fabsf(loops); i++)
+      motion = combine_root_motion(motion, step);
+    return combine_root_motion(motion, to_delta(sample_track(track, time - start - loops * track.duration)));
+  };
+  return combine_root_motion(inverse_root_motion(unrolled(from)), unrolled(to));
+}
+
+// Model space transform of bone, chaining only its ancestors.
+static mat4 bone_model_transform(const Skeleton &skeleton, const Transforms &pose, int bone)
+{
+  mat4 model = compose_transform(pose.translations[bone], pose.rotations[bone], pose.scales[bone]);
+  for (int parent = skeleton.parents[bone]; parent >= 0; parent = skeleton.parents[parent])
+    model = compose_transform(pose.translations[parent], pose.rotations[parent], pose.scales[parent]) * model;
+  return model;
+}
+
+static int find_root_motion_bone(const AnimationClip &clip, const Skeleton &skeleton, const RootMotionOptions &options)
+{
+  if (options.bone)
+  {
+    const int bone = skeleton.find_bone(options.bone);
+    if (bone < 0)
+      debug_error("clip %s: no root motion bone %s", clip.name.c_str(), options.bone);
+    return bone;
+  }
+  // down the first children from the root, Root then Hips on most rigs
+  for (int bone = 0; bone < skeleton.num_bones(); bone++)
+  {
+    if (clip.translations.tracks[bone].count > 1)
+      return bone;
+    if (bone + 1 >= skeleton.num_bones() || skeleton.parents[bone + 1] != bone)
+      break;
+  }
+  const int hips = skeleton.find_bone("Hips");
+  return hips >= 0 ? hips : 0;
+}
+
+template<typename T>
+static void replace_track(KeyChannel<T> &channel, int bone, const std::vector<float> &times, const std::vector<T> &values)
+{
+  const auto [first, count] = channel.tracks[bone];
+  channel.times.erase(channel.times.begin() + first, channel.times.begin() + first + count);
+  channel.times.insert(channel.times.begin() + first, times.begin(), times.end());
+  channel.values.erase(channel.values.begin() + first, channel.values.begin() + first + count);
+  channel.values.insert(channel.values.begin() + first, values.begin(), values.end());
+  const int shift = int(times.size()) - int(count);
+  for (auto &track : channel.tracks)
+    if (track.first > first)
+      track.first += shift;
+  channel.tracks[bone].count = times.size();
+}
+
+template<typename T>
+static void append_track_times(const KeyChannel<T> &channel, int bone, std::vector<float> &times)
+{
+  const auto [first, count] = channel.tracks[bone];
+  times.insert(times.end(), channel.times.begin() + first, channel.times.begin() + first + count);
+}
+
+void extract_root_motion(AnimationClip &clip, const Skeleton &skeleton, const RootMotionOptions &options)
+{
+  clip.rootMotion = nullptr;
+  const int bone = find_root_motion_bone(clip, skeleton, options);
+  if (bone < 0 || clip.duration <= 0.f || options.axes == 0)
+    return;
+
+  auto track = std::make_shared<RootMotionTrack>();
+  track->bone = bone;
+  track->axes = options.axes;
+  track->duration = clip.duration;
+  const int numSamples = max(2, int(ceilf(clip.duration * options.sampleRate)) + 1);
+  // spread evenly so the last sample lands on the end of the clip
+  track->sampleRate = (numSamples - 1) / clip.duration;
+  track->samples.resize(numSamples);
+
+  Transforms pose;
+  pose.resize(skeleton.num_bones());
+  vec3 startPosition;
+  quat startRotation, rotation;
+  vec3 scale;
+  float yaw = 0.f;
+  for (int i = 0; i < numSamples; i++)
+  {
+    sample_clip(clip, min(i / track->sampleRate, clip.duration), pose);
+    vec3 position;
+    decompose_transform(bone_model_transform(skeleton, pose, bone), position, rotation, scale);
+    if (i == 0)
+    {
+      startPosition = position;
+      startRotation = rotation;
+    }
+    if (options.axes & RootMotionYaw)
+    {
+      // twist around up of the rotation since the start, unwrapped against the previous sample
+      const quat delta = rotation * conjugate(startRotation);
+      const float twist = length(vec2(delta.w, delta.y)) > 1e-6f ? 2.f * atan2f(delta.y, delta.w) : yaw;
+      yaw = twist + PITWO * roundf((yaw - twist) / PITWO);
+    }
+    // the frame moves so that, after it is taken out, the bone keeps its start position on the extracted axes
+    vec3 translation = position - angleAxis(yaw, RootMotionUp) * startPosition;
+    for (int axis = 0; axis < 3; axis++)
+      if (!(options.axes & (RootMotionX << axis)))
+        translation[axis] = 0.f;
+    track->samples[i] = vec4(translation, yaw);
+  }
+
+  if (options.removeFromClip)
+  {
+    // rekey translation and rotation at the union of their times, either of them can carry part of the motion
+    std::vector<float> times;
+    append_track_times(clip.translations, bone, times);
+    append_track_times(clip.rotations, bone, times);
+    std::sort(times.begin(), times.end());
+    times.erase(std::unique(times.begin(), times.end(), [](float a, float b) { return b - a < 1e-6f; }), times.end());
+
+    std::vector<vec3> translations(times.size());
+    std::vector<quat> rotations(times.size());
+    for (size_t i = 0; i < times.size(); i++)
+    {
+      sample_clip(clip, times[i], pose);
+      const mat4 model = bone_model_transform(skeleton, pose, bone);
+      const mat4 local = compose_transform(pose.translations[bone], pose.rotations[bone], pose.scales[bone]);
+      const mat4 parent = model * inverse(local);
+      const mat4 remaining = inverse(root_motion_transform(to_delta(sample_track(*track, times[i])))) * model;
+      decompose_transform(inverse(parent) * remaining, translations[i], rotations[i], scale);
+    }
+    replace_track(clip.translations, bone, times, translations);
+    replace_track(clip.rotations, bone, times, rotations);
+  }
+  clip.rootMotion = track;
+}
+
+// The clip with its first root chain bone walking forward and turning, what a locomotion clip with motion looks like.
+static AnimationClip make_moving_clip(const AnimationClip &clip, const Skeleton &skeleton, int bone)
+{
+  AnimationClip moving = clip;
+  const int numKeys = int(clip.duration * 30.f) + 1;
+  std::vector<float> times(numKeys);
+  std::vector<vec3> translations(numKeys);
+  std::vector<quat> rotations(numKeys);
+  Transforms pose;
+  pose.resize(skeleton.num_bones());
+  for (int i = 0; i < numKeys; i++)
+  {
+    times[i] = min(i / 30.f, clip.duration);
+    sample_clip(clip, times[i], pose);
+    const quat turn = angleAxis(0.6f * times[i], RootMotionUp);
+    translations[i] = pose.translations[bone] + turn * vec3(0.f, 0.f, 1.4f * times[i]);
+    rotations[i] = turn * pose.rotations[bone];
+  }
+  replace_track(moving.translations, bone, times, translations);
+  replace_track(moving.rotations, bone, times, rotations);
+  moving.rootMotion = nullptr;
+  return moving;
+}
+
+void benchmark_root_motion(const Skeleton &skeleton, const AnimationClip &clip)
+{
+  // bone 0 is either the bone itself or one of its fixed ancestors, so the walk shows up on the bone's motion
+  AnimationClip original = make_moving_clip(clip, skeleton, 0);
+  AnimationClip extracted = original;
+  extract_root_motion(extracted, skeleton);
+  if (!extracted.rootMotion)
+    return;
+  const RootMotionTrack &track = *extracted.rootMotion;
+
+  // the remaining pose carried by the track has to give back the original bone
+  Transforms before, after;
+  before.resize(skeleton.num_bones());
+  after.resize(skeleton.num_bones());
+  float poseError = 0.f;
+  for (float time = 0.f; time <= clip.duration; time += clip.duration / 37.f)
+  {
+    sample_clip(original, time, before);
+    sample_clip(extracted, time, after);
+    const mat4 restored = root_motion_transform(integrate_root_motion(track, 0.f, time, false)) *
+                          bone_model_transform(skeleton, after, track.bone);
+    const mat4 expected = bone_model_transform(skeleton, before, track.bone);
+    for (int c = 0; c < 4; c++)
+      poseError = max(poseError, length(restored[c] - expected[c]));
+  }
+
+  // chaining frames across loop boundaries has to match one integration over the whole span
+  const float duration = clip.duration;
+  const RootMotionDelta whole = integrate_root_motion(track, 0.3f * duration, 3.6f * duration);
+  RootMotionDelta chained;
+  for (float time = 0.3f * duration; time < 3.6f * duration - 1e-4f; time += duration / 7.f)
+    chained = combine_root_motion(chained, integrate_root_motion(track, time, min(time + duration / 7.f, 3.6f * duration)));
+  const float chainError = length(whole.translation - chained.translation) + fabsf(whole.yaw - chained.yaw);
+
+  std::mt19937 random(7);
+  std::uniform_real_distribution<float> times(0.f, 3.f * duration);
+  std::vector<float> from(1024), to(1024);
+  for (size_t i = 0; i < from.size(); i++)
+    from[i] = times(random), to[i] = from[i] + times(random) * 0.1f;
+  size_t next = 0;
+  const double integrateNs = measure_ns(100000, [&]() {
+    const size_t i = next++ % from.size();
+    do_not_optimize(integrate_root_motion(track, from[i], to[i]));
+  });
+  ClipCursor cursor;
+  float time = 0.f;
+  const double poseNs = measure_ns(20000, [&]() {
+    time = fmodf(time + 1.f / 60.f, duration);
+    sample_clip(original, time, cursor, before);
+    do_not_optimize(bone_model_transform(skeleton, before, track.bone));
+  });
+
+  debug_log("root motion of %s (bone %s): %d samples, %d B against %d B of clip, %.2f m and %.0f deg per loop",
+    clip.name.c_str(), skeleton.names[track.bone].c_str(), (int)track.samples.size(), (int)track.size_bytes(),
+    (int)extracted.size_bytes(), length(vec3(track.samples.back())), track.samples.back().w * RadToDeg);
+  debug_log("  integrate %.0f ns against %.0f ns sampling the pose to read the bone, restored bone error %g, "
+            "chained over 3 loops error %g",
+    integrateNs, poseNs, poseError, chainError);
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include <3dmath.h>
+
+struct Skeleton;
+struct AnimationClip;
+
+enum RootMotionAxes : uint32_t
+{
+  RootMotionX = 1,
+  RootMotionY = 2,
+  RootMotionZ = 4,
+  RootMotionYaw = 8, // rotation around the model space up axis
+  RootMotionGround = RootMotionX | RootMotionZ | RootMotionYaw
+};
+
+struct RootMotionOptions
+{
+  const char *bone = nullptr; // null picks the first of the root chain whose translation is keyed
+  uint32_t axes = RootMotionGround;
+  bool removeFromClip = true; // the bone keeps still on the extracted axes, the motion only lives in the track
+  float sampleRate = 30.f;
+};
+
+// Motion of the character frame in skeleton model space, relative to the start of the clip: a translation and
+// a yaw, sampled at a fixed rate so no times are stored.
+struct RootMotionTrack
+{
+  int bone = 0;
+  uint32_t axes = 0;
+  float duration = 0.f;
+  float sampleRate = 30.f;
+  std::vector<vec4> samples; // xyz translation, w yaw in radians, unwrapped so it interpolates across +-pi
+
+  size_t size_bytes() const { return sizeof(RootMotionTrack) + samples.size() * sizeof(vec4); }
+};
+
+using RootMotionTrackPtr = std::shared_ptr<const RootMotionTrack>;
+
+// Motion between two times, in the frame the character had at the first one. Applied on the right of that frame.
+struct RootMotionDelta
+{
+  vec3 translation = vec3(0.f);
+  float yaw = 0.f;
+};
+
+// Extracts the motion of the bone into clip.rootMotion and, with removeFromClip, takes it out of the bone's keys.
+// The remaining pose times the track gives back the original model space transform of the bone at every key.
+void extract_root_motion(AnimationClip &clip, const Skeleton &skeleton, const RootMotionOptions &options = {});
+
+// Sums the motion from time from to time to, which may lie any number of loops apart, and run backwards.
+// Without loop the times are clamped to the clip. Only the track is read.
+RootMotionDelta integrate_root_motion(const RootMotionTrack &track, float from, float to, bool loop = true);
+
+RootMotionDelta blend_root_motion(const RootMotionDelta &a, const RootMotionDelta &b, float weight);
+// a then b, b given in the frame a ends in
+RootMotionDelta combine_root_motion(const RootMotionDelta &a, const RootMotionDelta &b);
+mat4 root_motion_transform(const RootMotionDelta &delta);
+
+// Logs the track size against the clip, ns per integration against sampling the pose to read the bone, and
+// the error of chained integrations over loop boundaries.
+void benchmark_root_motion(const Skeleton &skeleton, const AnimationClip &clip);
@@ -0,0 +1,111 @@
+#include "skeleton.h"
+#include <cassert>
+#include <render/model.h>
+#include <benchmark.h>
+#include <log.h>
+
+void Transforms::resize(size_t count)
+{
+  translations.resize(count, vec3(0.f));
+  rotations.resize(count, quat(1.f, 0.f, 0.f, 0.f));
+  scales.resize(count, vec3(1.f));
+}
+
+int Skeleton::find_bone(const std::string &name) const
+{
+  auto it = boneIndex.find(name);
+  return it != boneIndex.end() ? it->second : -1;
+}
+
+void decompose_transform(const mat4 &transform, vec3 &translation, quat &rotation, vec3 &scale)
+{
+  translation = vec3(transform[3]);
+  scale = vec3(length(vec3(transform[0])), length(vec3(transform[1])), length(vec3(transform[2])));
+  mat3 rotationMatrix(vec3(transform[0]) / scale.x, vec3(transform[1]) / scale.y, vec3(transform[2]) / scale.z);
+  rotation = normalize(quat_cast(rotationMatrix));
+}
+
+mat4 compose_transform(vec3 translation, quat rotation, vec3 scale)
+{
+  // translate * rotate * scale without the matrix products
+  mat3 r = mat3_cast(rotation);
+  return mat4(vec4(r[0] * scale.x, 0.f), vec4(r[1] * scale.y, 0.f), vec4(r[2] * scale.z, 0.f), vec4(translation, 1.f));
+}
+
+Skeleton build_skeleton(const std::vector<ModelNode> &nodes)
+{
+  Skeleton skeleton;
+  const int numBones = nodes.size();
+  skeleton.names.reserve(numBones);
+  skeleton.parents.reserve(numBones);
+  skeleton.bindPose.resize(numBones);
+  for (int i = 0; i < numBones; i++)
+  {
+    const ModelNode &node = nodes[i];
+    assert(node.parent < i);
+    skeleton.names.push_back(node.name);
+    skeleton.boneIndex.emplace(node.name, i);
+    skeleton.parents.push_back(node.parent);
+    decompose_transform(node.transform, skeleton.bindPose.translations[i], skeleton.bindPose.rotations[i],
+      skeleton.bindPose.scales[i]);
+  }
+
+  skeleton.subtreeEnd.resize(numBones);
+  for (int i = 0; i < numBones; i++)
+    skeleton.subtreeEnd[i] = i + 1;
+  for (int i = numBones - 1; i > 0; i--)
+    if (skeleton.parents[i] >= 0)
+      skeleton.subtreeEnd[skeleton.parents[i]] = max(skeleton.subtreeEnd[skeleton.parents[i]], skeleton.subtreeEnd[i]);
+  return skeleton;
+}
+
+void local_to_model(const Skeleton &skeleton, const Transforms &local, mat4 *model_space)
+{
+  static const mat4 identity(1.f);
+  const int numBones = skeleton.num_bones();
+  const int *parents = skeleton.parents.data();
+  for (int i = 0; i < numBones; i++)
+  {
+    // a select between two addresses, not a branch over different code
+    const mat4 &parent = parents[i] >= 0 ? model_space[parents[i]] : identity;
+    model_space[i] = parent * compose_transform(local.translations[i], local.rotations[i], local.scales[i]);
+  }
+}
+
+static void recursive_local_to_model(const std::vector<std::vector<int>> &children, const Transforms &local, int bone,
+  const mat4 &parent, mat4 *model_space)
+{
+  mat4 transform = glm::translate(parent, local.translations[bone]) * mat4_cast(local.rotations[bone]);
+  model_space[bone] = glm::scale(transform, local.scales[bone]);
+  for (int child : children[bone])
+    recursive_local_to_model(children, local, child, model_space[bone], model_space);
+}
+
+void benchmark_skeleton(const Skeleton &skeleton)
+{
+  const int numBones = skeleton.num_bones();
+  std::vector<mat4> linear(numBones), recursive(numBones);
+  std::vector<std::vector<int>> children(numBones);
+  for (int i = 0; i < numBones; i++)
+    if (skeleton.parents[i] >= 0)
+      children[skeleton.parents[i]].push_back(i);
+
+  const int iterations = 100000;
+  double linearNs = measure_ns(iterations, [&]() {
+    local_to_model(skeleton, skeleton.bindPose, linear.data());
+    do_not_optimize(linear[numBones - 1]);
+  });
+  double recursiveNs = measure_ns(iterations, [&]() {
+    for (int i = 0; i < numBones; i++)
+      if (skeleton.parents[i] < 0)
+        recursive_local_to_model(children, skeleton.bindPose, i, mat4(1.f), recursive.data());
+    do_not_optimize(recursive[numBones - 1]);
+  });
+
+  float maxError = 0.f;
+  for (int i = 0; i < numBones; i++)
+    for (int c = 0; c < 4; c++)
+      maxError = max(maxError, compMax(abs(linear[i][c] - recursive[i][c])));
+  debug_log("skeleton %d bones: local_to_model %.0f ns (%.1f ns/bone), recursive glm walk %.0f ns, max difference %g",
+    numBones, linearNs, linearNs / numBones, recursiveNs, maxError);
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <memory>
+#include <3dmath.h>
+
+struct ModelNode;
+
+// Local bone transforms, one entry per bone in skeleton order.
+struct Transforms
+{
+  std::vector<vec3> translations;
+  std::vector<quat> rotations;
+  std::vector<vec3> scales;
+
+  void resize(size_t count);
+  size_t size() const { return translations.size(); }
+};
+
+// Bones are in depth first order: a parent always precedes its children
+// and the subtree of bone i is the contiguous range [i, subtreeEnd[i]).
+struct Skeleton
+{
+  std::vector<std::string> names;
+  std::unordered_map<std::string, int> boneIndex;
+  std::vector<int> parents; // -1 for roots
+  std::vector<int> subtreeEnd;
+  Transforms bindPose;
+
+  int num_bones() const { return parents.size(); }
+  int find_bone(const std::string &name) const;
+};
+
+using SkeletonPtr = std::shared_ptr<Skeleton>;
+
+// nodes come from import_model and are already in depth first order
+Skeleton build_skeleton(const std::vector<ModelNode> &nodes);
+
+void decompose_transform(const mat4 &transform, vec3 &translation, quat &rotation, vec3 &scale);
+mat4 compose_transform(vec3 translation, quat rotation, vec3 scale);
+
+// One linear pass over the bones, every parent is already in model space when its children are reached.
+void local_to_model(const Skeleton &skeleton, const Transforms &local, mat4 *model_space);
+
+// Logs ns per skeleton of local_to_model against a recursive walk chaining glm::translate/rotate/scale.
+void benchmark_skeleton(const Skeleton &skeleton);
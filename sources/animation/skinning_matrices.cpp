@@ -0,0 +1,363 @@
+#include "skinning_matrices.h"
+#include "skeleton.h"
+#include "soa_pose.h"
+#include "animation_clip.h"
+#include <render/model.h>
+#include <benchmark.h>
+#include <log.h>
+
+Affine3x4 to_affine(const mat4 &m)
+{
+  Affine3x4 a;
+  for (int r = 0; r < 3; r++)
+    for (int c = 0; c < 4; c++)
+      a.rows[r][c] = m[c][r];
+  return a;
+}
+
+mat4 to_mat4(const Affine3x4 &a)
+{
+  mat4 m(1.f);
+  for (int r = 0; r < 3; r++)
+    for (int c = 0; c < 4; c++)
+      m[c][r] = a.rows[r][c];
+  return m;
+}
+
+std::vector<Affine3x4> skeleton_inverse_bind(const Skeleton &skeleton, const MeshSkin *skin)
+{
+  const int numBones = skeleton.num_bones();
+  std::vector<mat4> bindModel(numBones);
+  local_to_model(skeleton, skeleton.bindPose, bindModel.data());
+  std::vector<Affine3x4> inverseBind(numBones);
+  for (int i = 0; i < numBones; i++)
+    inverseBind[i] = to_affine(inverse(bindModel[i]));
+  if (skin)
+  {
+    for (size_t j = 0; j < skin->boneNames.size(); j++)
+    {
+      const int bone = skeleton.find_bone(skin->boneNames[j]);
+      if (bone >= 0)
+        inverseBind[bone] = to_affine(skin->bindPoseInv[j]);
+      else
+        debug_error("skin bone %s is not in the skeleton", skin->boneNames[j].c_str());
+    }
+  }
+  return inverseBind;
+}
+
+// Lane kernels: every float of a 3x4 matrix in its own register, one bone or character per lane.
+
+template<typename L>
+static inline void compose_affine(const typename L::V (&p)[PoseRowCount], typename L::V (&m)[12])
+{
+  using V = typename L::V;
+  const V two = L::set1(2.f), one = L::set1(1.f);
+  const V x = p[PoseQX], y = p[PoseQY], z = p[PoseQZ], w = p[PoseQW];
+  const V x2 = L::mul(x, two), y2 = L::mul(y, two), z2 = L::mul(z, two);
+  const V xx = L::mul(x, x2), yy = L::mul(y, y2), zz = L::mul(z, z2);
+  const V xy = L::mul(x, y2), xz = L::mul(x, z2), yz = L::mul(y, z2);
+  const V wx = L::mul(w, x2), wy = L::mul(w, y2), wz = L::mul(w, z2);
+  const V sx = p[PoseSX], sy = p[PoseSY], sz = p[PoseSZ];
+  // translate * rotate * scale: the rotation columns scaled, the translation as the last column
+  m[0] = L::mul(L::sub(one, L::add(yy, zz)), sx);
+  m[1] = L::mul(L::sub(xy, wz), sy);
+  m[2] = L::mul(L::add(xz, wy), sz);
+  m[3] = p[PoseTX];
+  m[4] = L::mul(L::add(xy, wz), sx);
+  m[5] = L::mul(L::sub(one, L::add(xx, zz)), sy);
+  m[6] = L::mul(L::sub(yz, wx), sz);
+  m[7] = p[PoseTY];
+  m[8] = L::mul(L::sub(xz, wy), sx);
+  m[9] = L::mul(L::add(yz, wx), sy);
+  m[10] = L::mul(L::sub(one, L::add(xx, yy)), sz);
+  m[11] = p[PoseTZ];
+}
+
+template<typename L>
+static inline void multiply_affine(const typename L::V (&a)[12], const typename L::V (&b)[12], typename L::V (&out)[12])
+{
+  for (int r = 0; r < 3; r++)
+  {
+    const typename L::V a0 = a[r * 4], a1 = a[r * 4 + 1], a2 = a[r * 4 + 2];
+    for (int c = 0; c < 4; c++)
+      out[r * 4 + c] = L::add(L::add(L::mul(a0, b[c]), L::mul(a1, b[4 + c])), L::mul(a2, b[8 + c]));
+    out[r * 4 + 3] = L::add(out[r * 4 + 3], a[r * 4 + 3]);
+  }
+}
+
+// Single matrix products for the dependent chain of one character.
+
+static inline void multiply_affine_scalar(const Affine3x4 &a, const Affine3x4 &b, Affine3x4 &out)
+{
+  for (int r = 0; r < 3; r++)
+  {
+    for (int c = 0; c < 4; c++)
+      out.rows[r][c] = a.rows[r][0] * b.rows[0][c] + a.rows[r][1] * b.rows[1][c] + a.rows[r][2] * b.rows[2][c];
+    out.rows[r][3] += a.rows[r][3];
+  }
+}
+
+#if SIMD_SSE
+static inline void multiply_affine_sse(const Affine3x4 &a, const Affine3x4 &b, Affine3x4 &out)
+{
+  const __m128 b0 = _mm_load_ps(b.rows[0]), b1 = _mm_load_ps(b.rows[1]), b2 = _mm_load_ps(b.rows[2]);
+  const __m128 translationMask = _mm_set_ps(1.f, 0.f, 0.f, 0.f);
+  for (int r = 0; r < 3; r++)
+  {
+    const __m128 row = _mm_load_ps(a.rows[r]);
+    __m128 result = _mm_mul_ps(_mm_shuffle_ps(row, row, _MM_SHUFFLE(0, 0, 0, 0)), b0);
+    result = _mm_add_ps(result, _mm_mul_ps(_mm_shuffle_ps(row, row, _MM_SHUFFLE(1, 1, 1, 1)), b1));
+    result = _mm_add_ps(result, _mm_mul_ps(_mm_shuffle_ps(row, row, _MM_SHUFFLE(2, 2, 2, 2)), b2));
+    result = _mm_add_ps(result, _mm_mul_ps(row, translationMask));
+    _mm_store_ps(out.rows[r], result);
+  }
+}
+#endif
+
+template<typename Multiply>
+static void chain_affine(const Skeleton &skeleton, const Affine3x4 *locals, const Affine3x4 *inverse_bind,
+  Affine3x4 *model, Affine3x4 *skinning, Multiply multiply)
+{
+  const int numBones = skeleton.num_bones();
+  const int *parents = skeleton.parents.data();
+  for (int i = 0; i < numBones; i++)
+  {
+    if (parents[i] >= 0)
+      multiply(model[parents[i]], locals[i], model[i]);
+    else
+      model[i] = locals[i];
+    if (skinning)
+      multiply(model[i], inverse_bind[i], skinning[i]);
+  }
+}
+
+void local_to_model_affine(const Skeleton &skeleton, const SoaPose &local, const Affine3x4 *inverse_bind,
+  Affine3x4 *model, Affine3x4 *skinning, SimdWidth width)
+{
+  // the local matrices don't depend on each other, only the chain below is serial
+  thread_local std::vector<Affine3x4> locals;
+  locals.resize(local.num_blocks() * PoseBlockWidth);
+  simd_dispatch(width, [&](auto lanes) {
+    using L = decltype(lanes);
+    alignas(32) float columns[12][PoseBlockWidth];
+    for (int block = 0; block < local.num_blocks(); block++)
+    {
+      const PoseBlock &pose = local.blocks[block];
+      for (int lane = 0; lane < PoseBlockWidth; lane += L::Width)
+      {
+        typename L::V p[PoseRowCount], m[12];
+        for (int row = 0; row < PoseRowCount; row++)
+          p[row] = L::load(pose.rows[row] + lane);
+        compose_affine<L>(p, m);
+        for (int e = 0; e < 12; e++)
+          L::store(columns[e] + lane, m[e]);
+      }
+      for (int lane = 0; lane < PoseBlockWidth; lane++)
+      {
+        Affine3x4 &dst = locals[block * PoseBlockWidth + lane];
+        for (int e = 0; e < 12; e++)
+          dst.rows[e / 4][e % 4] = columns[e][lane];
+      }
+    }
+  });
+
+#if SIMD_SSE
+  if (width != SimdWidth::Scalar)
+  {
+    chain_affine(skeleton, locals.data(), inverse_bind, model, skinning, multiply_affine_sse);
+    return;
+  }
+#endif
+  chain_affine(skeleton, locals.data(), inverse_bind, model, skinning, multiply_affine_scalar);
+}
+
+// Model space matrices of up to 8 characters for one bone, lane j is character j of the group.
+struct alignas(32) AffineLanes
+{
+  float m[12][8];
+};
+
+// Writes lane j of m as the matrix of character j, transposing 4x4 tiles instead of storing float by float.
+static inline void scatter_affine(ScalarLanes, const float (&m)[12], Affine3x4 *const *skinning, int bone)
+{
+  for (int e = 0; e < 12; e++)
+    skinning[0][bone].rows[e / 4][e % 4] = m[e];
+}
+
+#if SIMD_SSE
+static inline void store_rows_transposed(__m128 x, __m128 y, __m128 z, __m128 w, Affine3x4 *const *skinning, int bone, int row)
+{
+  _MM_TRANSPOSE4_PS(x, y, z, w);
+  _mm_store_ps(skinning[0][bone].rows[row], x);
+  _mm_store_ps(skinning[1][bone].rows[row], y);
+  _mm_store_ps(skinning[2][bone].rows[row], z);
+  _mm_store_ps(skinning[3][bone].rows[row], w);
+}
+
+static inline void scatter_affine(SseLanes, const __m128 (&m)[12], Affine3x4 *const *skinning, int bone)
+{
+  for (int r = 0; r < 3; r++)
+    store_rows_transposed(m[r * 4], m[r * 4 + 1], m[r * 4 + 2], m[r * 4 + 3], skinning, bone, r);
+}
+#endif
+
+#if SIMD_AVX2
+static inline void scatter_affine(Avx2Lanes, const __m256 (&m)[12], Affine3x4 *const *skinning, int bone)
+{
+  for (int r = 0; r < 3; r++)
+  {
+    const __m256 *row = m + r * 4;
+    store_rows_transposed(_mm256_castps256_ps128(row[0]), _mm256_castps256_ps128(row[1]), _mm256_castps256_ps128(row[2]),
+      _mm256_castps256_ps128(row[3]), skinning, bone, r);
+    store_rows_transposed(_mm256_extractf128_ps(row[0], 1), _mm256_extractf128_ps(row[1], 1),
+      _mm256_extractf128_ps(row[2], 1), _mm256_extractf128_ps(row[3], 1), skinning + 4, bone, r);
+  }
+}
+#endif
+
+template<typename L>
+static void interleaved_group(const Skeleton &skeleton, const SoaPose *const *locals, const Affine3x4 *inverse_bind,
+  Affine3x4 *const *skinning, std::vector<AffineLanes> &models)
+{
+  using V = typename L::V;
+  constexpr int W = L::Width;
+  alignas(32) float gathered[PoseRowCount][8];
+  const int numBones = skeleton.num_bones();
+  for (int i = 0; i < numBones; i++)
+  {
+    const int block = i / PoseBlockWidth, boneLane = i % PoseBlockWidth;
+    for (int j = 0; j < W; j++)
+      for (int row = 0; row < PoseRowCount; row++)
+        gathered[row][j] = locals[j]->blocks[block].rows[row][boneLane];
+
+    V p[PoseRowCount], local[12], model[12], inverseBind[12], skin[12];
+    for (int row = 0; row < PoseRowCount; row++)
+      p[row] = L::load(gathered[row]);
+    compose_affine<L>(p, local);
+
+    const int parent = skeleton.parents[i];
+    if (parent >= 0)
+    {
+      V parentModel[12];
+      for (int e = 0; e < 12; e++)
+        parentModel[e] = L::load(models[parent].m[e]);
+      multiply_affine<L>(parentModel, local, model);
+    }
+    else
+      std::copy(local, local + 12, model);
+    for (int e = 0; e < 12; e++)
+    {
+      L::store(models[i].m[e], model[e]);
+      inverseBind[e] = L::set1(inverse_bind[i].rows[e / 4][e % 4]);
+    }
+
+    multiply_affine<L>(model, inverseBind, skin);
+    scatter_affine(L(), skin, skinning, i);
+  }
+}
+
+void local_to_model_affine_interleaved(const Skeleton &skeleton, const SoaPose *const *locals, int count,
+  const Affine3x4 *inverse_bind, Affine3x4 *const *skinning, SimdWidth width)
+{
+  thread_local std::vector<AffineLanes> models;
+  models.resize(skeleton.num_bones());
+  int first = 0;
+  simd_dispatch(width, [&](auto lanes) {
+    using L = decltype(lanes);
+    for (; first + L::Width <= count; first += L::Width)
+      interleaved_group<L>(skeleton, locals + first, inverse_bind, skinning + first, models);
+  });
+  // the characters that don't fill a group
+  for (; first < count; first++)
+    interleaved_group<ScalarLanes>(skeleton, locals + first, inverse_bind, skinning + first, models);
+}
+
+static float max_difference(const Affine3x4 &a, const Affine3x4 &b)
+{
+  float difference = 0.f;
+  for (int r = 0; r < 3; r++)
+    for (int c = 0; c < 4; c++)
+      difference = max(difference, fabsf(a.rows[r][c] - b.rows[r][c]));
+  return difference;
+}
+
+void benchmark_skinning_matrices(const Skeleton &skeleton, const AnimationClip &clip)
+{
+  const int numBones = skeleton.num_bones();
+  const int numCharacters = 64;
+  std::vector<Transforms> poses(numCharacters);
+  std::vector<SoaPose> soaPoses(numCharacters);
+  std::vector<const SoaPose *> locals(numCharacters);
+  for (int c = 0; c < numCharacters; c++)
+  {
+    poses[c].resize(numBones);
+    sample_clip(clip, clip.duration * c / numCharacters, poses[c]);
+    to_soa(poses[c], soaPoses[c]);
+    locals[c] = &soaPoses[c];
+  }
+  const std::vector<Affine3x4> inverseBind = skeleton_inverse_bind(skeleton, nullptr);
+  std::vector<mat4> inverseBindMat4(numBones);
+  for (int i = 0; i < numBones; i++)
+    inverseBindMat4[i] = to_mat4(inverseBind[i]);
+
+  std::vector<mat4> glmModel(numBones);
+  std::vector<std::vector<mat4>> glmSkinning(numCharacters, std::vector<mat4>(numBones));
+  auto glm_chain = [&](int c) {
+    const Transforms &pose = poses[c];
+    for (int i = 0; i < numBones; i++)
+    {
+      mat4 local = glm::translate(mat4(1.f), pose.translations[i]) * mat4_cast(pose.rotations[i]) *
+                   glm::scale(mat4(1.f), pose.scales[i]);
+      glmModel[i] = skeleton.parents[i] >= 0 ? glmModel[skeleton.parents[i]] * local : local;
+      glmSkinning[c][i] = glmModel[i] * inverseBindMat4[i];
+    }
+  };
+
+  const int iterations = 200;
+  const double glmNs = measure_ns(iterations, [&]() {
+    for (int c = 0; c < numCharacters; c++)
+      glm_chain(c);
+    do_not_optimize(glmSkinning[numCharacters - 1][numBones - 1]);
+  }) / numCharacters;
+  debug_log("skinning matrices, %d characters of %d bones: glm::mat4 chain %.0f ns/character (%.1f M bones/s)",
+    numCharacters, numBones, glmNs, numBones * 1e3 / glmNs);
+
+  std::vector<Affine3x4> model(numBones);
+  std::vector<std::vector<Affine3x4>> skinning(numCharacters, std::vector<Affine3x4>(numBones));
+  std::vector<Affine3x4 *> skinningPtrs(numCharacters);
+  for (int c = 0; c < numCharacters; c++)
+    skinningPtrs[c] = skinning[c].data();
+  auto difference_to_glm = [&]() {
+    float difference = 0.f;
+    for (int c = 0; c < numCharacters; c++)
+      for (int i = 0; i < numBones; i++)
+        difference = max(difference, max_difference(skinning[c][i], to_affine(glmSkinning[c][i])));
+    return difference;
+  };
+
+  for (SimdWidth width : {SimdWidth::Scalar, SimdWidth::Sse, SimdWidth::Avx2})
+  {
+    if (width > BestSimdWidth)
+      break;
+    const double singleNs = measure_ns(iterations, [&]() {
+      for (int c = 0; c < numCharacters; c++)
+        local_to_model_affine(skeleton, soaPoses[c], inverseBind.data(), model.data(), skinning[c].data(), width);
+      do_not_optimize(skinning[numCharacters - 1][numBones - 1]);
+    }) / numCharacters;
+    const float singleDifference = difference_to_glm();
+    const double interleavedNs = measure_ns(iterations, [&]() {
+      local_to_model_affine_interleaved(skeleton, locals.data(), numCharacters, inverseBind.data(), skinningPtrs.data(), width);
+      do_not_optimize(skinning[numCharacters - 1][numBones - 1]);
+    }) / numCharacters;
+    const float interleavedDifference = difference_to_glm();
+
+    simd_dispatch(width, [&](auto lanes) {
+      using L = decltype(lanes);
+      debug_log("  %-6s 3x4 per character %.0f ns (%.1fx glm), interleaved by %d %.0f ns (%.1fx glm), "
+                "max difference to glm %g / %g",
+        L::name, singleNs, glmNs / singleNs, L::Width, interleavedNs, glmNs / interleavedNs, singleDifference,
+        interleavedDifference);
+    });
+  }
+}
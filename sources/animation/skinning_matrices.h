@@ -0,0 +1,36 @@
+#pragma once
+#include <vector>
+#include <simd.h>
+#include <3dmath.h>
+
+struct Skeleton;
+struct SoaPose;
+struct MeshSkin;
+struct AnimationClip;
+
+// Upper three rows of a column vector transform, the fourth row is always (0, 0, 0, 1).
+// Rows are vec4 aligned, the same layout a mat3x4 palette entry has on the gpu.
+struct alignas(16) Affine3x4
+{
+  float rows[3][4];
+};
+
+Affine3x4 to_affine(const mat4 &m);
+mat4 to_mat4(const Affine3x4 &a);
+
+// One inverse bind matrix per skeleton bone. Bones the skin doesn't list, or all of them without a skin,
+// use the inverse of the skeleton's own bind pose, so their skinning matrix is identity at rest.
+std::vector<Affine3x4> skeleton_inverse_bind(const Skeleton &skeleton, const MeshSkin *skin);
+
+// Builds every local affine straight from translation/rotation/scale, 8 or 4 bones per instruction,
+// then chains them down the skeleton. skinning[i] = model[i] * inverse_bind[i], skinning may be null.
+void local_to_model_affine(const Skeleton &skeleton, const SoaPose &local, const Affine3x4 *inverse_bind,
+  Affine3x4 *model, Affine3x4 *skinning, SimdWidth width = BestSimdWidth);
+
+// The same pass for a crowd sharing one skeleton, one character per lane so the whole chain is vectorized.
+// skinning[c] receives the palette of locals[c].
+void local_to_model_affine_interleaved(const Skeleton &skeleton, const SoaPose *const *locals, int count,
+  const Affine3x4 *inverse_bind, Affine3x4 *const *skinning, SimdWidth width = BestSimdWidth);
+
+// Logs ns per character of both passes at every width against glm::mat4 chaining.
+void benchmark_skinning_matrices(const Skeleton &skeleton, const AnimationClip &clip);
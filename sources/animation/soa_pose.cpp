@@ -0,0 +1,444 @@
+#include "soa_pose.h"
+#include "skeleton.h"
+#include "animation_clip.h"
+#include "keyframes.h"
+#include <benchmark.h>
+#include <log.h>
+
+void SoaPose::resize(int num_bones)
+{
+  numBones = num_bones;
+  blocks.resize((num_bones + PoseBlockWidth - 1) / PoseBlockWidth);
+  for (PoseBlock &block : blocks)
+    for (int lane = 0; lane < PoseBlockWidth; lane++)
+      for (int row = 0; row < PoseRowCount; row++)
+        block.rows[row][lane] = row == PoseQW || row >= PoseSX ? 1.f : 0.f;
+}
+
+static void store_bone(SoaPose &soa, int bone, const vec3 &t, const quat &q, const vec3 &s)
+{
+  PoseBlock &block = soa.blocks[bone / PoseBlockWidth];
+  const int lane = bone % PoseBlockWidth;
+  block.rows[PoseTX][lane] = t.x;
+  block.rows[PoseTY][lane] = t.y;
+  block.rows[PoseTZ][lane] = t.z;
+  block.rows[PoseQX][lane] = q.x;
+  block.rows[PoseQY][lane] = q.y;
+  block.rows[PoseQZ][lane] = q.z;
+  block.rows[PoseQW][lane] = q.w;
+  block.rows[PoseSX][lane] = s.x;
+  block.rows[PoseSY][lane] = s.y;
+  block.rows[PoseSZ][lane] = s.z;
+}
+
+void to_soa(const Transforms &pose, SoaPose &soa)
+{
+  const int numBones = pose.size();
+  if (soa.numBones != numBones)
+    soa.resize(numBones);
+  for (int i = 0; i < numBones; i++)
+    store_bone(soa, i, pose.translations[i], pose.rotations[i], pose.scales[i]);
+}
+
+void from_soa(const SoaPose &soa, Transforms &pose)
+{
+  pose.resize(soa.numBones);
+  for (int i = 0; i < soa.numBones; i++)
+  {
+    const PoseBlock &block = soa.blocks[i / PoseBlockWidth];
+    const int lane = i % PoseBlockWidth;
+    pose.translations[i] = vec3(block.rows[PoseTX][lane], block.rows[PoseTY][lane], block.rows[PoseTZ][lane]);
+    pose.rotations[i] = quat(block.rows[PoseQW][lane], block.rows[PoseQX][lane], block.rows[PoseQY][lane], block.rows[PoseQZ][lane]);
+    pose.scales[i] = vec3(block.rows[PoseSX][lane], block.rows[PoseSY][lane], block.rows[PoseSZ][lane]);
+  }
+}
+
+template<typename T>
+static void gather_channel(const KeyChannel<T> &channel, float time, uint32_t *cursor, int bone, T &from, T &to, float &alpha)
+{
+  const auto [first, count] = channel.tracks[bone];
+  if (count == 1)
+  {
+    from = to = channel.values[first];
+    alpha = 0.f;
+    return;
+  }
+  const float *times = channel.times.data() + first;
+  const uint32_t k = advance_key(times, count, time, cursor[bone]);
+  cursor[bone] = k;
+  from = channel.values[first + k];
+  to = channel.values[first + k + 1];
+  alpha = clamp((time - times[k]) / (times[k + 1] - times[k]), 0.f, 1.f);
+}
+
+static void prepare_keyframes(int num_bones, ClipCursor &cursor, SoaKeyframes &keys)
+{
+  if (cursor.rotationKeys.size() != size_t(num_bones))
+    cursor.reset(num_bones);
+  if (keys.from.numBones != num_bones)
+  {
+    keys.from.resize(num_bones);
+    keys.to.resize(num_bones);
+    keys.alpha.assign(keys.from.num_blocks(), AlphaBlock{});
+  }
+}
+
+static void gather_bone(const AnimationClip &clip, float time, ClipCursor &cursor, int bone, SoaKeyframes &keys)
+{
+  vec3 t0, t1, s0, s1;
+  quat q0, q1;
+  AlphaBlock &alpha = keys.alpha[bone / PoseBlockWidth];
+  const int lane = bone % PoseBlockWidth;
+  gather_channel(clip.translations, time, cursor.translationKeys.data(), bone, t0, t1, alpha.translation[lane]);
+  gather_channel(clip.rotations, time, cursor.rotationKeys.data(), bone, q0, q1, alpha.rotation[lane]);
+  gather_channel(clip.scales, time, cursor.scaleKeys.data(), bone, s0, s1, alpha.scale[lane]);
+  store_bone(keys.from, bone, t0, q0, s0);
+  store_bone(keys.to, bone, t1, q1, s1);
+}
+
+void gather_keyframes(const AnimationClip &clip, float time, ClipCursor &cursor, SoaKeyframes &keys)
+{
+  const int numBones = clip.num_bones();
+  prepare_keyframes(numBones, cursor, keys);
+  for (int i = 0; i < numBones; i++)
+    gather_bone(clip, time, cursor, i, keys);
+}
+
+// Kernels, one lane group of one block per call, instantiated for every width in simd.h.
+
+template<typename L>
+static inline void lerp_rows(const PoseBlock &a, const PoseBlock &b, int first_row, int last_row, typename L::V t,
+  PoseBlock &out, int lane)
+{
+  for (int row = first_row; row < last_row; row++)
+  {
+    const typename L::V va = L::load(a.rows[row] + lane), vb = L::load(b.rows[row] + lane);
+    L::store(out.rows[row] + lane, L::add(va, L::mul(L::sub(vb, va), t)));
+  }
+}
+
+template<typename L>
+static inline typename L::V rotation_dot(const PoseBlock &a, const PoseBlock &b, int lane)
+{
+  typename L::V d = L::mul(L::load(a.rows[PoseQX] + lane), L::load(b.rows[PoseQX] + lane));
+  for (int row = PoseQY; row <= PoseQW; row++)
+    d = L::add(d, L::mul(L::load(a.rows[row] + lane), L::load(b.rows[row] + lane)));
+  return d;
+}
+
+template<typename L>
+static inline void normalize_rotation(typename L::V (&q)[4], PoseBlock &out, int lane)
+{
+  typename L::V lengthSq = L::mul(q[0], q[0]);
+  for (int c = 1; c < 4; c++)
+    lengthSq = L::add(lengthSq, L::mul(q[c], q[c]));
+  const typename L::V invLength = L::div(L::set1(1.f), L::sqrt(lengthSq));
+  for (int c = 0; c < 4; c++)
+    L::store(out.rows[PoseQX + c] + lane, L::mul(q[c], invLength));
+}
+
+// nlerp with b flipped into a's hemisphere so the blend takes the short way round
+template<typename L>
+static inline void nlerp_rotation(const PoseBlock &a, const PoseBlock &b, typename L::V t, PoseBlock &out, int lane)
+{
+  const typename L::V sign = L::sign(rotation_dot<L>(a, b, lane));
+  typename L::V q[4];
+  for (int c = 0; c < 4; c++)
+  {
+    const typename L::V va = L::load(a.rows[PoseQX + c] + lane);
+    const typename L::V vb = L::mul(L::load(b.rows[PoseQX + c] + lane), sign);
+    q[c] = L::add(va, L::mul(L::sub(vb, va), t));
+  }
+  normalize_rotation<L>(q, out, lane);
+}
+
+template<typename L, typename F>
+static inline void for_each_lane_group(int num_blocks, F &&f)
+{
+  for (int block = 0; block < num_blocks; block++)
+    for (int lane = 0; lane < PoseBlockWidth; lane += L::Width)
+      f(block, lane);
+}
+
+template<typename L>
+static inline void interpolate_block(const SoaKeyframes &keys, int block, SoaPose &out, int lane)
+{
+  const PoseBlock &a = keys.from.blocks[block], &b = keys.to.blocks[block];
+  const AlphaBlock &alpha = keys.alpha[block];
+  PoseBlock &o = out.blocks[block];
+  lerp_rows<L>(a, b, PoseTX, PoseQX, L::load(alpha.translation + lane), o, lane);
+  nlerp_rotation<L>(a, b, L::load(alpha.rotation + lane), o, lane);
+  lerp_rows<L>(a, b, PoseSX, PoseRowCount, L::load(alpha.scale + lane), o, lane);
+}
+
+void interpolate_keyframes(const SoaKeyframes &keys, SoaPose &out, SimdWidth width)
+{
+  if (out.numBones != keys.from.numBones)
+    out.resize(keys.from.numBones);
+  simd_dispatch(width, [&](auto lanes) {
+    using L = decltype(lanes);
+    for_each_lane_group<L>(out.num_blocks(), [&](int block, int lane) { interpolate_block<L>(keys, block, out, lane); });
+  });
+}
+
+void sample_clip(const AnimationClip &clip, float time, ClipCursor &cursor, SoaKeyframes &keys, SoaPose &out, SimdWidth width)
+{
+  gather_keyframes(clip, time, cursor, keys);
+  interpolate_keyframes(keys, out, width);
+}
+
+void blend_poses(const SoaPose &a, const SoaPose &b, float weight, SoaPose &out, SimdWidth width)
+{
+  if (out.numBones != a.numBones)
+    out.resize(a.numBones);
+  simd_dispatch(width, [&](auto lanes) {
+    using L = decltype(lanes);
+    const typename L::V t = L::set1(weight);
+    for_each_lane_group<L>(out.num_blocks(), [&](int block, int lane) {
+      const PoseBlock &pa = a.blocks[block], &pb = b.blocks[block];
+      PoseBlock &o = out.blocks[block];
+      lerp_rows<L>(pa, pb, PoseTX, PoseQX, t, o, lane);
+      nlerp_rotation<L>(pa, pb, t, o, lane);
+      lerp_rows<L>(pa, pb, PoseSX, PoseRowCount, t, o, lane);
+    });
+  });
+}
+
+void fix_shortest_path(const SoaPose &reference, SoaPose &pose, SimdWidth width)
+{
+  simd_dispatch(width, [&](auto lanes) {
+    using L = decltype(lanes);
+    for_each_lane_group<L>(pose.num_blocks(), [&](int block, int lane) {
+      PoseBlock &p = pose.blocks[block];
+      const typename L::V sign = L::sign(rotation_dot<L>(reference.blocks[block], p, lane));
+      for (int row = PoseQX; row <= PoseQW; row++)
+        L::store(p.rows[row] + lane, L::mul(L::load(p.rows[row] + lane), sign));
+    });
+  });
+}
+
+void clear_pose(SoaPose &accumulator)
+{
+  for (PoseBlock &block : accumulator.blocks)
+    for (auto &row : block.rows)
+      for (float &value : row)
+        value = 0.f;
+}
+
+void accumulate_pose(const SoaPose &pose, float weight, SoaPose &accumulator, SimdWidth width)
+{
+  if (accumulator.numBones != pose.numBones)
+  {
+    accumulator.resize(pose.numBones);
+    clear_pose(accumulator);
+  }
+  simd_dispatch(width, [&](auto lanes) {
+    using L = decltype(lanes);
+    const typename L::V w = L::set1(weight);
+    for_each_lane_group<L>(pose.num_blocks(), [&](int block, int lane) {
+      const PoseBlock &p = pose.blocks[block];
+      PoseBlock &acc = accumulator.blocks[block];
+      // an empty accumulator has a zero dot, the sign of +0 keeps the first pose as it is
+      const typename L::V rotationWeight = L::mul(w, L::sign(rotation_dot<L>(acc, p, lane)));
+      for (int row = 0; row < PoseRowCount; row++)
+      {
+        const typename L::V rowWeight = row >= PoseQX && row <= PoseQW ? rotationWeight : w;
+        L::store(acc.rows[row] + lane, L::add(L::load(acc.rows[row] + lane), L::mul(L::load(p.rows[row] + lane), rowWeight)));
+      }
+    });
+  });
+}
+
+void normalize_pose(SoaPose &accumulator, SimdWidth width)
+{
+  simd_dispatch(width, [&](auto lanes) {
+    using L = decltype(lanes);
+    for_each_lane_group<L>(accumulator.num_blocks(), [&](int block, int lane) {
+      PoseBlock &acc = accumulator.blocks[block];
+      typename L::V q[4];
+      for (int c = 0; c < 4; c++)
+        q[c] = L::load(acc.rows[PoseQX + c] + lane);
+      normalize_rotation<L>(q, acc, lane);
+    });
+  });
+}
+
+// pose = pose * delta, delta = nlerp(identity, additive, w) on the identity side of the hemisphere, normalized after
+// the product. Translations add, scales multiply by the delta lerped from 1.
+template<typename L>
+static inline void apply_additive(const PoseBlock &a, typename L::V w, PoseBlock &p, int lane)
+{
+  using V = typename L::V;
+  const V one = L::set1(1.f);
+  for (int row = PoseTX; row <= PoseTZ; row++)
+    L::store(p.rows[row] + lane, L::add(L::load(p.rows[row] + lane), L::mul(L::load(a.rows[row] + lane), w)));
+  for (int row = PoseSX; row <= PoseSZ; row++)
+  {
+    const V scale = L::add(one, L::mul(L::sub(L::load(a.rows[row] + lane), one), w));
+    L::store(p.rows[row] + lane, L::mul(L::load(p.rows[row] + lane), scale));
+  }
+
+  const V sign = L::sign(L::load(a.rows[PoseQW] + lane));
+  const V dx = L::mul(L::mul(L::load(a.rows[PoseQX] + lane), sign), w);
+  const V dy = L::mul(L::mul(L::load(a.rows[PoseQY] + lane), sign), w);
+  const V dz = L::mul(L::mul(L::load(a.rows[PoseQZ] + lane), sign), w);
+  const V dw = L::add(one, L::mul(L::sub(L::mul(L::load(a.rows[PoseQW] + lane), sign), one), w));
+  const V px = L::load(p.rows[PoseQX] + lane), py = L::load(p.rows[PoseQY] + lane);
+  const V pz = L::load(p.rows[PoseQZ] + lane), pw = L::load(p.rows[PoseQW] + lane);
+  V q[4];
+  q[0] = L::add(L::add(L::mul(pw, dx), L::mul(px, dw)), L::sub(L::mul(py, dz), L::mul(pz, dy)));
+  q[1] = L::add(L::sub(L::mul(pw, dy), L::mul(px, dz)), L::add(L::mul(py, dw), L::mul(pz, dx)));
+  q[2] = L::add(L::add(L::mul(pw, dz), L::mul(px, dy)), L::sub(L::mul(pz, dw), L::mul(py, dx)));
+  q[3] = L::sub(L::sub(L::mul(pw, dw), L::mul(px, dx)), L::add(L::mul(py, dy), L::mul(pz, dz)));
+  normalize_rotation<L>(q, p, lane);
+}
+
+void apply_additive_pose(const SoaPose &additive, float weight, SoaPose &pose, SimdWidth width)
+{
+  simd_dispatch(width, [&](auto lanes) {
+    using L = decltype(lanes);
+    const typename L::V w = L::set1(weight);
+    for_each_lane_group<L>(pose.num_blocks(), [&](int block, int lane) {
+      apply_additive<L>(additive.blocks[block], w, pose.blocks[block], lane);
+    });
+  });
+}
+
+// Masked kernels, the same lane groups but only over the blocks of the mask.
+
+template<typename L, typename F>
+static inline void for_each_masked_lane_group(const BoneMask &mask, F &&f)
+{
+  for (size_t i = 0; i < mask.blocks.size(); i++)
+    for (int lane = 0; lane < PoseBlockWidth; lane += L::Width)
+      f(mask.blocks[i], mask.weights[i], lane);
+}
+
+void sample_clip_masked(const AnimationClip &clip, float time, ClipCursor &cursor, SoaKeyframes &keys,
+  const BoneMask &mask, SoaPose &out, SimdWidth width)
+{
+  const int numBones = clip.num_bones();
+  prepare_keyframes(numBones, cursor, keys);
+  if (out.numBones != numBones)
+    out.resize(numBones);
+  for (int block : mask.blocks)
+    for (int i = block * PoseBlockWidth; i < min((block + 1) * PoseBlockWidth, numBones); i++)
+      gather_bone(clip, time, cursor, i, keys);
+  simd_dispatch(width, [&](auto lanes) {
+    using L = decltype(lanes);
+    for_each_masked_lane_group<L>(mask, [&](int block, const MaskBlock &, int lane) {
+      interpolate_block<L>(keys, block, out, lane);
+    });
+  });
+}
+
+void blend_poses_masked(const SoaPose &layer, const BoneMask &mask, float weight, SoaPose &pose, SimdWidth width)
+{
+  simd_dispatch(width, [&](auto lanes) {
+    using L = decltype(lanes);
+    const typename L::V w = L::set1(weight);
+    for_each_masked_lane_group<L>(mask, [&](int block, const MaskBlock &m, int lane) {
+      const typename L::V t = L::mul(L::load(m.weights + lane), w);
+      const PoseBlock &b = layer.blocks[block];
+      PoseBlock &p = pose.blocks[block];
+      lerp_rows<L>(p, b, PoseTX, PoseQX, t, p, lane);
+      nlerp_rotation<L>(p, b, t, p, lane);
+      lerp_rows<L>(p, b, PoseSX, PoseRowCount, t, p, lane);
+    });
+  });
+}
+
+void apply_additive_pose_masked(const SoaPose &additive, const BoneMask &mask, float weight, SoaPose &pose,
+  SimdWidth width)
+{
+  simd_dispatch(width, [&](auto lanes) {
+    using L = decltype(lanes);
+    const typename L::V w = L::set1(weight);
+    for_each_masked_lane_group<L>(mask, [&](int block, const MaskBlock &m, int lane) {
+      apply_additive<L>(additive.blocks[block], L::mul(L::load(m.weights + lane), w), pose.blocks[block], lane);
+    });
+  });
+}
+
+static float max_difference(const SoaPose &a, const SoaPose &b)
+{
+  float difference = 0.f;
+  for (int block = 0; block < a.num_blocks(); block++)
+    for (int row = 0; row < PoseRowCount; row++)
+      for (int lane = 0; lane < PoseBlockWidth; lane++)
+        difference = max(difference, fabsf(a.blocks[block].rows[row][lane] - b.blocks[block].rows[row][lane]));
+  return difference;
+}
+
+void benchmark_pose_kernels(const Skeleton &skeleton, const AnimationClip &clip)
+{
+  const int numBones = skeleton.num_bones();
+  Transforms sampled;
+  sampled.resize(numBones);
+  SoaPose a, b, c;
+  sample_clip(clip, clip.duration * 0.25f, sampled);
+  to_soa(sampled, a);
+  sample_clip(clip, clip.duration * 0.5f, sampled);
+  to_soa(sampled, b);
+  sample_clip(clip, clip.duration * 0.75f, sampled);
+  to_soa(sampled, c);
+
+  ClipCursor cursor;
+  SoaKeyframes keys;
+  const int iterations = 100000;
+  float time = 0.f;
+  const double gatherNs = measure_ns(iterations / 10, [&]() {
+    time += 1.f / 60.f;
+    if (time > clip.duration)
+      time -= clip.duration;
+    gather_keyframes(clip, time, cursor, keys);
+  });
+  debug_log("pose kernels on %d bones (%d blocks of %d), cursor gather %.0f ns/pose", numBones, a.num_blocks(),
+    PoseBlockWidth, gatherNs);
+
+  SoaPose reference[5];
+  for (SimdWidth width : {SimdWidth::Scalar, SimdWidth::Sse, SimdWidth::Avx2})
+  {
+    if (width > BestSimdWidth)
+      break;
+    SoaPose out[5];
+    auto interpolate = [&]() { interpolate_keyframes(keys, out[0], width); };
+    auto blend = [&]() { blend_poses(a, b, 0.3f, out[1], width); };
+    auto fixup = [&]() { fix_shortest_path(a, out[2], width); };
+    auto accumulate = [&]() {
+      clear_pose(out[3]);
+      accumulate_pose(a, 0.5f, out[3], width);
+      accumulate_pose(b, 0.3f, out[3], width);
+      accumulate_pose(c, 0.2f, out[3], width);
+      normalize_pose(out[3], width);
+    };
+    // restarts from a every time so the result stays comparable, the copy is part of the cost
+    auto additive = [&]() {
+      out[4].blocks = a.blocks;
+      apply_additive_pose(b, 0.6f, out[4], width);
+    };
+    out[2] = c;
+    out[4] = a;
+    const double ns[5] = {
+      measure_ns(iterations, [&]() { interpolate(); do_not_optimize(out[0].blocks[0]); }),
+      measure_ns(iterations, [&]() { blend(); do_not_optimize(out[1].blocks[0]); }),
+      measure_ns(iterations, [&]() { fixup(); do_not_optimize(out[2].blocks[0]); }),
+      measure_ns(iterations, [&]() { accumulate(); do_not_optimize(out[3].blocks[0]); }),
+      measure_ns(iterations, [&]() { additive(); do_not_optimize(out[4].blocks[0]); })};
+
+    float difference = 0.f;
+    if (width == SimdWidth::Scalar)
+      std::copy(out, out + 5, reference);
+    else
+      for (int i = 0; i < 5; i++)
+        difference = max(difference, max_difference(out[i], reference[i]));
+
+    simd_dispatch(width, [&](auto lanes) {
+      using L = decltype(lanes);
+      auto rate = [&](double kernelNs) { return numBones * 1e3 / kernelNs; };
+      debug_log("  %-6s (%d lanes): interpolate %.0f, blend %.0f, fixup %.0f, accumulate 3 poses %.0f, additive %.0f M bones/s, "
+                "max difference to scalar %g",
+        L::name, L::Width, rate(ns[0]), rate(ns[1]), rate(ns[2]), rate(ns[3]), rate(ns[4]), difference);
+    });
+  }
+}
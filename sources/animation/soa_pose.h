@@ -0,0 +1,98 @@
+#pragma once
+#include <vector>
+#include <simd.h>
+
+struct Skeleton;
+struct Transforms;
+struct AnimationClip;
+struct ClipCursor;
+
+constexpr int PoseBlockWidth = 8;
+
+enum PoseRow
+{
+  PoseTX, PoseTY, PoseTZ,
+  PoseQX, PoseQY, PoseQZ, PoseQW,
+  PoseSX, PoseSY, PoseSZ,
+  PoseRowCount
+};
+
+// Eight bones side by side, one row per component, so a kernel loads 4 or 8 bones with one instruction.
+struct alignas(32) PoseBlock
+{
+  float rows[PoseRowCount][PoseBlockWidth];
+};
+
+// Local pose in skeleton order, the lanes past numBones hold identity transforms.
+struct SoaPose
+{
+  int numBones = 0;
+  std::vector<PoseBlock> blocks;
+
+  void resize(int num_bones);
+  int num_blocks() const { return blocks.size(); }
+};
+
+void to_soa(const Transforms &pose, SoaPose &soa);
+void from_soa(const SoaPose &soa, Transforms &pose);
+
+// Interpolation factors of every bone, one row per channel like the pose blocks.
+struct alignas(32) AlphaBlock
+{
+  float translation[PoseBlockWidth], rotation[PoseBlockWidth], scale[PoseBlockWidth];
+};
+
+// The two keys around a time for every track, gathered by the cursor and blended by one kernel call.
+struct SoaKeyframes
+{
+  SoaPose from, to;
+  std::vector<AlphaBlock> alpha;
+};
+
+void gather_keyframes(const AnimationClip &clip, float time, ClipCursor &cursor, SoaKeyframes &keys);
+void interpolate_keyframes(const SoaKeyframes &keys, SoaPose &out, SimdWidth width = BestSimdWidth);
+// gather + interpolate, keys is scratch
+void sample_clip(const AnimationClip &clip, float time, ClipCursor &cursor, SoaKeyframes &keys, SoaPose &out,
+  SimdWidth width = BestSimdWidth);
+
+// out = lerp/nlerp(a, b, weight), out may be a or b.
+void blend_poses(const SoaPose &a, const SoaPose &b, float weight, SoaPose &out, SimdWidth width = BestSimdWidth);
+
+// Flips every rotation of pose into the hemisphere of the matching rotation of reference.
+void fix_shortest_path(const SoaPose &reference, SoaPose &pose, SimdWidth width = BestSimdWidth);
+
+// accumulator += weight * pose with rotations aligned to the accumulator first.
+// Start from clear_pose, weights are expected to sum to 1, normalize_pose finishes the rotations.
+void clear_pose(SoaPose &accumulator);
+void accumulate_pose(const SoaPose &pose, float weight, SoaPose &accumulator, SimdWidth width = BestSimdWidth);
+void normalize_pose(SoaPose &accumulator, SimdWidth width = BestSimdWidth);
+
+// pose = pose * (weight * additive): translations add, rotations multiply by the delta nlerped from identity,
+// scales multiply by the delta lerped from 1. additive holds local deltas against some reference pose.
+void apply_additive_pose(const SoaPose &additive, float weight, SoaPose &pose, SimdWidth width = BestSimdWidth);
+
+// Bones a layer acts on with their weights, grouped by pose block. Masked kernels visit only these blocks,
+// the rest of the skeleton isn't read or written.
+struct alignas(32) MaskBlock
+{
+  float weights[PoseBlockWidth]; // 0 for the bones of the block outside the mask
+};
+
+struct BoneMask
+{
+  std::vector<int> blocks; // ascending
+  std::vector<MaskBlock> weights; // one per entry of blocks
+};
+
+// sample_clip over the blocks of mask, the other blocks of out keep what they had.
+void sample_clip_masked(const AnimationClip &clip, float time, ClipCursor &cursor, SoaKeyframes &keys,
+  const BoneMask &mask, SoaPose &out, SimdWidth width = BestSimdWidth);
+// pose = lerp/nlerp(pose, layer, weight * mask) over the blocks of mask.
+void blend_poses_masked(const SoaPose &layer, const BoneMask &mask, float weight, SoaPose &pose,
+  SimdWidth width = BestSimdWidth);
+// apply_additive_pose with weight * mask over the blocks of mask.
+void apply_additive_pose_masked(const SoaPose &additive, const BoneMask &mask, float weight, SoaPose &pose,
+  SimdWidth width = BestSimdWidth);
+
+// Logs M bones/s of every kernel at each compiled width against the scalar reference.
+void benchmark_pose_kernels(const Skeleton &skeleton, const AnimationClip &clip);
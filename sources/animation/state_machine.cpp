@@ -0,0 +1,340 @@
+#include "state_machine.h"
+#include "skeleton.h"
+#include <atomic>
+#include <benchmark.h>
+#include <job_system.h>
+#include <log.h>
+
+int StateMachine::find_state(const char *name) const
+{
+  for (size_t i = 0; i < states.size(); i++)
+    if (states[i].name == name)
+      return i;
+  return -1;
+}
+
+int StateMachine::find_parameter(const char *name) const
+{
+  for (size_t i = 0; i < parameters.size(); i++)
+    if (parameters[i] == name)
+      return i;
+  return -1;
+}
+
+static int parameter_index(StateMachine &machine, const std::string &name)
+{
+  int index = machine.find_parameter(name.c_str());
+  if (index < 0)
+  {
+    index = machine.parameters.size();
+    machine.parameters.push_back(name);
+  }
+  return index;
+}
+
+int add_state(StateMachine &machine, const char *name, BlendTreePtr tree)
+{
+  AnimationState state;
+  state.name = name;
+  state.tree = std::move(tree);
+  for (const std::string &parameter : state.tree->parameters)
+    state.treeParameters.push_back(parameter_index(machine, parameter));
+  machine.states.push_back(std::move(state));
+  return machine.states.size() - 1;
+}
+
+int add_transition(StateMachine &machine, int from, int to, float duration, std::vector<TransitionCondition> conditions,
+  float exit_time, bool interruptible, TransitionBlend blend)
+{
+  machine.transitions.push_back(StateTransition{from, to, duration, exit_time, interruptible, std::move(conditions), blend});
+  machine.inertialized = machine.inertialized || blend == TransitionBlend::Inertialize;
+  return machine.transitions.size() - 1;
+}
+
+TransitionCondition make_condition(StateMachine &machine, const char *parameter, ConditionOp op, float value)
+{
+  return TransitionCondition{parameter_index(machine, parameter), op, value};
+}
+
+StateMachinePtr make_clip_state_machine(const std::vector<AnimationClipPtr> &clips, float fade_duration,
+  TransitionBlend blend)
+{
+  auto machine = std::make_shared<StateMachine>();
+  for (size_t i = 0; i < clips.size(); i++)
+  {
+    const std::string &name = clips[i]->name;
+    add_state(*machine, !name.empty() ? name.c_str() : ("clip " + std::to_string(i)).c_str(), make_clip_tree(clips[i]));
+    add_transition(*machine, AnyState, i, fade_duration, {make_condition(*machine, "state", ConditionOp::Equal, i)}, -1.f,
+      true, blend);
+  }
+  return machine;
+}
+
+void init_state_machine_instance(StateMachineInstance &instance, StateMachinePtr machine)
+{
+  instance.machine = std::move(machine);
+  const StateMachine &states = *instance.machine;
+  instance.parameters.assign(states.parameters.size(), 0.f);
+  instance.states.resize(states.states.size());
+  for (size_t i = 0; i < states.states.size(); i++)
+    init_blend_tree_instance(instance.states[i], states.states[i].tree);
+  instance.current = states.entry;
+  instance.transition = -1;
+  instance.source = -1;
+  instance.fadeTime = 0.f;
+  instance.transitionsTaken = 0;
+  instance.capturePending = false;
+  instance.outputs = 0;
+  instance.rootMotion = {};
+  const int numBones = !states.states.empty() ? states.states[0].tree->num_bones() : 0;
+  instance.frozen.resize(numBones);
+  if (states.inertialized)
+  {
+    instance.previous.resize(numBones);
+    instance.beforePrevious.resize(numBones);
+    instance.inertializer.offset.resize(numBones);
+    instance.inertializer.decay.resize(instance.inertializer.offset.num_blocks());
+  }
+}
+
+void set_state_parameter(StateMachineInstance &instance, const char *name, float value)
+{
+  const int index = instance.machine->find_parameter(name);
+  if (index >= 0)
+    instance.parameters[index] = value;
+  else
+    debug_error("state machine has no parameter %s", name);
+}
+
+static bool condition_holds(const TransitionCondition &condition, const std::vector<float> &parameters)
+{
+  const float value = parameters[condition.parameter];
+  switch (condition.op)
+  {
+  case ConditionOp::Greater: return value > condition.value;
+  case ConditionOp::Less: return value < condition.value;
+  case ConditionOp::Equal: return value == condition.value;
+  case ConditionOp::Trigger: return value != 0.f;
+  }
+  return false;
+}
+
+static int find_transition(const StateMachineInstance &instance)
+{
+  const StateMachine &machine = *instance.machine;
+  for (size_t i = 0; i < machine.transitions.size(); i++)
+  {
+    const StateTransition &transition = machine.transitions[i];
+    if (transition.to == instance.current || (transition.from != AnyState && transition.from != instance.current))
+      continue;
+    if (transition.exitTime >= 0.f && instance.states[instance.current].phase < transition.exitTime)
+      continue;
+    bool holds = true;
+    for (const TransitionCondition &condition : transition.conditions)
+      holds = holds && condition_holds(condition, instance.parameters);
+    if (holds)
+      return i;
+  }
+  return -1;
+}
+
+static BlendTreeInstance &state_tree(StateMachineInstance &instance, int state)
+{
+  const AnimationState &description = instance.machine->states[state];
+  BlendTreeInstance &tree = instance.states[state];
+  for (size_t i = 0; i < description.treeParameters.size(); i++)
+    tree.parameters[i] = instance.parameters[description.treeParameters[i]];
+  return tree;
+}
+
+static void evaluate_state(StateMachineInstance &instance, int state, float dt, PosePool &pool, SoaPose &out,
+  SimdWidth width)
+{
+  evaluate_blend_tree(state_tree(instance, state), dt, pool, out, width);
+}
+
+// The current state, blended over the source while a crossfade runs or with the decaying offset of an inertialization.
+static void evaluate_states(StateMachineInstance &instance, float dt, PosePool &pool, SoaPose &out, SimdWidth width)
+{
+  evaluate_state(instance, instance.current, dt, pool, out, width);
+  instance.rootMotion = instance.states[instance.current].rootMotion;
+  if (instance.transition < 0)
+    return;
+
+  const StateTransition &transition = instance.machine->transitions[instance.transition];
+  const float duration = transition.duration;
+  if (transition.blend == TransitionBlend::Inertialize)
+  {
+    if (instance.capturePending)
+    {
+      // the last output already holds whatever the transition interrupted
+      const SoaPose &beforePrevious = instance.outputs > 1 ? instance.beforePrevious : instance.previous;
+      begin_inertialization(instance.previous, beforePrevious, dt, out, duration, instance.inertializer);
+      instance.capturePending = false;
+    }
+    apply_inertialization(instance.inertializer, instance.fadeTime, out, width);
+    return;
+  }
+  const float t = clamp(instance.fadeTime / duration, 0.f, 1.f);
+  const float weight = t * t * (3.f - 2.f * t);
+  if (instance.source >= 0)
+  {
+    SoaPose *source = pool.acquire(out.numBones);
+    evaluate_state(instance, instance.source, dt, pool, *source, width);
+    blend_poses(*source, out, weight, out, width);
+    instance.rootMotion = blend_root_motion(instance.states[instance.source].rootMotion, instance.rootMotion, weight);
+    pool.release(source);
+  }
+  else // a frozen pose has no motion of its own, the target's motion plays through the fade
+    blend_poses(instance.frozen, out, weight, out, width);
+}
+
+void update_state_machine(StateMachineInstance &instance, float dt, PosePool &pool, SoaPose &out, SimdWidth width)
+{
+  const StateMachine &machine = *instance.machine;
+  const bool fading = instance.transition >= 0;
+  const int next = !fading || machine.transitions[instance.transition].interruptible ? find_transition(instance) : -1;
+  if (next >= 0)
+  {
+    const StateTransition &transition = machine.transitions[next];
+    for (const TransitionCondition &condition : transition.conditions)
+      if (condition.op == ConditionOp::Trigger)
+        instance.parameters[condition.parameter] = 0.f;
+
+    const bool inertialize = transition.blend == TransitionBlend::Inertialize && instance.outputs > 0;
+    if (fading && transition.duration > 0.f && !inertialize)
+    {
+      // the interrupted crossfade stops where it is and fades out as a whole
+      evaluate_states(instance, 0.f, pool, instance.frozen, width);
+      instance.source = -1;
+    }
+    else
+      instance.source = inertialize ? -1 : instance.current;
+    instance.capturePending = inertialize;
+    instance.current = transition.to;
+    instance.states[transition.to].phase = 0.f;
+    // an inertialization needs an output to start from, without one the switch is immediate
+    const bool blends = transition.blend == TransitionBlend::Crossfade || inertialize;
+    instance.transition = transition.duration > 0.f && blends ? next : -1;
+    instance.fadeTime = 0.f;
+    instance.transitionsTaken++;
+  }
+
+  if (instance.transition >= 0)
+  {
+    instance.fadeTime += dt;
+    if (instance.fadeTime >= machine.transitions[instance.transition].duration)
+      instance.transition = -1;
+  }
+  evaluate_states(instance, dt, pool, out, width);
+
+  if (machine.inertialized)
+  {
+    std::swap(instance.previous.blocks, instance.beforePrevious.blocks);
+    instance.previous.blocks = out.blocks;
+    instance.outputs++;
+  }
+}
+
+void advance_state_machine(StateMachineInstance &instance, float dt)
+{
+  BlendTreeInstance &tree = state_tree(instance, instance.current);
+  advance_blend_tree(tree, dt);
+  instance.rootMotion = tree.rootMotion;
+}
+
+void benchmark_state_machine(const Skeleton &skeleton, const AnimationClip &clip)
+{
+  // idle, a walk/run speed blend, a strafe set and an additive hit reaction, any of them reachable by trigger
+  std::vector<AnimationClipPtr> clips;
+  clips.push_back(std::make_shared<AnimationClip>(clip));
+  for (int i = 1; i < 5; i++)
+    clips.push_back(make_procedural_clip(skeleton, 0.6f + 0.35f * i, 30.f));
+
+  auto locomotion = std::make_shared<BlendTree>();
+  locomotion->root = add_blend_1d(*locomotion, "speed",
+    {add_clip_node(*locomotion, clips[1]), add_clip_node(*locomotion, clips[2]), add_clip_node(*locomotion, clips[3])},
+    {0.f, 2.f, 5.f});
+  auto strafe = std::make_shared<BlendTree>();
+  strafe->root = add_blend_2d(*strafe, "x", "y",
+    {add_clip_node(*strafe, clips[1]), add_clip_node(*strafe, clips[2]), add_clip_node(*strafe, clips[3]),
+      add_clip_node(*strafe, clips[4])},
+    {vec2(1, 0), vec2(0, 1), vec2(-1, 0), vec2(0, -1)});
+  auto hit = std::make_shared<BlendTree>();
+  hit->root = add_additive(*hit, add_clip_node(*hit, clips[0]), add_clip_node(*hit, clips[4]), nullptr);
+
+  auto machine = std::make_shared<StateMachine>();
+  const char *triggers[] = {"idle", "move", "strafe", "hit"};
+  const int states[] = {
+    add_state(*machine, "idle", make_clip_tree(clips[0])),
+    add_state(*machine, "move", locomotion),
+    add_state(*machine, "strafe", strafe),
+    add_state(*machine, "hit", hit)};
+  for (int i = 0; i < 4; i++)
+    add_transition(*machine, AnyState, states[i], 0.25f, {make_condition(*machine, triggers[i], ConditionOp::Trigger)},
+      -1.f, i != 3);
+  add_transition(*machine, states[3], states[0], 0.2f, {}, 0.9f);
+  int triggerParameters[4];
+  for (int i = 0; i < 4; i++)
+    triggerParameters[i] = machine->find_parameter(triggers[i]);
+  const int speed = machine->find_parameter("speed");
+  const int strafeX = machine->find_parameter("x"), strafeY = machine->find_parameter("y");
+
+  constexpr int NumCharacters = 1000;
+  constexpr int WarmupFrames = 60, Frames = 240;
+  constexpr float Dt = 1.f / 60.f;
+  std::vector<StateMachineInstance> instances(NumCharacters);
+  std::vector<SoaPose> poses(NumCharacters);
+  for (StateMachineInstance &instance : instances)
+    init_state_machine_instance(instance, machine);
+
+  // xorshift per character, so the frames are the same on any number of workers
+  std::vector<uint32_t> seeds(NumCharacters);
+  for (int i = 0; i < NumCharacters; i++)
+    seeds[i] = 2654435761u * (i + 1);
+  std::atomic<uint64_t> updateAllocations{0};
+  auto update_characters = [&](size_t begin, size_t end) {
+    const uint64_t allocationsBefore = get_thread_heap_allocations();
+    PosePool &pool = thread_pose_pool();
+    for (size_t i = begin; i < end; i++)
+    {
+      uint32_t &seed = seeds[i];
+      seed ^= seed << 13, seed ^= seed >> 17, seed ^= seed << 5;
+      StateMachineInstance &instance = instances[i];
+      // about one state change per character per second
+      if (seed % 60 == 0)
+        instance.parameters[triggerParameters[(seed >> 8) % 4]] = 1.f;
+      instance.parameters[speed] = (seed >> 12) % 500 * 0.01f;
+      instance.parameters[strafeX] = cosf(seed * 1e-3f);
+      instance.parameters[strafeY] = sinf(seed * 1e-3f);
+      update_state_machine(instance, Dt, pool, poses[i]);
+    }
+    updateAllocations += get_thread_heap_allocations() - allocationsBefore;
+  };
+
+  for (int frame = 0; frame < WarmupFrames; frame++)
+    parallel_for(NumCharacters, 16, update_characters);
+
+  int transitions = 0;
+  for (const StateMachineInstance &instance : instances)
+    transitions -= instance.transitionsTaken;
+  updateAllocations = 0;
+  const uint64_t allocationsBefore = get_heap_allocations();
+  // measure_ns also runs its warm up, every frame it runs counts
+  int measuredFrames = 0;
+  const double frameNs = measure_ns(Frames, [&]() {
+    parallel_for(NumCharacters, 16, update_characters);
+    measuredFrames++;
+  });
+  const uint64_t allocations = get_heap_allocations() - allocationsBefore;
+  for (const StateMachineInstance &instance : instances)
+    transitions += instance.transitionsTaken;
+
+  debug_log("state machine, %d characters of %d bones, %d workers:", NumCharacters, skeleton.num_bones(), get_num_workers() + 1);
+  debug_log("  %.3f ms per frame, %.2f transitions per frame", frameNs * 1e-6, transitions / float(measuredFrames));
+  if (HeapAllocationsCounted)
+    debug_log("  heap allocations per frame: %.2f in the updates, %.2f in total with the job dispatch",
+      updateAllocations / float(measuredFrames), allocations / float(measuredFrames));
+  else
+    debug_log("  heap allocations not counted, configure with BENCHMARK_ALLOCATIONS");
+}
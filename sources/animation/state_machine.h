@@ -0,0 +1,112 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+#include "blend_tree.h"
+#include "inertialization.h"
+
+// from of a transition that may leave any state
+constexpr int AnyState = -1;
+
+enum class ConditionOp
+{
+  Greater,
+  Less,
+  Equal,
+  Trigger // holds while the parameter is not 0, taking the transition sets it back to 0
+};
+
+enum class TransitionBlend
+{
+  Crossfade,  // samples the source and the target for the whole duration
+  Inertialize // samples only the target, the offset to the source decays within the duration
+};
+
+struct TransitionCondition
+{
+  int parameter;
+  ConditionOp op;
+  float value = 0.f;
+};
+
+struct StateTransition
+{
+  int from = AnyState;
+  int to = 0;
+  float duration = 0.f;      // crossfade in seconds, 0 switches at once
+  float exitTime = -1.f;     // normalized phase of the source state it waits for, negative fires any time
+  bool interruptible = true; // whether another transition may cut into its crossfade
+  std::vector<TransitionCondition> conditions; // all of them have to hold
+  TransitionBlend blend = TransitionBlend::Crossfade;
+};
+
+// Every state plays a blend tree. The tree's parameters are machine parameters of the same name.
+struct AnimationState
+{
+  std::string name;
+  BlendTreePtr tree;
+  std::vector<int> treeParameters; // machine parameter of every tree parameter
+};
+
+// Transitions are checked in the order they were added, the first one that holds is taken.
+struct StateMachine
+{
+  std::vector<AnimationState> states;
+  std::vector<StateTransition> transitions;
+  std::vector<std::string> parameters;
+  int entry = 0;
+  bool inertialized = false; // some transition inertializes, instances keep their last two poses
+
+  int find_state(const char *name) const;
+  int find_parameter(const char *name) const;
+};
+
+using StateMachinePtr = std::shared_ptr<const StateMachine>;
+
+// Builders return the new state or transition index. Parameters are created by name on first use.
+int add_state(StateMachine &machine, const char *name, BlendTreePtr tree);
+int add_transition(StateMachine &machine, int from, int to, float duration, std::vector<TransitionCondition> conditions,
+  float exit_time = -1.f, bool interruptible = true, TransitionBlend blend = TransitionBlend::Crossfade);
+TransitionCondition make_condition(StateMachine &machine, const char *parameter, ConditionOp op, float value = 0.f);
+
+// One state per clip, parameter "state" set to a clip index blends to it in fade_duration.
+StateMachinePtr make_clip_state_machine(const std::vector<AnimationClipPtr> &clips, float fade_duration,
+  TransitionBlend blend = TransitionBlend::Crossfade);
+
+struct StateMachineInstance
+{
+  StateMachinePtr machine;
+  std::vector<float> parameters;
+  std::vector<BlendTreeInstance> states; // one per state, made at init so switching allocates nothing
+  int current = 0;
+
+  // crossfade from source, or from frozen when a transition was interrupted, into current
+  int transition = -1;
+  int source = -1;
+  SoaPose frozen;
+  float fadeTime = 0.f;
+
+  // inertialized transitions capture their offset against the last two outputs on their first frame
+  bool capturePending = false;
+  Inertializer inertializer;
+  SoaPose previous, beforePrevious;
+  int outputs = 0;
+  int transitionsTaken = 0;
+  RootMotionDelta rootMotion; // of the last update, crossfaded like the poses
+};
+
+void init_state_machine_instance(StateMachineInstance &instance, StateMachinePtr machine);
+void set_state_parameter(StateMachineInstance &instance, const char *name, float value);
+
+// Takes at most one transition, advances the playing states by dt and writes the blended local pose to out
+// and the root motion of the step to instance.rootMotion.
+// Temporary poses come from pool, steady state updates make no heap allocations.
+void update_state_machine(StateMachineInstance &instance, float dt, PosePool &pool, SoaPose &out,
+  SimdWidth width = BestSimdWidth);
+
+// Only the current state's phase and root motion, for a character nobody sees. Transitions wait and
+// a running fade stays where it is until the next update_state_machine.
+void advance_state_machine(StateMachineInstance &instance, float dt);
+
+// Logs update time and heap allocations of 1000 characters that change state at random, on all workers.
+void benchmark_state_machine(const Skeleton &skeleton, const AnimationClip &clip);
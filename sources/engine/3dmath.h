@@ -33,4 +33,9 @@ template<typename T>
 quat to_quat(const T& t)
 {
   return quat(t.w, t.x, t.y, t.z);
-}
\ No newline at end of file
+}
+template<typename T>
+mat4 to_mat4(const T& t)
+{
+  return transpose(make_mat4(&t.a1));
+}
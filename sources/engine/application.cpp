@@ -3,6 +3,9 @@
 #include <imgui/imgui_impl_opengl3.h>
 #include <imgui/imgui_impl_sdl.h>
 #include <SDL2/SDL.h>
+#include "job_system.h"
+#include <render/gpu_resource.h>
+#include <render/gpu_ring.h>
 
 extern void game_init();
 extern void game_update();
@@ -26,7 +29,7 @@ void init_application(const char *project_name, int width, int height, bool full
   SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, 0);
   SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
   SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 4);
-  SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+  SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 5);
 
 
   size_t window_flags = SDL_WINDOW_OPENGL;
@@ -49,10 +52,50 @@ void init_application(const char *project_name, int width, int height, bool full
   const char *glsl_version = "#version 450";
   ImGui_ImplOpenGL3_Init(glsl_version);
   glEnable(GL_DEBUG_OUTPUT);
+  init_job_system();
+}
+
+// A hidden window's context without imgui, for runs that only read results back.
+// LIBGL_ALWAYS_SOFTWARE=1 puts it on Mesa llvmpipe, so it works without a GPU.
+bool init_offscreen_context(const char *project_name)
+{
+  if (SDL_Init(SDL_INIT_VIDEO) != 0)
+  {
+    debug_error("SDL_Init failed: %s", SDL_GetError());
+    return false;
+  }
+  SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, 0);
+  SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+  SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 4);
+  SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 5);
+
+  context.window = SDL_CreateWindow(project_name, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 64, 64,
+    (SDL_WindowFlags)(SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN));
+  if (context.window)
+    context.gl_context = SDL_GL_CreateContext(context.window);
+  if (!context.gl_context || !gladLoadGLLoader(SDL_GL_GetProcAddress))
+  {
+    debug_error("no GL 4.5 context: %s", SDL_GetError());
+    SDL_Quit();
+    return false;
+  }
+  debug_log("offscreen context on %s", (const char *)glGetString(GL_RENDERER));
+  return true;
+}
+
+void close_offscreen_context()
+{
+  close_job_system();
+  flush_gpu_deletes();
+  SDL_GL_DeleteContext(context.gl_context);
+  SDL_DestroyWindow(context.window);
+  SDL_Quit();
 }
 
 void close_application()
 {
+  close_job_system();
+  flush_gpu_deletes();
   ImGui_ImplOpenGL3_Shutdown();
   ImGui_ImplSDL2_Shutdown();
   ImGui::DestroyContext();
@@ -97,6 +140,7 @@ void main_loop()
   game_init();
 
   bool running = true;
+  bool firstFrame = true;
   while (running)
   {
     update_time();
@@ -116,12 +160,40 @@ void main_loop()
       {
         if (ImGui::BeginMainMenuBar())
         {
+          GpuMemoryStats memory = get_gpu_memory_stats();
+          size_t totalBytes = 0;
+          for (int i = 0; i < GpuMemoryCategoryCount; i++)
+            totalBytes += memory.bytes[i];
+          ImGui::Text("VRAM %.1f MB", totalBytes / float(1 << 20));
+          for (int i = 0; i < GpuMemoryCategoryCount; i++)
+          {
+            ImGui::Separator();
+            ImGui::Text("%s %.1f MB (%d)", gpu_memory_category_name(GpuMemoryCategory(i)), memory.bytes[i] / float(1 << 20),
+              memory.objects[i]);
+          }
+          if (memory.pendingDeletes > 0)
+          {
+            ImGui::Separator();
+            ImGui::Text("deleting %d", memory.pendingDeletes);
+          }
+          GpuRingStats ring = get_ring_stats();
+          ImGui::Separator();
+          ImGui::Text("ring %.1f KB/frame, %d waits (%.1f ms)", ring.lastFrameBytes / 1024.f, ring.fenceWaits, ring.fenceWaitMs);
           ImGui::EndMainMenuBar();
         }
       }
 
       ImGui::Render();
       ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+      end_ring_frame();
+      end_gpu_frame();
+
+      if (firstFrame)
+      {
+        firstFrame = false;
+        update_time();
+        debug_log("time to first frame %.2f ms, %d job workers", get_time() * 1000.f, get_num_workers());
+      }
     }
 	}
 }
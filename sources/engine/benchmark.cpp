@@ -0,0 +1,86 @@
+#include "benchmark.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#ifdef COUNT_HEAP_ALLOCATIONS
+static std::atomic<uint64_t> heapAllocations{0};
+static thread_local uint64_t threadHeapAllocations = 0;
+
+uint64_t get_heap_allocations()
+{
+  return heapAllocations.load(std::memory_order_relaxed);
+}
+
+uint64_t get_thread_heap_allocations()
+{
+  return threadHeapAllocations;
+}
+
+static void count_allocation()
+{
+  heapAllocations.fetch_add(1, std::memory_order_relaxed);
+  threadHeapAllocations++;
+}
+
+// The nothrow and array forms of the standard library call these two.
+void *operator new(std::size_t size)
+{
+  count_allocation();
+  if (void *ptr = std::malloc(size ? size : 1))
+    return ptr;
+  throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept
+{
+  std::free(ptr);
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment)
+{
+  count_allocation();
+  const std::size_t align = static_cast<std::size_t>(alignment);
+  const std::size_t rounded = (size + align - 1) / align * align;
+#ifdef _MSC_VER
+  void *ptr = _aligned_malloc(rounded ? rounded : align, align);
+#else
+  void *ptr = std::aligned_alloc(align, rounded ? rounded : align);
+#endif
+  if (!ptr)
+    throw std::bad_alloc();
+  return ptr;
+}
+
+void operator delete(void *ptr, std::align_val_t) noexcept
+{
+#ifdef _MSC_VER
+  _aligned_free(ptr);
+#else
+  std::free(ptr);
+#endif
+}
+
+void operator delete(void *ptr, std::size_t, std::align_val_t alignment) noexcept
+{
+  operator delete(ptr, alignment);
+}
+
+#else
+
+uint64_t get_heap_allocations()
+{
+  return 0;
+}
+
+uint64_t get_thread_heap_allocations()
+{
+  return 0;
+}
+
+#endif
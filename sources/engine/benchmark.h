@@ -0,0 +1,40 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+
+// Keeps the optimizer from dropping a computation whose result is otherwise unused.
+template<typename T>
+inline void do_not_optimize(const T &value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  asm volatile("" : : "r,m"(value) : "memory");
+#else
+  static volatile const void *sink;
+  sink = &value;
+#endif
+}
+
+// Average time of one call of f in nanoseconds, after a short warm up.
+template<typename F>
+inline double measure_ns(int iterations, F &&f)
+{
+  using clock = std::chrono::high_resolution_clock;
+  for (int i = 0; i < iterations / 10 + 1; i++)
+    f();
+  auto start = clock::now();
+  for (int i = 0; i < iterations; i++)
+    f();
+  return std::chrono::duration<double, std::nano>(clock::now() - start).count() / iterations;
+}
+
+// The replaced operator new that counts them costs every allocation, so only builds configured with
+// BENCHMARK_ALLOCATIONS count. Elsewhere both counters stay 0.
+#ifdef COUNT_HEAP_ALLOCATIONS
+constexpr bool HeapAllocationsCounted = true;
+#else
+constexpr bool HeapAllocationsCounted = false;
+#endif
+
+// Heap allocations made through operator new since start, on every thread and on the calling one.
+uint64_t get_heap_allocations();
+uint64_t get_thread_heap_allocations();
@@ -0,0 +1,121 @@
+#include "job_system.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct JobSystem
+{
+  std::vector<std::thread> workers;
+  std::deque<std::function<void()>> queue;
+  std::mutex mutex;
+  std::condition_variable wakeUp;
+  bool quit = false;
+
+  ~JobSystem()
+  {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      quit = true;
+    }
+    wakeUp.notify_all();
+    for (std::thread &worker : workers)
+      worker.join();
+  }
+};
+
+static std::unique_ptr<JobSystem> jobSystem;
+static std::once_flag jobSystemInit;
+
+static void worker_loop(JobSystem &system)
+{
+  while (true)
+  {
+    std::function<void()> job;
+    {
+      std::unique_lock<std::mutex> lock(system.mutex);
+      system.wakeUp.wait(lock, [&]() { return system.quit || !system.queue.empty(); });
+      if (system.quit && system.queue.empty())
+        return;
+      job = std::move(system.queue.front());
+      system.queue.pop_front();
+    }
+    job();
+  }
+}
+
+void init_job_system(int num_threads)
+{
+  std::call_once(jobSystemInit, [num_threads]() {
+    int count = num_threads > 0 ? num_threads : std::max(1, (int)std::thread::hardware_concurrency() - 1);
+    jobSystem = std::make_unique<JobSystem>();
+    for (int i = 0; i < count; i++)
+      jobSystem->workers.emplace_back(worker_loop, std::ref(*jobSystem));
+  });
+}
+
+void close_job_system()
+{
+  // workers finish the queued jobs before they exit
+  jobSystem.reset();
+}
+
+int get_num_workers()
+{
+  init_job_system();
+  return jobSystem->workers.size();
+}
+
+void schedule_job(std::function<void()> &&job)
+{
+  init_job_system();
+  {
+    std::unique_lock<std::mutex> lock(jobSystem->mutex);
+    jobSystem->queue.emplace_back(std::move(job));
+  }
+  jobSystem->wakeUp.notify_one();
+}
+
+void parallel_for(size_t count, size_t grain, const std::function<void(size_t, size_t)> &f)
+{
+  grain = std::max<size_t>(grain, 1);
+  const size_t numChunks = (count + grain - 1) / grain;
+  if (numChunks <= 1)
+  {
+    if (count > 0)
+      f(0, count);
+    return;
+  }
+
+  struct Work
+  {
+    std::atomic<size_t> nextChunk{0};
+    std::atomic<size_t> doneChunks{0};
+    std::mutex mutex;
+    std::condition_variable done;
+  };
+  auto work = std::make_shared<Work>();
+
+  // helpers that start after every chunk is taken return at once, so the caller never waits on the queue
+  auto run_chunks = [work, numChunks, count, grain, &f]() {
+    size_t chunk;
+    while ((chunk = work->nextChunk.fetch_add(1)) < numChunks)
+    {
+      f(chunk * grain, std::min(count, (chunk + 1) * grain));
+      if (work->doneChunks.fetch_add(1) + 1 == numChunks)
+      {
+        std::unique_lock<std::mutex> lock(work->mutex);
+        work->done.notify_all();
+      }
+    }
+  };
+  const size_t numHelpers = std::min<size_t>(get_num_workers(), numChunks - 1);
+  for (size_t i = 0; i < numHelpers; i++)
+    schedule_job(run_chunks);
+  run_chunks();
+
+  std::unique_lock<std::mutex> lock(work->mutex);
+  work->done.wait(lock, [&]() { return work->doneChunks.load() == numChunks; });
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <functional>
+#include <future>
+#include <memory>
+
+// Fixed pool of worker threads, started on first use.
+void init_job_system(int num_threads = 0); // 0 means hardware_concurrency - 1
+void close_job_system();
+int get_num_workers();
+
+void schedule_job(std::function<void()> &&job);
+
+template<typename F>
+auto run_async(F &&f) -> std::future<decltype(f())>
+{
+  using T = decltype(f());
+  auto task = std::make_shared<std::packaged_task<T()>>(std::forward<F>(f));
+  std::future<T> result = task->get_future();
+  schedule_job([task]() { (*task)(); });
+  return result;
+}
+
+// Calls f(begin, end) over [0, count) split into chunks of grain items.
+// The calling thread takes chunks too, so it's safe to call from inside a job.
+void parallel_for(size_t count, size_t grain, const std::function<void(size_t, size_t)> &f);
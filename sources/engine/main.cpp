@@ -2,14 +2,22 @@
 
 #include <filesystem>
 #include <iostream>
+#include <string>
 
 
 extern void init_application(const char *project_name, int width, int height, bool full_screen);
 extern void close_application();
 extern void main_loop();
+extern bool run_benchmarks();
+extern bool run_skinning_validation();
 
-int main(int, char**)
+int main(int argc, char** argv)
 {
+  if (argc > 1 && std::string(argv[1]) == "--bench")
+    return run_benchmarks() ? 0 : 1;
+  if (argc > 1 && std::string(argv[1]) == "--validate-skinning")
+    return run_skinning_validation() ? 0 : 1;
+
   init_application("animations", 2048, 1024, true);
 
   main_loop();
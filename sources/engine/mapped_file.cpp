@@ -0,0 +1,102 @@
+#include "mapped_file.h"
+#include <filesystem>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+bool MappedFile::open(const char *path)
+{
+  close();
+  HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+  LARGE_INTEGER fileSize;
+  if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+  {
+    CloseHandle(file);
+    return false;
+  }
+  HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (!mapping)
+  {
+    CloseHandle(file);
+    return false;
+  }
+  void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (!view)
+  {
+    CloseHandle(mapping);
+    CloseHandle(file);
+    return false;
+  }
+  fileHandle = file;
+  mappingHandle = mapping;
+  mappedData = (const uint8_t *)view;
+  mappedSize = (size_t)fileSize.QuadPart;
+  return true;
+}
+
+void MappedFile::close()
+{
+  if (mappedData)
+    UnmapViewOfFile(mappedData);
+  if (mappingHandle)
+    CloseHandle(mappingHandle);
+  if (fileHandle)
+    CloseHandle(fileHandle);
+  mappedData = nullptr;
+  mappingHandle = fileHandle = nullptr;
+  mappedSize = 0;
+}
+
+#else
+
+bool MappedFile::open(const char *path)
+{
+  close();
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0)
+  {
+    ::close(fd);
+    return false;
+  }
+  void *view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (view == MAP_FAILED)
+    return false;
+  mappedData = (const uint8_t *)view;
+  mappedSize = (size_t)st.st_size;
+  return true;
+}
+
+void MappedFile::close()
+{
+  if (mappedData)
+    munmap((void *)mappedData, mappedSize);
+  mappedData = nullptr;
+  mappedSize = 0;
+}
+
+#endif
+
+bool file_stamp(const char *path, uint64_t &size, int64_t &time)
+{
+  std::error_code ec;
+  size = std::filesystem::file_size(path, ec);
+  if (ec)
+    return false;
+  time = std::filesystem::last_write_time(path, ec).time_since_epoch().count();
+  return !ec;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Read-only memory mapping of a whole file, unmapped on destruction.
+class MappedFile
+{
+  const uint8_t *mappedData = nullptr;
+  size_t mappedSize = 0;
+#ifdef _WIN32
+  void *fileHandle = nullptr;
+  void *mappingHandle = nullptr;
+#endif
+
+public:
+  MappedFile() = default;
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  ~MappedFile() { close(); }
+
+  bool open(const char *path);
+  void close();
+
+  bool is_open() const { return mappedData != nullptr; }
+  const uint8_t *data() const { return mappedData; }
+  size_t size() const { return mappedSize; }
+};
+
+// Size and modification time of a file, baked caches store them to notice a changed source.
+bool file_stamp(const char *path, uint64_t &size, int64_t &time);
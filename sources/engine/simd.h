@@ -0,0 +1,121 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+
+// SSE2 is part of every x64 target, AVX2 only when the compiler is asked for it (-mavx2, /arch:AVX2),
+// which CMakeLists.txt does unless ENABLE_AVX2 is turned off.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMD_SSE 1
+#include <immintrin.h>
+#endif
+#if defined(__AVX2__)
+#define SIMD_AVX2 1
+#endif
+
+// The same kernel source is instantiated for 1, 4 and 8 floats at a time through these.
+// Operations are plain mul/add without fma so every width rounds like the scalar reference.
+
+struct ScalarLanes
+{
+  using V = float;
+  static constexpr int Width = 1;
+  static constexpr const char *name = "scalar";
+
+  static V load(const float *p) { return *p; }
+  static void store(float *p, V v) { *p = v; }
+  static V set1(float x) { return x; }
+  static V add(V a, V b) { return a + b; }
+  static V sub(V a, V b) { return a - b; }
+  static V mul(V a, V b) { return a * b; }
+  static V div(V a, V b) { return a / b; }
+  static V sqrt(V a) { return sqrtf(a); }
+  static V min(V a, V b) { return a < b ? a : b; }
+  static V max(V a, V b) { return a > b ? a : b; }
+  // +1 or -1 carrying the sign bit of a
+  static V sign(V a) { return copysignf(1.f, a); }
+  // base[offsets[lane]] for every lane, offsets aligned like a load
+  static V gather(const float *base, const int32_t *offsets) { return base[offsets[0]]; }
+};
+
+#if SIMD_SSE
+struct SseLanes
+{
+  using V = __m128;
+  static constexpr int Width = 4;
+  static constexpr const char *name = "sse";
+
+  static V load(const float *p) { return _mm_load_ps(p); }
+  static void store(float *p, V v) { _mm_store_ps(p, v); }
+  static V set1(float x) { return _mm_set1_ps(x); }
+  static V add(V a, V b) { return _mm_add_ps(a, b); }
+  static V sub(V a, V b) { return _mm_sub_ps(a, b); }
+  static V mul(V a, V b) { return _mm_mul_ps(a, b); }
+  static V div(V a, V b) { return _mm_div_ps(a, b); }
+  static V sqrt(V a) { return _mm_sqrt_ps(a); }
+  static V min(V a, V b) { return _mm_min_ps(a, b); }
+  static V max(V a, V b) { return _mm_max_ps(a, b); }
+  static V sign(V a) { return _mm_or_ps(_mm_and_ps(a, _mm_set1_ps(-0.f)), _mm_set1_ps(1.f)); }
+  static V gather(const float *base, const int32_t *offsets)
+  {
+    return _mm_setr_ps(base[offsets[0]], base[offsets[1]], base[offsets[2]], base[offsets[3]]);
+  }
+};
+#endif
+
+#if SIMD_AVX2
+struct Avx2Lanes
+{
+  using V = __m256;
+  static constexpr int Width = 8;
+  static constexpr const char *name = "avx2";
+
+  static V load(const float *p) { return _mm256_load_ps(p); }
+  static void store(float *p, V v) { _mm256_store_ps(p, v); }
+  static V set1(float x) { return _mm256_set1_ps(x); }
+  static V add(V a, V b) { return _mm256_add_ps(a, b); }
+  static V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+  static V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+  static V div(V a, V b) { return _mm256_div_ps(a, b); }
+  static V sqrt(V a) { return _mm256_sqrt_ps(a); }
+  static V min(V a, V b) { return _mm256_min_ps(a, b); }
+  static V max(V a, V b) { return _mm256_max_ps(a, b); }
+  static V sign(V a) { return _mm256_or_ps(_mm256_and_ps(a, _mm256_set1_ps(-0.f)), _mm256_set1_ps(1.f)); }
+  static V gather(const float *base, const int32_t *offsets)
+  {
+    return _mm256_i32gather_ps(base, _mm256_load_si256((const __m256i *)offsets), sizeof(float));
+  }
+};
+#endif
+
+enum class SimdWidth
+{
+  Scalar,
+  Sse,
+  Avx2
+};
+
+#if SIMD_AVX2
+constexpr SimdWidth BestSimdWidth = SimdWidth::Avx2;
+#elif SIMD_SSE
+constexpr SimdWidth BestSimdWidth = SimdWidth::Sse;
+#else
+constexpr SimdWidth BestSimdWidth = SimdWidth::Scalar;
+#endif
+
+// Calls f with the lanes type of width, a width the build lacks runs on the widest one it has.
+template<typename F>
+inline void simd_dispatch(SimdWidth width, F &&f)
+{
+  if (width > BestSimdWidth)
+    width = BestSimdWidth;
+  switch (width)
+  {
+#if SIMD_AVX2
+    case SimdWidth::Avx2: f(Avx2Lanes()); return;
+#endif
+#if SIMD_SSE
+    case SimdWidth::Sse: f(SseLanes()); return;
+#endif
+    default: f(ScalarLanes()); return;
+  }
+}
@@ -0,0 +1,58 @@
+#include <render/model.h>
+#include <render/vertex_format.h>
+#include <render/texture_compression.h>
+#include <animation/skeleton.h>
+#include <animation/animation_clip.h>
+#include <animation/clip_compression.h>
+#include <animation/soa_pose.h>
+#include <animation/skinning_matrices.h>
+#include <animation/cpu_skinning.h>
+#include <animation/dual_quat_skinning.h>
+#include <animation/blend_tree.h>
+#include <animation/state_machine.h>
+#include <animation/inertialization.h>
+#include <animation/animation_layers.h>
+#include <animation/root_motion.h>
+#include <animation/animation_lod.h>
+#include <log.h>
+
+// Headless run over the vertex and texture codecs and the animation kernels on the MotusMan model,
+// started with --bench. Returns false when a round trip check fails.
+bool run_benchmarks()
+{
+  const char *path = ROOT_PATH"resources/MotusMan_v55/MotusMan_v55.fbx";
+  bool passed = check_vertex_codecs();
+  passed &= check_texture_compression(ROOT_PATH"resources/MotusMan_v55/MCG_diff.jpg");
+  passed &= check_texture_compression(ROOT_PATH"resources/MotusMan_v55/MCG_spec.jpg");
+  ModelPtr model = import_model(path);
+  if (!model)
+    return false;
+  if (!model->meshData.empty())
+  {
+    const PackedMesh packed = pack_mesh(model->meshData[0]);
+    passed &= packed.numLods > 0 && report_vertex_format(path, model->meshData[0], packed);
+  }
+
+  Skeleton skeleton = build_skeleton(model->nodes);
+  benchmark_skeleton(skeleton);
+
+  AnimationClipPtr clip = !model->animations.empty() ? import_clip(model->animations[0], skeleton)
+                                                     : make_procedural_clip(skeleton, 2.f, 30.f);
+  benchmark_clip(*clip);
+  report_clip_compression(*clip, skeleton);
+  benchmark_pose_kernels(skeleton, *clip);
+  benchmark_skinning_matrices(skeleton, *clip);
+  benchmark_blend_tree(skeleton, *clip);
+  benchmark_state_machine(skeleton, *clip);
+  benchmark_inertialization(skeleton, *clip);
+  benchmark_animation_layers(skeleton, *clip);
+  benchmark_root_motion(skeleton, *clip);
+  benchmark_animation_lod(skeleton, *clip);
+  if (!model->meshData.empty() && !model->skins.empty())
+  {
+    benchmark_cpu_skinning(skeleton, model->meshData[0], model->skins[0], *clip);
+    const std::vector<Affine3x4> inverseBind = skeleton_inverse_bind(skeleton, &model->skins[0]);
+    report_skinning_cost(skeleton, *clip, model->meshData[0], inverseBind.data());
+  }
+  return passed;
+}
@@ -2,6 +2,10 @@
 #include <render/direction_light.h>
 #include <render/material.h>
 #include <render/mesh.h>
+#include <render/asset_registry.h>
+#include <render/bone_palette.h>
+#include <animation/character_rig.h>
+#include <job_system.h>
 #include "camera.h"
 #include <application.h>
 
@@ -17,6 +21,9 @@ struct Character
   glm::mat4 transform;
   MeshPtr mesh;
   MaterialPtr material;
+  int lod = 0;
+  RigInstance animation; // no rig draws the mesh unskinned, animation.states takes the state parameters
+  GpuRingAllocation palette;
 };
 
 struct Scene
@@ -26,7 +33,18 @@ struct Scene
   UserCamera userCamera;
 
   std::vector<Character> characters;
+  uint32_t animationFrame = 0;
 
+  // characters join the scene once their mesh and texture are resident
+  struct PendingCharacter
+  {
+    glm::mat4 transform;
+    AsyncMeshPtr mesh;
+    AsyncTexture2DPtr texture;
+    MaterialPtr material;
+    std::future<CharacterRigPtr> rig;
+  };
+  std::vector<PendingCharacter> pendingCharacters;
 };
 
 static std::unique_ptr<Scene> scene;
@@ -58,18 +76,87 @@ void game_init()
   input.onMouseWheelEvent += [](const SDL_MouseWheelEvent &e) { arccam_mouse_wheel_handler(e, scene->userCamera.arcballCamera); };
 
 
-  auto material = make_material("character", ROOT_PATH"sources/shaders/character_vs.glsl", ROOT_PATH"sources/shaders/character_ps.glsl");
-  std::fflush(stdout);
-  material->set_property("mainTex", create_texture2d(ROOT_PATH"resources/MotusMan_v55/MCG_diff.jpg"));
-
-  scene->characters.emplace_back(Character{
+  // decoding runs on the job system while the shader compiles here, uploads are spread over the next frames
+  const char *characterPath = ROOT_PATH"resources/MotusMan_v55/MotusMan_v55.fbx";
+  MaterialPtr material = make_material("character", ROOT_PATH"sources/shaders/character_vs.glsl", ROOT_PATH"sources/shaders/character_ps.glsl");
+  // dual quaternions keep the volume of MotusMan's shoulders and wrists
+  if (material)
+    material->set_property("SkinningMode", int(SkinningDualQuat));
+  scene->pendingCharacters.emplace_back(Scene::PendingCharacter{
     glm::identity<glm::mat4>(),
-    load_mesh(ROOT_PATH"resources/MotusMan_v55/MotusMan_v55.fbx", 0),
-    std::move(material)
+    get_mesh_async(characterPath, 0),
+    get_texture2d_async(ROOT_PATH"resources/MotusMan_v55/MCG_diff.jpg"),
+    std::move(material),
+    run_async([characterPath]() { return import_character_rig(characterPath, 0); })
   });
   std::fflush(stdout);
 }
 
+static void update_pending_characters()
+{
+  process_asset_uploads();
+
+  std::vector<Scene::PendingCharacter> &pending = scene->pendingCharacters;
+  if (pending.empty())
+    return;
+  for (size_t i = 0; i < pending.size();)
+  {
+    Scene::PendingCharacter &character = pending[i];
+    bool failed = character.mesh->failed || character.texture->failed || !character.material;
+    bool rigReady = character.rig.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    if (!failed && !(character.mesh->resident() && character.texture->resident() && rigReady))
+    {
+      i++;
+      continue;
+    }
+    if (!failed)
+    {
+      character.material->set_property("mainTex", character.texture->asset);
+      Character &added = scene->characters.emplace_back();
+      added.transform = character.transform;
+      added.mesh = character.mesh->asset;
+      added.material = std::move(character.material);
+      if (CharacterRigPtr rig = character.rig.get())
+      {
+        const int *mode = added.material->get_property<int>("SkinningMode");
+        StateMachinePtr stateMachine = rig->stateMachine;
+        init_rig_instance(added.animation, std::move(rig), 0, 0.f, mode && *mode == SkinningDualQuat);
+        attach_state_machine(added.animation, std::move(stateMachine));
+        // spreads the characters of each update rate over the frames
+        added.animation.lod.offset = scene->characters.size() - 1;
+      }
+    }
+    pending[i] = std::move(pending.back());
+    pending.pop_back();
+  }
+  if (pending.empty())
+  {
+    AssetRegistryStats stats = get_asset_registry_stats();
+    debug_log("%d characters ready, assets: %d meshes, %d textures, %d shaders, %.2f MB resident, %d hits, %d misses",
+      (int)scene->characters.size(), stats.meshes, stats.textures, stats.shaders, stats.residentBytes / float(1 << 20),
+      stats.hits, stats.misses);
+  }
+}
+
+
+static float projected_size(const Mesh &mesh, const mat4 &transform, const UserCamera &camera)
+{
+  vec3 center = vec3(transform * vec4(mesh.boundsCenter, 1.f));
+  float distance = max(length(center - vec3(camera.transform[3])), 1e-3f);
+  // projection[1][1] is 1 / tan(fovy / 2), the result is a fraction of the screen height
+  return mesh.boundsRadius * camera.projection[1][1] / distance;
+}
+
+static bool sphere_visible(const mat4 &proj_view, vec3 center, float radius)
+{
+  // the frustum planes are sums and differences of the rows of proj_view
+  auto row = [&](int i) { return vec4(proj_view[0][i], proj_view[1][i], proj_view[2][i], proj_view[3][i]); };
+  const vec4 x = row(0), y = row(1), z = row(2), w = row(3);
+  for (const vec4 &plane : {w + x, w - x, w + y, w - y, w + z, w - z})
+    if (dot(vec3(plane), center) + plane.w < -radius * length(vec3(plane)))
+      return false;
+  return true;
+}
 
 void game_update()
 {
@@ -77,6 +164,38 @@ void game_update()
     scene->userCamera.arcballCamera,
     scene->userCamera.transform,
     get_delta_time());
+
+  update_pending_characters();
+
+  const UserCamera &camera = scene->userCamera;
+  const mat4 projView = camera.projection * inverse(camera.transform);
+  for (Character &character : scene->characters)
+  {
+    const Mesh &mesh = *character.mesh;
+    float screenSize = projected_size(mesh, character.transform, camera);
+    character.lod = select_mesh_lod(mesh, screenSize, character.lod);
+    const bool visible = sphere_visible(projView, vec3(character.transform * vec4(mesh.boundsCenter, 1.f)), mesh.boundsRadius);
+    AnimationLod &animationLod = character.animation.lod;
+    animationLod.interval = select_animation_interval(screenSize, visible, animationLod.interval);
+  }
+
+  // every worker evaluates with its own pose pool
+  std::vector<Character> &characters = scene->characters;
+  const float dt = get_delta_time();
+  const uint32_t frame = scene->animationFrame++;
+  parallel_for(characters.size(), 8, [&characters, dt, frame](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++)
+    {
+      Character &character = characters[i];
+      if (!character.animation.rig)
+        continue;
+      update_rig_instance_lod(character.animation, frame, dt);
+      // root motion is in skeleton model space, the transform places the mesh
+      const mat4 &modelToMesh = character.animation.rig->modelToMesh;
+      character.transform = character.transform * modelToMesh * root_motion_transform(character.animation.rootMotion) *
+                            inverse(modelToMesh);
+    }
+  });
 }
 
 void render_character(const Character &character, const mat4 &cameraProjView, vec3 cameraPosition, const DirectionLight &light)
@@ -86,14 +205,27 @@ void render_character(const Character &character, const mat4 &cameraProjView, ve
 
   shader.use();
   material.bind_uniforms_to_shader();
-  shader.set_mat4x4("Transform", character.transform);
+  const CharacterRig *rig = character.animation.rig.get();
+  // skinned vertices are in skeleton model space
+  shader.set_mat4x4("Transform", rig ? character.transform * rig->modelToMesh : character.transform);
   shader.set_mat4x4("ViewProjection", cameraProjView);
   shader.set_vec3("CameraPosition", cameraPosition);
   shader.set_vec3("LightDirection", glm::normalize(light.lightDirection));
   shader.set_vec3("AmbientLight", light.ambient);
   shader.set_vec3("SunLight", light.lightColor);
 
-  render(character.mesh);
+  const VertexQuantization &quantization = character.mesh->quantization;
+  shader.set_vec3("PositionOffset", quantization.positionOffset);
+  shader.set_vec3("PositionScale", quantization.positionScale);
+  shader.set_vec2("UVOffset", quantization.uvOffset);
+  shader.set_vec2("UVScale", quantization.uvScale);
+
+  // the material may ask for dual quaternions, only a rig makes either mode possible
+  if (rig)
+    bind_bone_palette(character.palette);
+  shader.set_int("SkinningMode", !rig ? SkinningRest : character.animation.dualQuaternions ? SkinningDualQuat : SkinningLinear);
+
+  render(character.mesh, character.lod);
 }
 
 void game_render()
@@ -109,6 +241,17 @@ void game_render()
   const glm::mat4 &transform = scene->userCamera.transform;
   mat4 projView = projection * inverse(transform);
 
+  // every palette goes up once per frame, before the first draw
+  for (Character &character : scene->characters)
+  {
+    const RigInstance &animation = character.animation;
+    if (!animation.rig)
+      continue;
+    character.palette = animation.dualQuaternions
+                          ? upload_bone_palette(animation.dualQuatPalette.data(), animation.dualQuatPalette.size())
+                          : upload_bone_palette(animation.palette.data(), animation.palette.size());
+  }
+
   for (const Character &character : scene->characters)
     render_character(character, projView, glm::vec3(transform[3]), scene->light);
 }
\ No newline at end of file
@@ -0,0 +1,242 @@
+#include <render/mesh.h>
+#include <render/mesh_optimizer.h>
+#include <render/shader.h>
+#include <render/bone_palette.h>
+#include <render/skinned_mesh.h>
+#include <animation/character_rig.h>
+#include <animation/cpu_skinning.h>
+#include <animation/dual_quat_skinning.h>
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+#include <chrono>
+#include <log.h>
+
+extern bool init_offscreen_context(const char *project_name);
+extern void close_offscreen_context();
+
+// max distance between a gpu and a cpu skinned vertex, relative to the mesh bounding radius
+constexpr float SkinningTolerance = 1e-4f;
+// crowd size of the frame time comparison
+constexpr int CostCharacters = 1000;
+
+static SkinningMode skinning_mode(const RigInstance &instance)
+{
+  return instance.dualQuaternions ? SkinningDualQuat : SkinningLinear;
+}
+
+static GpuRingAllocation upload_palette(const RigInstance &instance)
+{
+  return instance.dualQuaternions ? upload_bone_palette(instance.dualQuatPalette.data(), instance.dualQuatPalette.size())
+                                  : upload_bone_palette(instance.palette.data(), instance.palette.size());
+}
+
+static void set_mesh_uniforms(const Shader &shader, const VertexQuantization &quantization, const mat4 &view_projection)
+{
+  shader.set_mat4x4("Transform", mat4(1.f));
+  shader.set_mat4x4("ViewProjection", view_projection);
+  shader.set_vec3("PositionOffset", quantization.positionOffset);
+  shader.set_vec3("PositionScale", quantization.positionScale);
+  shader.set_vec2("UVOffset", quantization.uvOffset);
+  shader.set_vec2("UVScale", quantization.uvScale);
+}
+
+static const char *method_name(const RigInstance &instance, bool cpu_skinned)
+{
+  return cpu_skinned ? "cpu" : instance.dualQuaternions ? "dual quat" : "linear";
+}
+
+// World positions character_vs.glsl outputs for count vertices from first of vertex_array, the shader
+// and its uniforms already set up.
+static std::vector<vec3> capture_positions(uint32_t vertex_array, uint32_t first, uint32_t count)
+{
+  GpuBuffer captured(GpuMemoryStreaming, sizeof(vec3) * count, nullptr);
+  glEnable(GL_RASTERIZER_DISCARD);
+  glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, captured.get());
+  glBindVertexArray(vertex_array);
+  glBeginTransformFeedback(GL_POINTS);
+  glDrawArrays(GL_POINTS, first, count);
+  glEndTransformFeedback();
+  glDisable(GL_RASTERIZER_DISCARD);
+
+  std::vector<vec3> positions(count);
+  glGetNamedBufferSubData(captured.get(), 0, sizeof(vec3) * count, positions.data());
+  return positions;
+}
+
+// Compares captured positions to the cpu reference of the instance's method on the same decoded vertices and palette.
+static bool check_positions(const std::vector<vec3> &positions, const MeshData &decoded, const RigInstance &instance,
+  float bounds_radius, bool cpu_skinned)
+{
+  float maxError = 0.f;
+  uint32_t worst = 0;
+  for (uint32_t i = 0; i < positions.size(); i++)
+  {
+    const vec3 reference = instance.dualQuaternions
+                             ? skin_vertex_dual_quat_reference(decoded, i, instance.dualQuatPalette.data()).position
+                             : skin_vertex_reference(decoded, i, instance.palette.data()).position;
+    const float error = length(positions[i] - reference);
+    if (error > maxError)
+    {
+      maxError = error;
+      worst = i;
+    }
+  }
+  const float tolerance = SkinningTolerance * bounds_radius;
+  const bool passed = maxError <= tolerance;
+  debug_log("  %-9s t = %.3f s: %u vertices, max position error %g (vertex %u), tolerance %g, %s",
+    method_name(instance, cpu_skinned), instance.time, (uint32_t)positions.size(), maxError, worst, tolerance,
+    passed ? "passed" : "FAILED");
+  return passed;
+}
+
+// Runs character_vs.glsl over every vertex of lod 0 with transform feedback and checks the skinned positions.
+static bool validate_pose(const Shader &shader, const Mesh &mesh, const MeshData &decoded, const RigInstance &instance)
+{
+  shader.use();
+  set_mesh_uniforms(shader, mesh.quantization, mat4(1.f));
+  shader.set_int("SkinningMode", skinning_mode(instance));
+  bind_bone_palette(upload_palette(instance));
+  const std::vector<vec3> positions =
+    capture_positions(mesh.vertexArray.get(), mesh.lods[0].baseVertex, decoded.vertices.size());
+  end_ring_frame();
+  return check_positions(positions, decoded, instance, mesh.boundsRadius, false);
+}
+
+// Skins the instance's linear palette on the workers straight into the mapped streaming buffer of cpu_mesh,
+// then lets character_vs.glsl pass the vertices through in rest mode, which is what a draw of it sees.
+static bool validate_cpu_skinned_pose(const Shader &shader, const CpuSkinnedMesh &cpu_mesh,
+  const SkinnedMeshSource &source, const MeshData &decoded, const RigInstance &instance, float bounds_radius)
+{
+  SkinnedVertex *vertices = map_skinned_vertices(cpu_mesh);
+  if (!vertices)
+  {
+    debug_error("can't map the cpu skinned vertices");
+    return false;
+  }
+  skin_mesh(source, instance.palette.data(), vertices);
+  unmap_skinned_vertices(cpu_mesh);
+
+  shader.use();
+  set_mesh_uniforms(shader, VertexQuantization{}, mat4(1.f));
+  shader.set_int("SkinningMode", SkinningRest);
+  const std::vector<vec3> positions = capture_positions(cpu_mesh.vertexArray.get(), 0, cpu_mesh.numVertices);
+  return check_positions(positions, decoded, instance, bounds_radius, true);
+}
+
+// One frame of CostCharacters draws of lod 0, each with its own palette upload like game_render does,
+// or with cpu_mesh each skinned on the workers into the mapped vertex buffer before its draw.
+// Logs gpu time from a timer query and the cpu time until glFinish returns.
+static void measure_frame_time(const Shader &shader, const MeshPtr &mesh_ptr, const RigInstance &instance,
+  const CpuSkinnedMesh *cpu_mesh = nullptr, const SkinnedMeshSource *source = nullptr)
+{
+  const Mesh &mesh = *mesh_ptr;
+  // every character lands on the small offscreen target, so the vertex work dominates
+  const mat4 viewProjection = glm::scale(mat4(1.f), vec3(0.8f / mesh.boundsRadius)) * glm::translate(mat4(1.f), -mesh.boundsCenter);
+  GLuint query;
+  glCreateQueries(GL_TIME_ELAPSED, 1, &query);
+  constexpr int Frames = 2;
+  double gpuMs = 0.0, cpuMs = 0.0;
+  for (int frame = 0; frame <= Frames; frame++)
+  {
+    auto start = std::chrono::high_resolution_clock::now();
+    glBeginQuery(GL_TIME_ELAPSED, query);
+    glClear(GL_COLOR_BUFFER_BIT);
+    shader.use();
+    set_mesh_uniforms(shader, cpu_mesh ? VertexQuantization{} : mesh.quantization, viewProjection);
+    shader.set_int("SkinningMode", cpu_mesh ? SkinningRest : skinning_mode(instance));
+    for (int c = 0; c < CostCharacters; c++)
+    {
+      if (cpu_mesh)
+      {
+        // one buffer for the whole crowd, every map orphans the storage the previous draw reads
+        if (SkinnedVertex *vertices = map_skinned_vertices(*cpu_mesh))
+        {
+          skin_mesh(*source, instance.palette.data(), vertices);
+          unmap_skinned_vertices(*cpu_mesh);
+        }
+        render(*cpu_mesh);
+        continue;
+      }
+      bind_bone_palette(upload_palette(instance));
+      render(mesh_ptr, 0);
+    }
+    glEndQuery(GL_TIME_ELAPSED);
+    end_ring_frame();
+    glFinish();
+    GLuint64 ns = 0;
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+    // the first frame pays for shader and buffer setup
+    if (frame > 0)
+    {
+      gpuMs += ns * 1e-6;
+      cpuMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+  }
+  glDeleteQueries(1, &query);
+  debug_log("  %-9s %d characters of %u vertices: gpu %.2f ms, cpu until finished %.2f ms per frame",
+    method_name(instance, cpu_mesh), CostCharacters, mesh.lods[0].numVertices, gpuMs / Frames,
+    cpuMs / Frames);
+}
+
+// Headless check of the gpu and cpu skinning paths, started with --validate-skinning. Returns false on any mismatch.
+bool run_skinning_validation()
+{
+  const char *path = ROOT_PATH"resources/MotusMan_v55/MotusMan_v55.fbx";
+  if (!init_offscreen_context("skinning validation"))
+    return false;
+
+  bool passed = false;
+  {
+    CharacterRigPtr rig = import_character_rig(path, 0);
+    Assimp::Importer importer;
+    const aiScene *scene = read_scene(importer, path);
+    ShaderPtr capture = compile_capture_shader("skinning validation", ROOT_PATH"sources/shaders/character_vs.glsl",
+      {"vsOutput.WorldPosition"});
+    ShaderPtr draw = compile_shader("skinning cost", ROOT_PATH"sources/shaders/character_vs.glsl",
+      ROOT_PATH"sources/shaders/character_ps.glsl");
+    if (rig && scene && scene->mNumMeshes > 0 && capture && draw)
+    {
+      MeshData data = import_mesh_data(scene, scene->mMeshes[0]);
+      optimize_mesh(path, data);
+      // the cpu side reads the vertices back from the packed format, with the quantization the gpu sees
+      const PackedMesh packed = pack_mesh(data);
+      MeshPtr mesh = create_mesh(packed);
+      if (mesh)
+      {
+        const MeshData decoded = unpack_mesh(packed, 0);
+        debug_log("skinning validation on %s:", path);
+        passed = true;
+        const AnimationClip &clip = *rig->clips[0];
+        for (bool dualQuaternions : {false, true})
+        {
+          RigInstance instance;
+          init_rig_instance(instance, rig, 0, 0.f, dualQuaternions);
+          for (float fraction : {0.f, 0.37f, 0.81f})
+          {
+            update_rig_instance(instance, clip.duration * fraction - instance.time);
+            passed &= validate_pose(*capture, *mesh, decoded, instance);
+          }
+          measure_frame_time(*draw, mesh, instance);
+        }
+
+        // the cpu path draws the same decoded vertices from a streaming buffer
+        const SkinnedMeshSource source = build_skinned_mesh_source(decoded);
+        CpuSkinnedMeshPtr cpuMesh = create_cpu_skinned_mesh(decoded);
+        RigInstance instance;
+        init_rig_instance(instance, rig, 0, 0.f);
+        for (float fraction : {0.f, 0.37f, 0.81f})
+        {
+          update_rig_instance(instance, clip.duration * fraction - instance.time);
+          passed &= validate_cpu_skinned_pose(*capture, *cpuMesh, source, decoded, instance, mesh->boundsRadius);
+        }
+        measure_frame_time(*draw, mesh, instance, cpuMesh.get(), &source);
+      }
+      else
+        debug_error("can't pack the mesh of %s", path);
+    }
+    else
+      debug_error("nothing to validate in %s", path);
+  }
+  close_offscreen_context();
+  return passed;
+}
@@ -0,0 +1,197 @@
+#include "asset_registry.h"
+#include <cfloat>
+#include <cstdint>
+#include <filesystem>
+#include <thread>
+#include <unordered_map>
+#include <log.h>
+
+template<typename T>
+struct AssetTable
+{
+  std::unordered_map<std::string, std::weak_ptr<T>> resident;
+  // held strongly so a load finishes even if every requester is gone, moved to resident once uploaded
+  std::unordered_map<std::string, std::shared_ptr<AsyncAsset<T>>> pending;
+
+  std::shared_ptr<T> find_resident(const std::string &key)
+  {
+    auto it = resident.find(key);
+    return it != resident.end() ? it->second.lock() : nullptr;
+  }
+
+  void update_pending()
+  {
+    for (auto it = pending.begin(); it != pending.end();)
+    {
+      if (it->second->resident())
+        resident[it->first] = it->second->asset;
+      if (it->second->resident() || it->second->failed)
+        it = pending.erase(it);
+      else
+        ++it;
+    }
+  }
+
+  int count_alive()
+  {
+    int count = 0;
+    for (auto it = resident.begin(); it != resident.end();)
+    {
+      if (it->second.expired())
+        it = resident.erase(it);
+      else
+      {
+        count++;
+        ++it;
+      }
+    }
+    return count;
+  }
+};
+
+struct AssetRegistry
+{
+  AssetTable<Mesh> meshes;
+  AssetTable<Texture2D> textures;
+  std::unordered_map<std::string, std::weak_ptr<Shader>> shaders;
+  int hits = 0, misses = 0;
+};
+
+static AssetRegistry registry;
+
+static std::string canonical_key(const char *path)
+{
+  std::error_code ec;
+  std::filesystem::path canonical = std::filesystem::weakly_canonical(path, ec);
+  return ec ? std::string(path) : canonical.generic_string();
+}
+
+static std::string mesh_key(const char *path, int idx)
+{
+  return canonical_key(path) + "#" + std::to_string(idx);
+}
+
+template<typename T>
+static std::shared_ptr<T> get_asset(AssetTable<T> &table, const std::string &key, std::shared_ptr<T> (*load)(const char *, int),
+  const char *path, int idx)
+{
+  table.update_pending();
+  if (std::shared_ptr<T> asset = table.find_resident(key))
+  {
+    registry.hits++;
+    return asset;
+  }
+  // a pending async load of the same key is finished here, importing it again would race it on the cache file
+  auto it = table.pending.find(key);
+  if (it != table.pending.end())
+  {
+    registry.hits++;
+    std::shared_ptr<AsyncAsset<T>> handle = it->second;
+    while (!handle->resident() && !handle->failed)
+    {
+      process_asset_uploads(FLT_MAX, SIZE_MAX);
+      if (!handle->resident() && !handle->failed)
+        std::this_thread::yield();
+    }
+    table.update_pending();
+    return handle->asset;
+  }
+  registry.misses++;
+  std::shared_ptr<T> asset = load(path, idx);
+  if (asset)
+    table.resident[key] = asset;
+  return asset;
+}
+
+template<typename T>
+static std::shared_ptr<AsyncAsset<T>> get_asset_async(AssetTable<T> &table, const std::string &key,
+  std::shared_ptr<AsyncAsset<T>> (*load)(const char *, int), const char *path, int idx)
+{
+  table.update_pending();
+  if (std::shared_ptr<T> asset = table.find_resident(key))
+  {
+    registry.hits++;
+    auto handle = std::make_shared<AsyncAsset<T>>();
+    handle->asset = std::move(asset);
+    return handle;
+  }
+  auto it = table.pending.find(key);
+  if (it != table.pending.end())
+  {
+    registry.hits++;
+    return it->second;
+  }
+  registry.misses++;
+  std::shared_ptr<AsyncAsset<T>> handle = load(path, idx);
+  table.pending.emplace(key, handle);
+  return handle;
+}
+
+MeshPtr get_mesh(const char *path, int idx)
+{
+  return get_asset(registry.meshes, mesh_key(path, idx), load_mesh, path, idx);
+}
+
+AsyncMeshPtr get_mesh_async(const char *path, int idx)
+{
+  return get_asset_async(registry.meshes, mesh_key(path, idx), load_mesh_async, path, idx);
+}
+
+Texture2DPtr get_texture2d(const char *path)
+{
+  auto load = [](const char *path, int) { return create_texture2d(path); };
+  return get_asset<Texture2D>(registry.textures, canonical_key(path), load, path, 0);
+}
+
+AsyncTexture2DPtr get_texture2d_async(const char *path)
+{
+  auto load = [](const char *path, int) { return create_texture2d_async(path); };
+  return get_asset_async<Texture2D>(registry.textures, canonical_key(path), load, path, 0);
+}
+
+ShaderPtr get_shader(const char *name, const char *vs_path, const char *ps_path)
+{
+  std::string key = canonical_key(vs_path) + "|" + canonical_key(ps_path);
+  auto it = registry.shaders.find(key);
+  if (it != registry.shaders.end())
+    if (ShaderPtr shader = it->second.lock())
+    {
+      registry.hits++;
+      return shader;
+    }
+  registry.misses++;
+  ShaderPtr shader = compile_shader(name, vs_path, ps_path);
+  if (shader)
+    registry.shaders[key] = shader;
+  return shader;
+}
+
+AssetRegistryStats get_asset_registry_stats()
+{
+  registry.meshes.update_pending();
+  registry.textures.update_pending();
+
+  AssetRegistryStats stats = {};
+  stats.hits = registry.hits;
+  stats.misses = registry.misses;
+  stats.meshes = registry.meshes.count_alive();
+  stats.textures = registry.textures.count_alive();
+  for (auto it = registry.shaders.begin(); it != registry.shaders.end();)
+  {
+    if (it->second.expired())
+      it = registry.shaders.erase(it);
+    else
+    {
+      stats.shaders++;
+      ++it;
+    }
+  }
+  stats.pending = registry.meshes.pending.size() + registry.textures.pending.size();
+  for (auto &[key, weak] : registry.meshes.resident)
+    if (MeshPtr mesh = weak.lock())
+      stats.residentBytes += mesh->gpu_bytes();
+  for (auto &[key, weak] : registry.textures.resident)
+    if (Texture2DPtr texture = weak.lock())
+      stats.residentBytes += texture->texture.size();
+  return stats;
+}
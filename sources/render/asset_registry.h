@@ -0,0 +1,23 @@
+#pragma once
+#include <string>
+#include "asset_streaming.h"
+#include "shader.h"
+
+// Path keyed caches for the GL thread. Entries are weak, an asset is freed with its last user
+// and the next request for it loads it again. Keys are the canonical path plus the import settings.
+// A synchronous get of a key that is loading asynchronously waits for that load and drives its upload.
+MeshPtr get_mesh(const char *path, int idx);
+AsyncMeshPtr get_mesh_async(const char *path, int idx);
+Texture2DPtr get_texture2d(const char *path);
+AsyncTexture2DPtr get_texture2d_async(const char *path);
+ShaderPtr get_shader(const char *name, const char *vs_path, const char *ps_path);
+
+struct AssetRegistryStats
+{
+  int hits, misses;
+  int meshes, textures, shaders; // alive right now
+  int pending;                   // async loads not resident yet
+  size_t residentBytes;          // meshes and textures
+};
+
+AssetRegistryStats get_asset_registry_stats();
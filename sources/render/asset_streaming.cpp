@@ -0,0 +1,267 @@
+#include "asset_streaming.h"
+#include "mesh_cache.h"
+#include <job_system.h>
+#include <log.h>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include "glad/glad.h"
+
+constexpr size_t StagingBufferSize = 4 << 20;
+
+// One decoded asset on its way to the GPU, step copies at most max_bytes of it through the staging buffer.
+struct StagedUpload
+{
+  virtual ~StagedUpload() = default;
+  virtual size_t step(uint32_t staging, size_t max_bytes) = 0;
+  virtual bool done() const = 0;
+  // publishes the asset to its handle
+  virtual void finish() = 0;
+};
+
+static void copy_to_staging(uint32_t staging, const void *data, size_t size)
+{
+  // staging storage is mutable on purpose, invalidation lets the driver orphan it instead of waiting for the previous copy
+  memcpy(glMapNamedBufferRange(staging, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT), data, size);
+  glUnmapNamedBuffer(staging);
+}
+
+struct TextureUpload final : StagedUpload
+{
+  AsyncTexture2DPtr handle;
+  TextureData data;
+  Texture2DPtr texture;
+  int mip = 0;
+  uint32_t nextRow = 0; // pixel rows, or block rows of the current mip for compressed data
+
+  size_t step(uint32_t staging, size_t max_bytes) override
+  {
+    return data.compressed ? step_blocks(staging, max_bytes) : step_pixels(staging, max_bytes);
+  }
+
+  size_t step_pixels(uint32_t staging, size_t max_bytes)
+  {
+    if (!texture)
+      texture = allocate_texture2d(data.width, data.height, data.channels);
+    const size_t rowSize = size_t(data.width) * data.channels;
+    const int rows = clamp(int(max_bytes / rowSize), 1, data.height - int(nextRow));
+    const size_t bytes = rowSize * rows;
+
+    copy_to_staging(staging, data.pixels.get() + rowSize * nextRow, bytes);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging);
+    upload_texture2d_pixels(*texture, data.width, data.channels, nextRow, rows, nullptr);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    nextRow += rows;
+    if (int(nextRow) == data.height)
+      mip = 1;
+    return bytes;
+  }
+
+  size_t step_blocks(uint32_t staging, size_t max_bytes)
+  {
+    const CompressedTexture &compressed = *data.compressed;
+    if (!texture)
+      texture = allocate_texture2d(compressed);
+    const TextureMip &m = compressed.mips[mip];
+    const uint32_t blockRows = (m.height + 3) / 4;
+    const size_t rowSize = (m.width + 3) / 4 * texture_block_size(compressed.format);
+    const uint32_t rows = clamp(uint32_t(max_bytes / rowSize), 1u, blockRows - nextRow);
+    const size_t bytes = rowSize * rows;
+
+    copy_to_staging(staging, compressed.blocks + m.offset + rowSize * nextRow, bytes);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging);
+    upload_texture2d_blocks(*texture, compressed, mip, nextRow, rows, nullptr);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    nextRow += rows;
+    if (nextRow == blockRows)
+    {
+      mip++;
+      nextRow = 0;
+    }
+    return bytes;
+  }
+
+  bool done() const override { return mip == (data.compressed ? data.compressed->numMips : 1); }
+  void finish() override
+  {
+    finish_texture2d(*texture, !data.compressed);
+    handle->asset = std::move(texture);
+  }
+};
+
+struct MeshUpload final : StagedUpload
+{
+  AsyncMeshPtr handle;
+  std::unique_ptr<ImportedMesh> imported;
+  GpuBuffer buffers[2]; // vertices, indices
+  size_t offsets[2] = {0, 0};
+
+  size_t stream_size(int s) const { return s == 0 ? imported->vertex_bytes() : imported->index_bytes(); }
+  const uint8_t *stream_data(int s) const { return s == 0 ? imported->vertex_data() : imported->index_data(); }
+
+  size_t step(uint32_t staging, size_t max_bytes) override
+  {
+    if (!buffers[0])
+      for (int s = 0; s < 2; s++)
+        buffers[s] = GpuBuffer(GpuMemoryMesh, stream_size(s), nullptr);
+    const int s = offsets[0] < stream_size(0) ? 0 : 1;
+    const size_t bytes = std::min(max_bytes, stream_size(s) - offsets[s]);
+
+    copy_to_staging(staging, stream_data(s) + offsets[s], bytes);
+    // copies are allowed into immutable storage without GL_DYNAMIC_STORAGE_BIT
+    glCopyNamedBufferSubData(staging, buffers[s].get(), 0, offsets[s], bytes);
+    offsets[s] += bytes;
+    return bytes;
+  }
+  bool done() const override { return buffers[0] && offsets[0] == stream_size(0) && offsets[1] == stream_size(1); }
+  void finish() override
+  {
+    handle->asset = create_mesh(*imported, std::move(buffers[0]), std::move(buffers[1]));
+  }
+};
+
+// import failures still go through the queue, handles are only touched on the GL thread
+template<typename T>
+struct FailedUpload final : StagedUpload
+{
+  std::shared_ptr<AsyncAsset<T>> handle;
+
+  size_t step(uint32_t, size_t) override { return 0; }
+  bool done() const override { return true; }
+  void finish() override { handle->failed = true; }
+};
+
+struct AssetStreaming
+{
+  std::mutex mutex;
+  std::deque<std::unique_ptr<StagedUpload>> decoded; // filled by the job system
+  std::deque<std::unique_ptr<StagedUpload>> uploads; // GL thread only
+  std::atomic<int> loading{0};
+  GpuBuffer staging;
+
+  AssetStreamingStats stats = {};
+  int streamFrames = 0;
+  size_t streamBytes = 0;
+};
+
+static AssetStreaming streaming;
+
+static void push_decoded(std::unique_ptr<StagedUpload> &&upload)
+{
+  std::unique_lock<std::mutex> lock(streaming.mutex);
+  streaming.decoded.emplace_back(std::move(upload));
+  streaming.loading--;
+}
+
+AsyncMeshPtr load_mesh_async(const char *path, int idx)
+{
+  auto handle = std::make_shared<AsyncAsset<Mesh>>();
+  streaming.loading++;
+  schedule_job([handle, path = std::string(path), idx]() {
+    std::unique_ptr<ImportedMesh> imported = import_mesh(path.c_str(), idx);
+    if (!imported)
+    {
+      auto failed = std::make_unique<FailedUpload<Mesh>>();
+      failed->handle = handle;
+      push_decoded(std::move(failed));
+      return;
+    }
+    auto upload = std::make_unique<MeshUpload>();
+    upload->handle = handle;
+    upload->imported = std::move(imported);
+    push_decoded(std::move(upload));
+  });
+  return handle;
+}
+
+AsyncTexture2DPtr create_texture2d_async(const char *path)
+{
+  auto handle = std::make_shared<AsyncAsset<Texture2D>>();
+  streaming.loading++;
+  schedule_job([handle, path = std::string(path)]() {
+    TextureData data = load_texture_data(path.c_str());
+    if (!data.valid())
+    {
+      debug_error("can't load texture %s", path.c_str());
+      auto failed = std::make_unique<FailedUpload<Texture2D>>();
+      failed->handle = handle;
+      push_decoded(std::move(failed));
+      return;
+    }
+    auto upload = std::make_unique<TextureUpload>();
+    upload->handle = handle;
+    upload->data = std::move(data);
+    push_decoded(std::move(upload));
+  });
+  return handle;
+}
+
+void process_asset_uploads(float budget_ms, size_t budget_bytes)
+{
+  using clock = std::chrono::high_resolution_clock;
+  auto startTime = clock::now();
+  auto elapsed_ms = [&]() { return std::chrono::duration<float, std::milli>(clock::now() - startTime).count(); };
+
+  std::deque<std::unique_ptr<StagedUpload>> &uploads = streaming.uploads;
+  {
+    std::unique_lock<std::mutex> lock(streaming.mutex);
+    for (auto &upload : streaming.decoded)
+      uploads.emplace_back(std::move(upload));
+    streaming.decoded.clear();
+  }
+
+  AssetStreamingStats &stats = streaming.stats;
+  if (uploads.empty())
+  {
+    stats.frameBytes = 0;
+    stats.frameMs = 0.f;
+    stats.uploading = 0;
+    stats.loading = streaming.loading;
+    return;
+  }
+
+  if (!streaming.staging)
+    streaming.staging = GpuBuffer::streaming(GpuMemoryStreaming, StagingBufferSize);
+
+  size_t bytes = 0;
+  while (!uploads.empty())
+  {
+    StagedUpload &upload = *uploads.front();
+    if (!upload.done())
+    {
+      if (bytes >= budget_bytes || elapsed_ms() >= budget_ms)
+        break;
+      bytes += upload.step(streaming.staging.get(), std::min(budget_bytes - bytes, StagingBufferSize));
+    }
+    if (upload.done())
+    {
+      upload.finish();
+      uploads.pop_front();
+    }
+  }
+
+  stats.frameBytes = bytes;
+  stats.frameMs = elapsed_ms();
+  stats.totalBytes += bytes;
+  stats.worstFrameMs = max(stats.worstFrameMs, stats.frameMs);
+  stats.uploading = uploads.size();
+  stats.loading = streaming.loading;
+  streaming.streamFrames++;
+  streaming.streamBytes += bytes;
+
+  if (uploads.empty() && stats.loading == 0)
+  {
+    debug_log("asset streaming idle: %.2f MB uploaded over %d frames, worst frame %.2f ms",
+      streaming.streamBytes / float(1 << 20), streaming.streamFrames, stats.worstFrameMs);
+    stats.worstFrameMs = 0.f;
+    streaming.streamFrames = 0;
+    streaming.streamBytes = 0;
+  }
+}
+
+AssetStreamingStats get_asset_streaming_stats()
+{
+  return streaming.stats;
+}
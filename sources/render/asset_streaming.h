@@ -0,0 +1,40 @@
+#pragma once
+#include <memory>
+#include "mesh.h"
+#include "texture2d.h"
+
+// Handle filled on the GL thread once the asset is resident, until then asset is null.
+template<typename T>
+struct AsyncAsset
+{
+  std::shared_ptr<T> asset;
+  bool failed = false;
+
+  bool resident() const { return asset != nullptr; }
+};
+
+using AsyncMeshPtr = std::shared_ptr<AsyncAsset<Mesh>>;
+using AsyncTexture2DPtr = std::shared_ptr<AsyncAsset<Texture2D>>;
+
+// File I/O and decoding run on the job system, the GL part is left to process_asset_uploads.
+AsyncMeshPtr load_mesh_async(const char *path, int idx);
+AsyncTexture2DPtr create_texture2d_async(const char *path);
+
+constexpr float UploadBudgetMs = 2.f;
+constexpr size_t UploadBudgetBytes = 8 << 20;
+
+// Call once per frame on the GL thread, copies decoded assets to the GPU through a staging buffer
+// in slices until either budget runs out. Large assets take several frames.
+void process_asset_uploads(float budget_ms = UploadBudgetMs, size_t budget_bytes = UploadBudgetBytes);
+
+struct AssetStreamingStats
+{
+  int loading;        // decoding on the job system
+  int uploading;      // waiting for or in the middle of an upload
+  size_t frameBytes;  // uploaded by the last process_asset_uploads
+  float frameMs;
+  size_t totalBytes;
+  float worstFrameMs; // longest process_asset_uploads since the queue was last empty
+};
+
+AssetStreamingStats get_asset_streaming_stats();
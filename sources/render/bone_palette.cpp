@@ -0,0 +1,34 @@
+#include "bone_palette.h"
+#include "glad/glad.h"
+#include <cstring>
+#include <animation/skinning_matrices.h>
+#include <animation/dual_quat_skinning.h>
+
+static GpuRingAllocation upload(const void *palette, size_t bytes)
+{
+  static size_t alignment = 0;
+  if (!alignment)
+  {
+    GLint value;
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &value);
+    alignment = value;
+  }
+  GpuRingAllocation allocation = ring_allocate(bytes, alignment);
+  memcpy(allocation.data, palette, bytes);
+  return allocation;
+}
+
+GpuRingAllocation upload_bone_palette(const Affine3x4 *palette, int num_bones)
+{
+  return upload(palette, sizeof(Affine3x4) * num_bones);
+}
+
+GpuRingAllocation upload_bone_palette(const DualQuat *palette, int num_bones)
+{
+  return upload(palette, sizeof(DualQuat) * num_bones);
+}
+
+void bind_bone_palette(const GpuRingAllocation &palette)
+{
+  bind_ring_range(GL_SHADER_STORAGE_BUFFER, BonePaletteBinding, palette);
+}
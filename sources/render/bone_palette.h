@@ -0,0 +1,23 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "gpu_ring.h"
+
+struct Affine3x4;
+struct DualQuat;
+
+// Storage buffer binding of the BonePalette block in character_vs.glsl.
+constexpr uint32_t BonePaletteBinding = 1;
+
+// SkinningMode of character_vs.glsl. Also the int material property that picks the palette a character builds.
+enum SkinningMode
+{
+  SkinningRest,
+  SkinningLinear,
+  SkinningDualQuat
+};
+
+// Every character copies its bones into the frame's ring segment once and binds that range for its draws.
+GpuRingAllocation upload_bone_palette(const Affine3x4 *palette, int num_bones);
+GpuRingAllocation upload_bone_palette(const DualQuat *palette, int num_bones);
+void bind_bone_palette(const GpuRingAllocation &palette);
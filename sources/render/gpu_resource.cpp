@@ -0,0 +1,156 @@
+#include "gpu_resource.h"
+#include <utility>
+#include <vector>
+#include "glad/glad.h"
+
+struct PendingDelete
+{
+  void (*destroy)(uint32_t name);
+  uint32_t name;
+  size_t bytes;
+  GpuMemoryCategory category;
+  uint64_t frame;
+};
+
+struct GpuResources
+{
+  GpuMemoryStats stats = {};
+  std::vector<PendingDelete> pending;
+  uint64_t frame = 0;
+};
+
+// GL thread only, like the handles themselves
+static GpuResources &resources = *new GpuResources(); // never destroyed, handles in statics may outlive it
+
+const char *gpu_memory_category_name(GpuMemoryCategory category)
+{
+  switch (category)
+  {
+    case GpuMemoryMesh: return "mesh";
+    case GpuMemoryTexture: return "texture";
+    case GpuMemoryStreaming: return "streaming";
+    case GpuMemoryShader: return "shader";
+    default: return "unknown";
+  }
+}
+
+GpuMemoryStats get_gpu_memory_stats()
+{
+  GpuMemoryStats stats = resources.stats;
+  stats.pendingDeletes = resources.pending.size();
+  return stats;
+}
+
+template<typename Deleter>
+GpuHandle<Deleter>::GpuHandle(uint32_t name, size_t bytes, GpuMemoryCategory category) :
+  name(name), bytes(bytes), category(category)
+{
+  resources.stats.bytes[category] += bytes;
+  resources.stats.objects[category]++;
+}
+
+template<typename Deleter>
+GpuHandle<Deleter> &GpuHandle<Deleter>::operator=(GpuHandle &&other) noexcept
+{
+  if (this != &other)
+  {
+    reset();
+    name = std::exchange(other.name, 0);
+    bytes = std::exchange(other.bytes, 0);
+    category = other.category;
+  }
+  return *this;
+}
+
+template<typename Deleter>
+void GpuHandle<Deleter>::reset()
+{
+  if (name)
+    resources.pending.push_back(PendingDelete{Deleter::destroy, name, bytes, category, resources.frame});
+  name = 0;
+  bytes = 0;
+}
+
+template class GpuHandle<GpuBufferDeleter>;
+template class GpuHandle<GpuTextureDeleter>;
+template class GpuHandle<GpuVertexArrayDeleter>;
+template class GpuHandle<GpuProgramDeleter>;
+
+void GpuBufferDeleter::destroy(uint32_t name) { glDeleteBuffers(1, &name); }
+void GpuTextureDeleter::destroy(uint32_t name) { glDeleteTextures(1, &name); }
+void GpuVertexArrayDeleter::destroy(uint32_t name) { glDeleteVertexArrays(1, &name); }
+void GpuProgramDeleter::destroy(uint32_t name) { glDeleteProgram(name); }
+
+static uint32_t create_buffer_name()
+{
+  GLuint buffer;
+  glCreateBuffers(1, &buffer);
+  return buffer;
+}
+
+GpuBuffer::GpuBuffer(GpuMemoryCategory category, size_t size, const void *data, uint32_t flags) :
+  GpuHandle(create_buffer_name(), size, category)
+{
+  glNamedBufferStorage(name, size, data, flags);
+}
+
+GpuBuffer GpuBuffer::streaming(GpuMemoryCategory category, size_t size)
+{
+  GpuBuffer buffer(create_buffer_name(), size, category);
+  glNamedBufferData(buffer.name, size, nullptr, GL_STREAM_DRAW);
+  return buffer;
+}
+
+static uint32_t create_texture_name()
+{
+  GLuint texture;
+  glCreateTextures(GL_TEXTURE_2D, 1, &texture);
+  return texture;
+}
+
+GpuTexture::GpuTexture(GpuMemoryCategory category, int levels, uint32_t internal_format, int w, int h, size_t bytes) :
+  GpuHandle(create_texture_name(), bytes, category)
+{
+  glTextureStorage2D(name, levels, internal_format, w, h);
+}
+
+GpuVertexArray GpuVertexArray::create()
+{
+  GLuint vertexArray;
+  glCreateVertexArrays(1, &vertexArray);
+  return GpuVertexArray(vertexArray);
+}
+
+GpuProgram::GpuProgram(uint32_t program) : GpuHandle(program, 0, GpuMemoryShader)
+{
+}
+
+static void run_deletes(uint64_t until_frame)
+{
+  std::vector<PendingDelete> &pending = resources.pending;
+  size_t kept = 0;
+  for (PendingDelete &entry : pending)
+  {
+    if (entry.frame > until_frame)
+    {
+      pending[kept++] = entry;
+      continue;
+    }
+    entry.destroy(entry.name);
+    resources.stats.bytes[entry.category] -= entry.bytes;
+    resources.stats.objects[entry.category]--;
+  }
+  pending.resize(kept);
+}
+
+void end_gpu_frame()
+{
+  resources.frame++;
+  if (resources.frame >= GpuFramesInFlight)
+    run_deletes(resources.frame - GpuFramesInFlight);
+}
+
+void flush_gpu_deletes()
+{
+  run_deletes(resources.frame);
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+enum GpuMemoryCategory
+{
+  GpuMemoryMesh,
+  GpuMemoryTexture,
+  GpuMemoryStreaming, // staging and per-frame data
+  GpuMemoryShader,    // programs, counted but without a size
+  GpuMemoryCategoryCount
+};
+
+const char *gpu_memory_category_name(GpuMemoryCategory category);
+
+struct GpuMemoryStats
+{
+  size_t bytes[GpuMemoryCategoryCount];
+  int objects[GpuMemoryCategoryCount];
+  int pendingDeletes;
+};
+
+GpuMemoryStats get_gpu_memory_stats();
+
+// Owning GL names. Destruction only queues the delete, end_gpu_frame runs it once the frames
+// that could still reference the object are done on the GPU.
+template<typename Deleter>
+class GpuHandle
+{
+protected:
+  uint32_t name = 0;
+  size_t bytes = 0;
+  GpuMemoryCategory category = GpuMemoryMesh;
+
+  GpuHandle(uint32_t name, size_t bytes, GpuMemoryCategory category);
+
+public:
+  GpuHandle() = default;
+  GpuHandle(const GpuHandle &) = delete;
+  GpuHandle &operator=(const GpuHandle &) = delete;
+  GpuHandle(GpuHandle &&other) noexcept { *this = static_cast<GpuHandle &&>(other); }
+  GpuHandle &operator=(GpuHandle &&other) noexcept;
+  ~GpuHandle() { reset(); }
+
+  void reset();
+  uint32_t get() const { return name; }
+  size_t size() const { return bytes; }
+  explicit operator bool() const { return name != 0; }
+};
+
+struct GpuBufferDeleter { static void destroy(uint32_t name); };
+struct GpuTextureDeleter { static void destroy(uint32_t name); };
+struct GpuVertexArrayDeleter { static void destroy(uint32_t name); };
+struct GpuProgramDeleter { static void destroy(uint32_t name); };
+
+class GpuBuffer : public GpuHandle<GpuBufferDeleter>
+{
+  GpuBuffer(uint32_t name, size_t size, GpuMemoryCategory category) : GpuHandle(name, size, category) {}
+
+public:
+  GpuBuffer() = default;
+  // immutable storage, flags are glBufferStorage flags
+  GpuBuffer(GpuMemoryCategory category, size_t size, const void *data, uint32_t flags = 0);
+  // mutable storage for buffers orphaned on every write
+  static GpuBuffer streaming(GpuMemoryCategory category, size_t size);
+};
+
+class GpuTexture : public GpuHandle<GpuTextureDeleter>
+{
+public:
+  GpuTexture() = default;
+  // immutable 2d storage of levels mips, bytes is only for accounting
+  GpuTexture(GpuMemoryCategory category, int levels, uint32_t internal_format, int w, int h, size_t bytes);
+};
+
+class GpuVertexArray : public GpuHandle<GpuVertexArrayDeleter>
+{
+  explicit GpuVertexArray(uint32_t name) : GpuHandle(name, 0, GpuMemoryMesh) {}
+
+public:
+  GpuVertexArray() = default;
+  static GpuVertexArray create();
+};
+
+class GpuProgram : public GpuHandle<GpuProgramDeleter>
+{
+public:
+  GpuProgram() = default;
+  // takes ownership of an already linked program
+  explicit GpuProgram(uint32_t program);
+};
+
+// Frames the CPU may run ahead of the GPU, deletes wait this many end_gpu_frame calls.
+constexpr int GpuFramesInFlight = 3;
+
+void end_gpu_frame();
+// deletes everything queued, for shutdown
+void flush_gpu_deletes();
@@ -0,0 +1,110 @@
+#include "gpu_ring.h"
+#include "gpu_resource.h"
+#include "glad/glad.h"
+#include <log.h>
+#include <chrono>
+
+// 4 MB per frame holds a thousand palettes of 70 bones before the first grow
+constexpr size_t InitialSegmentBytes = 4 << 20;
+constexpr GLbitfield RingMapFlags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+static struct
+{
+  GpuBuffer buffer;
+  uint8_t *mapped = nullptr;
+  size_t segmentBytes = 0;
+  GLsync fences[GpuFramesInFlight] = {};
+  int segment = 0;
+  bool frameOpen = false;
+  size_t head = 0; // within the current segment
+  size_t frameBytes = 0;
+  GpuRingStats stats = {};
+} ring;
+
+static void create_ring(size_t segment_bytes)
+{
+  for (GLsync &fence : ring.fences)
+  {
+    // the old buffer's delete is deferred, nothing needs to wait for these
+    if (fence)
+      glDeleteSync(fence);
+    fence = nullptr;
+  }
+  ring.segmentBytes = segment_bytes;
+  ring.buffer = GpuBuffer(GpuMemoryStreaming, segment_bytes * GpuFramesInFlight, nullptr, RingMapFlags);
+  ring.mapped = (uint8_t *)glMapNamedBufferRange(ring.buffer.get(), 0, ring.buffer.size(), RingMapFlags);
+  ring.segment = 0;
+  ring.head = 0;
+  ring.stats.segmentBytes = segment_bytes;
+}
+
+static void wait_for_segment()
+{
+  GLsync &fence = ring.fences[ring.segment];
+  if (!fence)
+    return;
+  GLenum result = glClientWaitSync(fence, 0, 0);
+  if (result == GL_TIMEOUT_EXPIRED)
+  {
+    auto start = std::chrono::high_resolution_clock::now();
+    ring.stats.fenceWaits++;
+    do
+      result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+    while (result == GL_TIMEOUT_EXPIRED);
+    ring.stats.fenceWaitMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+  }
+  if (result == GL_WAIT_FAILED)
+    debug_error("ring buffer fence wait failed");
+  glDeleteSync(fence);
+  fence = nullptr;
+}
+
+GpuRingAllocation ring_allocate(size_t size, size_t alignment)
+{
+  if (!ring.buffer)
+    create_ring(InitialSegmentBytes);
+  if (!ring.frameOpen)
+  {
+    wait_for_segment();
+    ring.frameOpen = true;
+    ring.head = 0;
+    ring.frameBytes = 0;
+  }
+  size_t offset = (ring.head + alignment - 1) / alignment * alignment;
+  if (offset + size > ring.segmentBytes)
+  {
+    debug_log("ring buffer grows from %zu to %zu KB per frame", ring.segmentBytes >> 10, (2 * (ring.segmentBytes + size)) >> 10);
+    ring.stats.grows++;
+    create_ring(2 * (ring.segmentBytes + size));
+    offset = 0;
+  }
+  ring.head = offset + size;
+  ring.frameBytes += size;
+  ring.stats.totalBytes += size;
+
+  const size_t bufferOffset = ring.segment * ring.segmentBytes + offset;
+  return GpuRingAllocation{ring.buffer.get(), bufferOffset, size, ring.mapped + bufferOffset};
+}
+
+void end_ring_frame()
+{
+  if (!ring.frameOpen)
+  {
+    ring.stats.lastFrameBytes = 0;
+    return;
+  }
+  ring.fences[ring.segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  ring.stats.lastFrameBytes = ring.frameBytes;
+  ring.segment = (ring.segment + 1) % GpuFramesInFlight;
+  ring.frameOpen = false;
+}
+
+void bind_ring_range(uint32_t target, uint32_t index, const GpuRingAllocation &allocation)
+{
+  glBindBufferRange(target, index, allocation.buffer, allocation.offset, allocation.size);
+}
+
+GpuRingStats get_ring_stats()
+{
+  return ring.stats;
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Per-frame dynamic data (bone palettes, per-draw constants) written straight into a persistently
+// mapped, coherent buffer. The buffer is cut into GpuFramesInFlight segments: a frame fills one segment,
+// end_ring_frame fences it and the segment is written again only after that fence has passed.
+struct GpuRingAllocation
+{
+  uint32_t buffer = 0;
+  size_t offset = 0;
+  size_t size = 0;
+  void *data = nullptr; // write only, visible to the gpu without a flush
+};
+
+// The first allocation of a frame waits for its segment. A frame that outgrows its segment moves to a
+// bigger buffer on the spot, allocations handed out before keep the old one until the gpu is done with it.
+GpuRingAllocation ring_allocate(size_t size, size_t alignment);
+void end_ring_frame();
+
+// glBindBufferRange of an allocation, target is GL_UNIFORM_BUFFER or GL_SHADER_STORAGE_BUFFER
+void bind_ring_range(uint32_t target, uint32_t index, const GpuRingAllocation &allocation);
+
+struct GpuRingStats
+{
+  size_t segmentBytes;
+  size_t lastFrameBytes;  // streamed in the last finished frame
+  size_t totalBytes;
+  int fenceWaits;         // segments that weren't free yet when a frame wanted them
+  double fenceWaitMs;
+  int grows;
+};
+
+GpuRingStats get_ring_stats();
@@ -10,7 +10,9 @@ void Material::bind_uniforms_to_shader() const
   {
 
     int location = uniforms[property.shaderUniformIdx].shaderLocation;
-    if (const auto *v = std::get_if<float>(&property.value))
+    if (const auto *v = std::get_if<int>(&property.value))
+      shader->set_int(location, *v);
+    else if (const auto *v = std::get_if<float>(&property.value))
       shader->set_float(location, *v);
     else if (const auto *v = std::get_if<glm::vec2>(&property.value))
       shader->set_vec2(location, *v);
@@ -20,9 +22,7 @@ void Material::bind_uniforms_to_shader() const
       shader->set_vec4(location, *v);
     else if (const auto *v = std::get_if<Texture2DPtr>(&property.value))
     {
-      unsigned textureObject = (*v)->textureObject;
-      glActiveTexture(GL_TEXTURE0 + textureBinding);
-      glBindTexture(GL_TEXTURE_2D, textureObject);
+      glBindTextureUnit(textureBinding, (*v)->texture.get());
       glUniform1i(location, textureBinding);
       textureBinding++;
     }
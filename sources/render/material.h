@@ -4,16 +4,17 @@
 #include "log.h"
 #include "shader.h"
 #include "texture2d.h"
+#include "asset_registry.h"
 
 #define TYPES \
-  TYPE(float, GL_FLOAT) TYPE(vec2, GL_FLOAT_VEC2) TYPE(vec3, GL_FLOAT_VEC3) TYPE(vec4, GL_FLOAT_VEC4) TYPE(Texture2DPtr, GL_SAMPLER_2D)\
+  TYPE(int, GL_INT) TYPE(float, GL_FLOAT) TYPE(vec2, GL_FLOAT_VEC2) TYPE(vec3, GL_FLOAT_VEC3) TYPE(vec4, GL_FLOAT_VEC4) TYPE(Texture2DPtr, GL_SAMPLER_2D)\
 
 
 class Material
 {
 private:
   ShaderPtr shader;
-  using MaterialProperty = std::variant<float, glm::vec2, glm::vec3, glm::vec4, Texture2DPtr>;
+  using MaterialProperty = std::variant<int, float, glm::vec2, glm::vec3, glm::vec4, Texture2DPtr>;
 
   struct Property
   {
@@ -55,12 +56,23 @@ public:
     debug_error("property %s in shader %s didn't found", name, shader->name.c_str());
     return false;
   }
+
+  // null if the property was never set or holds another type
+  template<typename T>
+  const T *get_property(const char *name) const
+  {
+    for (const Property &p : properties)
+      if (p.name == name)
+        return std::get_if<T>(&p.value);
+    return nullptr;
+  }
 };
 
 using MaterialPtr = std::shared_ptr<Material>;
 
 inline MaterialPtr make_material(const char *name, const char *vs_file, const char *ps_file)
 {
-  ShaderPtr shader = compile_shader(name, vs_file, ps_file);
+  // programs are shared between materials, only the properties are per material
+  ShaderPtr shader = get_shader(name, vs_file, ps_file);
   return shader ? std::make_shared<Material>(std::move(shader)) : nullptr;
 }
\ No newline at end of file
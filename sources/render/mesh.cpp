@@ -1,72 +1,104 @@
 #include "mesh.h"
 #include <vector>
+#include <unordered_map>
 #include <3dmath.h>
 #include <assimp/scene.h>
 #include <assimp/Importer.hpp>
 #include <assimp/postprocess.h>
 #include <log.h>
+#include <chrono>
+#include <job_system.h>
 #include "glad/glad.h"
+#include "mesh_cache.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplify.h"
 
 
-static void create_indices(const std::vector<unsigned int> &indices)
+// every attribute reads the single interleaved stream bound to binding 0
+static void init_channel(uint32_t vao, int index, uint32_t offset, int component_count, GLenum type, bool normalized)
 {
-  GLuint arrayIndexBuffer;
-  glGenBuffers(1, &arrayIndexBuffer);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, arrayIndexBuffer);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices[0]) * indices.size(), indices.data(), GL_STATIC_DRAW);
-  glBindVertexArray(0);
+  glEnableVertexArrayAttrib(vao, index);
+  glVertexArrayAttribFormat(vao, index, component_count, type, normalized, offset);
+  glVertexArrayAttribBinding(vao, index, 0);
 }
 
-static void init_channel(int index, size_t data_size, const void *data_ptr, int component_count, bool is_float)
+static void init_integer_channel(uint32_t vao, int index, uint32_t offset, int component_count, GLenum type)
 {
-  GLuint arrayBuffer;
-  glGenBuffers(1, &arrayBuffer);
-  glBindBuffer(GL_ARRAY_BUFFER, arrayBuffer);
-  glBufferData(GL_ARRAY_BUFFER, data_size, data_ptr, GL_STATIC_DRAW);
-  glEnableVertexAttribArray(index);
+  glEnableVertexArrayAttrib(vao, index);
+  glVertexArrayAttribIFormat(vao, index, component_count, type, offset);
+  glVertexArrayAttribBinding(vao, index, 0);
+}
 
-  if (is_float)
-    glVertexAttribPointer(index, component_count, GL_FLOAT, GL_FALSE, 0, 0);
+static MeshPtr create_mesh(GpuBuffer &&vertex_buffer, GpuBuffer &&index_buffer, size_t numIndices, uint32_t indexSize,
+  const VertexLayout &layout, const VertexQuantization &quantization, vec3 boundsCenter, float boundsRadius,
+  int numLods, const MeshLodRange *lods)
+{
+  GpuVertexArray vertexArray = GpuVertexArray::create();
+  const uint32_t vao = vertexArray.get();
+  glVertexArrayVertexBuffer(vao, 0, vertex_buffer.get(), 0, layout.stride);
+  if (layout.quantizedPositions)
+    init_channel(vao, 0, 0, 4, GL_UNSIGNED_SHORT, true);
   else
-    glVertexAttribIPointer(index, component_count, GL_UNSIGNED_INT, 0, 0);
-}
+    init_channel(vao, 0, 0, 3, GL_FLOAT, false);
+  init_channel(vao, 1, layout.normal, 4, GL_INT_2_10_10_10_REV, true);
+  init_channel(vao, 2, layout.uv, 2, GL_UNSIGNED_SHORT, true);
+  init_channel(vao, 3, layout.weights, 4, GL_UNSIGNED_BYTE, true);
+  init_integer_channel(vao, 4, layout.boneIndex, 4, GL_UNSIGNED_BYTE);
+  glVertexArrayElementBuffer(vao, index_buffer.get());
 
+  return std::make_shared<Mesh>(std::move(vertexArray), std::move(vertex_buffer), std::move(index_buffer), numIndices, indexSize,
+    quantization, boundsCenter, boundsRadius, numLods, lods);
+}
 
-template<int i>
-static void InitChannel() { }
+static MeshPtr create_mesh(const uint8_t *indices, size_t numIndices, uint32_t indexSize, const uint8_t *vertices, uint32_t numVertices,
+  const VertexLayout &layout, const VertexQuantization &quantization, vec3 boundsCenter, float boundsRadius,
+  int numLods, const MeshLodRange *lods)
+{
+  GpuBuffer vertexBuffer(GpuMemoryMesh, size_t(layout.stride) * numVertices, vertices);
+  GpuBuffer indexBuffer(GpuMemoryMesh, size_t(indexSize) * numIndices, indices);
+  return create_mesh(std::move(vertexBuffer), std::move(indexBuffer), numIndices, indexSize, layout, quantization,
+    boundsCenter, boundsRadius, numLods, lods);
+}
 
-template<int i, typename T, typename... Channel>
-static void InitChannel(const std::vector<T> &channel, const Channel&... channels)
+MeshPtr create_mesh(const PackedMesh &packed)
 {
-  if (channel.size() > 0)
-  {
-    const int size = sizeof(T) / sizeof(channel[0][0]);
-    init_channel(i, sizeof(T) * channel.size(), channel.data(), size, !(std::is_same<T, uvec4>::value));
-  }
-  InitChannel<i + 1>(channels...);
+  if (packed.numLods == 0)
+    return nullptr;
+  return create_mesh(packed.indices.data(), packed.numIndices, packed.indexSize, packed.vertices.data(), packed.numVertices,
+    packed.layout, packed.quantization, packed.boundsCenter, packed.boundsRadius, packed.numLods, packed.lods);
 }
 
+MeshPtr create_mesh(const MeshData &data)
+{
+  return create_mesh(pack_mesh(data));
+}
 
-template<typename... Channel>
-MeshPtr create_mesh(const std::vector<unsigned int> &indices, const Channel&... channels)
+static MeshPtr create_mesh(const MeshCacheView &cache)
 {
-  uint32_t vertexArrayBufferObject;
-  glGenVertexArrays(1, &vertexArrayBufferObject);
-  glBindVertexArray(vertexArrayBufferObject);
-  InitChannel<0>(channels...);
-  create_indices(indices);
-  return std::make_shared<Mesh>(vertexArrayBufferObject, indices.size());
+  const MeshCacheHeader &header = *cache.header;
+  return create_mesh(cache.stream_as<uint8_t>(MeshStreamIndices), header.numIndices, header.indexSize,
+    cache.stream_as<uint8_t>(MeshStreamVertices), header.numVertices, header.layout, header.quantization,
+    header.boundsCenter, header.boundsRadius, header.numLods, header.lods);
 }
 
 
-MeshPtr create_mesh(const aiMesh *mesh)
+// depth first index of every node, the order import_model keeps nodes and build_skeleton keeps bones in
+static void index_nodes(const aiNode *node, uint32_t &next, std::unordered_map<std::string, uint32_t> &indices)
 {
-  std::vector<uint32_t> indices;
-  std::vector<vec3> vertices;
-  std::vector<vec3> normals;
-  std::vector<vec2> uv;
-  std::vector<vec4> weights;
-  std::vector<uvec4> weightsIndex;
+  indices.emplace(node->mName.C_Str(), next++);
+  for (unsigned i = 0; i < node->mNumChildren; i++)
+    index_nodes(node->mChildren[i], next, indices);
+}
+
+MeshData import_mesh_data(const aiScene *scene, const aiMesh *mesh)
+{
+  MeshData data;
+  std::vector<uint32_t> &indices = data.indices;
+  std::vector<vec3> &vertices = data.vertices;
+  std::vector<vec3> &normals = data.normals;
+  std::vector<vec2> &uv = data.uv;
+  std::vector<vec4> &weights = data.weights;
+  std::vector<uvec4> &weightsIndex = data.weightsIndex;
 
   int numVert = mesh->mNumVertices;
   int numFaces = mesh->mNumFaces;
@@ -82,25 +114,33 @@ MeshPtr create_mesh(const aiMesh *mesh)
     }
   }
 
+  // channels are independent, each one is split into chunks over the job system
+  constexpr size_t VertexGrain = 4096;
   if (mesh->HasPositions())
   {
     vertices.resize(numVert);
-    for (int i = 0; i < numVert; i++)
-      vertices[i] = to_vec3(mesh->mVertices[i]);
+    parallel_for(numVert, VertexGrain, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++)
+        vertices[i] = to_vec3(mesh->mVertices[i]);
+    });
   }
 
   if (mesh->HasNormals())
   {
     normals.resize(numVert);
-    for (int i = 0; i < numVert; i++)
-      normals[i] = to_vec3(mesh->mNormals[i]);
+    parallel_for(numVert, VertexGrain, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++)
+        normals[i] = to_vec3(mesh->mNormals[i]);
+    });
   }
 
   if (mesh->HasTextureCoords(0))
   {
     uv.resize(numVert);
-    for (int i = 0; i < numVert; i++)
-      uv[i] = to_vec2(mesh->mTextureCoords[0][i]);
+    parallel_for(numVert, VertexGrain, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++)
+        uv[i] = to_vec2(mesh->mTextureCoords[0][i]);
+    });
   }
 
   if (mesh->HasBones())
@@ -108,62 +148,147 @@ MeshPtr create_mesh(const aiMesh *mesh)
     weights.resize(numVert, vec4(0.f));
     weightsIndex.resize(numVert);
     int numBones = mesh->mNumBones;
+    // vertices keep the skeleton bone instead of the aiBone index, so one palette serves every mesh of a character
+    std::unordered_map<std::string, uint32_t> nodeIndices;
+    uint32_t numNodes = 0;
+    if (scene->mRootNode)
+      index_nodes(scene->mRootNode, numNodes, nodeIndices);
     std::vector<int> weightsOffset(numVert, 0);
+    // bones scatter into shared vertices, so this part stays serial
     for (int i = 0; i < numBones; i++)
     {
       const aiBone *bone = mesh->mBones[i];
-      //bonesMap[std::string(bone->mName.C_Str())] = i;
+      auto node = nodeIndices.find(bone->mName.C_Str());
+      uint32_t skeletonBone = 0;
+      if (node != nodeIndices.end())
+        skeletonBone = node->second;
+      else
+        debug_error("bone %s of mesh %s has no node", bone->mName.C_Str(), mesh->mName.C_Str());
 
       for (unsigned j = 0; j < bone->mNumWeights; j++)
       {
         int vertex = bone->mWeights[j].mVertexId;
         int offset = weightsOffset[vertex]++;
         weights[vertex][offset] = bone->mWeights[j].mWeight;
-        weightsIndex[vertex][offset] = i;
+        weightsIndex[vertex][offset] = skeletonBone;
       }
     }
     //the sum of weights not 1
-    for (int i = 0; i < numVert; i++)
-    {
-      vec4 w = weights[i];
-      float s = w.x + w.y + w.z + w.w;
-      weights[i] *= 1.f / s;
-    }
+    parallel_for(numVert, VertexGrain, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++)
+      {
+        vec4 w = weights[i];
+        float s = w.x + w.y + w.z + w.w;
+        weights[i] *= 1.f / s;
+      }
+    });
   }
-  return create_mesh(indices, vertices, normals, uv, weights, weightsIndex);
+  return data;
 }
 
-MeshPtr load_mesh(const char *path, int idx)
+const aiScene *read_scene(Assimp::Importer &importer, const char *path)
 {
-
-  Assimp::Importer importer;
   importer.SetPropertyBool(AI_CONFIG_IMPORT_FBX_PRESERVE_PIVOTS, false);
   importer.SetPropertyFloat(AI_CONFIG_GLOBAL_SCALE_FACTOR_KEY, 1.f);
 
   importer.ReadFile(path, aiPostProcessSteps::aiProcess_Triangulate | aiPostProcessSteps::aiProcess_LimitBoneWeights |
     aiPostProcessSteps::aiProcess_GenNormals | aiProcess_GlobalScale | aiProcess_FlipWindingOrder);
 
-  const aiScene* scene = importer.GetScene();
+  return importer.GetScene();
+}
+
+std::unique_ptr<ImportedMesh> import_mesh(const char *path, int idx)
+{
+  auto imported = std::make_unique<ImportedMesh>();
+  if (open_mesh_cache(path, idx, imported->cache))
+  {
+    imported->cached = true;
+    return imported;
+  }
+
+  Assimp::Importer importer;
+  const aiScene* scene = read_scene(importer, path);
   if (!scene)
   {
     debug_error("no asset in %s", path);
     return nullptr;
   }
 
-  return create_mesh(scene->mMeshes[idx]);
+  MeshData data = import_mesh_data(scene, scene->mMeshes[idx]);
+  optimize_mesh(path, data);
+  imported->packed = pack_mesh(generate_lods(path, data));
+  if (imported->packed.numLods == 0)
+  {
+    debug_error("can't pack mesh %d of %s", idx, path);
+    return nullptr;
+  }
+  save_mesh_cache(path, idx, imported->packed);
+  return imported;
+}
+
+MeshPtr create_mesh(const ImportedMesh &imported)
+{
+  return imported.cached ? create_mesh(imported.cache) : create_mesh(imported.packed);
+}
+
+MeshPtr create_mesh(const ImportedMesh &imported, GpuBuffer &&vertex_buffer, GpuBuffer &&index_buffer)
+{
+  if (imported.cached)
+  {
+    const MeshCacheHeader &header = *imported.cache.header;
+    return create_mesh(std::move(vertex_buffer), std::move(index_buffer), header.numIndices, header.indexSize, header.layout, header.quantization,
+      header.boundsCenter, header.boundsRadius, header.numLods, header.lods);
+  }
+  const PackedMesh &packed = imported.packed;
+  return create_mesh(std::move(vertex_buffer), std::move(index_buffer), packed.numIndices, packed.indexSize, packed.layout, packed.quantization,
+    packed.boundsCenter, packed.boundsRadius, packed.numLods, packed.lods);
+}
+
+MeshPtr load_mesh(const char *path, int idx)
+{
+  using clock = std::chrono::high_resolution_clock;
+  auto startTime = clock::now();
+  auto elapsed_ms = [&]() { return std::chrono::duration<float, std::milli>(clock::now() - startTime).count(); };
+
+  std::unique_ptr<ImportedMesh> imported = import_mesh(path, idx);
+  if (!imported)
+    return nullptr;
+  MeshPtr mesh = create_mesh(*imported);
+  debug_log("mesh %s[%d] %s %.2f ms", path, idx, imported->cached ? "warm load (cache)" : "cold load (fbx)", elapsed_ms());
+  return mesh;
+}
+
+void render(const MeshPtr &mesh, int lod)
+{
+  const MeshLodRange &range = mesh->lods[clamp(lod, 0, mesh->numLods - 1)];
+  glBindVertexArray(mesh->vertexArray.get());
+  GLenum indexType = mesh->indexSize == sizeof(uint16_t) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+  const void *firstIndex = (const void *)(size_t(range.firstIndex) * mesh->indexSize);
+  glDrawElementsBaseVertex(GL_TRIANGLES, range.numIndices, indexType, firstIndex, range.baseVertex);
 }
 
-void render(const MeshPtr &mesh)
+// projected simplification error budget, in fractions of the screen height
+constexpr float LodErrorBudget = 1.f / 1000.f;
+constexpr float LodHysteresis = 0.2f;
+
+int select_mesh_lod(const Mesh &mesh, float screen_size, int current_lod)
 {
-  glBindVertexArray(mesh->vertexArrayBufferObject);
-  glDrawElementsBaseVertex(GL_TRIANGLES, mesh->numIndices, GL_UNSIGNED_INT, 0, 0);
+  // lod errors are relative to the bounding radius, screen_size is the projected diameter
+  auto projected_error = [&](int lod) { return mesh.lods[lod].error * screen_size * 0.5f; };
+  int lod = clamp(current_lod, 0, mesh.numLods - 1);
+  while (lod + 1 < mesh.numLods && projected_error(lod + 1) < LodErrorBudget * (1.f - LodHysteresis))
+    lod++;
+  while (lod > 0 && projected_error(lod) > LodErrorBudget * (1.f + LodHysteresis))
+    lod--;
+  return lod;
 }
 
 MeshPtr make_plane_mesh()
 {
-  std::vector<uint32_t> indices = {0,1,2,0,2,3};
-  std::vector<vec3> vertices = {vec3(-1,0,-1), vec3(1,0,-1), vec3(1,0,1), vec3(-1,0,1)};
-  std::vector<vec3> normals(4, vec3(0,1,0));
-  std::vector<vec2> uv = {vec2(0,0), vec2(1,0), vec2(1,1), vec2(0,1)};
-  return create_mesh(indices, vertices, normals, uv);
+  MeshData data;
+  data.indices = {0,1,2,0,2,3};
+  data.vertices = {vec3(-1,0,-1), vec3(1,0,-1), vec3(1,0,1), vec3(-1,0,1)};
+  data.normals = std::vector<vec3>(4, vec3(0,1,0));
+  data.uv = {vec2(0,0), vec2(1,0), vec2(1,1), vec2(0,1)};
+  return create_mesh(data);
 }
@@ -1,22 +1,71 @@
 #pragma once
 #include <map>
 #include <memory>
+#include <algorithm>
+#include <vector>
+#include <3dmath.h>
+#include "vertex_format.h"
+#include "gpu_resource.h"
 
 
 struct Mesh
 {
-  const uint32_t vertexArrayBufferObject;
+  const GpuVertexArray vertexArray;
+  const GpuBuffer vertexBuffer, indexBuffer;
   const int numIndices;
+  const uint32_t indexSize;
+  const VertexQuantization quantization;
+  const vec3 boundsCenter;
+  const float boundsRadius;
+  const int numLods;
+  MeshLodRange lods[MaxMeshLods];
 
-  Mesh(uint32_t vertexArrayBufferObject, int numIndices) :
-    vertexArrayBufferObject(vertexArrayBufferObject),
-    numIndices(numIndices)
-    {}
+  Mesh(GpuVertexArray &&vertexArray, GpuBuffer &&vertexBuffer, GpuBuffer &&indexBuffer, int numIndices, uint32_t indexSize,
+    const VertexQuantization &quantization, vec3 boundsCenter, float boundsRadius, int numLods, const MeshLodRange *lod_ranges) :
+    vertexArray(std::move(vertexArray)),
+    vertexBuffer(std::move(vertexBuffer)),
+    indexBuffer(std::move(indexBuffer)),
+    numIndices(numIndices),
+    indexSize(indexSize),
+    quantization(quantization),
+    boundsCenter(boundsCenter),
+    boundsRadius(boundsRadius),
+    numLods(numLods)
+    {
+      std::copy(lod_ranges, lod_ranges + numLods, lods);
+    }
+
+  size_t gpu_bytes() const { return vertexBuffer.size() + indexBuffer.size(); }
 };
 
 using MeshPtr = std::shared_ptr<Mesh>;
 
+// CPU side copy of an imported mesh, pack_mesh turns it into the GPU layout
+struct MeshData
+{
+  std::vector<uint32_t> indices;
+  std::vector<vec3> vertices;
+  std::vector<vec3> normals;
+  std::vector<vec2> uv;
+  std::vector<vec4> weights;
+  std::vector<uvec4> weightsIndex;
+};
+
+struct aiMesh;
+struct aiScene;
+namespace Assimp { class Importer; }
+// the single place with import settings, shared by load_mesh and load_model
+const aiScene *read_scene(Assimp::Importer &importer, const char *path);
+// weightsIndex holds depth first node indices of the scene, which are the bone indices of its skeleton
+MeshData import_mesh_data(const aiScene *scene, const aiMesh *mesh);
+MeshPtr create_mesh(const MeshData &data);
+MeshPtr create_mesh(const PackedMesh &packed);
+
 MeshPtr load_mesh(const char *path, int idx);
 MeshPtr make_plane_mesh();
 
-void render(const MeshPtr &mesh);
\ No newline at end of file
+void render(const MeshPtr &mesh, int lod = 0);
+
+// Picks the lod for a mesh whose bounding sphere covers screen_size of the screen height,
+// switching only when the projected error leaves the [1 - h, 1 + h] band around the budget.
+int select_mesh_lod(const Mesh &mesh, float screen_size, int current_lod);
@@ -0,0 +1,128 @@
+#include "mesh_cache.h"
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <log.h>
+
+constexpr uint64_t StreamAlignment = 16;
+
+std::string mesh_cache_path(const char *path, int idx)
+{
+  return std::string(path) + "." + std::to_string(idx) + ".meshbin";
+}
+
+bool open_mesh_cache(const char *path, int idx, MeshCacheView &view)
+{
+  uint64_t sourceSize;
+  int64_t sourceTime;
+  if (!file_stamp(path, sourceSize, sourceTime))
+    return false;
+
+  if (!view.file.open(mesh_cache_path(path, idx).c_str()))
+    return false;
+
+  if (view.file.size() < sizeof(MeshCacheHeader))
+    return false;
+  const MeshCacheHeader *header = (const MeshCacheHeader *)view.file.data();
+  if (header->magic != MeshCacheMagic || header->version != MeshCacheVersion ||
+      header->sourceSize != sourceSize || header->sourceTime != sourceTime ||
+      header->numLods < 1 || header->numLods > MaxMeshLods)
+    return false;
+
+  // a stale or damaged file falls back to import, nothing of it may reach gl unchecked
+  const uint64_t fileSize = view.file.size();
+  for (int s = 0; s < MeshStreamCount; s++)
+    if (header->streamOffset[s] > fileSize || header->streamSize[s] > fileSize - header->streamOffset[s])
+    {
+      debug_error("mesh cache %s is truncated", mesh_cache_path(path, idx).c_str());
+      return false;
+    }
+  bool valid = (header->indexSize == 2 || header->indexSize == 4) &&
+               header->streamSize[MeshStreamIndices] == uint64_t(header->numIndices) * header->indexSize &&
+               header->streamSize[MeshStreamVertices] == uint64_t(header->numVertices) * header->layout.stride;
+  for (int i = 0; valid && i < header->numLods; i++)
+  {
+    const MeshLodRange &lod = header->lods[i];
+    valid = uint64_t(lod.firstIndex) + lod.numIndices <= header->numIndices &&
+            uint64_t(lod.baseVertex) + lod.numVertices <= header->numVertices;
+  }
+  if (!valid)
+  {
+    debug_error("mesh cache %s has inconsistent stream sizes", mesh_cache_path(path, idx).c_str());
+    return false;
+  }
+
+  view.header = header;
+  return true;
+}
+
+template<typename T>
+static void add_stream(MeshCacheHeader &header, MeshCacheStream s, const std::vector<T> &stream, uint64_t &offset)
+{
+  header.streamSize[s] = sizeof(T) * stream.size();
+  header.streamOffset[s] = stream.empty() ? 0 : offset;
+  offset = (offset + header.streamSize[s] + StreamAlignment - 1) & ~(StreamAlignment - 1);
+}
+
+template<typename T>
+static void write_stream(std::ofstream &file, const MeshCacheHeader &header, MeshCacheStream s, const std::vector<T> &stream)
+{
+  if (stream.empty())
+    return;
+  file.seekp(header.streamOffset[s]);
+  file.write((const char *)stream.data(), header.streamSize[s]);
+}
+
+bool save_mesh_cache(const char *path, int idx, const PackedMesh &mesh)
+{
+  MeshCacheHeader header = {};
+  header.magic = MeshCacheMagic;
+  header.version = MeshCacheVersion;
+  if (!file_stamp(path, header.sourceSize, header.sourceTime))
+    return false;
+  header.numIndices = mesh.numIndices;
+  header.numVertices = mesh.numVertices;
+  header.indexSize = mesh.indexSize;
+  header.layout = mesh.layout;
+  header.quantization = mesh.quantization;
+  header.boundsCenter = mesh.boundsCenter;
+  header.boundsRadius = mesh.boundsRadius;
+  header.numLods = mesh.numLods;
+  std::copy(mesh.lods, mesh.lods + MaxMeshLods, header.lods);
+
+  uint64_t offset = (sizeof(MeshCacheHeader) + StreamAlignment - 1) & ~(StreamAlignment - 1);
+  add_stream(header, MeshStreamIndices, mesh.indices, offset);
+  add_stream(header, MeshStreamVertices, mesh.vertices, offset);
+
+  // the cache may be mapped by another load, so it is written aside and renamed over the old one
+  const std::string cachePath = mesh_cache_path(path, idx);
+  const std::string tempPath = cachePath + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+  {
+    std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+    if (!file)
+    {
+      debug_error("can't write mesh cache %s", tempPath.c_str());
+      return false;
+    }
+    file.write((const char *)&header, sizeof(header));
+    write_stream(file, header, MeshStreamIndices, mesh.indices);
+    write_stream(file, header, MeshStreamVertices, mesh.vertices);
+    if (!file.good())
+    {
+      file.close();
+      std::remove(tempPath.c_str());
+      debug_error("can't write mesh cache %s", tempPath.c_str());
+      return false;
+    }
+  }
+  std::error_code ec;
+  std::filesystem::rename(tempPath, cachePath, ec);
+  if (ec)
+  {
+    std::remove(tempPath.c_str());
+    debug_error("can't replace mesh cache %s: %s", cachePath.c_str(), ec.message().c_str());
+    return false;
+  }
+  return true;
+}
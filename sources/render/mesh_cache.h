@@ -0,0 +1,85 @@
+#pragma once
+#include <string>
+#include <mapped_file.h>
+#include "mesh.h"
+
+// Baked binary mesh: a header followed by the index and interleaved vertex streams of PackedMesh,
+// so a warm start maps the file and uploads it without touching assimp.
+constexpr uint32_t MeshCacheMagic = 0x4248534D; // "MSHB"
+constexpr uint32_t MeshCacheVersion = 6;
+
+enum MeshCacheStream
+{
+  MeshStreamIndices,
+  MeshStreamVertices,
+  MeshStreamCount
+};
+
+struct MeshCacheHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint64_t sourceSize;
+  int64_t sourceTime;
+  uint32_t numIndices;
+  uint32_t numVertices;
+  uint32_t indexSize;
+  VertexLayout layout;
+  VertexQuantization quantization;
+  vec3 boundsCenter;
+  float boundsRadius;
+  int32_t numLods;
+  MeshLodRange lods[MaxMeshLods];
+  uint64_t streamOffset[MeshStreamCount]; // 0 if the stream is absent
+  uint64_t streamSize[MeshStreamCount];
+};
+
+struct MeshCacheView
+{
+  MappedFile file;
+  const MeshCacheHeader *header = nullptr;
+
+  const void *stream(MeshCacheStream s) const
+  {
+    return header->streamOffset[s] ? file.data() + header->streamOffset[s] : nullptr;
+  }
+  template<typename T>
+  const T *stream_as(MeshCacheStream s) const { return (const T *)stream(s); }
+};
+
+std::string mesh_cache_path(const char *path, int idx);
+
+// Returns false if the cache is missing, of another version or older than the source asset.
+bool open_mesh_cache(const char *path, int idx, MeshCacheView &view);
+bool save_mesh_cache(const char *path, int idx, const PackedMesh &mesh);
+
+// CPU half of load_mesh, either a mapped cache or a freshly imported and packed mesh.
+// import_mesh runs on any thread, create_mesh uploads the result on the GL thread.
+struct ImportedMesh
+{
+  MeshCacheView cache;
+  PackedMesh packed;
+  bool cached = false;
+
+  const uint8_t *index_data() const
+  {
+    return cached ? cache.stream_as<uint8_t>(MeshStreamIndices) : packed.indices.data();
+  }
+  size_t index_bytes() const
+  {
+    return cached ? cache.header->streamSize[MeshStreamIndices] : packed.indices.size();
+  }
+  const uint8_t *vertex_data() const
+  {
+    return cached ? cache.stream_as<uint8_t>(MeshStreamVertices) : packed.vertices.data();
+  }
+  size_t vertex_bytes() const
+  {
+    return cached ? cache.header->streamSize[MeshStreamVertices] : packed.vertices.size();
+  }
+};
+
+std::unique_ptr<ImportedMesh> import_mesh(const char *path, int idx);
+MeshPtr create_mesh(const ImportedMesh &imported);
+// for buffers already filled with index_data() and vertex_data(), e.g. by a staged upload
+MeshPtr create_mesh(const ImportedMesh &imported, GpuBuffer &&vertex_buffer, GpuBuffer &&index_buffer);
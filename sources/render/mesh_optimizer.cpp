@@ -0,0 +1,315 @@
+#include "mesh_optimizer.h"
+#include "mesh.h"
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <unordered_map>
+#include <log.h>
+
+VertexCacheStats analyze_vertex_cache(const uint32_t *indices, size_t numIndices, uint32_t numVertices)
+{
+  // cacheTime[v] is the value of misses when v entered the cache, FIFO order makes this enough,
+  // the first use of a vertex is always a miss
+  std::vector<uint32_t> cacheTime(numVertices, 0);
+  std::vector<bool> used(numVertices, false);
+  uint32_t misses = 0, usedVertices = 0;
+  for (size_t i = 0; i < numIndices; i++)
+  {
+    uint32_t v = indices[i];
+    if (!used[v])
+    {
+      used[v] = true;
+      usedVertices++;
+    }
+    else if (misses - cacheTime[v] < VertexCacheSize)
+      continue;
+    cacheTime[v] = misses++;
+  }
+  size_t numTriangles = numIndices / 3;
+  return VertexCacheStats{
+    numTriangles ? float(misses) / numTriangles : 0.f,
+    usedVertices ? float(misses) / usedVertices : 0.f};
+}
+
+template<typename T>
+static void gather_channel(std::vector<T> &channel, const std::vector<uint32_t> &source)
+{
+  if (channel.empty())
+    return;
+  std::vector<T> result(source.size());
+  for (size_t i = 0; i < source.size(); i++)
+    result[i] = channel[source[i]];
+  channel = std::move(result);
+}
+
+// source[new vertex] = old vertex, indices are remapped by the caller
+static void gather_vertices(MeshData &data, const std::vector<uint32_t> &source)
+{
+  gather_channel(data.vertices, source);
+  gather_channel(data.normals, source);
+  gather_channel(data.uv, source);
+  gather_channel(data.weights, source);
+  gather_channel(data.weightsIndex, source);
+}
+
+struct VertexKey
+{
+  const MeshData *data;
+  uint32_t index;
+};
+
+template<typename T>
+static bool channel_equal(const std::vector<T> &channel, uint32_t a, uint32_t b)
+{
+  return channel.empty() || memcmp(&channel[a], &channel[b], sizeof(T)) == 0;
+}
+
+template<typename T>
+static void channel_hash(const std::vector<T> &channel, uint32_t i, size_t &hash)
+{
+  if (channel.empty())
+    return;
+  const uint8_t *bytes = (const uint8_t *)&channel[i];
+  for (size_t j = 0; j < sizeof(T); j++)
+    hash = (hash ^ bytes[j]) * 1099511628211ull; // FNV-1a
+}
+
+struct VertexKeyHash
+{
+  size_t operator()(const VertexKey &key) const
+  {
+    size_t hash = 14695981039346656037ull;
+    channel_hash(key.data->vertices, key.index, hash);
+    channel_hash(key.data->normals, key.index, hash);
+    channel_hash(key.data->uv, key.index, hash);
+    channel_hash(key.data->weights, key.index, hash);
+    channel_hash(key.data->weightsIndex, key.index, hash);
+    return hash;
+  }
+};
+
+struct VertexKeyEqual
+{
+  bool operator()(const VertexKey &a, const VertexKey &b) const
+  {
+    const MeshData &d = *a.data;
+    return channel_equal(d.vertices, a.index, b.index) && channel_equal(d.normals, a.index, b.index) &&
+      channel_equal(d.uv, a.index, b.index) && channel_equal(d.weights, a.index, b.index) &&
+      channel_equal(d.weightsIndex, a.index, b.index);
+  }
+};
+
+void weld_vertices(MeshData &data)
+{
+  uint32_t numVertices = data.vertices.size();
+  std::unordered_map<VertexKey, uint32_t, VertexKeyHash, VertexKeyEqual> unique;
+  unique.reserve(numVertices);
+  std::vector<uint32_t> remap(numVertices);
+  std::vector<uint32_t> firstVertex;
+  for (uint32_t i = 0; i < numVertices; i++)
+  {
+    auto [it, inserted] = unique.emplace(VertexKey{&data, i}, (uint32_t)firstVertex.size());
+    if (inserted)
+      firstVertex.push_back(i);
+    remap[i] = it->second;
+  }
+  if (firstVertex.size() == numVertices)
+    return;
+
+  for (uint32_t &index : data.indices)
+    index = remap[index];
+  gather_vertices(data, firstVertex);
+}
+
+struct TriangleAdjacency
+{
+  std::vector<uint32_t> offsets; // numVertices + 1
+  std::vector<uint32_t> triangles;
+};
+
+static TriangleAdjacency build_adjacency(const std::vector<uint32_t> &indices, uint32_t numVertices)
+{
+  TriangleAdjacency adjacency;
+  adjacency.offsets.assign(numVertices + 1, 0);
+  for (uint32_t index : indices)
+    adjacency.offsets[index + 1]++;
+  std::partial_sum(adjacency.offsets.begin(), adjacency.offsets.end(), adjacency.offsets.begin());
+  adjacency.triangles.resize(indices.size());
+  std::vector<uint32_t> fill(adjacency.offsets.begin(), adjacency.offsets.end() - 1);
+  for (size_t i = 0; i < indices.size(); i++)
+    adjacency.triangles[fill[indices[i]]++] = i / 3;
+  return adjacency;
+}
+
+// returns triangle order and the start of each cluster in it
+static std::vector<uint32_t> tipsify(const std::vector<uint32_t> &indices, uint32_t numVertices, std::vector<uint32_t> &clusters)
+{
+  const int cacheSize = VertexCacheSize;
+  const uint32_t numTriangles = indices.size() / 3;
+  TriangleAdjacency adjacency = build_adjacency(indices, numVertices);
+
+  std::vector<int> liveTriangles(numVertices);
+  for (uint32_t v = 0; v < numVertices; v++)
+    liveTriangles[v] = adjacency.offsets[v + 1] - adjacency.offsets[v];
+  std::vector<int> cacheTime(numVertices, 0);
+  std::vector<bool> emitted(numTriangles, false);
+  std::vector<uint32_t> deadEnd;
+  std::vector<uint32_t> candidates;
+  std::vector<uint32_t> order;
+  order.reserve(numTriangles);
+
+  int timeStamp = cacheSize + 1;
+  uint32_t cursor = 0;
+  int fanning = numVertices > 0 ? 0 : -1;
+  clusters.assign(1, 0);
+
+  while (fanning >= 0)
+  {
+    candidates.clear();
+    for (uint32_t a = adjacency.offsets[fanning]; a < adjacency.offsets[fanning + 1]; a++)
+    {
+      uint32_t t = adjacency.triangles[a];
+      if (emitted[t])
+        continue;
+      emitted[t] = true;
+      order.push_back(t);
+      for (int j = 0; j < 3; j++)
+      {
+        uint32_t v = indices[t * 3 + j];
+        deadEnd.push_back(v);
+        candidates.push_back(v);
+        liveTriangles[v]--;
+        if (timeStamp - cacheTime[v] > cacheSize)
+          cacheTime[v] = timeStamp++;
+      }
+    }
+
+    // pick the candidate that stays in cache the longest after emitting all its triangles
+    int best = -1, bestPriority = -1;
+    for (uint32_t v : candidates)
+    {
+      if (liveTriangles[v] <= 0)
+        continue;
+      int priority = 0;
+      if (timeStamp - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize)
+        priority = timeStamp - cacheTime[v];
+      if (priority > bestPriority)
+      {
+        bestPriority = priority;
+        best = v;
+      }
+    }
+
+    if (best < 0)
+    {
+      // dead end: the cache is effectively flushed, which is a hard boundary for overdraw clusters
+      while (!deadEnd.empty() && best < 0)
+      {
+        uint32_t v = deadEnd.back();
+        deadEnd.pop_back();
+        if (liveTriangles[v] > 0)
+          best = v;
+      }
+      while (best < 0 && cursor < numVertices)
+      {
+        if (liveTriangles[cursor] > 0)
+          best = cursor;
+        cursor++;
+      }
+      if (best >= 0 && order.size() > clusters.back())
+        clusters.push_back(order.size());
+    }
+    fanning = best;
+  }
+  clusters.push_back(order.size());
+  return order;
+}
+
+void optimize_vertex_cache(MeshData &data)
+{
+  if (data.indices.empty())
+    return;
+  const std::vector<uint32_t> &indices = data.indices;
+  std::vector<uint32_t> clusters;
+  std::vector<uint32_t> order = tipsify(indices, data.vertices.size(), clusters);
+
+  // Sander et al. "fast linear-speed overdraw": clusters that face away from the mesh center
+  // are likely to occlude the rest, so they go first
+  auto triangle_vertex = [&](uint32_t t, int j) { return data.vertices[indices[t * 3 + j]]; };
+  vec3 meshCenter(0.f);
+  float meshArea = 0.f;
+  for (uint32_t t = 0; t < indices.size() / 3; t++)
+  {
+    vec3 p0 = triangle_vertex(t, 0), p1 = triangle_vertex(t, 1), p2 = triangle_vertex(t, 2);
+    float area = length(cross(p1 - p0, p2 - p0));
+    meshCenter += (p0 + p1 + p2) * (area / 3.f);
+    meshArea += area;
+  }
+  meshCenter = meshArea > 0.f ? meshCenter / meshArea : vec3(0.f);
+
+  const size_t numClusters = clusters.size() - 1;
+  std::vector<float> sortKey(numClusters);
+  for (size_t c = 0; c < numClusters; c++)
+  {
+    vec3 center(0.f), normal(0.f);
+    float area = 0.f;
+    for (uint32_t i = clusters[c]; i < clusters[c + 1]; i++)
+    {
+      uint32_t t = order[i];
+      vec3 p0 = triangle_vertex(t, 0), p1 = triangle_vertex(t, 1), p2 = triangle_vertex(t, 2);
+      vec3 n = cross(p1 - p0, p2 - p0);
+      float triangleArea = length(n);
+      center += (p0 + p1 + p2) * (triangleArea / 3.f);
+      normal += n;
+      area += triangleArea;
+    }
+    center = area > 0.f ? center / area : center;
+    float normalLength = length(normal);
+    sortKey[c] = normalLength > 0.f ? dot(center - meshCenter, normal / normalLength) : 0.f;
+  }
+  std::vector<uint32_t> clusterOrder(numClusters);
+  std::iota(clusterOrder.begin(), clusterOrder.end(), 0);
+  std::stable_sort(clusterOrder.begin(), clusterOrder.end(), [&](uint32_t a, uint32_t b) { return sortKey[a] > sortKey[b]; });
+
+  std::vector<uint32_t> result;
+  result.reserve(indices.size());
+  for (uint32_t c : clusterOrder)
+    for (uint32_t i = clusters[c]; i < clusters[c + 1]; i++)
+      for (int j = 0; j < 3; j++)
+        result.push_back(indices[order[i] * 3 + j]);
+  data.indices = std::move(result);
+}
+
+void optimize_vertex_fetch(MeshData &data)
+{
+  const uint32_t numVertices = data.vertices.size();
+  std::vector<uint32_t> remap(numVertices, ~0u);
+  std::vector<uint32_t> source;
+  source.reserve(numVertices);
+  for (uint32_t &index : data.indices)
+  {
+    if (remap[index] == ~0u)
+    {
+      remap[index] = source.size();
+      source.push_back(index);
+    }
+    index = remap[index];
+  }
+  // unreferenced vertices are dropped
+  gather_vertices(data, source);
+}
+
+void optimize_mesh(const char *name, MeshData &data)
+{
+  const uint32_t numVertices = data.vertices.size();
+  VertexCacheStats before = analyze_vertex_cache(data.indices.data(), data.indices.size(), numVertices);
+
+  weld_vertices(data);
+  optimize_vertex_cache(data);
+  optimize_vertex_fetch(data);
+
+  VertexCacheStats after = analyze_vertex_cache(data.indices.data(), data.indices.size(), data.vertices.size());
+  debug_log("mesh %s optimized: %u -> %u vertices, %u triangles, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f, %d bit indices",
+    name, numVertices, (uint32_t)data.vertices.size(), (uint32_t)data.indices.size() / 3,
+    before.acmr, after.acmr, before.atvr, after.atvr, data.vertices.size() <= 65536 ? 16 : 32);
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct MeshData;
+
+// Simulated post-transform cache, FIFO of VertexCacheSize entries like most desktop GPUs.
+constexpr int VertexCacheSize = 16;
+
+struct VertexCacheStats
+{
+  float acmr; // cache misses per triangle, 0.5 is the ideal for a regular grid
+  float atvr; // cache misses per referenced vertex, 1.0 is the ideal
+};
+
+VertexCacheStats analyze_vertex_cache(const uint32_t *indices, size_t numIndices, uint32_t numVertices);
+
+// Merges vertices equal in every channel, skin weights and bone indices included.
+void weld_vertices(MeshData &data);
+
+// Tipsify (Sander et al. 2007): reorders triangles for the post-transform cache,
+// then sorts the resulting clusters so the outward facing ones are drawn first to reduce overdraw.
+void optimize_vertex_cache(MeshData &data);
+
+// Renumbers vertices in the order the index buffer first uses them.
+void optimize_vertex_fetch(MeshData &data);
+
+// All of the above, logs ACMR/ATVR before and after.
+void optimize_mesh(const char *name, MeshData &data);
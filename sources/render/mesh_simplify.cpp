@@ -0,0 +1,345 @@
+#include "mesh_simplify.h"
+#include "mesh_optimizer.h"
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+#include <log.h>
+
+// relative to the bounding radius, the last lods are meant for characters a few dozen pixels tall
+constexpr float LodErrorLimits[MaxMeshLods] = {0.f, 0.01f, 0.025f, 0.06f};
+constexpr int LodMaxInfluences[MaxMeshLods] = {4, 4, 2, 2};
+// sum of absolute weight differences allowed between the two ends of a collapse
+constexpr float MaxSkinDistance = 0.5f;
+
+struct Quadric
+{
+  // symmetric 4x4 matrix of the plane equation ax + by + cz + d
+  double a2 = 0, ab = 0, ac = 0, ad = 0, b2 = 0, bc = 0, bd = 0, c2 = 0, cd = 0, d2 = 0;
+  double weight = 0; // total area, keeps the error in squared distance units
+
+  void add_plane(vec3 n, float d, float weight)
+  {
+    a2 += weight * n.x * n.x; ab += weight * n.x * n.y; ac += weight * n.x * n.z; ad += weight * n.x * d;
+    b2 += weight * n.y * n.y; bc += weight * n.y * n.z; bd += weight * n.y * d;
+    c2 += weight * n.z * n.z; cd += weight * n.z * d;
+    d2 += weight * d * d;
+    this->weight += weight;
+  }
+  void add(const Quadric &q)
+  {
+    a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad; b2 += q.b2; bc += q.bc; bd += q.bd; c2 += q.c2; cd += q.cd; d2 += q.d2;
+    weight += q.weight;
+  }
+  double error(vec3 p) const
+  {
+    double x = p.x, y = p.y, z = p.z;
+    double e = a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x
+             + b2 * y * y + 2 * bc * y * z + 2 * bd * y
+             + c2 * z * z + 2 * cd * z
+             + d2;
+    return e > 0 && weight > 0 ? e / weight : 0;
+  }
+};
+
+struct Collapse
+{
+  uint32_t from, to;
+  double cost;
+};
+
+static float skin_distance(const MeshData &data, uint32_t a, uint32_t b)
+{
+  float distance = 0.f;
+  for (int i = 0; i < 4; i++)
+  {
+    if (data.weights[a][i] <= 0.f)
+      continue;
+    // weight of the same bone in the other vertex, bones may come in any slot order
+    float other = 0.f;
+    for (int j = 0; j < 4; j++)
+      if (data.weightsIndex[b][j] == data.weightsIndex[a][i])
+        other += data.weights[b][j];
+    distance += std::abs(data.weights[a][i] - other);
+  }
+  // bones present only in b
+  for (int j = 0; j < 4; j++)
+  {
+    bool shared = false;
+    for (int i = 0; i < 4; i++)
+      shared |= data.weightsIndex[a][i] == data.weightsIndex[b][j] && data.weights[a][i] > 0.f;
+    if (!shared)
+      distance += data.weights[b][j];
+  }
+  return distance;
+}
+
+static uint32_t dominant_bone(const MeshData &data, uint32_t v)
+{
+  const vec4 &w = data.weights[v];
+  int best = 0;
+  for (int i = 1; i < 4; i++)
+    if (w[i] > w[best])
+      best = i;
+  return data.weightsIndex[v][best];
+}
+
+static bool can_collapse(const MeshData &data, uint32_t from, uint32_t to)
+{
+  if (data.weights.empty())
+    return true;
+  return dominant_bone(data, from) == dominant_bone(data, to) && skin_distance(data, from, to) <= MaxSkinDistance;
+}
+
+struct PositionHash
+{
+  size_t operator()(const vec3 &p) const
+  {
+    uint32_t bits[3];
+    memcpy(bits, &p, sizeof(bits));
+    return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+  }
+};
+
+// seams are vertices duplicated by the welder because of a different uv or normal at the same position,
+// borders are edges used by one triangle only
+static std::vector<bool> find_locked_vertices(const MeshData &data, const std::vector<uint32_t> &indices)
+{
+  const uint32_t numVertices = data.vertices.size();
+  std::unordered_map<vec3, uint32_t, PositionHash> firstAtPosition;
+  std::vector<uint32_t> positionGroup(numVertices);
+  std::vector<uint32_t> groupSize(numVertices, 0);
+  for (uint32_t v = 0; v < numVertices; v++)
+  {
+    positionGroup[v] = firstAtPosition.emplace(data.vertices[v], v).first->second;
+    groupSize[positionGroup[v]]++;
+  }
+
+  std::vector<bool> locked(numVertices, false);
+  for (uint32_t v = 0; v < numVertices; v++)
+    locked[v] = groupSize[positionGroup[v]] > 1;
+
+  std::unordered_map<uint64_t, int> edgeUse;
+  edgeUse.reserve(indices.size());
+  auto edge_key = [&](uint32_t a, uint32_t b) {
+    a = positionGroup[a], b = positionGroup[b];
+    return a < b ? (uint64_t(a) << 32) | b : (uint64_t(b) << 32) | a;
+  };
+  for (size_t t = 0; t < indices.size(); t += 3)
+    for (int j = 0; j < 3; j++)
+      edgeUse[edge_key(indices[t + j], indices[t + (j + 1) % 3])]++;
+  for (size_t t = 0; t < indices.size(); t += 3)
+    for (int j = 0; j < 3; j++)
+    {
+      uint32_t a = indices[t + j], b = indices[t + (j + 1) % 3];
+      if (edgeUse[edge_key(a, b)] == 1)
+        locked[a] = locked[b] = true;
+    }
+  return locked;
+}
+
+static vec3 triangle_normal(const MeshData &data, uint32_t a, uint32_t b, uint32_t c)
+{
+  return cross(data.vertices[b] - data.vertices[a], data.vertices[c] - data.vertices[a]);
+}
+
+std::vector<uint32_t> simplify_mesh(const MeshData &data, size_t target_index_count, float target_error, float &result_error)
+{
+  const uint32_t numVertices = data.vertices.size();
+  std::vector<uint32_t> indices = data.indices;
+  result_error = 0.f;
+  if (indices.size() <= target_index_count || numVertices == 0)
+    return indices;
+
+  vec3 lo = data.vertices[0], hi = data.vertices[0];
+  for (const vec3 &p : data.vertices)
+  {
+    lo = min(lo, p);
+    hi = max(hi, p);
+  }
+  const float radius = max(length(hi - lo) * 0.5f, 1e-6f);
+  const double maxCost = double(target_error * radius) * double(target_error * radius);
+
+  const std::vector<bool> locked = find_locked_vertices(data, indices);
+
+  std::vector<Quadric> quadrics(numVertices);
+  for (size_t t = 0; t < indices.size(); t += 3)
+  {
+    vec3 n = triangle_normal(data, indices[t], indices[t + 1], indices[t + 2]);
+    float area = length(n);
+    if (area <= 0.f)
+      continue;
+    n /= area;
+    float d = -dot(n, data.vertices[indices[t]]);
+    for (int j = 0; j < 3; j++)
+      quadrics[indices[t + j]].add_plane(n, d, area);
+  }
+
+  std::vector<uint32_t> adjacencyOffset(numVertices + 1), adjacency;
+  std::vector<uint32_t> remap(numVertices);
+  std::vector<bool> touched(numVertices);
+  std::vector<Collapse> collapses;
+  double worstCost = 0;
+
+  while (indices.size() > target_index_count)
+  {
+    std::fill(adjacencyOffset.begin(), adjacencyOffset.end(), 0);
+    for (uint32_t index : indices)
+      adjacencyOffset[index + 1]++;
+    for (uint32_t v = 0; v < numVertices; v++)
+      adjacencyOffset[v + 1] += adjacencyOffset[v];
+    adjacency.resize(indices.size());
+    {
+      std::vector<uint32_t> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+      for (size_t i = 0; i < indices.size(); i++)
+        adjacency[fill[indices[i]]++] = i / 3;
+    }
+
+    collapses.clear();
+    for (size_t t = 0; t < indices.size(); t += 3)
+      for (int j = 0; j < 3; j++)
+      {
+        uint32_t a = indices[t + j], b = indices[t + (j + 1) % 3];
+        if (!locked[a] && can_collapse(data, a, b))
+          collapses.push_back({a, b, quadrics[a].error(data.vertices[b])});
+        if (!locked[b] && can_collapse(data, b, a))
+          collapses.push_back({b, a, quadrics[b].error(data.vertices[a])});
+      }
+    std::sort(collapses.begin(), collapses.end(), [](const Collapse &a, const Collapse &b) { return a.cost < b.cost; });
+
+    for (uint32_t v = 0; v < numVertices; v++)
+      remap[v] = v;
+    std::fill(touched.begin(), touched.end(), false);
+    size_t indexCount = indices.size();
+    int applied = 0;
+
+    for (const Collapse &collapse : collapses)
+    {
+      if (collapse.cost > maxCost || indexCount <= target_index_count)
+        break;
+      const uint32_t from = collapse.from, to = collapse.to;
+      if (touched[from] || touched[to])
+        continue;
+
+      // reject collapses that flip a triangle around the moving vertex
+      bool flips = false;
+      int removed = 0;
+      for (uint32_t a = adjacencyOffset[from]; a < adjacencyOffset[from + 1] && !flips; a++)
+      {
+        const uint32_t *tri = &indices[adjacency[a] * 3];
+        if (tri[0] == to || tri[1] == to || tri[2] == to)
+        {
+          removed++;
+          continue;
+        }
+        uint32_t moved[3] = {tri[0], tri[1], tri[2]};
+        for (uint32_t &v : moved)
+          if (v == from)
+            v = to;
+        vec3 before = triangle_normal(data, tri[0], tri[1], tri[2]);
+        vec3 after = triangle_normal(data, moved[0], moved[1], moved[2]);
+        flips = dot(before, after) <= 0.f;
+      }
+      if (flips)
+        continue;
+
+      remap[from] = to;
+      quadrics[to].add(quadrics[from]);
+      // neighbours are frozen for this pass, so every flip test above sees up to date triangles
+      for (uint32_t a = adjacencyOffset[from]; a < adjacencyOffset[from + 1]; a++)
+        for (int j = 0; j < 3; j++)
+          touched[indices[adjacency[a] * 3 + j]] = true;
+      indexCount -= removed * 3;
+      worstCost = std::max(worstCost, collapse.cost);
+      applied++;
+    }
+    if (applied == 0)
+      break;
+
+    size_t write = 0;
+    for (size_t t = 0; t < indices.size(); t += 3)
+    {
+      uint32_t a = remap[indices[t]], b = remap[indices[t + 1]], c = remap[indices[t + 2]];
+      if (a == b || b == c || a == c)
+        continue;
+      indices[write++] = a;
+      indices[write++] = b;
+      indices[write++] = c;
+    }
+    indices.resize(write);
+  }
+
+  result_error = float(sqrt(worstCost)) / radius;
+  return indices;
+}
+
+void limit_bone_influences(MeshData &data, int max_influences)
+{
+  for (size_t v = 0; v < data.weights.size(); v++)
+  {
+    vec4 &w = data.weights[v];
+    uvec4 &bones = data.weightsIndex[v];
+    // sort the 4 slots by weight, descending
+    for (int i = 1; i < 4; i++)
+      for (int j = i; j > 0 && w[j] > w[j - 1]; j--)
+      {
+        std::swap(w[j], w[j - 1]);
+        std::swap(bones[j], bones[j - 1]);
+      }
+    for (int i = max_influences; i < 4; i++)
+    {
+      w[i] = 0.f;
+      bones[i] = 0;
+    }
+    float sum = w.x + w.y + w.z + w.w;
+    if (sum > 0.f)
+      w /= sum;
+  }
+}
+
+std::vector<MeshLod> generate_lods(const char *name, const MeshData &data)
+{
+  std::vector<MeshLod> lods;
+  lods.push_back(MeshLod{data, 0.f});
+
+  std::vector<uint32_t> indices = data.indices;
+  float error = 0.f;
+  for (int lod = 1; lod < MaxMeshLods; lod++)
+  {
+    MeshData source = data;
+    source.indices = indices;
+    // each level is measured against the previous lod, the sum bounds how far it is from lod 0,
+    // so a level only gets what its limit leaves over the levels before it
+    float levelError;
+    std::vector<uint32_t> simplified =
+      simplify_mesh(source, indices.size() / 6 * 3, LodErrorLimits[lod] - error, levelError);
+    if (simplified.size() > indices.size() * 9 / 10)
+      break;
+    indices = simplified;
+    error += levelError;
+
+    MeshLod result{std::move(source), error};
+    result.data.indices = std::move(simplified);
+    optimize_vertex_cache(result.data);
+    optimize_vertex_fetch(result.data);
+    limit_bone_influences(result.data, LodMaxInfluences[lod]);
+    lods.push_back(std::move(result));
+  }
+
+  for (size_t lod = 0; lod < lods.size(); lod++)
+    debug_log("mesh %s lod%d: %u triangles, %u vertices, error %.4f", name, (int)lod,
+      (uint32_t)lods[lod].data.indices.size() / 3, (uint32_t)lods[lod].data.vertices.size(), lods[lod].error);
+  return lods;
+}
+
+PackedMesh pack_mesh(const std::vector<MeshLod> &lods, bool quantize_positions)
+{
+  const MeshData *lodData[MaxMeshLods];
+  float errors[MaxMeshLods];
+  int numLods = min((int)lods.size(), MaxMeshLods);
+  for (int lod = 0; lod < numLods; lod++)
+  {
+    lodData[lod] = &lods[lod].data;
+    errors[lod] = lods[lod].error;
+  }
+  return pack_mesh_lods(lodData, errors, numLods, quantize_positions);
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <vector>
+#include "mesh.h"
+
+struct MeshLod
+{
+  MeshData data;
+  float error; // to lod 0, relative to the mesh bounding radius
+};
+
+// Quadric error simplification by half-edge collapses, returns a new index buffer over the same vertices.
+// UV seam and open border vertices never move, and a vertex only collapses into one with the same dominant bone
+// and close skin weights, so the simplified surface keeps following the skeleton like the original.
+std::vector<uint32_t> simplify_mesh(const MeshData &data, size_t target_index_count, float target_error, float &result_error);
+
+// Keeps the max_influences largest weights of every vertex and renormalizes them.
+void limit_bone_influences(MeshData &data, int max_influences);
+
+// LOD0 is the input mesh, every next lod aims at half the triangles of the previous one.
+// Lods stop early if the error limit doesn't let the mesh shrink anymore.
+std::vector<MeshLod> generate_lods(const char *name, const MeshData &data);
+
+PackedMesh pack_mesh(const std::vector<MeshLod> &lods, bool quantize_positions = true);
@@ -0,0 +1,166 @@
+#include "model.h"
+#include <assimp/scene.h>
+#include <assimp/Importer.hpp>
+#include <log.h>
+#include <chrono>
+#include <job_system.h>
+#include "mesh_cache.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplify.h"
+
+
+static void import_nodes(const aiNode *node, int parent, std::vector<ModelNode> &nodes, std::vector<int> &mesh_nodes)
+{
+  int index = nodes.size();
+  nodes.emplace_back(ModelNode{std::string(node->mName.C_Str()), parent, to_mat4(node->mTransformation)});
+  for (unsigned i = 0; i < node->mNumMeshes; i++)
+    if (node->mMeshes[i] < mesh_nodes.size() && mesh_nodes[node->mMeshes[i]] < 0)
+      mesh_nodes[node->mMeshes[i]] = index;
+  for (unsigned i = 0; i < node->mNumChildren; i++)
+    import_nodes(node->mChildren[i], index, nodes, mesh_nodes);
+}
+
+static MeshSkin import_skin(const aiMesh *mesh)
+{
+  MeshSkin skin;
+  skin.boneNames.reserve(mesh->mNumBones);
+  skin.bindPoseInv.reserve(mesh->mNumBones);
+  for (unsigned i = 0; i < mesh->mNumBones; i++)
+  {
+    const aiBone *bone = mesh->mBones[i];
+    skin.boneNames.emplace_back(bone->mName.C_Str());
+    skin.bindPoseInv.push_back(to_mat4(bone->mOffsetMatrix));
+  }
+  return skin;
+}
+
+static ModelAnimation import_animation(const aiAnimation *animation)
+{
+  // fbx files usually have it, assimp uses 0 for "unknown"
+  const double ticksPerSecond = animation->mTicksPerSecond > 0 ? animation->mTicksPerSecond : 25.0;
+  auto to_seconds = [&](double ticks) { return float(ticks / ticksPerSecond); };
+
+  ModelAnimation result;
+  result.name = animation->mName.C_Str();
+  result.duration = to_seconds(animation->mDuration);
+  result.channels.resize(animation->mNumChannels);
+  for (unsigned i = 0; i < animation->mNumChannels; i++)
+  {
+    const aiNodeAnim *src = animation->mChannels[i];
+    ModelAnimationChannel &dst = result.channels[i];
+    dst.nodeName = src->mNodeName.C_Str();
+
+    dst.positionKeys.resize(src->mNumPositionKeys);
+    for (unsigned j = 0; j < src->mNumPositionKeys; j++)
+      dst.positionKeys[j] = {to_seconds(src->mPositionKeys[j].mTime), to_vec3(src->mPositionKeys[j].mValue)};
+
+    dst.rotationKeys.resize(src->mNumRotationKeys);
+    for (unsigned j = 0; j < src->mNumRotationKeys; j++)
+      dst.rotationKeys[j] = {to_seconds(src->mRotationKeys[j].mTime), to_quat(src->mRotationKeys[j].mValue)};
+
+    dst.scaleKeys.resize(src->mNumScalingKeys);
+    for (unsigned j = 0; j < src->mNumScalingKeys; j++)
+      dst.scaleKeys[j] = {to_seconds(src->mScalingKeys[j].mTime), to_vec3(src->mScalingKeys[j].mValue)};
+  }
+  return result;
+}
+
+// nodes and animations, everything but the meshes themselves
+static void import_hierarchy(const aiScene *scene, Model &model)
+{
+  model.meshNodes.assign(scene->mNumMeshes, -1);
+  if (scene->mRootNode)
+    import_nodes(scene->mRootNode, -1, model.nodes, model.meshNodes);
+
+  model.animations.reserve(scene->mNumAnimations);
+  for (unsigned i = 0; i < scene->mNumAnimations; i++)
+    model.animations.push_back(import_animation(scene->mAnimations[i]));
+}
+
+ModelPtr import_model(const char *path)
+{
+  Assimp::Importer importer;
+  const aiScene *scene = read_scene(importer, path);
+  if (!scene)
+  {
+    debug_error("no asset in %s", path);
+    return nullptr;
+  }
+
+  auto model = std::make_shared<Model>();
+  model->path = path;
+
+  // meshes are independent once the scene is read, one job each
+  model->meshData.resize(scene->mNumMeshes);
+  model->skins.resize(scene->mNumMeshes);
+  parallel_for(scene->mNumMeshes, 1, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++)
+    {
+      model->meshData[i] = import_mesh_data(scene, scene->mMeshes[i]);
+      optimize_mesh(scene->mMeshes[i]->mName.C_Str(), model->meshData[i]);
+      model->skins[i] = import_skin(scene->mMeshes[i]);
+    }
+  });
+
+  import_hierarchy(scene, *model);
+  return model;
+}
+
+ModelPtr import_model_rig(const char *path)
+{
+  Assimp::Importer importer;
+  const aiScene *scene = read_scene(importer, path);
+  if (!scene)
+  {
+    debug_error("no asset in %s", path);
+    return nullptr;
+  }
+
+  auto model = std::make_shared<Model>();
+  model->path = path;
+  model->skins.reserve(scene->mNumMeshes);
+  for (unsigned i = 0; i < scene->mNumMeshes; i++)
+    model->skins.push_back(import_skin(scene->mMeshes[i]));
+
+  import_hierarchy(scene, *model);
+  return model;
+}
+
+ModelPtr load_model(const char *path)
+{
+  using clock = std::chrono::high_resolution_clock;
+  auto startTime = clock::now();
+
+  ModelPtr model = import_model(path);
+  if (!model)
+    return nullptr;
+
+  std::vector<PackedMesh> packed(model->meshData.size());
+  parallel_for(packed.size(), 1, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++)
+    {
+      packed[i] = pack_mesh(generate_lods(path, model->meshData[i]));
+      // keeps later load_mesh calls on the warm path
+      if (packed[i].numLods > 0)
+        save_mesh_cache(path, i, packed[i]);
+    }
+  });
+  // only the uploads stay on the GL thread
+  model->meshes.reserve(packed.size());
+  for (const PackedMesh &mesh : packed)
+    model->meshes.push_back(create_mesh(mesh));
+  model->meshData.clear();
+
+  float ms = std::chrono::duration<float, std::milli>(clock::now() - startTime).count();
+  debug_log("model %s: %d meshes, %d nodes, %d animations, %.2f ms", path,
+    (int)model->meshes.size(), (int)model->nodes.size(), (int)model->animations.size(), ms);
+  return model;
+}
+
+int find_node(const Model &model, const char *name)
+{
+  for (size_t i = 0; i < model.nodes.size(); i++)
+    if (model.nodes[i].name == name)
+      return i;
+  return -1;
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "mesh.h"
+
+struct ModelNode
+{
+  std::string name;
+  int parent; // -1 for the root, parents always precede children
+  mat4 transform; // relative to parent
+};
+
+// aiBone list of one mesh. BoneIndex in the mesh data is already the node of each bone,
+// the names match them to skeleton bones for the inverse bind matrices.
+struct MeshSkin
+{
+  std::vector<std::string> boneNames;
+  std::vector<mat4> bindPoseInv; // aiBone::mOffsetMatrix
+};
+
+template<typename T>
+struct AnimationKey
+{
+  float time; // in seconds
+  T value;
+};
+
+struct ModelAnimationChannel
+{
+  std::string nodeName;
+  std::vector<AnimationKey<vec3>> positionKeys;
+  std::vector<AnimationKey<quat>> rotationKeys;
+  std::vector<AnimationKey<vec3>> scaleKeys;
+};
+
+struct ModelAnimation
+{
+  std::string name;
+  float duration; // in seconds
+  std::vector<ModelAnimationChannel> channels;
+};
+
+struct Model
+{
+  std::string path;
+  std::vector<MeshPtr> meshes; // empty after import_model
+  std::vector<MeshData> meshData; // empty after load_model
+  std::vector<MeshSkin> skins; // one per mesh
+  std::vector<ModelNode> nodes;
+  std::vector<int> meshNodes; // node holding each mesh, -1 if no node references it
+  std::vector<ModelAnimation> animations;
+};
+
+using ModelPtr = std::shared_ptr<Model>;
+
+// Parses the file once and keeps every mesh, the node hierarchy and all animations.
+// import_model doesn't touch GL, load_model also uploads the meshes.
+ModelPtr import_model(const char *path);
+ModelPtr load_model(const char *path);
+// Only nodes, skins and animations, for instances whose meshes come through the mesh cache.
+ModelPtr import_model_rig(const char *path);
+
+int find_node(const Model &model, const char *name);
@@ -11,7 +11,7 @@
 
 static void read_shader_info(Shader &shader)
 {
-  GLuint program = shader.program;
+  GLuint program = shader.program.get();
 
   int count;
   const GLsizei bufSize = 128;
@@ -38,7 +38,8 @@ struct ShaderInfo
   std::string sources;
 };
 
-static bool compile_shader(const char *shaderName, const std::vector<ShaderInfo> &shaders, GLuint &program)
+static bool compile_shader(const char *shaderName, const std::vector<ShaderInfo> &shaders, GLuint &program,
+  const std::vector<const char *> &captured = {})
 {
   std::vector<GLuint> compiled_shaders;
   compiled_shaders.reserve(shaders.size());
@@ -64,6 +65,8 @@ static bool compile_shader(const char *shaderName, const std::vector<ShaderInfo>
   program = glCreateProgram();
   for (GLuint shaderProg : compiled_shaders)
     glAttachShader(program, shaderProg);
+  if (!captured.empty())
+    glTransformFeedbackVaryings(program, captured.size(), captured.data(), GL_INTERLEAVED_ATTRIBS);
 
   glLinkProgram(program);
   glGetProgramiv(program, GL_LINK_STATUS, &success);
@@ -88,7 +91,8 @@ static std::string read_file(const char *path)
   return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
 }
 
-static bool compile_shader(const char *name, const Shader::ShaderSources &sources, GLuint &program)
+static bool compile_shader(const char *name, const Shader::ShaderSources &sources, GLuint &program,
+  const std::vector<const char *> &captured = {})
 {
   std::vector<ShaderInfo> shaderCode;
 
@@ -96,7 +100,7 @@ static bool compile_shader(const char *name, const Shader::ShaderSources &source
   {
     shaderCode.emplace_back(ShaderInfo{shaderType, path, read_file(path.c_str())});
   }
-  return compile_shader(name, shaderCode, program);
+  return compile_shader(name, shaderCode, program, captured);
 }
 
 static std::vector<ShaderPtr> shaderList;
@@ -116,6 +120,20 @@ ShaderPtr compile_shader(const char *name, const char *vs_path, const char *ps_p
   return nullptr;
 }
 
+ShaderPtr compile_capture_shader(const char *name, const char *vs_path, const std::vector<const char *> &captured)
+{
+  Shader::ShaderSources shaderSources{{GL_VERTEX_SHADER, vs_path}};
+
+  GLuint program;
+  if (compile_shader(name, shaderSources, program, captured))
+  {
+    // not in shaderList, hot reload would drop the captured outputs
+    auto shader = std::make_shared<Shader>(name, program, shaderSources);
+    read_shader_info(*shader);
+    return shader;
+  }
+  return nullptr;
+}
 
 void recompile_all_shaders()
 {
@@ -124,8 +142,8 @@ void recompile_all_shaders()
     GLuint program;
     if (compile_shader(shader->name.c_str(), shader->shaderSources, program))
     {
-      glDeleteProgram(shader->program);
-      shader->program = program;
+      // the old program is deleted once the frames using it are done
+      shader->program = GpuProgram(program);
       read_shader_info(*shader);
     }
   }
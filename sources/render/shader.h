@@ -4,6 +4,7 @@
 #include <string>
 #include <memory>
 #include "glad/glad.h"
+#include "gpu_resource.h"
 
 
 struct ShaderUniform
@@ -22,7 +23,7 @@ public:
 
 	const std::string name;
 	const ShaderSources shaderSources; //for hotreload
-	GLuint program;
+	GpuProgram program;
   std::vector<ShaderUniform> uniforms;
 
 	Shader(const std::string &shader_name, GLuint shader_program, ShaderSources sources):
@@ -33,16 +34,16 @@ public:
 
 	void use() const
 	{
-		glUseProgram(program);
+		glUseProgram(program.get());
 	}
 
 	int get_uniform_location(const char *name)
 	{
-		return glGetUniformLocation(program, name);
+		return glGetUniformLocation(program.get(), name);
 	}
 	void set_mat3x3(const char*name, const mat3 &matrix, bool transpose = false) const
 	{
-		glUniformMatrix3fv(glGetUniformLocation(program, name), 1, transpose, glm::value_ptr(matrix));
+		glUniformMatrix3fv(glGetUniformLocation(program.get(), name), 1, transpose, glm::value_ptr(matrix));
 	}
 	void set_mat3x3(int uniform_location, const mat3 &matrix, bool transpose = false) const
 	{
@@ -51,7 +52,7 @@ public:
 
 	void set_mat4x4(const char *name, const mat4 matrix, bool transpose = false) const
 	{
-		set_mat4x4(glGetUniformLocation(program, name), matrix, transpose);
+		set_mat4x4(glGetUniformLocation(program.get(), name), matrix, transpose);
 	}
 	void set_mat4x4(int uniform_location, const mat4 matrix, bool transpose = false) const
 	{
@@ -60,7 +61,7 @@ public:
 
 	void set_float(const char *name, const float &v) const
 	{
-		set_float(glGetUniformLocation(program, name), v);
+		set_float(glGetUniformLocation(program.get(), name), v);
   }
 	void set_float(int uniform_location, const float &v) const
 	{
@@ -68,7 +69,7 @@ public:
   }
 	void set_int(const char *name, int v) const
 	{
-		set_int(glGetUniformLocation(program, name), v);
+		set_int(glGetUniformLocation(program.get(), name), v);
   }
 	void set_int(int uniform_location, int v) const
 	{
@@ -77,7 +78,7 @@ public:
 
 	void set_vec2(const char*name, const vec2 &v) const
 	{
-		set_vec2(glGetUniformLocation(program, name), v);
+		set_vec2(glGetUniformLocation(program.get(), name), v);
   }
 	void set_vec2(int uniform_location, const vec2 &v) const
 	{
@@ -86,7 +87,7 @@ public:
 
 	void set_vec3(const char*name, const vec3 &v) const
 	{
-		set_vec3(glGetUniformLocation(program, name), v);
+		set_vec3(glGetUniformLocation(program.get(), name), v);
   }
 	void set_vec3(int uniform_location, const vec3 &v) const
 	{
@@ -95,7 +96,7 @@ public:
 
 	void set_vec4(const char*name, const vec4 &v) const
 	{
-		set_vec4(glGetUniformLocation(program, name), v);
+		set_vec4(glGetUniformLocation(program.get(), name), v);
   }
 	void set_vec4(int uniform_location, const vec4 &v) const
 	{
@@ -106,5 +107,8 @@ public:
 using ShaderPtr = std::shared_ptr<Shader>;
 
 ShaderPtr compile_shader(const char *name, const char *vs_path, const char *ps_path);
+// A vertex shader alone whose outputs are written to transform feedback buffers, interleaved in the
+// order given. Meant for reading back what a shader computes, draw it with GL_RASTERIZER_DISCARD.
+ShaderPtr compile_capture_shader(const char *name, const char *vs_path, const std::vector<const char *> &captured);
 
 void recompile_all_shaders();
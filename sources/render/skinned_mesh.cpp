@@ -0,0 +1,57 @@
+#include "skinned_mesh.h"
+#include "mesh.h"
+#include "glad/glad.h"
+#include <animation/cpu_skinning.h>
+
+enum SkinnedMeshBinding
+{
+  SkinnedBinding,
+  StaticBinding
+};
+
+static void init_channel(uint32_t vao, int index, uint32_t binding, uint32_t offset, int component_count)
+{
+  glEnableVertexArrayAttrib(vao, index);
+  glVertexArrayAttribFormat(vao, index, component_count, GL_FLOAT, false, offset);
+  glVertexArrayAttribBinding(vao, index, binding);
+}
+
+CpuSkinnedMeshPtr create_cpu_skinned_mesh(const MeshData &data)
+{
+  auto mesh = std::make_shared<CpuSkinnedMesh>();
+  mesh->numVertices = data.vertices.size();
+  mesh->numIndices = data.indices.size();
+  mesh->skinnedBuffer = GpuBuffer::streaming(GpuMemoryStreaming, sizeof(SkinnedVertex) * mesh->numVertices);
+  std::vector<vec2> uv = data.uv;
+  uv.resize(mesh->numVertices, vec2(0.f));
+  mesh->staticBuffer = GpuBuffer(GpuMemoryMesh, sizeof(vec2) * mesh->numVertices, uv.data());
+  mesh->indexBuffer = GpuBuffer(GpuMemoryMesh, sizeof(uint32_t) * mesh->numIndices, data.indices.data());
+
+  mesh->vertexArray = GpuVertexArray::create();
+  const uint32_t vao = mesh->vertexArray.get();
+  glVertexArrayVertexBuffer(vao, SkinnedBinding, mesh->skinnedBuffer.get(), 0, sizeof(SkinnedVertex));
+  glVertexArrayVertexBuffer(vao, StaticBinding, mesh->staticBuffer.get(), 0, sizeof(vec2));
+  init_channel(vao, 0, SkinnedBinding, offsetof(SkinnedVertex, position), 3);
+  init_channel(vao, 1, SkinnedBinding, offsetof(SkinnedVertex, normal), 3);
+  init_channel(vao, 2, StaticBinding, 0, 2);
+  glVertexArrayElementBuffer(vao, mesh->indexBuffer.get());
+  return mesh;
+}
+
+SkinnedVertex *map_skinned_vertices(const CpuSkinnedMesh &mesh)
+{
+  // invalidation orphans last frame's storage instead of waiting for the draw that still reads it
+  return (SkinnedVertex *)glMapNamedBufferRange(mesh.skinnedBuffer.get(), 0, mesh.skinnedBuffer.size(),
+    GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+}
+
+void unmap_skinned_vertices(const CpuSkinnedMesh &mesh)
+{
+  glUnmapNamedBuffer(mesh.skinnedBuffer.get());
+}
+
+void render(const CpuSkinnedMesh &mesh)
+{
+  glBindVertexArray(mesh.vertexArray.get());
+  glDrawElements(GL_TRIANGLES, mesh.numIndices, GL_UNSIGNED_INT, nullptr);
+}
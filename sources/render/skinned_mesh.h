@@ -0,0 +1,27 @@
+#pragma once
+#include <memory>
+#include "gpu_resource.h"
+
+struct MeshData;
+struct SkinnedVertex;
+
+// A mesh skinned on the CPU: uvs and indices are static, positions and normals live in a
+// streaming buffer that is orphaned and rewritten every frame.
+struct CpuSkinnedMesh
+{
+  GpuVertexArray vertexArray;
+  GpuBuffer skinnedBuffer, staticBuffer, indexBuffer;
+  uint32_t numVertices = 0;
+  uint32_t numIndices = 0;
+};
+
+using CpuSkinnedMeshPtr = std::shared_ptr<CpuSkinnedMesh>;
+
+CpuSkinnedMeshPtr create_cpu_skinned_mesh(const MeshData &data);
+
+// Write-only mapping of numVertices vertices, any thread may fill it until unmap_skinned_vertices.
+SkinnedVertex *map_skinned_vertices(const CpuSkinnedMesh &mesh);
+void unmap_skinned_vertices(const CpuSkinnedMesh &mesh);
+
+// Positions are already in model space, the shader's position quantization has to be identity.
+void render(const CpuSkinnedMesh &mesh);
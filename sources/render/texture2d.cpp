@@ -1,56 +1,164 @@
 #include "texture2d.h"
 #include "glad/glad.h"
+#include "texture_cache.h"
 #include <cassert>
+#include <log.h>
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb/stb_image.h>
 
-Texture2DPtr create_texture(const unsigned char *image, int w, int h, int ch)
+static GLenum texture_format(int ch)
+{
+  assert(ch == 3 || ch == 4);
+  return ch == 4 ? GL_RGBA : GL_RGB;
+}
+
+static int mip_count(int w, int h)
 {
-  GLuint textureObject;
-  glGenTextures(1, &textureObject);
-  auto texture = std::make_shared<Texture2D>(textureObject);
-  GLuint textureType = GL_TEXTURE_2D;
+  int levels = 1;
+  while ((w | h) >> levels)
+    levels++;
+  return levels;
+}
 
-  glBindTexture(textureType, textureObject);
+Texture2DPtr allocate_texture2d(int w, int h, int ch)
+{
+  return std::make_shared<Texture2D>(GpuTexture(GpuMemoryTexture, mip_count(w, h), ch == 4 ? GL_RGBA8 : GL_RGB8, w, h,
+    size_t(w) * h * ch * 4 / 3));
+}
+
+static GLenum compressed_format(TextureFormat format)
+{
+  switch (format)
+  {
+    case TextureFormat::BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case TextureFormat::BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    case TextureFormat::BC7: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+  }
+  return 0;
+}
+
+Texture2DPtr allocate_texture2d(const CompressedTexture &compressed)
+{
+  return std::make_shared<Texture2D>(GpuTexture(GpuMemoryTexture, compressed.numMips, compressed_format(compressed.format),
+    compressed.width, compressed.height, compressed.total_size()));
+}
+
+void upload_texture2d_pixels(const Texture2D &texture, int w, int ch, int first_row, int rows, const void *pixels)
+{
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTextureSubImage2D(texture.texture.get(), 0, 0, first_row, w, rows, texture_format(ch), GL_UNSIGNED_BYTE, pixels);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+void upload_texture2d_blocks(const Texture2D &texture, const CompressedTexture &compressed, int mip, uint32_t first_row,
+  uint32_t rows, const void *blocks)
+{
+  const TextureMip &m = compressed.mips[mip];
+  const uint32_t rowSize = (m.width + 3) / 4 * texture_block_size(compressed.format);
+  const uint32_t y = first_row * 4;
+  glCompressedTextureSubImage2D(texture.texture.get(), mip, 0, y, m.width, std::min(rows * 4, m.height - y),
+    compressed_format(compressed.format), rowSize * rows, blocks);
+}
 
-  if (ch == 4)
-    glTexImage2D(textureType, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
-  else if (ch == 3)
-    glTexImage2D(textureType, 0, GL_RGB, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
+void finish_texture2d(const Texture2D &texture, bool generate_mips)
+{
+  const GLuint textureObject = texture.texture.get();
 
-  const bool generateMips = true;
-  if (generateMips)
+  const bool useMips = true;
+  if (useMips)
   {
-    glGenerateMipmap(textureType);
+    if (generate_mips)
+      glGenerateTextureMipmap(textureObject);
     GLenum mipmapMinPixelFormat = GL_LINEAR_MIPMAP_LINEAR;
     GLenum mipmapMagPixelFormat = GL_LINEAR;
 
-    glTexParameteri(textureType, GL_TEXTURE_MIN_FILTER, mipmapMinPixelFormat);
-    glTexParameteri(textureType, GL_TEXTURE_MAG_FILTER, mipmapMagPixelFormat);
+    glTextureParameteri(textureObject, GL_TEXTURE_MIN_FILTER, mipmapMinPixelFormat);
+    glTextureParameteri(textureObject, GL_TEXTURE_MAG_FILTER, mipmapMagPixelFormat);
   }
   else
   {
     GLenum minMagixelFormat = GL_LINEAR;
-    glTexParameteri(textureType, GL_TEXTURE_MIN_FILTER, minMagixelFormat);
-    glTexParameteri(textureType, GL_TEXTURE_MAG_FILTER, minMagixelFormat);
+    glTextureParameteri(textureObject, GL_TEXTURE_MIN_FILTER, minMagixelFormat);
+    glTextureParameteri(textureObject, GL_TEXTURE_MAG_FILTER, minMagixelFormat);
   }
-  glBindTexture(textureType, 0);
+}
 
+Texture2DPtr create_texture(const unsigned char *image, int w, int h, int ch)
+{
+  Texture2DPtr texture = allocate_texture2d(w, h, ch);
+  upload_texture2d_pixels(*texture, w, ch, 0, h, image);
+  finish_texture2d(*texture, true);
   return texture;
 }
 
-Texture2DPtr create_texture2d(const char *path)
+static Texture2DPtr create_texture(const CompressedTexture &compressed)
 {
-  int w, h, ch;
+  Texture2DPtr texture = allocate_texture2d(compressed);
+  for (int mip = 0; mip < compressed.numMips; mip++)
+  {
+    const TextureMip &m = compressed.mips[mip];
+    upload_texture2d_blocks(*texture, compressed, mip, 0, (m.height + 3) / 4, compressed.blocks + m.offset);
+  }
+  finish_texture2d(*texture, false);
+  return texture;
+}
+
+static TextureFormat choose_texture_format(TextureCompression compression, int channels)
+{
+  if (compression == TextureCompression::HighQuality)
+    return TextureFormat::BC7;
+  // gray alpha images keep their alpha too
+  return channels == 2 || channels == 4 ? TextureFormat::BC3 : TextureFormat::BC1;
+}
+
+TextureData load_texture_data(const char *path, TextureCompression compression)
+{
+  TextureData data;
+  // the flag is global in this stb version, every texture here wants it set so concurrent loads agree
   stbi_set_flip_vertically_on_load(true);
-  auto stbiData = stbi_load(path, &w, &h, &ch, 0);
-  // @TODO: sort this out, this is 3 now !
-  //assert(ch == 4);
-  Texture2DPtr result;
-  if (stbiData)
+  if (compression == TextureCompression::None)
   {
-    result = create_texture(stbiData, w, h, ch);
-    stbi_image_free(stbiData);
+    // uploads take rgb or rgba, gray and gray alpha images are expanded like the compressed path does
+    if (!stbi_info(path, &data.width, &data.height, &data.channels))
+      return data;
+    const int channels = data.channels == 3 ? 3 : 4;
+    unsigned char *pixels = stbi_load(path, &data.width, &data.height, &data.channels, channels);
+    data.channels = channels;
+    if (pixels)
+      data.pixels = std::unique_ptr<unsigned char, void (*)(void *)>(pixels, stbi_image_free);
+    return data;
   }
-  return result;
+
+  // the header is enough to pick the format, a warm start never decodes the image
+  if (!stbi_info(path, &data.width, &data.height, &data.channels))
+    return data;
+  TextureFormat format = choose_texture_format(compression, data.channels);
+  data.compressed = open_texture_cache(path, format);
+  if (data.compressed)
+    return data;
+
+  int channels;
+  unsigned char *rgba = stbi_load(path, &data.width, &data.height, &channels, 4);
+  if (!rgba)
+    return data;
+  data.compressed = compress_texture(rgba, data.width, data.height, format);
+  // gray alpha is expanded with the alpha in the fourth channel
+  report_texture_compression(path, rgba, data.channels == 2 ? 4 : data.channels, *data.compressed);
+  stbi_image_free(rgba);
+  save_texture_cache(path, *data.compressed);
+  return data;
+}
+
+Texture2DPtr create_texture2d(const TextureData &data)
+{
+  if (data.compressed)
+    return create_texture(*data.compressed);
+  if (!data.pixels)
+    return nullptr;
+  return create_texture(data.pixels.get(), data.width, data.height, data.channels);
+}
+
+Texture2DPtr create_texture2d(const char *path, TextureCompression compression)
+{
+  return create_texture2d(load_texture_data(path, compression));
 }
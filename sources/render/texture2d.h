@@ -1,13 +1,47 @@
 #pragma once
 
+#include <cstddef>
 #include <memory>
+#include "texture_compression.h"
+#include "gpu_resource.h"
 
 struct Texture2D
 {
-  const unsigned textureObject;
-  Texture2D(unsigned textureObject) : textureObject(textureObject) {}
+  const GpuTexture texture; // immutable storage, mip chain included
+  Texture2D(GpuTexture &&texture) : texture(std::move(texture)) {}
 };
 
 using Texture2DPtr = std::shared_ptr<Texture2D>;
 
-Texture2DPtr create_texture2d(const char *path);
\ No newline at end of file
+enum class TextureCompression
+{
+  None,       // raw pixels, mips are generated on the GPU
+  Default,    // BC1 for rgb, BC3 with alpha
+  HighQuality // BC7
+};
+
+// Decoded pixels or a compressed mip chain, safe to produce on any thread
+struct TextureData
+{
+  std::unique_ptr<unsigned char, void (*)(void *)> pixels{nullptr, nullptr};
+  CompressedTexturePtr compressed;
+  int width = 0, height = 0, channels = 0;
+
+  bool valid() const { return pixels || compressed; }
+};
+
+// Compressed textures come from the texture cache, a cold load encodes the image and writes the cache.
+TextureData load_texture_data(const char *path, TextureCompression compression = TextureCompression::Default);
+// GL thread only
+Texture2DPtr create_texture2d(const TextureData &data);
+// Staged uploads: allocate the texture, fill it with upload_texture2d_pixels or upload_texture2d_blocks, then set up mips and filters.
+Texture2DPtr allocate_texture2d(int w, int h, int ch);
+Texture2DPtr allocate_texture2d(const CompressedTexture &compressed);
+// level 0 rows, pixels is an offset if a pixel unpack buffer is bound
+void upload_texture2d_pixels(const Texture2D &texture, int w, int ch, int first_row, int rows, const void *pixels);
+// rows are rows of 4x4 blocks, blocks is an offset if a pixel unpack buffer is bound
+void upload_texture2d_blocks(const Texture2D &texture, const CompressedTexture &compressed, int mip, uint32_t first_row,
+  uint32_t rows, const void *blocks);
+void finish_texture2d(const Texture2D &texture, bool generate_mips);
+
+Texture2DPtr create_texture2d(const char *path, TextureCompression compression = TextureCompression::Default);
@@ -0,0 +1,106 @@
+#include "texture_cache.h"
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <log.h>
+
+constexpr uint64_t DataAlignment = 16;
+
+std::string texture_cache_path(const char *path, TextureFormat format)
+{
+  std::string name = texture_format_name(format);
+  std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+  return std::string(path) + "." + name + ".texbin";
+}
+
+CompressedTexturePtr open_texture_cache(const char *path, TextureFormat format)
+{
+  uint64_t sourceSize;
+  int64_t sourceTime;
+  if (!file_stamp(path, sourceSize, sourceTime))
+    return nullptr;
+
+  auto texture = std::make_unique<CompressedTexture>();
+  std::string cachePath = texture_cache_path(path, format);
+  if (!texture->file.open(cachePath.c_str()) || texture->file.size() < sizeof(TextureCacheHeader))
+    return nullptr;
+  const TextureCacheHeader &header = *(const TextureCacheHeader *)texture->file.data();
+  if (header.magic != TextureCacheMagic || header.version != TextureCacheVersion ||
+      header.sourceSize != sourceSize || header.sourceTime != sourceTime || header.format != format ||
+      header.numMips < 1 || header.numMips > MaxTextureMips)
+    return nullptr;
+
+  texture->format = header.format;
+  texture->width = header.width;
+  texture->height = header.height;
+  // uploads read blocks by the mip table, so it has to be the chain of the header's size and format
+  texture->numMips = texture_mip_chain(header.width, header.height, header.format, texture->mips);
+  bool consistent = header.width > 0 && header.height > 0 && header.numMips == texture->numMips;
+  for (int mip = 0; consistent && mip < texture->numMips; mip++)
+  {
+    const TextureMip &expected = texture->mips[mip], &stored = header.mips[mip];
+    consistent = stored.width == expected.width && stored.height == expected.height &&
+                 stored.offset == expected.offset && stored.size == expected.size;
+  }
+  if (!consistent)
+  {
+    debug_error("texture cache %s has an inconsistent mip chain", cachePath.c_str());
+    return nullptr;
+  }
+  const uint64_t fileSize = texture->file.size();
+  if (header.dataOffset > fileSize || texture->total_size() > fileSize - header.dataOffset)
+  {
+    debug_error("texture cache %s is truncated", cachePath.c_str());
+    return nullptr;
+  }
+  texture->blocks = texture->file.data() + header.dataOffset;
+  return texture;
+}
+
+bool save_texture_cache(const char *path, const CompressedTexture &texture)
+{
+  TextureCacheHeader header = {};
+  header.magic = TextureCacheMagic;
+  header.version = TextureCacheVersion;
+  if (!file_stamp(path, header.sourceSize, header.sourceTime))
+    return false;
+  header.format = texture.format;
+  header.width = texture.width;
+  header.height = texture.height;
+  header.numMips = texture.numMips;
+  std::copy(texture.mips, texture.mips + MaxTextureMips, header.mips);
+  header.dataOffset = (sizeof(TextureCacheHeader) + DataAlignment - 1) & ~(DataAlignment - 1);
+
+  // the cache may be mapped by another load, so it is written aside and renamed over the old one
+  const std::string cachePath = texture_cache_path(path, texture.format);
+  const std::string tempPath = cachePath + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+  {
+    std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+    if (!file)
+    {
+      debug_error("can't write texture cache %s", tempPath.c_str());
+      return false;
+    }
+    file.write((const char *)&header, sizeof(header));
+    file.seekp(header.dataOffset);
+    file.write((const char *)texture.blocks, texture.total_size());
+    if (!file.good())
+    {
+      file.close();
+      std::remove(tempPath.c_str());
+      debug_error("can't write texture cache %s", tempPath.c_str());
+      return false;
+    }
+  }
+  std::error_code ec;
+  std::filesystem::rename(tempPath, cachePath, ec);
+  if (ec)
+  {
+    std::remove(tempPath.c_str());
+    debug_error("can't replace texture cache %s: %s", cachePath.c_str(), ec.message().c_str());
+    return false;
+  }
+  return true;
+}
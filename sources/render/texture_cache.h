@@ -0,0 +1,27 @@
+#pragma once
+#include <string>
+#include "texture_compression.h"
+
+// Baked block compressed mip chain: a header and the blocks of every mip back to back,
+// so a warm start maps the file and uploads it without decoding the source image.
+constexpr uint32_t TextureCacheMagic = 0x58544342; // "BCTX"
+constexpr uint32_t TextureCacheVersion = 1;
+
+struct TextureCacheHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint64_t sourceSize;
+  int64_t sourceTime;
+  TextureFormat format;
+  uint32_t width, height;
+  int32_t numMips;
+  TextureMip mips[MaxTextureMips];
+  uint64_t dataOffset;
+};
+
+std::string texture_cache_path(const char *path, TextureFormat format);
+
+// Returns nullptr if the cache is missing, of another version or older than the source image.
+CompressedTexturePtr open_texture_cache(const char *path, TextureFormat format);
+bool save_texture_cache(const char *path, const CompressedTexture &texture);
@@ -0,0 +1,671 @@
+#include "texture_compression.h"
+#include <3dmath.h>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <job_system.h>
+#include <log.h>
+#include <stb/stb_image.h>
+
+uint32_t texture_block_size(TextureFormat format)
+{
+  return format == TextureFormat::BC1 ? 8 : 16;
+}
+
+const char *texture_format_name(TextureFormat format)
+{
+  switch (format)
+  {
+    case TextureFormat::BC1: return "BC1";
+    case TextureFormat::BC3: return "BC3";
+    case TextureFormat::BC7: return "BC7";
+  }
+  return "unknown";
+}
+
+// Principal axis of the block colors by power iteration on the covariance matrix,
+// returns the extreme points of the colors projected on it.
+template<int N>
+static void fit_principal_axis(const float (*colors)[4], float (*endpoints)[4])
+{
+  float mean[N] = {};
+  for (int i = 0; i < 16; i++)
+    for (int c = 0; c < N; c++)
+      mean[c] += colors[i][c] / 16.f;
+
+  float covariance[N][N] = {};
+  for (int i = 0; i < 16; i++)
+    for (int a = 0; a < N; a++)
+      for (int b = 0; b < N; b++)
+        covariance[a][b] += (colors[i][a] - mean[a]) * (colors[i][b] - mean[b]);
+
+  float axis[N];
+  for (int c = 0; c < N; c++)
+    axis[c] = 1.f;
+  for (int iteration = 0; iteration < 8; iteration++)
+  {
+    float next[N] = {};
+    float norm = 0.f;
+    for (int a = 0; a < N; a++)
+    {
+      for (int b = 0; b < N; b++)
+        next[a] += covariance[a][b] * axis[b];
+      norm = std::max(norm, std::abs(next[a]));
+    }
+    if (norm < FLT_EPSILON)
+      break;
+    for (int c = 0; c < N; c++)
+      axis[c] = next[c] / norm;
+  }
+
+  float minT = FLT_MAX, maxT = -FLT_MAX;
+  for (int i = 0; i < 16; i++)
+  {
+    float t = 0.f;
+    for (int c = 0; c < N; c++)
+      t += (colors[i][c] - mean[c]) * axis[c];
+    minT = std::min(minT, t);
+    maxT = std::max(maxT, t);
+  }
+  for (int c = 0; c < N; c++)
+  {
+    endpoints[0][c] = mean[c] + axis[c] * maxT;
+    endpoints[1][c] = mean[c] + axis[c] * minT;
+  }
+}
+
+// Least squares endpoints for fixed interpolation weights, weights[i] is the share of endpoint 1 in texel i.
+template<int N>
+static bool refit_endpoints(const float (*colors)[4], const float *weights, float (*endpoints)[4])
+{
+  float aa = 0.f, ab = 0.f, bb = 0.f;
+  float ax[N] = {}, bx[N] = {};
+  for (int i = 0; i < 16; i++)
+  {
+    float b = weights[i], a = 1.f - b;
+    aa += a * a;
+    ab += a * b;
+    bb += b * b;
+    for (int c = 0; c < N; c++)
+    {
+      ax[c] += a * colors[i][c];
+      bx[c] += b * colors[i][c];
+    }
+  }
+  float det = aa * bb - ab * ab;
+  if (std::abs(det) < FLT_EPSILON)
+    return false;
+  for (int c = 0; c < N; c++)
+  {
+    endpoints[0][c] = clamp((bb * ax[c] - ab * bx[c]) / det, 0.f, 255.f);
+    endpoints[1][c] = clamp((aa * bx[c] - ab * ax[c]) / det, 0.f, 255.f);
+  }
+  return true;
+}
+
+static void load_block_colors(const uint8_t *rgba, float (*colors)[4])
+{
+  for (int i = 0; i < 16; i++)
+    for (int c = 0; c < 4; c++)
+      colors[i][c] = rgba[i * 4 + c];
+}
+
+template<int N>
+static float color_distance(const float *a, const float *b)
+{
+  float d = 0.f;
+  for (int c = 0; c < N; c++)
+    d += (a[c] - b[c]) * (a[c] - b[c]);
+  return d;
+}
+
+// BC1
+
+static uint16_t pack_565(const float *color)
+{
+  int r = clamp(int(color[0] * 31.f / 255.f + 0.5f), 0, 31);
+  int g = clamp(int(color[1] * 63.f / 255.f + 0.5f), 0, 63);
+  int b = clamp(int(color[2] * 31.f / 255.f + 0.5f), 0, 31);
+  return uint16_t((r << 11) | (g << 5) | b);
+}
+
+static void unpack_565(uint16_t c, float *color)
+{
+  int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+  color[0] = float((r << 3) | (r >> 2));
+  color[1] = float((g << 2) | (g >> 4));
+  color[2] = float((b << 3) | (b >> 2));
+  color[3] = 255.f;
+}
+
+// palette of the 4 color mode, index 2 and 3 are at 1/3 and 2/3 from c0
+static void bc1_palette(uint16_t c0, uint16_t c1, float (*palette)[4])
+{
+  unpack_565(c0, palette[0]);
+  unpack_565(c1, palette[1]);
+  for (int c = 0; c < 4; c++)
+  {
+    palette[2][c] = (2.f * palette[0][c] + palette[1][c]) / 3.f;
+    palette[3][c] = (palette[0][c] + 2.f * palette[1][c]) / 3.f;
+  }
+}
+
+static float bc1_assign_indices(const float (*colors)[4], uint16_t c0, uint16_t c1, uint8_t *indices)
+{
+  float palette[4][4];
+  bc1_palette(c0, c1, palette);
+  float error = 0.f;
+  for (int i = 0; i < 16; i++)
+  {
+    float best = FLT_MAX;
+    for (int p = 0; p < 4; p++)
+    {
+      float d = color_distance<3>(colors[i], palette[p]);
+      if (d < best)
+      {
+        best = d;
+        indices[i] = p;
+      }
+    }
+    error += best;
+  }
+  return error;
+}
+
+// always the 4 color mode (c0 > c1), which is also the only mode the BC3 color block has
+static float bc1_encode_endpoints(const float (*colors)[4], const float (*endpoints)[4], uint16_t &c0, uint16_t &c1, uint8_t *indices)
+{
+  c0 = pack_565(endpoints[0]);
+  c1 = pack_565(endpoints[1]);
+  if (c0 < c1)
+    std::swap(c0, c1);
+  if (c0 == c1)
+  {
+    // a flat block, every texel takes c0 which reads the same in both modes
+    float palette[4][4];
+    bc1_palette(c0, c1, palette);
+    float error = 0.f;
+    for (int i = 0; i < 16; i++)
+    {
+      indices[i] = 0;
+      error += color_distance<3>(colors[i], palette[0]);
+    }
+    return error;
+  }
+  return bc1_assign_indices(colors, c0, c1, indices);
+}
+
+static void encode_bc1_color(const float (*colors)[4], uint8_t *block)
+{
+  float endpoints[2][4];
+  fit_principal_axis<3>(colors, endpoints);
+  // insetting the bounding line by 1/16 of its length reduces the error of the interpolated colors
+  for (int c = 0; c < 3; c++)
+  {
+    float inset = (endpoints[0][c] - endpoints[1][c]) / 16.f;
+    endpoints[0][c] = clamp(endpoints[0][c] - inset, 0.f, 255.f);
+    endpoints[1][c] = clamp(endpoints[1][c] + inset, 0.f, 255.f);
+  }
+
+  uint16_t c0, c1;
+  uint8_t indices[16];
+  float error = bc1_encode_endpoints(colors, endpoints, c0, c1, indices);
+
+  const float indexWeight[4] = {0.f, 1.f, 1.f / 3.f, 2.f / 3.f};
+  float weights[16];
+  for (int i = 0; i < 16; i++)
+    weights[i] = indexWeight[indices[i]];
+  float refined[2][4];
+  uint16_t r0, r1;
+  uint8_t refinedIndices[16];
+  if (refit_endpoints<3>(colors, weights, refined) &&
+      bc1_encode_endpoints(colors, refined, r0, r1, refinedIndices) < error)
+  {
+    c0 = r0;
+    c1 = r1;
+    memcpy(indices, refinedIndices, sizeof(indices));
+  }
+
+  uint32_t bits = 0;
+  for (int i = 0; i < 16; i++)
+    bits |= uint32_t(indices[i]) << (i * 2);
+  memcpy(block, &c0, 2);
+  memcpy(block + 2, &c1, 2);
+  memcpy(block + 4, &bits, 4);
+}
+
+void encode_bc1_block(const uint8_t *rgba, uint8_t *block)
+{
+  float colors[16][4];
+  load_block_colors(rgba, colors);
+  encode_bc1_color(colors, block);
+}
+
+static void decode_bc1_color(const uint8_t *block, uint8_t *rgba, bool allow_three_color)
+{
+  uint16_t c0, c1;
+  uint32_t bits;
+  memcpy(&c0, block, 2);
+  memcpy(&c1, block + 2, 2);
+  memcpy(&bits, block + 4, 4);
+  float palette[4][4];
+  bc1_palette(c0, c1, palette);
+  if (allow_three_color && c0 <= c1)
+    for (int c = 0; c < 4; c++)
+    {
+      palette[2][c] = (palette[0][c] + palette[1][c]) / 2.f;
+      palette[3][c] = 0.f;
+    }
+  for (int i = 0; i < 16; i++)
+    for (int c = 0; c < 4; c++)
+      rgba[i * 4 + c] = uint8_t(palette[(bits >> (i * 2)) & 3][c] + 0.5f);
+}
+
+// BC3
+
+static void bc3_alpha_palette(int a0, int a1, float *palette)
+{
+  palette[0] = a0;
+  palette[1] = a1;
+  if (a0 > a1)
+    for (int i = 1; i < 7; i++)
+      palette[i + 1] = ((7 - i) * a0 + i * a1) / 7.f;
+  else
+  {
+    for (int i = 1; i < 5; i++)
+      palette[i + 1] = ((5 - i) * a0 + i * a1) / 5.f;
+    palette[6] = 0.f;
+    palette[7] = 255.f;
+  }
+}
+
+static void encode_bc3_alpha(const float (*colors)[4], uint8_t *block)
+{
+  int a0 = 0, a1 = 255;
+  for (int i = 0; i < 16; i++)
+  {
+    a0 = std::max(a0, int(colors[i][3]));
+    a1 = std::min(a1, int(colors[i][3]));
+  }
+  float palette[8];
+  bc3_alpha_palette(a0, a1, palette);
+  uint64_t bits = 0;
+  for (int i = 0; i < 16; i++)
+  {
+    int bestIndex = 0;
+    float best = FLT_MAX;
+    // a0 == a1 leaves every texel on index 0
+    for (int p = 0; p < (a0 > a1 ? 8 : 1); p++)
+    {
+      float d = std::abs(colors[i][3] - palette[p]);
+      if (d < best)
+      {
+        best = d;
+        bestIndex = p;
+      }
+    }
+    bits |= uint64_t(bestIndex) << (i * 3);
+  }
+  block[0] = a0;
+  block[1] = a1;
+  for (int i = 0; i < 6; i++)
+    block[2 + i] = uint8_t(bits >> (i * 8));
+}
+
+void encode_bc3_block(const uint8_t *rgba, uint8_t *block)
+{
+  float colors[16][4];
+  load_block_colors(rgba, colors);
+  encode_bc3_alpha(colors, block);
+  encode_bc1_color(colors, block + 8);
+}
+
+static void decode_bc3_alpha(const uint8_t *block, uint8_t *rgba)
+{
+  float palette[8];
+  bc3_alpha_palette(block[0], block[1], palette);
+  uint64_t bits = 0;
+  for (int i = 0; i < 6; i++)
+    bits |= uint64_t(block[2 + i]) << (i * 8);
+  for (int i = 0; i < 16; i++)
+    rgba[i * 4 + 3] = uint8_t(palette[(bits >> (i * 3)) & 7] + 0.5f);
+}
+
+// BC7 mode 6
+
+static const int Bc7Weights4[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+static int bc7_interpolate(int e0, int e1, int index)
+{
+  return ((64 - Bc7Weights4[index]) * e0 + Bc7Weights4[index] * e1 + 32) >> 6;
+}
+
+struct Bc7Mode6
+{
+  uint8_t endpoints[2][4]; // 7 bit values
+  uint8_t pbits[2];
+  uint8_t indices[16];
+};
+
+static float bc7_assign_indices(const float (*colors)[4], Bc7Mode6 &mode)
+{
+  float palette[16][4];
+  for (int p = 0; p < 16; p++)
+    for (int c = 0; c < 4; c++)
+    {
+      int e0 = (mode.endpoints[0][c] << 1) | mode.pbits[0];
+      int e1 = (mode.endpoints[1][c] << 1) | mode.pbits[1];
+      palette[p][c] = bc7_interpolate(e0, e1, p);
+    }
+  float error = 0.f;
+  for (int i = 0; i < 16; i++)
+  {
+    float best = FLT_MAX;
+    for (int p = 0; p < 16; p++)
+    {
+      float d = color_distance<4>(colors[i], palette[p]);
+      if (d < best)
+      {
+        best = d;
+        mode.indices[i] = p;
+      }
+    }
+    error += best;
+  }
+  return error;
+}
+
+// tries every p-bit pair, the p-bit is the shared low bit of all channels of an endpoint
+static float bc7_quantize(const float (*colors)[4], const float (*endpoints)[4], Bc7Mode6 &best)
+{
+  float bestError = FLT_MAX;
+  for (int p = 0; p < 4; p++)
+  {
+    Bc7Mode6 mode;
+    mode.pbits[0] = p & 1;
+    mode.pbits[1] = p >> 1;
+    for (int e = 0; e < 2; e++)
+      for (int c = 0; c < 4; c++)
+        mode.endpoints[e][c] = clamp(int((endpoints[e][c] - mode.pbits[e]) / 2.f + 0.5f), 0, 127);
+    float error = bc7_assign_indices(colors, mode);
+    if (error < bestError)
+    {
+      bestError = error;
+      best = mode;
+    }
+  }
+  return bestError;
+}
+
+struct BitWriter
+{
+  uint8_t *data;
+  int position = 0;
+
+  void write(uint32_t value, int count)
+  {
+    for (int i = 0; i < count; i++, position++)
+      data[position >> 3] |= ((value >> i) & 1) << (position & 7);
+  }
+};
+
+struct BitReader
+{
+  const uint8_t *data;
+  int position = 0;
+
+  uint32_t read(int count)
+  {
+    uint32_t value = 0;
+    for (int i = 0; i < count; i++, position++)
+      value |= ((data[position >> 3] >> (position & 7)) & 1u) << i;
+    return value;
+  }
+};
+
+void encode_bc7_block(const uint8_t *rgba, uint8_t *block)
+{
+  float colors[16][4];
+  load_block_colors(rgba, colors);
+  float endpoints[2][4];
+  fit_principal_axis<4>(colors, endpoints);
+
+  Bc7Mode6 mode;
+  float error = bc7_quantize(colors, endpoints, mode);
+  for (int iteration = 0; iteration < 2; iteration++)
+  {
+    float weights[16];
+    for (int i = 0; i < 16; i++)
+      weights[i] = Bc7Weights4[mode.indices[i]] / 64.f;
+    float refined[2][4];
+    Bc7Mode6 refinedMode;
+    if (!refit_endpoints<4>(colors, weights, refined))
+      break;
+    float refinedError = bc7_quantize(colors, refined, refinedMode);
+    if (refinedError >= error)
+      break;
+    error = refinedError;
+    mode = refinedMode;
+  }
+
+  // the anchor texel's index drops its top bit, so it has to be in the lower half
+  if (mode.indices[0] & 8)
+  {
+    for (int c = 0; c < 4; c++)
+      std::swap(mode.endpoints[0][c], mode.endpoints[1][c]);
+    std::swap(mode.pbits[0], mode.pbits[1]);
+    for (int i = 0; i < 16; i++)
+      mode.indices[i] = 15 - mode.indices[i];
+  }
+
+  memset(block, 0, 16);
+  BitWriter writer{block};
+  writer.write(1 << 6, 7);
+  for (int c = 0; c < 4; c++)
+    for (int e = 0; e < 2; e++)
+      writer.write(mode.endpoints[e][c], 7);
+  writer.write(mode.pbits[0], 1);
+  writer.write(mode.pbits[1], 1);
+  for (int i = 0; i < 16; i++)
+    writer.write(mode.indices[i], i == 0 ? 3 : 4);
+}
+
+static void decode_bc7(const uint8_t *block, uint8_t *rgba)
+{
+  BitReader reader{block};
+  if (reader.read(7) != (1 << 6))
+  {
+    // other modes are never written by encode_bc7_block
+    for (int i = 0; i < 16; i++)
+      memcpy(rgba + i * 4, "\xff\x00\xff\xff", 4);
+    return;
+  }
+  int endpoints[2][4];
+  for (int c = 0; c < 4; c++)
+    for (int e = 0; e < 2; e++)
+      endpoints[e][c] = reader.read(7) << 1;
+  int p0 = reader.read(1), p1 = reader.read(1);
+  for (int c = 0; c < 4; c++)
+  {
+    endpoints[0][c] |= p0;
+    endpoints[1][c] |= p1;
+  }
+  for (int i = 0; i < 16; i++)
+  {
+    int index = reader.read(i == 0 ? 3 : 4);
+    for (int c = 0; c < 4; c++)
+      rgba[i * 4 + c] = bc7_interpolate(endpoints[0][c], endpoints[1][c], index);
+  }
+}
+
+void decode_texture_block(TextureFormat format, const uint8_t *block, uint8_t *rgba)
+{
+  switch (format)
+  {
+    case TextureFormat::BC1: decode_bc1_color(block, rgba, true); break;
+    case TextureFormat::BC3: decode_bc1_color(block + 8, rgba, false); decode_bc3_alpha(block, rgba); break;
+    case TextureFormat::BC7: decode_bc7(block, rgba); break;
+  }
+}
+
+static std::vector<uint8_t> downsample(const uint8_t *rgba, int w, int h)
+{
+  const int out_w = std::max(w / 2, 1), out_h = std::max(h / 2, 1);
+  std::vector<uint8_t> result(size_t(out_w) * out_h * 4);
+  parallel_for(out_h, 16, [&](size_t begin, size_t end) {
+    for (size_t y = begin; y < end; y++)
+      for (int x = 0; x < out_w; x++)
+      {
+        // odd sizes fold the last row or column into the previous texel
+        int x0 = std::min(x * 2, w - 1), x1 = std::min(x * 2 + 1, w - 1);
+        int y0 = std::min(int(y) * 2, h - 1), y1 = std::min(int(y) * 2 + 1, h - 1);
+        for (int c = 0; c < 4; c++)
+        {
+          int sum = rgba[(size_t(y0) * w + x0) * 4 + c] + rgba[(size_t(y0) * w + x1) * 4 + c] +
+            rgba[(size_t(y1) * w + x0) * 4 + c] + rgba[(size_t(y1) * w + x1) * 4 + c];
+          result[(y * out_w + x) * 4 + c] = uint8_t((sum + 2) / 4);
+        }
+      }
+  });
+  return result;
+}
+
+static void encode_mip(const uint8_t *rgba, int w, int h, TextureFormat format, uint8_t *blocks)
+{
+  auto encode = format == TextureFormat::BC1 ? encode_bc1_block : format == TextureFormat::BC3 ? encode_bc3_block : encode_bc7_block;
+  const int blocksX = (w + 3) / 4, blocksY = (h + 3) / 4;
+  const uint32_t blockSize = texture_block_size(format);
+  parallel_for(blocksY, 4, [&](size_t begin, size_t end) {
+    uint8_t texels[16 * 4];
+    for (size_t by = begin; by < end; by++)
+      for (int bx = 0; bx < blocksX; bx++)
+      {
+        // edge blocks repeat the last texel
+        for (int i = 0; i < 16; i++)
+        {
+          int x = std::min(bx * 4 + i % 4, w - 1), y = std::min(int(by) * 4 + i / 4, h - 1);
+          memcpy(texels + i * 4, rgba + (size_t(y) * w + x) * 4, 4);
+        }
+        encode(texels, blocks + (by * blocksX + bx) * blockSize);
+      }
+  });
+}
+
+int texture_mip_chain(uint32_t w, uint32_t h, TextureFormat format, TextureMip *mips)
+{
+  int numMips = 0;
+  uint64_t offset = 0;
+  for (uint32_t mipW = w, mipH = h; numMips < MaxTextureMips; mipW = std::max(mipW / 2, 1u), mipH = std::max(mipH / 2, 1u))
+  {
+    uint64_t size = uint64_t((mipW + 3) / 4) * ((mipH + 3) / 4) * texture_block_size(format);
+    mips[numMips++] = TextureMip{mipW, mipH, offset, size};
+    offset += size;
+    if (mipW == 1 && mipH == 1)
+      break;
+  }
+  return numMips;
+}
+
+CompressedTexturePtr compress_texture(const uint8_t *rgba, int w, int h, TextureFormat format)
+{
+  auto texture = std::make_unique<CompressedTexture>();
+  texture->format = format;
+  texture->width = w;
+  texture->height = h;
+  texture->numMips = texture_mip_chain(w, h, format, texture->mips);
+  texture->encoded.resize(texture->total_size());
+
+  std::vector<uint8_t> level;
+  const uint8_t *source = rgba;
+  for (int mip = 0; mip < texture->numMips; mip++)
+  {
+    const TextureMip &m = texture->mips[mip];
+    if (mip > 0)
+    {
+      level = downsample(source, texture->mips[mip - 1].width, texture->mips[mip - 1].height);
+      source = level.data();
+    }
+    encode_mip(source, m.width, m.height, format, texture->encoded.data() + m.offset);
+  }
+  texture->blocks = texture->encoded.data();
+  return texture;
+}
+
+std::vector<uint8_t> decompress_texture_mip(const CompressedTexture &texture, int mip)
+{
+  const TextureMip &m = texture.mips[mip];
+  const int blocksX = (m.width + 3) / 4, blocksY = (m.height + 3) / 4;
+  const uint32_t blockSize = texture_block_size(texture.format);
+  std::vector<uint8_t> rgba(size_t(m.width) * m.height * 4);
+  uint8_t texels[16 * 4];
+  for (int by = 0; by < blocksY; by++)
+    for (int bx = 0; bx < blocksX; bx++)
+    {
+      decode_texture_block(texture.format, texture.blocks + m.offset + (size_t(by) * blocksX + bx) * blockSize, texels);
+      for (int i = 0; i < 16; i++)
+      {
+        uint32_t x = bx * 4 + i % 4, y = by * 4 + i / 4;
+        if (x < m.width && y < m.height)
+          memcpy(&rgba[(size_t(y) * m.width + x) * 4], texels + i * 4, 4);
+      }
+    }
+  return rgba;
+}
+
+float texture_psnr(const uint8_t *a, const uint8_t *b, int w, int h, int channels)
+{
+  double squaredError = 0.0;
+  for (size_t i = 0; i < size_t(w) * h; i++)
+    for (int c = 0; c < channels; c++)
+    {
+      double d = double(a[i * 4 + c]) - b[i * 4 + c];
+      squaredError += d * d;
+    }
+  double mse = squaredError / (double(w) * h * channels);
+  return mse > 0.0 ? float(10.0 * std::log10(255.0 * 255.0 / mse)) : 99.f;
+}
+
+float report_texture_compression(const char *name, const uint8_t *rgba, int channels, const CompressedTexture &texture)
+{
+  std::vector<uint8_t> decoded = decompress_texture_mip(texture, 0);
+  float psnr = texture_psnr(rgba, decoded.data(), texture.width, texture.height, std::min(channels, 4));
+  size_t uncompressed = 0;
+  for (int mip = 0; mip < texture.numMips; mip++)
+    uncompressed += size_t(texture.mips[mip].width) * texture.mips[mip].height * channels;
+  debug_log("texture %s: %dx%d %s, %d mips, %.2f MB (uncompressed %.2f MB, %.1fx), PSNR %.2f dB",
+    name, texture.width, texture.height, texture_format_name(texture.format), texture.numMips,
+    texture.total_size() / float(1 << 20), uncompressed / float(1 << 20), float(uncompressed) / texture.total_size(), psnr);
+  return psnr;
+}
+
+bool check_texture_compression(const char *path)
+{
+  int w, h, channels;
+  unsigned char *image = stbi_load(path, &w, &h, &channels, 4);
+  if (!image)
+  {
+    debug_error("can't load texture %s", path);
+    return false;
+  }
+  constexpr int CropSize = 512;
+  const int cw = std::min(w, CropSize), ch = std::min(h, CropSize);
+  std::vector<uint8_t> crop(size_t(cw) * ch * 4);
+  for (int y = 0; y < ch; y++)
+    memcpy(&crop[size_t(y) * cw * 4], image + size_t(y) * w * 4, size_t(cw) * 4);
+  stbi_image_free(image);
+
+  bool passed = true;
+  for (TextureFormat format : {TextureFormat::BC1, TextureFormat::BC3, TextureFormat::BC7})
+  {
+    CompressedTexturePtr texture = compress_texture(crop.data(), cw, ch, format);
+    const float psnr = report_texture_compression(path, crop.data(), format == TextureFormat::BC1 ? 3 : 4, *texture);
+    const float bound = format == TextureFormat::BC1 ? MinPsnrBC1 : format == TextureFormat::BC3 ? MinPsnrBC3 : MinPsnrBC7;
+    if (psnr < bound)
+    {
+      debug_error("texture %s: %s PSNR %.2f dB is below %.2f dB", path, texture_format_name(format), psnr, bound);
+      passed = false;
+    }
+  }
+  return passed;
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <mapped_file.h>
+
+enum class TextureFormat : uint32_t
+{
+  BC1, // rgb 565 endpoints, 4 bits per texel
+  BC3, // BC1 color with interpolated alpha, 8 bits per texel
+  BC7  // mode 6 only: rgba 7777 + p-bit endpoints, 4 bit indices, 8 bits per texel
+};
+
+constexpr int MaxTextureMips = 16;
+
+uint32_t texture_block_size(TextureFormat format);
+const char *texture_format_name(TextureFormat format);
+
+struct TextureMip
+{
+  uint32_t width, height;
+  uint64_t offset, size; // in the block data
+};
+
+// Full mip chain of 4x4 blocks, either just encoded or mapped from the texture cache.
+struct CompressedTexture
+{
+  TextureFormat format;
+  uint32_t width, height;
+  int numMips;
+  TextureMip mips[MaxTextureMips];
+
+  std::vector<uint8_t> encoded;
+  MappedFile file;
+  const uint8_t *blocks = nullptr; // into encoded or file
+
+  size_t total_size() const { return mips[numMips - 1].offset + mips[numMips - 1].size; }
+};
+
+using CompressedTexturePtr = std::unique_ptr<CompressedTexture>;
+
+// Lays out the mips of a w x h texture down to 1x1 back to back, returns how many there are.
+int texture_mip_chain(uint32_t w, uint32_t h, TextureFormat format, TextureMip *mips);
+
+// rgba holds the 16 texels of a block in row order, 4 bytes each
+void encode_bc1_block(const uint8_t *rgba, uint8_t *block);
+void encode_bc3_block(const uint8_t *rgba, uint8_t *block);
+void encode_bc7_block(const uint8_t *rgba, uint8_t *block);
+void decode_texture_block(TextureFormat format, const uint8_t *block, uint8_t *rgba);
+
+// rgba8 input, mips are box filtered down to 1x1 and every level is encoded over the job system
+CompressedTexturePtr compress_texture(const uint8_t *rgba, int w, int h, TextureFormat format);
+std::vector<uint8_t> decompress_texture_mip(const CompressedTexture &texture, int mip);
+
+// over the first channels of rgba8 images
+float texture_psnr(const uint8_t *a, const uint8_t *b, int w, int h, int channels);
+
+// Logs top mip PSNR against the source and the size against uncompressed mips, returns the PSNR.
+float report_texture_compression(const char *name, const uint8_t *rgba, int channels, const CompressedTexture &texture);
+
+// PSNR every format has to reach on photographic textures like the MotusMan maps.
+constexpr float MinPsnrBC1 = 30.f;
+constexpr float MinPsnrBC3 = 30.f;
+constexpr float MinPsnrBC7 = 40.f;
+
+// Encodes a 512x512 crop of the image at path in every format, returns false if one stays below its PSNR.
+bool check_texture_compression(const char *path);
@@ -0,0 +1,360 @@
+#include "vertex_format.h"
+#include "mesh.h"
+#include <cassert>
+#include <cfloat>
+#include <cstring>
+#include <log.h>
+#include <job_system.h>
+
+constexpr float Unorm16Max = 65535.f;
+constexpr float Snorm10Max = 511.f;
+
+VertexLayout make_vertex_layout(bool quantized_positions)
+{
+  VertexLayout layout;
+  layout.quantizedPositions = quantized_positions;
+  layout.normal = quantized_positions ? 4 * sizeof(uint16_t) : 3 * sizeof(float);
+  layout.uv = layout.normal + sizeof(uint32_t);
+  layout.weights = layout.uv + 2 * sizeof(uint16_t);
+  layout.boneIndex = layout.weights + 4;
+  layout.stride = layout.boneIndex + 4;
+  return layout;
+}
+
+uint32_t encode_normal(vec3 n)
+{
+  float len = length(n);
+  n = len > 0.f ? n / len : vec3(0.f, 0.f, 1.f);
+  uint32_t packed = 0;
+  for (int i = 0; i < 3; i++)
+  {
+    int v = (int)roundf(clamp(n[i], -1.f, 1.f) * Snorm10Max);
+    packed |= (uint32_t(v) & 0x3FF) << (i * 10);
+  }
+  return packed;
+}
+
+vec3 decode_normal(uint32_t packed)
+{
+  vec3 n;
+  for (int i = 0; i < 3; i++)
+  {
+    // sign extend the 10 bit component
+    int v = int((packed >> (i * 10)) & 0x3FF);
+    if (v & 0x200)
+      v -= 0x400;
+    n[i] = max(v / Snorm10Max, -1.f);
+  }
+  return n;
+}
+
+uint16_t encode_unorm16(float v, float offset, float scale)
+{
+  return (uint16_t)roundf(clamp((v - offset) / scale, 0.f, 1.f) * Unorm16Max);
+}
+
+float decode_unorm16(uint16_t v, float offset, float scale)
+{
+  return offset + scale * (v / Unorm16Max);
+}
+
+void encode_weights(vec4 w, uint8_t out[4])
+{
+  float sum = w.x + w.y + w.z + w.w;
+  if (sum <= 0.f)
+  {
+    memset(out, 0, 4);
+    return;
+  }
+  w /= sum;
+  int total = 0, largest = 0;
+  for (int i = 0; i < 4; i++)
+  {
+    out[i] = (uint8_t)roundf(clamp(w[i], 0.f, 1.f) * 255.f);
+    total += out[i];
+    if (w[i] > w[largest])
+      largest = i;
+  }
+  // rounding error goes to the dominant bone, so the shader gets an exact partition of unity
+  out[largest] = uint8_t(out[largest] + (255 - total));
+}
+
+vec4 decode_weights(const uint8_t in[4])
+{
+  return vec4(in[0], in[1], in[2], in[3]) * (1.f / 255.f);
+}
+
+template<int N>
+static void quantization_range(const MeshData *const *lods, int num_lods, std::vector<vec<N, float>> MeshData::*channel,
+  vec<N, float> &offset, vec<N, float> &scale)
+{
+  vec<N, float> lo(FLT_MAX), hi(-FLT_MAX);
+  for (int lod = 0; lod < num_lods; lod++)
+    for (const vec<N, float> &value : lods[lod]->*channel)
+    {
+      lo = min(lo, value);
+      hi = max(hi, value);
+    }
+  if (lo.x > hi.x)
+    lo = hi = vec<N, float>(0.f);
+  offset = lo;
+  scale = hi - lo;
+  for (int i = 0; i < N; i++)
+    scale[i] = scale[i] > 0.f ? scale[i] : 1.f;
+}
+
+static void pack_vertex(const MeshData &data, uint32_t i, const VertexLayout &layout, const VertexQuantization &q, uint8_t *vertex)
+{
+  if (layout.quantizedPositions)
+  {
+    uint16_t *position = (uint16_t *)vertex;
+    for (int c = 0; c < 3; c++)
+      position[c] = encode_unorm16(data.vertices[i][c], q.positionOffset[c], q.positionScale[c]);
+  }
+  else
+    memcpy(vertex, &data.vertices[i], sizeof(vec3));
+
+  if (!data.normals.empty())
+  {
+    uint32_t normal = encode_normal(data.normals[i]);
+    memcpy(vertex + layout.normal, &normal, sizeof(normal));
+  }
+
+  if (!data.uv.empty())
+  {
+    uint16_t *uv = (uint16_t *)(vertex + layout.uv);
+    for (int c = 0; c < 2; c++)
+      uv[c] = encode_unorm16(data.uv[i][c], q.uvOffset[c], q.uvScale[c]);
+  }
+
+  if (!data.weights.empty())
+  {
+    encode_weights(data.weights[i], vertex + layout.weights);
+    for (int c = 0; c < 4; c++)
+      vertex[layout.boneIndex + c] = (uint8_t)data.weightsIndex[i][c];
+  }
+}
+
+PackedMesh pack_mesh_lods(const MeshData *const *lods, const float *errors, int num_lods, bool quantize_positions)
+{
+  assert(num_lods > 0 && num_lods <= MaxMeshLods);
+  // a truncated index would skin to another bone, such a mesh isn't packed at all
+  for (int lod = 0; lod < num_lods; lod++)
+    for (const uvec4 &bones : lods[lod]->weightsIndex)
+      for (int c = 0; c < 4; c++)
+        if (bones[c] > 255)
+        {
+          debug_error("bone index %u doesn't fit into 8 bits", bones[c]);
+          return PackedMesh{};
+        }
+  PackedMesh packed;
+  packed.layout = make_vertex_layout(quantize_positions);
+  packed.numLods = num_lods;
+  uint32_t maxLodVertices = 0;
+  for (int lod = 0; lod < num_lods; lod++)
+  {
+    MeshLodRange &range = packed.lods[lod];
+    range.firstIndex = packed.numIndices;
+    range.numIndices = lods[lod]->indices.size();
+    range.baseVertex = packed.numVertices;
+    range.numVertices = lods[lod]->vertices.size();
+    range.error = errors[lod];
+    packed.numIndices += range.numIndices;
+    packed.numVertices += range.numVertices;
+    maxLodVertices = max(maxLodVertices, range.numVertices);
+  }
+
+  // indices are local to their lod, baseVertex is added at draw time
+  packed.indexSize = maxLodVertices <= 0x10000 ? sizeof(uint16_t) : sizeof(uint32_t);
+  packed.indices.resize(size_t(packed.indexSize) * packed.numIndices);
+  for (int lod = 0; lod < num_lods; lod++)
+  {
+    const std::vector<uint32_t> &indices = lods[lod]->indices;
+    uint8_t *dst = packed.indices.data() + size_t(packed.indexSize) * packed.lods[lod].firstIndex;
+    if (packed.indexSize == sizeof(uint16_t))
+    {
+      for (size_t i = 0; i < indices.size(); i++)
+        ((uint16_t *)dst)[i] = (uint16_t)indices[i];
+    }
+    else
+      memcpy(dst, indices.data(), indices.size() * sizeof(uint32_t));
+  }
+
+  vec3 boundsMin, boundsExtent;
+  quantization_range(lods, num_lods, &MeshData::vertices, boundsMin, boundsExtent);
+  packed.boundsCenter = boundsMin + boundsExtent * 0.5f;
+  packed.boundsRadius = length(boundsExtent) * 0.5f;
+
+  VertexQuantization &q = packed.quantization;
+  if (quantize_positions)
+  {
+    q.positionOffset = boundsMin;
+    q.positionScale = boundsExtent;
+  }
+  quantization_range(lods, num_lods, &MeshData::uv, q.uvOffset, q.uvScale);
+
+  const VertexLayout &layout = packed.layout;
+  packed.vertices.resize(size_t(layout.stride) * packed.numVertices, 0);
+  for (int lod = 0; lod < num_lods; lod++)
+  {
+    uint8_t *vertices = packed.vertices.data() + size_t(layout.stride) * packed.lods[lod].baseVertex;
+    parallel_for(packed.lods[lod].numVertices, 4096, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++)
+        pack_vertex(*lods[lod], i, layout, q, vertices + size_t(layout.stride) * i);
+    });
+  }
+  return packed;
+}
+
+PackedMesh pack_mesh(const MeshData &data, bool quantize_positions)
+{
+  const MeshData *lods[] = {&data};
+  const float errors[] = {0.f};
+  return pack_mesh_lods(lods, errors, 1, quantize_positions);
+}
+
+uint32_t get_index(const PackedMesh &mesh, uint32_t i)
+{
+  if (mesh.indexSize == sizeof(uint16_t))
+    return ((const uint16_t *)mesh.indices.data())[i];
+  return ((const uint32_t *)mesh.indices.data())[i];
+}
+
+MeshData unpack_mesh(const PackedMesh &packed, int lod)
+{
+  const VertexLayout &layout = packed.layout;
+  const VertexQuantization &q = packed.quantization;
+  const MeshLodRange &range = packed.lods[lod];
+  MeshData data;
+  data.indices.resize(range.numIndices);
+  for (uint32_t i = 0; i < range.numIndices; i++)
+    data.indices[i] = get_index(packed, range.firstIndex + i);
+  data.vertices.resize(range.numVertices);
+  data.normals.resize(range.numVertices);
+  data.uv.resize(range.numVertices);
+  data.weights.resize(range.numVertices);
+  data.weightsIndex.resize(range.numVertices);
+  for (uint32_t i = 0; i < range.numVertices; i++)
+  {
+    const uint8_t *vertex = packed.vertices.data() + size_t(layout.stride) * (range.baseVertex + i);
+
+    if (layout.quantizedPositions)
+    {
+      const uint16_t *position = (const uint16_t *)vertex;
+      for (int c = 0; c < 3; c++)
+        data.vertices[i][c] = decode_unorm16(position[c], q.positionOffset[c], q.positionScale[c]);
+    }
+    else
+      memcpy(&data.vertices[i], vertex, sizeof(vec3));
+
+    uint32_t normal;
+    memcpy(&normal, vertex + layout.normal, sizeof(normal));
+    data.normals[i] = decode_normal(normal);
+
+    const uint16_t *uv = (const uint16_t *)(vertex + layout.uv);
+    for (int c = 0; c < 2; c++)
+      data.uv[i][c] = decode_unorm16(uv[c], q.uvOffset[c], q.uvScale[c]);
+
+    data.weights[i] = decode_weights(vertex + layout.weights);
+    for (int c = 0; c < 4; c++)
+      data.weightsIndex[i][c] = vertex[layout.boneIndex + c];
+  }
+  return data;
+}
+
+struct ChannelError
+{
+  float maxError = 0.f;
+  double sumError = 0.0;
+  int count = 0;
+  void add(float e) { maxError = max(maxError, e); sumError += e; count++; }
+  float avg() const { return count ? float(sumError / count) : 0.f; }
+};
+
+bool check_vertex_codecs()
+{
+  bool ok = true;
+  const vec3 normals[] = {
+    vec3(1, 0, 0), vec3(-1, 0, 0), vec3(0, 1, 0), vec3(0, -1, 0), vec3(0, 0, 1), vec3(0, 0, -1),
+    normalize(vec3(1, 1, 1)), normalize(vec3(-1, -1, -1)), normalize(vec3(1, -2, 3)), normalize(vec3(0.001f, 1, 0))};
+  for (vec3 n : normals)
+  {
+    vec3 d = decode_normal(encode_normal(n));
+    if (length(d - n) > 2.f / Snorm10Max)
+    {
+      debug_error("normal (%f %f %f) decoded as (%f %f %f)", n.x, n.y, n.z, d.x, d.y, d.z);
+      ok = false;
+    }
+  }
+
+  const vec4 weights[] = {
+    vec4(1, 0, 0, 0), vec4(0, 0, 0, 1), vec4(0.25f), vec4(1.f / 3.f, 1.f / 3.f, 1.f / 3.f, 0),
+    vec4(0.5f, 0.499f, 0.001f, 0), vec4(0.7f, 0.1f, 0.1f, 0.1f), vec4(2, 1, 1, 0)};
+  for (vec4 w : weights)
+  {
+    uint8_t q[4];
+    encode_weights(w, q);
+    vec4 d = decode_weights(q);
+    vec4 expected = w / (w.x + w.y + w.z + w.w);
+    if (q[0] + q[1] + q[2] + q[3] != 255 || any(greaterThan(abs(d - expected), vec4(2.f / 255.f))))
+    {
+      debug_error("weights (%f %f %f %f) decoded as (%f %f %f %f)", w.x, w.y, w.z, w.w, d.x, d.y, d.z, d.w);
+      ok = false;
+    }
+  }
+
+  const float scalars[] = {-3.f, -1.f, 0.f, 0.123456f, 1.f, 5.f};
+  const float offset = -3.f, scale = 8.f;
+  for (float v : scalars)
+  {
+    float d = decode_unorm16(encode_unorm16(v, offset, scale), offset, scale);
+    if (std::abs(d - v) > scale / Unorm16Max * 0.5f + 1e-6f)
+    {
+      debug_error("unorm16 %f decoded as %f", v, d);
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+bool report_vertex_format(const char *name, const MeshData &data, const PackedMesh &packed)
+{
+  bool ok = true;
+  MeshData decoded = unpack_mesh(packed, 0);
+  const VertexQuantization &q = packed.quantization;
+
+  ChannelError position, normal, uv, weight;
+  for (uint32_t i = 0; i < packed.lods[0].numVertices; i++)
+  {
+    position.add(length(decoded.vertices[i] - data.vertices[i]));
+    if (!data.normals.empty())
+      normal.add(angle(normalize(decoded.normals[i]), normalize(data.normals[i])) * RadToDeg);
+    if (!data.uv.empty())
+    {
+      vec2 e = abs(decoded.uv[i] - data.uv[i]);
+      uv.add(max(e.x, e.y));
+    }
+    if (!data.weights.empty())
+    {
+      vec4 e = abs(decoded.weights[i] - data.weights[i]);
+      weight.add(max(max(e.x, e.y), max(e.z, e.w)));
+    }
+  }
+
+  // half a quantization step on every axis, a bit of slack for float rounding
+  float positionBound = packed.layout.quantizedPositions ? length(q.positionScale) / Unorm16Max * 0.5f * 1.01f : 0.f;
+  ok &= position.maxError <= positionBound + 1e-6f;
+  ok &= normal.maxError < 0.5f;
+  ok &= uv.maxError <= max(q.uvScale.x, q.uvScale.y) / Unorm16Max * 0.5f * 1.01f;
+  ok &= weight.maxError <= 2.f / 255.f;
+
+  const uint32_t stride = packed.layout.stride;
+  debug_log("vertex format %s: %u vertices, %u -> %u bytes per vertex (%.2fx), %u KB -> %u KB, %u bit indices",
+    name, packed.numVertices, UnpackedVertexSize, stride, float(UnpackedVertexSize) / stride,
+    UnpackedVertexSize * packed.numVertices / 1024, stride * packed.numVertices / 1024, packed.indexSize * 8);
+  debug_log("  max/avg error: position %.2e/%.2e, normal %.3f/%.3f deg, uv %.2e/%.2e, weight %.4f/%.4f",
+    position.maxError, position.avg(), normal.maxError, normal.avg(), uv.maxError, uv.avg(), weight.maxError, weight.avg());
+  if (!ok)
+    debug_error("vertex format %s: round trip error is out of bounds", name);
+  return ok;
+}
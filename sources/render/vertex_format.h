@@ -0,0 +1,82 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <3dmath.h>
+
+// Interleaved skinned vertex, one buffer per mesh:
+//   position   float3 (12 B) or unorm16x4 (8 B) inside the mesh AABB
+//   normal     snorm 10:10:10:2 (4 B), decoded by the vertex fetch
+//   uv         unorm16x2 (4 B) inside the mesh uv bounds
+//   weights    unorm8x4 (4 B), always sums to 255
+//   boneIndex  uint8x4 (4 B)
+struct VertexLayout
+{
+  bool quantizedPositions;
+  uint32_t stride;
+  uint32_t normal;
+  uint32_t uv;
+  uint32_t weights;
+  uint32_t boneIndex;
+};
+
+// decoded = offset + scale * normalized, where normalized is in [0, 1] as the vertex fetch returns it
+struct VertexQuantization
+{
+  vec3 positionOffset = vec3(0.f);
+  vec3 positionScale = vec3(1.f);
+  vec2 uvOffset = vec2(0.f);
+  vec2 uvScale = vec2(1.f);
+};
+
+// size of a vertex as stored by MeshData, used for reports
+constexpr uint32_t UnpackedVertexSize = sizeof(vec3) + sizeof(vec3) + sizeof(vec2) + sizeof(vec4) + sizeof(uvec4);
+
+constexpr int MaxMeshLods = 4;
+
+// every lod has its own vertices and indices inside the shared buffers
+struct MeshLodRange
+{
+  uint32_t firstIndex;
+  uint32_t numIndices;
+  uint32_t baseVertex;
+  uint32_t numVertices;
+  float error; // simplification error relative to the mesh bounding radius
+};
+
+struct PackedMesh
+{
+  VertexLayout layout;
+  VertexQuantization quantization;
+  vec3 boundsCenter = vec3(0.f);
+  float boundsRadius = 0.f;
+  uint32_t numVertices = 0;
+  uint32_t numIndices = 0;
+  uint32_t indexSize = 4; // 2 when every lod fits into uint16
+  int numLods = 0;
+  MeshLodRange lods[MaxMeshLods];
+  std::vector<uint8_t> indices;
+  std::vector<uint8_t> vertices;
+};
+
+struct MeshData;
+
+VertexLayout make_vertex_layout(bool quantized_positions);
+// Both return a mesh with numLods 0 when a bone index doesn't fit into 8 bits.
+PackedMesh pack_mesh(const MeshData &data, bool quantize_positions = true);
+PackedMesh pack_mesh_lods(const MeshData *const *lods, const float *errors, int num_lods, bool quantize_positions = true);
+MeshData unpack_mesh(const PackedMesh &mesh, int lod);
+uint32_t get_index(const PackedMesh &mesh, uint32_t i);
+
+uint32_t encode_normal(vec3 n);
+vec3 decode_normal(uint32_t packed);
+uint16_t encode_unorm16(float v, float offset, float scale);
+float decode_unorm16(uint16_t v, float offset, float scale);
+void encode_weights(vec4 w, uint8_t out[4]);
+vec4 decode_weights(const uint8_t in[4]);
+
+// Runs the codecs over edge cases, returns false if some round trip error is above its bound.
+bool check_vertex_codecs();
+
+// Decodes the packed mesh back and logs bytes per vertex and the max error of every channel,
+// returns false if some error is above its bound.
+bool report_vertex_format(const char *name, const MeshData &data, const PackedMesh &packed);
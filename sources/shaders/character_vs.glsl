@@ -9,6 +9,20 @@ struct VsOutput
 
 uniform mat4 Transform;
 uniform mat4 ViewProjection;
+// quantized attributes come normalized to [0, 1]
+uniform vec3 PositionOffset;
+uniform vec3 PositionScale;
+uniform vec2 UVOffset;
+uniform vec2 UVScale;
+// 0 draws the rest pose, 1 blends the bone palette linearly, 2 blends it as dual quaternions
+uniform int SkinningMode;
+
+// Skinning transforms of the character per skeleton bone: three rows of an affine matrix for mode 1,
+// the real and the dual part of a dual quaternion for mode 2.
+layout(std430, binding = 1) readonly buffer BonePalette
+{
+  vec4 BoneRows[];
+};
 
 
 layout(location = 0) in vec3 Position;
@@ -19,15 +33,52 @@ layout(location = 4) in uvec4 BoneIndex;
 
 out VsOutput vsOutput;
 
-void main()
+void skin_linear(inout vec3 position, inout vec3 normal)
+{
+  vec4 row0 = vec4(0), row1 = vec4(0), row2 = vec4(0);
+  for (int i = 0; i < 4; i++)
+  {
+    uint first = BoneIndex[i] * 3u;
+    row0 += BoneWeights[i] * BoneRows[first];
+    row1 += BoneWeights[i] * BoneRows[first + 1u];
+    row2 += BoneWeights[i] * BoneRows[first + 2u];
+  }
+  vec4 p = vec4(position, 1);
+  position = vec3(dot(row0, p), dot(row1, p), dot(row2, p));
+  normal = vec3(dot(row0.xyz, normal), dot(row1.xyz, normal), dot(row2.xyz, normal));
+}
+
+void skin_dual_quat(inout vec3 position, inout vec3 normal)
 {
+  vec4 real = vec4(0), dual = vec4(0);
+  for (int i = 0; i < 4; i++)
+  {
+    uint first = BoneIndex[i] * 2u;
+    real += BoneWeights[i] * BoneRows[first];
+    dual += BoneWeights[i] * BoneRows[first + 1u];
+  }
+  float invLength = inversesqrt(dot(real, real));
+  real *= invLength;
+  dual *= invLength;
+  vec3 translation = 2 * (real.w * dual.xyz - dual.w * real.xyz + cross(real.xyz, dual.xyz));
+  position += 2 * cross(real.xyz, cross(real.xyz, position) + real.w * position) + translation;
+  normal += 2 * cross(real.xyz, cross(real.xyz, normal) + real.w * normal);
+}
 
-  vec3 VertexPosition = (Transform * vec4(Position, 1)).xyz;
-  vsOutput.EyespaceNormal = (Transform * vec4(Normal, 0)).xyz;
+void main()
+{
+  vec3 LocalPosition = PositionOffset + PositionScale * Position;
+  vec3 LocalNormal = Normal;
+  if (SkinningMode == 1)
+    skin_linear(LocalPosition, LocalNormal);
+  else if (SkinningMode == 2)
+    skin_dual_quat(LocalPosition, LocalNormal);
+  vec3 VertexPosition = (Transform * vec4(LocalPosition, 1)).xyz;
+  vsOutput.EyespaceNormal = (Transform * vec4(LocalNormal, 0)).xyz;
 
   gl_Position = ViewProjection * vec4(VertexPosition, 1);
   vsOutput.WorldPosition = VertexPosition;
 
-  vsOutput.UV = UV;
+  vsOutput.UV = UVOffset + UVScale * UV;
 
 }